@@ -2,7 +2,6 @@
 /// Implements to slim_control class to parse command-line arguments.
 
 #include <iostream>
-#include <fstream>
 #include <string>
 #include <sstream>
 #include <cstdlib>
@@ -13,7 +12,6 @@
 #include <unistd.h>
 #include <errno.h>
 #include <limits.h>
-#include <utime.h>
 
 #include <slim.h>
 #include "ljhslim.h"
@@ -286,64 +284,8 @@ void ljhslim_control::handle_one_file(const char *fname)
 
 
 
-/// Find the length of the text header in the ljh file
-static void parse_ljh_header(const char *rawname,
-                                   size_t &size,
-                                   int& nsamples) {
-  const string ENDHEADER("#End of Header");
-  const size_t LINESIZE=512;
-  char line[LINESIZE];
-  line[LINESIZE-1] = '\0';
-
-  nsamples=0;
-  size=0;
-  ifstream fp(rawname);
-
-  // Loop over lines until one starts with the ENDHEADER text.
-  while (1) {
-    fp.getline(line, LINESIZE-1);
-
-    // Found end-of-file before ENDHEADER?  If so, this must not be an LJH file
-    if (fp.eof())
-      throw bad_file(rawname, ": is not an LJH file. No #End of Header marker");
-
-    // Found line longer than LINSIZE?  If so, this must not be an LJH file
-    if (fp.fail())
-      throw bad_file(rawname, ": is not an LJH file. Long line found");
-
-    string sline(line);
-    size += sline.size() + 1; // +1 because fp.getline strips the \n character
-
-    for (int i=0; i<sline.size(); i++) {
-      if (sline[i] < '\t' || sline[i] >= 0x7f )
-        throw bad_file(rawname, ": is not an LJH file. Non-ASCII char in header");
-    }
-
-    if (sline.find("Total Samples:") == 0) {
-      size_t pos = sline.find_first_of("0123456789");
-      istringstream xxx(line+pos);
-      xxx >> nsamples;
-    }
-    if (sline.find(ENDHEADER)==0) break;
-
-  }
-  fp.close();
-}
-
-
-/// Alter the access and modification time on a closed file.
-/// \param filename  The file to alter.
-/// \param mtime     The new value for filename's atime and mtime.
-/// \return          Returns 0 on success or -1 on error (and errno is set).
-inline int alter_mtime(const char *filename, time_t mtime) {
-  struct utimbuf timbuf;
-  timbuf.actime = timbuf.modtime = mtime;
-  return utime(filename, &timbuf);
-}
-
-
-
-/// Compress one file using slim_compressor_t::compress_from_file()
+/// Compress one file using slim_compressor_t::compress_from_file(), with
+/// the LJH container adapter to find the header and record length.
 /// \param rawname  The name of the file to be encoded.
 void ljhslim_control::compress_one_file(const char *rawname) {
   
@@ -352,10 +294,6 @@ void ljhslim_control::compress_one_file(const char *rawname) {
   int ret = stat(rawname, &st);
   if (ret)
     throw bad_file(rawname, ": does not exist.");
-  const size_t raw_file_size = st.st_size;
-
-  cout.width(20);
-  cout << rawname << ": ";
 
   // Create the output slim-file name, create compressor object.
   ostringstream outstr;
@@ -369,82 +307,20 @@ void ljhslim_control::compress_one_file(const char *rawname) {
       throw bad_file(outname, ": slim file exists (use -k to force).");
   }
 
-  int nsamples=0;
-  size_t nbytes_text = 0;
-  parse_ljh_header(rawname, nbytes_text, nsamples);
+  container_adapter *ljh = container_adapter::create("ljh");
+  ljh->set_channel_defaults(code_method, deltas, permit_bitrotation);
+  try {
+    ljh->parse(rawname);
+  } catch (...) {
+    delete ljh;
+    throw;
+  }
 
   slim_compressor_t *compressor =
     new slim_compressor_t(outname, flags(), deltas, sample_pct);
-  compressor->get_input_file_stats(rawname);
-  
-  FILE *fp = fopen(rawname, "rb");
-
-  // Write the header
-  int repeats_header = nbytes_text;
-  int nframes_header = 1;
-  compressor->add_channel(repeats_header, code_method,
-                          SLIM_TYPE_U8, false, false);
-
-  unsigned char *header = new unsigned char[nbytes_text];
-  size_t count = fread(header, 1, nbytes_text, fp);
-  assert(count == nbytes_text);
-  compressor->write_onesection(header, nbytes_text);
-  delete[] header;
-
-  // Set up to write the binary data that follows the header.
-  compressor->reset_channels();
-  const int repeats_dummychan = 1;
-  const int repeats_timestamp = 1;
-  const int repeats_thisfile = nsamples;
-  compressor->add_channel(repeats_dummychan, code_method, 
-                          SLIM_TYPE_U16, deltas, permit_bitrotation);
-  compressor->add_channel(repeats_timestamp, code_method, 
-                          SLIM_TYPE_U32, deltas, permit_bitrotation);
-  compressor->add_channel(repeats_thisfile, code_method, 
-                          SLIM_TYPE_U16, deltas, permit_bitrotation);
-
-  size_t frame_size = compressor->get_frame_size();
-  int frames_per_sect = MAX_SECTION_LENGTH / frame_size;
-  const size_t section_size = frames_per_sect * frame_size;
-  unsigned char *rawdata = new unsigned char[MAX_SECTION_LENGTH];
-  compressor->set_section_frames(frames_per_sect);
-  while (true) {
-    size_t count = fread(rawdata, 1, section_size, fp);
-    if (count == 0) break;
-    compressor->write_onesection(rawdata, count);
-    if (count < section_size) break;
-  }
-  compressor->close_output();
+  compressor->compress_from_file(rawname, ljh);
   delete compressor;
-  delete[] rawdata;
-  fclose(fp);
- 
-  // Mark the compressed file with the raw file's modification time.
-  alter_mtime(outname, st.st_mtime);
-  
-  // Report on the compression ratio
-  {
-    struct stat status;
-    stat(outname, &status);
-    size_t final_size = status.st_size;
-
-    double ratio = double(raw_file_size) / final_size;
-    double bitsperword = 32.0/ratio;
-    double saved = 100.*(1.-double(final_size)/raw_file_size);
-    cout.width(20);
-
-    cout.setf(ios_base::fixed, ios_base::floatfield);
-    cout.width(8);
-    cout.precision(3);
-    cout << ratio << ":1, ";
-    cout.width(6);
-    cout.precision(3);
-    cout << bitsperword << " bits/word, ";
-    cout.width(6);
-    cout.precision(2);
-    cout << saved << "% saved.\n";
-    cout.precision(6);
-  }
+  delete ljh;
 
   // Clean up unwanted files
   struct stat st_raw, st_out;
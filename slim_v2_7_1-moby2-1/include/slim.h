@@ -29,6 +29,7 @@
 #include <cstdlib>
 #include <cassert>
 #include <cstring>   // for strlen, strcpy
+#include <string>
 #include <stdint.h>
 
 #include "version.h"
@@ -46,6 +47,19 @@ using namespace std;
 
 class slim_compressor_t;
 class slim_expander_t;
+class slim_reader_t;
+class zstd_seek_table;
+class slim_batch_t;
+class slim_stats_t;
+class frame_schema;
+class frame_detector;
+class container_adapter;
+class dirfile_format;
+class slim_dirfile_t;
+struct slim_batch_slot_t;
+struct slim_batch_pool_t;
+struct slim_batch_ring_t;
+struct slim_readahead_t;
 class slim_channel;
 class slim_channel_array;
 class slim_channel_encode;
@@ -97,6 +111,8 @@ enum slim_mode_t {
 /// Sizes (in bits) of some header data.
 enum {
   BITS_SLIM_SECT_SIZE = 32,  ///< Bits for size of raw section (in bytes).
+  BITS_SLIM_SECT_SLIM_SIZE = 32, ///< Bits for slim size of section (bytes).
+  BITS_SLIM_WIDE_SIZE = 64,  ///< Bits for any size, in XFLAG_WIDE files.
   BITS_SLIM_NUM_CHAN = 24,   ///< Bits for number of channels in section.
   BITS_SLIM_REPETITIONS = 24,///< Bits for number of reps/channel.
   BITS_SLIM_NBITS = 5,       ///< Bits for any word size.
@@ -104,6 +120,13 @@ enum {
   BITS_SLIM_TYPE_CODE = 4,   ///< Bits for storing data_t enum.
 };
 
+/// Most values that any encoder's parameters consist of.
+const int MAX_CODEC_PARAMS=4;
+
+/// In files with XFLAG_SAME, every this-many sections (starting with the
+/// first) give all channel parameters, to bound the work of random access.
+const int PARAMS_KEY_INTERVAL=16;
+
 /// Ghost bytes are those padded onto the end of the last raw data section
 /// in a file.  Their purpose is to ensure that we can encode the last word
 /// as usual, even if the raw data happen to end in the middle of that word.
@@ -119,9 +142,17 @@ enum file_header_flags_t {
   FLAG_ONECHAN = 0x10, ///< x10 All sections have only one channel.
   FLAG_NOREPS =  0x20, ///< x20 No channels repeat within a frame.
   FLAG_CRC =     0x40, ///< x40 Raw data CRC-32 is present at end of sections.
+  FLAG_SLEN =    0x80, ///< x80 Section headers give the section's slim size.
 };
 
-#define FILE_MAGIC "SL"     ///< ASCII string at byte 0 of all slim files.
+/// Extended flags: the first byte of XTRA header data, if any.
+enum xtra_header_flags_t {
+  XFLAG_WIDE =   0x01, ///< x01 All sizes in file/section headers are 64 bits.
+  XFLAG_SAME =   0x02, ///< x02 Channels can keep the prior section's params.
+};
+
+#define FILE_MAGIC "SL"     ///< ASCII string at byte 0 of slim files.
+#define FILE_MAGIC_V2 "S2"  ///< Instead, in files older readers can't expand.
 #define SLIM_SUFFIX "slm"   ///< Slim file suffix.
 
 
@@ -135,7 +166,7 @@ public:
   bad_file(const char *filename, const char *message);
   bad_file(const bad_file &bf);
   ~bad_file();
-  void mesg() const;
+  void mesg(ostream &os=cerr) const;
 
 protected:
   char *str;
@@ -161,6 +192,265 @@ inline int divide_round_up(int x, int denom) {
   return 1+(x-1)/denom;
 }
 
+/// Integer division of sizes, rounding up any remainder
+/// \param x     Number to be divided.
+/// \param denom Denominator (divisor).
+inline size_t divide_round_up(size_t x, size_t denom) {
+  return (x + denom - 1)/denom;
+}
+
+
+//---------------------------------------------------------------------------
+// Frame layouts
+//---------------------------------------------------------------------------
+
+/// One group of like channels in a frame_schema.
+struct schema_group {
+  int nchan;             ///< How many channels are in the group?
+  int repeats;           ///< How many repeats per channel in a frame?
+  enum data_t data_type; ///< Data type of each channel.
+  enum code_t code;      ///< Code method of each channel.
+  bool deltas;           ///< Do the channels encode deltas?
+  bool rotate;           ///< May the channels rotate up low bits?
+};
+
+
+// The layout of one frame, as read from a frame description file.
+
+class frame_schema {
+public:
+  frame_schema();
+  frame_schema(const frame_schema &fs);
+  ~frame_schema();
+  frame_schema &operator=(const frame_schema &fs);
+  void read(const char *path, enum code_t code, bool deltas, bool rotate);
+  void push(const schema_group &g);
+  void add_channels(slim_compressor_t *compressor) const;
+  void write(ostream &os) const;
+  int num_channels() const;
+  size_t frame_size() const;
+  static const char *code_name(enum code_t code);
+  /// Number of channel groups.
+  int size() const {return ngroups;}
+  /// Does the schema have no channels?
+  bool empty() const {return ngroups == 0;}
+  /// Line of the schema file where read() stopped.
+  int line() const {return lineno;}
+  /// The i-th channel group.
+  const schema_group &operator[](int i) const {return groups[i];}
+
+private:
+  schema_group *groups;  ///< The channel groups, in frame order.
+  int ngroups;           ///< Number of groups in use.
+  int nalloc;            ///< Number of groups allocated.
+  int lineno;            ///< Current line number within read().
+};
+
+
+// Finds the frame layout of a raw file by searching frame sizes, word
+// widths and signedness on a sample of it.
+
+class frame_detector {
+public:
+  frame_detector();
+  ~frame_detector();
+  void set_threads(int n);
+  void set_max_frame_size(size_t bytes);
+  double detect(const char *path, frame_schema &schema, bool rotate=false);
+  bool choose_code(const char *path, schema_group &g);
+  /// Bytes of the file looked at by the last detect().
+  size_t get_sample_size() const {return sample_size;}
+  /// Frame size (bytes) found by the last detect().
+  size_t get_frame_size() const {return frame_size;}
+
+private:
+  unsigned char *sample; ///< The first bytes of the file.
+  size_t sample_size;    ///< Bytes in sample.
+  size_t max_frame;      ///< Largest frame size (bytes) to consider.
+  size_t frame_size;     ///< Frame size found by the last detect().
+  int nthreads;          ///< Threads to search with.
+};
+
+
+//---------------------------------------------------------------------------
+// Container files
+//---------------------------------------------------------------------------
+
+/// One region of a container file, slimmed with its own channels.
+struct container_region {
+  size_t size;           ///< Bytes in the region (0 = the rest of the file).
+  frame_schema layout;   ///< The channels of each frame in the region.
+};
+
+
+// Front end for a file format that wraps binary frames in a header or
+// other regions: it divides a raw file into regions, each with its own
+// frame layout.  Subclass it for a new format, or get one of the
+// built-in formats from create().
+
+class container_adapter {
+public:
+  container_adapter();
+  virtual ~container_adapter();
+  static container_adapter *create(const char *spec);
+  /// Name of the format.
+  virtual const char *name() const = 0;
+  /// Find the regions of a raw file.  Throws bad_file if the file is
+  /// not of this format.
+  virtual void parse(const char *path) = 0;
+  void set_channel_defaults(enum code_t code, bool deltas, bool rotate);
+  void set_payload(const frame_schema &layout);
+  /// Number of regions found by parse().
+  int size() const {return nregions;}
+  /// The i-th region.
+  const container_region &operator[](int i) const {return regions[i];}
+
+protected:
+  void clear();
+  void add_header(size_t nbytes);
+  void add_region(size_t nbytes, const frame_schema &layout);
+  schema_group group(int nchan, int repeats, enum data_t data_type) const;
+
+  enum code_t code;      ///< Code method of channels the format defines.
+  bool deltas;           ///< Deltas setting of channels the format defines.
+  bool rotate;           ///< Rotation setting of channels the format defines.
+  frame_schema payload;  ///< Frame layout given by the user, if any.
+
+private:
+  container_adapter(const container_adapter &);
+  container_adapter &operator=(const container_adapter &);
+
+  container_region *regions; ///< The regions, in file order.
+  int nregions;          ///< Number of regions in use.
+  int nalloc;            ///< Number of regions allocated.
+};
+
+
+//---------------------------------------------------------------------------
+// Dirfiles
+//---------------------------------------------------------------------------
+
+/// What slim_dirfile_t::compress() did with a field.
+enum dirfile_status_t {
+  DIRFILE_PENDING,       ///< Not handled (yet).
+  DIRFILE_SLIMMED,       ///< Slimmed.
+  DIRFILE_EARLIER,       ///< Slimmed by an earlier run (no raw file left).
+  DIRFILE_SKIPPED,       ///< Left raw, because slim cannot code its type.
+  DIRFILE_FAILED,        ///< Not slimmed, because of an error.
+};
+
+
+/// One RAW field of a dirfile, and what became of it.
+struct dirfile_field {
+  string name;           ///< Field name (and its file, in the dirfile).
+  string type_name;      ///< Type as written in the format file.
+  enum data_t type;      ///< Slim data type (SLIM_TYPE_UNDETERMINED if none).
+  bool is_float;         ///< Floating-point data (slimmed as integers)?
+  int spf;               ///< Samples per frame.
+  enum code_t code;      ///< Code method used.
+  bool deltas;           ///< Were deltas coded?
+  size_t raw_bytes;      ///< Size of the raw file.
+  size_t slim_bytes;     ///< Size of the slim file.
+  enum dirfile_status_t status; ///< What was done.
+  string message;        ///< Error message, if it failed.
+};
+
+
+// The RAW fields listed in the format file of a dirfile (a directory
+// with one flat binary file per field).
+
+class dirfile_format {
+public:
+  dirfile_format();
+  ~dirfile_format();
+  void read(const char *dir);
+  const dirfile_field *find(const string &name) const;
+  /// Number of RAW fields.
+  int size() const {return nfields;}
+  /// The i-th RAW field, in format-file order.
+  dirfile_field &operator[](int i) {return fields[i];}
+  /// The i-th RAW field, in format-file order.
+  const dirfile_field &operator[](int i) const {return fields[i];}
+
+private:
+  dirfile_format(const dirfile_format &);
+  dirfile_format &operator=(const dirfile_format &);
+  void read_file(const string &dir, const string &name, int depth);
+  void push(const dirfile_field &f);
+
+  dirfile_field *fields; ///< The RAW fields.
+  int nfields;           ///< Number of fields in use.
+  int nalloc;            ///< Number of fields allocated.
+};
+
+
+// Slims every RAW field of a dirfile on a pool of threads, each reusing
+// one compressor from field to field, and writes a manifest of sizes.
+
+class slim_dirfile_t {
+public:
+  slim_dirfile_t(const char *dir);
+  ~slim_dirfile_t();
+
+  void set_threads(int n);
+  void set_flags(char flags_in, int sample_pct_in);
+  void set_channel_defaults(enum code_t code, bool deltas, bool rotate);
+  /// Choose each field's code method and deltas from a sample of it.
+  void set_auto_code(bool a=true) {auto_code=a;}
+  /// Upper limit on the raw size of a section (bytes).
+  void set_max_section_size(size_t size) {section_size=size;}
+  /// Adaptive section cost ratio (0 = fixed sizes).
+  void set_adaptive(double threshold) {adaptive=threshold;}
+  /// Let channels keep the previous section's parameters.
+  void set_reuse_params(bool r=true) {reuse_params=r;}
+  /// Use 64-bit sizes.
+  void set_wide_sizes(bool w=true) {wide_sizes=w;}
+  void use_lz4(bool background_thread=false);
+  void use_zstd(int level, int nworkers=0);
+  /// Overwrite slim files, and keep them even if larger than the raw.
+  void set_force(bool f=true) {force=f;}
+  /// Keep the raw files.
+  void set_preserve(bool p=true) {preserve=p;}
+  /// Discard the slim files (and keep the raw).
+  void set_practice(bool p=true) {practice=p;}
+
+  int compress();
+  void write_manifest(ostream &os) const;
+  string write_manifest() const;
+  /// The dirfile's RAW fields, and what became of them.
+  const dirfile_format &get_fields() const {return format;}
+
+private:
+  slim_dirfile_t(const slim_dirfile_t &);
+  slim_dirfile_t &operator=(const slim_dirfile_t &);
+  static void *worker(void *arg);
+  void compress_field(dirfile_field &f, slim_compressor_t *&compressor,
+                      frame_detector &detector);
+
+  string dir;            ///< The dirfile directory.
+  dirfile_format format; ///< Its RAW fields.
+  int nthreads;          ///< Worker threads.
+  char flags;            ///< File header flags for each slim file.
+  int sample_pct;        ///< Percent of data sampled for parameters.
+  enum code_t code;      ///< Code method, unless chosen per field.
+  bool deltas;           ///< Code deltas (of integer fields)?
+  bool rotate;           ///< Let channels rotate up low bits?
+  bool auto_code;        ///< Choose code and deltas per field?
+  size_t section_size;   ///< Upper limit on raw section size (bytes).
+  double adaptive;       ///< Adaptive section cost ratio (0 = fixed).
+  bool reuse_params;     ///< Let channels keep prior params.
+  bool wide_sizes;       ///< Write 64-bit sizes.
+  bool lz4_output;       ///< Wrap slim files in an LZ4 frame.
+  bool lz4_thread;       ///< Run LZ4 on a helper thread.
+  int zstd_level;        ///< zstd level (0 = no zstd).
+  int zstd_workers;      ///< zstd compression threads.
+  bool force;            ///< Overwrite, and keep slim files that grew.
+  bool preserve;         ///< Keep the raw files.
+  bool practice;         ///< Discard the slim files.
+  int next;              ///< Next field for a worker to take.
+  pthread_mutex_t lock;  ///< Guards next.
+};
+
 
 //---------------------------------------------------------------------------
 // Command-line options.
@@ -176,6 +466,11 @@ public:
   void unslim();
   void slimcat();
   void handle_one_file(const char *fname);
+  int handle_files(int nfiles, char * const fnames[]);
+  size_t memory_estimate(const char *fname) const;
+  virtual slim_control *clone() const;
+  /// Send statistics and per-file warnings to these streams.
+  void set_report(ostream *rep, ostream *err) {report=rep; errors=err;}
   virtual void usage() const;
   virtual void version() const;
   void usage_printoptions() const;
@@ -185,6 +480,9 @@ protected:
   void set_defaults();
   enum slim_mode_t detect_file_mode(const char *fname) const;
   virtual void compress_one_file(const char *fname);
+  void detect_one_file(const char *fname);
+  int compress_dirfile(const char *dir);
+  void build_channels(slim_compressor_t *compressor, size_t raw_file_size);
   virtual void expand_one_file(const char *fname);
   void debug_compress_from_memory(const char *rawname);
   void debug_expand_from_memory(const char *rawname);
@@ -202,6 +500,8 @@ protected:
   int  nchan;            ///< How many channels are in the raw file?
   int  nframes;          ///< How many frames allowed per section?
   int  repeats;          ///< How many repeats per channel in a frame?
+  size_t section_size;   ///< Upper limit on raw section size (bytes).
+  double adaptive;      ///< Adaptive section cost ratio (0 = fixed sizes).
   int  sample_pct;       ///< What pct of data per channel to use when sampling?
   size_t debug_buf_size; ///< Buffer size to use in debugging write()/read()?
   enum slim_mode_t mode; ///< Is the SLIM_ENCODE or SLIM_DECODE mode?
@@ -213,9 +513,27 @@ protected:
   bool onechan;          ///< Compressed file has only 1 channel.
   bool noreps;           ///< Compressed file has only 1 datum per frame.
   bool crc;              ///< CRC-32 appears at the end of each section.
+  bool slim_sizes;       ///< Section headers give the section slim size.
+  bool wide_sizes;       ///< Write 64-bit sizes in all headers.
+  bool reuse_params;     ///< Let channels keep the prior section's params.
   bool ignore_crc;       ///< Do not test the CRC value on expansion.
   bool reserved0;        ///< Not used.
   bool quiet;            ///< Don't print compression statistics
+  bool print_stats;      ///< Print per-stage statistics (JSON) per file.
+  bool lz4_output;       ///< Wrap compressed files in an LZ4 frame.
+  bool lz4_thread;       ///< Run the LZ4 compressor on a helper thread.
+  int  zstd_level;       ///< zstd level for compressed files (0 = no zstd).
+  int  zstd_workers;     ///< Number of zstd compression threads.
+  int  njobs;            ///< How many files to handle at once.
+  size_t job_memory;     ///< Memory budget for all jobs (0 = choose one).
+  const char *schema_path; ///< Frame description file (NULL = use -c/-r).
+  frame_schema schema;   ///< Channel layout read from schema_path.
+  bool detect_only;      ///< Print each raw file's frame layout; don't slim.
+  bool auto_layout;      ///< Slim each raw file with its detected layout.
+  const char *container_spec; ///< Container format of raw files (NULL = none).
+  bool dirfile_mode;     ///< Arguments are dirfiles, to slim field by field.
+  ostream *report;       ///< Where to print statistics (normally cout).
+  ostream *errors;       ///< Where to print per-file warnings (normally cerr).
 };
 
 
@@ -229,6 +547,7 @@ public:
   slim_channel *operator[](int i) const;
   void push(slim_channel *c, size_t frame_offset);
   int size() const {return num_chan;} ///< Return the # of channels known.
+  void truncate(int n);
   void clear();
 
 private:
@@ -241,6 +560,50 @@ private:
 };
 
 
+//---------------------------------------------------------------------------
+// Instrumentation
+//---------------------------------------------------------------------------
+
+/// Stages of compression and expansion timed by slim_stats_t.
+enum slim_stage_t {
+  SLIM_STAGE_READ,     ///< Read raw data (compress) or slim data (expand).
+  SLIM_STAGE_PARAMS,   ///< Compute (compress) or read (expand) section params.
+  SLIM_STAGE_CODE,     ///< Encode or decode the data.
+  SLIM_STAGE_CRC,      ///< Compute CRC-32 checksums.
+  SLIM_STAGE_FLUSH,    ///< Write slim data (compress) or raw data (expand).
+  SLIM_NUM_STAGES,     ///< Number of stages.
+};
+
+
+/// Time and bytes per stage, and other counters, for one file.  Kept by
+/// slim_compressor_t and slim_expander_t only when asked (set_stats()).
+class slim_stats_t {
+public:
+  slim_stats_t();
+  ~slim_stats_t();
+  void clear();
+  void set_channels(int n);
+  /// Charge the time since start (from slim_clock()) to a stage.
+  void add(enum slim_stage_t stage, double start, size_t nbytes=0);
+  void write_json(ostream &os, const char *filename, bool compressing) const;
+
+public:
+  double seconds[SLIM_NUM_STAGES]; ///< Time spent in each stage.
+  size_t bytes[SLIM_NUM_STAGES];   ///< Bytes handled by each stage.
+  size_t raw_bytes;      ///< Raw data size.
+  size_t slim_bytes;     ///< Slim data size.
+  int sections;          ///< Number of sections.
+  size_t refills;        ///< Bitstream buffers filled (or flushed).
+  int num_channels;      ///< Largest number of channels in any section.
+  size_t *overflows;     ///< Overflow values coded, per channel.
+
+private:
+  int num_allocated;     ///< Allocated size of overflows.
+};
+
+double slim_clock();
+
+
 //---------------------------------------------------------------------------
 // Files
 //---------------------------------------------------------------------------
@@ -251,6 +614,7 @@ public:
 		    char flags_in, bool deltas=false, int samplepct_in=50);
   virtual ~slim_compressor_t();
 
+  void open(const char *out_name);
   void get_input_file_stats(const char *raw_file_name);
   int write_file_header(const char *in_filename);
   void close_output();
@@ -263,10 +627,18 @@ public:
   void reset_channels();
 
   void set_section_frames(unsigned int nf); 
+  void set_max_section_size(size_t size);
+  /// Use 64-bit sizes.
+  void set_wide_sizes(bool w=true) {wide_sizes=requested_wide=w;}
+  void set_adaptive(double threshold=1.0);
+  /// Let channels keep the previous section's parameters (XFLAG_SAME).
+  void set_reuse_params(bool r=true) {reuse_params=r;}
 
   size_t write(const unsigned char *buf, size_t max);
   size_t write_onesection(const unsigned char *buf, size_t max);
-  int compress_from_file(const char *raw_file_name);
+  void set_layout(const frame_schema &layout);
+  int compress_from_file(const char *raw_file_name,
+                         const container_adapter *container=NULL);
 
 public:
   // Public attributes--so that they can be faked by caller.
@@ -277,18 +649,32 @@ public:
   // Inline read-only access to private data.
   size_t get_raw_size() const {return raw_size;} ///< Read raw file size.
   size_t get_frame_size() const {return frame_size;} ///< Read raw frame size.
+  /// Upper limit on the raw size of a section (bytes).
+  size_t get_max_section_size() const {return max_section_size;}
   void   set_quiet(bool q) {quiet=q;} ///< Don't print compression statistics
+  void   set_report(ostream *os) {report=os;} ///< Print statistics here.
+  void   use_lz4(bool background_thread=false);
+  void   use_zstd(int level, int nworkers=0);
+  void   set_stats(bool s=true);
+  const slim_stats_t *get_stats();
+  void   write_stats(ostream &os);
 
 private: 
   // Private methods
+  void update_stats();
   bool no_reps() const;
   int num_data(int chan_num, int frames_used=-1) const;
   int write_section_header();
+  void write_size(size_t size, int nbits);
   size_t encode_write_section(size_t length);
   int compute_section_params(size_t length);
+  size_t compress_region(FILE *infp, size_t nbytes);
+  size_t compress_adaptive(FILE *infp, size_t nbytes);
+  size_t section_overhead_bits() const;
   long data_offset(int i_data, int chan_num);
   void clear_channel_history();
   void confirm_flags();
+  bool needs_new_reader() const;
   void write_last_section_foot();
 
 private:
@@ -296,6 +682,7 @@ private:
   char *out_filename;    ///< Path of the output (compressed) data file.
 
   char flags;            ///< File header flags.
+  char requested_flags;  ///< File header flags, as given to the constructor.
 
   slim_channel_array channels; ///< Easily-resized vect of slim_channel_encode.
   size_t frame_size;     ///< Size (bytes) of a single frame.
@@ -305,12 +692,52 @@ private:
   int max_frames_per_section; ///< Limit on # of frames in each data section.
   int sections_written;  ///< Number of sections written to disk.
   int sample_pct;        ///< What percent of data to sample.
+  uint32_t *sample_data; ///< Sampled data, kept for all sections.
   raw_section *section;  ///< Buffer for holding entire section in memory.
   unsigned char *curptr; ///< Points beyond currently filled part of section.
   size_t sec_bytes_stored;///< Bytes stored into current section.
   obitstream *ob;        ///< The bitstream for compressed output.
+  size_t section_offset; ///< Byte offset of the current section header.
+  size_t max_section_size; ///< Upper limit on raw size of sections (bytes).
+  bool wide_sizes;       ///< Write 64-bit sizes (XFLAG_WIDE).
+  bool requested_wide;   ///< Were 64-bit sizes requested for all files?
+  bool reuse_params;     ///< Channels can keep prior params (XFLAG_SAME).
+  bool mixed_layouts;    ///< Will the channels change within the file?
+  bool narrow_runlength; ///< Any 8- or 16-bit runlength channels?
+  double adaptive_threshold; ///< Cost ratio to cut a section (0=fixed size).
   bool encode_deltas;    ///< Should all channels encode deltas.
   bool quiet;            ///< Don't print compression statistics
+  ostream *report;       ///< Where to print statistics (normally cout).
+  slim_stats_t *stats;   ///< Per-stage statistics, or NULL if not kept.
+};
+
+
+
+/// Description of one channel, as read from a section header.
+struct slim_channel_info_t {
+  unsigned int repetitions; ///< Number of reps / frame.
+  enum code_t codec;     ///< Encoding algorithm.
+  enum data_t data_type; ///< Raw data type.
+  bool deltas;           ///< Whether deltas are encoded.
+  int bit_rotation;      ///< Bits by which raw data are rotated.
+  int nbits;             ///< Bits per encoded symbol (0 if constant).
+};
+
+
+
+/// Description of one section, found without decoding its data.
+/// See slim_expander_t::scan_section().
+struct slim_section_info_t {
+  size_t slim_offset;    ///< Byte offset of the section header (slim file).
+  size_t slim_size;      ///< Compressed size of the section (bytes).
+  size_t raw_size;       ///< Raw size of the section (bytes).
+  unsigned int num_frames; ///< Number of (possibly partial) frames.
+  int num_channels;      ///< Number of channels.
+  /// Array of num_channels descriptions.  It belongs to the expander and
+  /// is valid until the next call to scan_section().
+  const slim_channel_info_t *channels;
+  bool skipped;          ///< Data were skipped (not decoded) to find the end.
+  bool reuses_params;    ///< Some channels keep the prior section's params.
 };
 
 
@@ -319,8 +746,14 @@ class slim_expander_t {
 public:
   slim_expander_t(const char *in_name);
   slim_expander_t(int in_fd);
+  slim_expander_t(int in_fd, int64_t offset);
+  slim_expander_t(const slim_reader_t *shared);
+  slim_expander_t(const char *in_name, unsigned char *data, size_t length);
   ~slim_expander_t();
 
+  void open(const char *in_name);
+  void open(int in_fd);
+  void close();
   int num_channels() const;
   bool is_open() const;
   int expand_to_file(const char *raw_file_name);
@@ -328,25 +761,55 @@ public:
   size_t read(unsigned char *buf, size_t max);
   size_t read_onesection(const unsigned char **bufptr);
   int dump_sliminfo(); 
+  size_t scan_section(slim_section_info_t *info);
+  size_t peek_section(slim_section_info_t *info);
+  int seek_section(int isect);
+  int seek(size_t raw_offset);
+  void set_read_ahead(int nsections);
 
 public:
   // Inline methods for read-only access to attribues.
   time_t get_mtime() const {return mtime;} ///< Read slim file's mtime.
   size_t get_rawsize() const {return raw_size;} ///< Read slim file's raw size.
+  /// Does the file header hold the raw size?
+  bool has_rawsize() const {return (flags & FLAG_SIZE) != 0;}
   size_t get_slimsize() const {return slim_size;} ///< Read slim file size.
+  const char *get_filename() const {return in_filename;} ///< Slim file path.
+  /// Sections to decode ahead of read() (0 if decoded as needed).
+  int get_read_ahead() const {return read_ahead;}
   void   set_ignore_crc(bool ic=true) {ignore_crc=ic;} ///< Ignore CRCs
   void   set_quiet(bool q) {quiet=q;} ///< Don't print compression statistics
+  void   set_report(ostream *os) {report=os;} ///< Print statistics here.
+  void   set_errors(ostream *os) {errors=os;} ///< Print warnings here.
+  /// Byte offset in the slim file of the most recent section header.
+  size_t get_section_offset() const {return section_offset;}
+  void   set_stats(bool s=true);
+  const slim_stats_t *get_stats();
+  void   write_stats(ostream &os);
 
 
 private:
   // Private methods
+  void update_stats();
+  void initialize(const char *in_name);
+  void reset(const char *in_name);
   int read_file_header();
   int read_section_header();
+  size_t read_size(int nbits);
   size_t load_decode_section();
+  size_t next_section();
+  void start_read_ahead();
+  void stop_read_ahead();
+  static void *read_ahead_worker(void *expander);
+  size_t decode_section_data(bool check_crc);
+  void skip_section_data(size_t next_offset);
   slim_channel_decode * add_channel(slim_channel_decode *c, int bit_rotat);
   slim_channel_decode * add_channel(int reps, enum code_t code, 
 				    enum data_t data_type,
 				    bool deltas, int bit_rotat);
+  slim_channel_decode * reuse_channel(int i, int reps, enum code_t code,
+                                      enum data_t data_type,
+                                      bool deltas, int bit_rotat);
 
 private:
   // Private attributes
@@ -359,10 +822,19 @@ private:
   size_t bytes_read;     ///< Bytes read (raw) from file.
   size_t sec_bytes_read; ///< Bytes read (raw) from this section.
   size_t current_section_size; ///< Size of the currently open section.
+  size_t current_section_slim_size; ///< Its slim size, or 0 if not known.
+  bool wide_sizes;       ///< File has 64-bit sizes (XFLAG_WIDE).
+  bool reuse_params;     ///< Channels can keep prior params (XFLAG_SAME).
+  bool section_reuses_params; ///< Current section kept some channels.
+  int header_section;    ///< Number of the last section header read.
   bool eof_tag_found;    ///< Have we read the End-of-File tag?
 
   raw_section *section;  ///< Buffer for holding entire section in memory.
+  raw_section *held_section; ///< Section being handed out (or NULL).
+  size_t held_size;      ///< Raw size of held_section.
   unsigned char *curptr; ///< Points to decoded, unconsumed data in section.
+  int read_ahead;        ///< Sections to decode ahead (0 = as needed).
+  slim_readahead_t *ahead; ///< Read-ahead thread state (NULL if none).
   bool used_read;        ///< User has called ::read()
   bool used_r_onesection;///< User has called ::read_onesection()
   bool ignore_crc;       ///< Do we ignore the CRC-32 checking.
@@ -371,6 +843,108 @@ private:
   unsigned int num_frames;///< Number of frames in the current section.
   ibitstream *ib;        ///< The bitstream for compressed input
   bool quiet;            ///< Don't print compression statistics
+  ostream *report;       ///< Where to print statistics (normally cout).
+  ostream *errors;       ///< Where to print warnings (normally cerr).
+  const slim_reader_t *reader; ///< Shared reader we are a cursor on (or NULL).
+  size_t section_offset; ///< Byte offset of the current section header.
+  slim_channel_info_t *chan_info; ///< Channels of the current section.
+  int chan_info_allocated; ///< Allocated size of chan_info.
+  slim_stats_t *stats;   ///< Per-stage statistics, or NULL if not kept.
+};
+
+
+
+/// Location of one section within a slim file and within its raw data.
+struct slim_section_index_t {
+  size_t slim_offset;    ///< Byte offset of the section header (slim file).
+  size_t raw_offset;     ///< Offset of the section's first raw byte.
+  size_t raw_size;       ///< Raw size of the section (bytes).
+  /// Latest section, at or before this one, that gives all channel params.
+  int key_section;
+};
+
+
+
+class slim_reader_t {
+public:
+  slim_reader_t(const char *in_name);
+  ~slim_reader_t();
+
+  slim_expander_t *new_cursor() const;
+  int find_section(size_t raw_offset) const;
+
+public:
+  // Inline methods for read-only access to attribues.
+  int num_sections() const {return n_sections;} ///< # of sections in file.
+  /// Index entry for section number i.
+  const slim_section_index_t &get_section(int i) const {return index[i];}
+  int get_fd() const {return fd;} ///< The shared, read-only descriptor.
+  const char *get_filename() const {return in_filename;} ///< Slim file path.
+  size_t get_rawsize() const {return raw_size;} ///< Total raw size (bytes).
+  size_t get_slimsize() const {return slim_size;} ///< Slim file size.
+  /// Frame table, if the file is zstd-compressed (else NULL).
+  const zstd_seek_table *get_seek_table() const {return seek_table;}
+
+  enum {CURSOR_IOBUFFER_SIZE=256*1024}; ///< Input buffer size per cursor.
+
+private:
+  // Private methods
+  void build_index();
+  void add_section(size_t slim_offset, size_t raw_offset, size_t raw_size,
+                   int key_section);
+
+private:
+  // Private attributes
+  char *in_filename;     ///< Path of the input (compressed) data file.
+  int fd;                ///< Descriptor shared by all cursors (pread only).
+  size_t raw_size;       ///< Raw file (uncompressed) size (bytes).
+  size_t slim_size;      ///< Slim file (compressed) size (bytes).
+  slim_section_index_t *index; ///< Array of all sections, in file order.
+  int n_sections;        ///< Number of sections in the index.
+  int n_allocated;       ///< Allocated size of the index (>= n_sections).
+  zstd_seek_table *seek_table; ///< Frame table of a zstd file, or NULL.
+};
+
+
+
+class slim_batch_t {
+public:
+  slim_batch_t(int nfiles, const char * const *names,
+               int depth=DEFAULT_DEPTH, int nthreads=DEFAULT_THREADS);
+  ~slim_batch_t();
+
+  slim_expander_t *next(int *ifile=NULL);
+
+public:
+  // Inline methods for read-only access to attribues.
+  int num_files() const {return nfiles;} ///< Number of files in the batch.
+  /// Are reads done by io_uring (instead of a pool of threads)?
+  bool uses_io_uring() const {return ring != NULL;}
+
+  enum {DEFAULT_DEPTH=32};  ///< Default limit on files read but not used.
+  enum {DEFAULT_THREADS=4}; ///< Default reader threads (without io_uring).
+
+private:
+  // Private methods
+  bool start_ring();
+  void start_pool(int nthreads);
+  int wait_ring();
+  int wait_pool();
+  void load_file(slim_batch_slot_t *slot);
+  static void *pool_worker(void *batch);
+
+private:
+  // Private attributes
+  int nfiles;            ///< Number of files in the batch.
+  int depth;             ///< Max files read (or being read) but not used.
+  slim_batch_slot_t *slots; ///< State of each file's read.
+  int next_to_issue;     ///< Index of the next file to start reading.
+  int outstanding;       ///< Files started but not yet returned by next().
+  int *ready;            ///< Files fully read, in order of completion.
+  int ready_head;        ///< Next entry of ready[] for next() to return.
+  int ready_tail;        ///< Next free entry of ready[].
+  slim_batch_ring_t *ring; ///< io_uring state (NULL if not in use).
+  slim_batch_pool_t *pool; ///< Reader thread state (NULL if not in use).
 };
 
 
@@ -398,9 +972,9 @@ public:
   slim_channel *next_chan;       ///< Next channel in a linked list
 
 protected:
-  const unsigned int repetitions;///< Number of repetitions of data per frame.
-  const size_t raw_size;         ///< The size (bytes) of a single data word.
-  const size_t frame_size;       ///< Size (bytes) of all data words per frame.
+  unsigned int repetitions;      ///< Number of repetitions of data per frame.
+  size_t raw_size;               ///< The size (bytes) of a single data word.
+  size_t frame_size;             ///< Size (bytes) of all data words per frame.
   int bit_rotation;              ///< Cyclically rotate raw data by X bits.
   int bit_unrotation;            ///< Cyclically rotate data by Y bits->raw.
   bool encode_deltas;            ///< Whether to encode the deltas
@@ -420,29 +994,41 @@ public:
   void set_encoder(encoder *e);
   template <typename T> int compute_params(T *data, int ndata);
   int write_params() const;
-  size_t encode_frame(void *buf);
-  size_t encode_partial_frame(void *buf, size_t size);
-  size_t encode_frame_singlevalue(void *buf);
+  size_t encode_frame(const void *buf);
+  size_t encode_partial_frame(const void *buf, size_t size);
+  size_t encode_frame_singlevalue(const void *buf);
   bool expect_zero_compression() const;
   encoder *replace_encoder();
   encoder *replace_constant(int d0);
   encoder *restore_encoder();
   virtual void reset_previous();
+  void set_lookahead(size_t stride, const void *end);
+  void set_reuse_params(bool r);
+  bool params_unchanged(unsigned int reps);
+  size_t take_overflows();
 
 private:
   encoder *enc;              ///< Encoder object for this channel.
   obitstream *ob;            ///< Output-bitstream for writing encoded data.
   encoder *usual_encoder;    ///< Encoder object to use on most sections.
+  encoder *spare_encoder;    ///< Last temporary encoder, kept for reuse.
+  bool spare_is_constant;    ///< Is spare_encoder a constant encoder?
   bool permit_rotation;      ///< Is bit-rotation permitted?
   bool usual_deltas;             ///< Whether the usual encoder does deltas.
   int ndata_sampled;             ///< How many data values used in sampling.
   const static int MIN_SAMPLES=5;///< How many data required for valid sample.
+  uint32_t *scratch;              ///< Bit-rotated copy of one frame's data.
+  size_t scratch_size;           ///< Size (bytes) of the scratch buffer.
+  /// Channel parameters in the previous section (see params_unchanged()).
+  uint32_t last_params[3+MAX_CODEC_PARAMS];
+  int n_last_params;             ///< Number of values in last_params.
 
 private:
   template <typename T>
   int constant_low_bits(const T *data, int ndata) const;
   uint32_t rotate(uint32_t u) const;
   uint32_t rotate(int i) const;
+  const void *rotated_copy(const void *buf, unsigned int nwords);
 };
 
 
@@ -460,10 +1046,16 @@ public:
   size_t decode_frame(void *buf, size_t size);
   size_t decode_frame_singlevalue(void *buf);
   void dump_info(ostream &fout=cout) const;
+  int get_nbits() const;
+  virtual void reset_previous();
+  void configure(unsigned int reps, int size, bool deltas);
+  void use_decoder(enum code_t code, enum data_t data_type, bool deltas);
+  size_t take_overflows();
 
 private:
   decoder *dec;             ///< Decoder object for this channel.
   ibitstream *ib;           ///< Input-bitstream for reading encoded data.
+  decoder *spare_dec;       ///< Last decoder replaced, kept for reuse.
 
 public:
   uint32_t rotate(uint32_t u) const;
@@ -483,7 +1075,9 @@ enum section_mode_t {
 };
 
 enum {
-  MAX_SECTION_LENGTH=0x1000000, ///< Maximum raw size of a section (bytes). 
+  MAX_SECTION_LENGTH=0x1000000, ///< Default maximum raw section size (bytes). 
+  MAX_SECTION_LENGTH_LIMIT=0x7ffffff8, ///< Largest allowed raw section size.
+  ADAPTIVE_BLOCK_LENGTH=0x10000, ///< Raw bytes per step of adaptive sections.
 };
 
 
@@ -499,6 +1093,7 @@ public:
   size_t fill(FILE *fp, size_t size);
   size_t flush(FILE *fp, size_t size);
   size_t resize(size_t size);
+  void set_max_size(size_t size);
   unsigned long crc(size_t length=0) const;
   int set_num_frames(int i);
 
@@ -525,6 +1120,7 @@ private:
   Buffer_t *buf;             ///< The section raw data buffer (usu buf=private).
   size_t private_buf_size;   ///< Private buffer allocated size
   size_t buf_size;           ///< Buffer allocated size
+  size_t max_size;           ///< Largest size allowed by resize()
   size_t frame_size;         ///< Size (bytes) of each data frame.
   int num_frames;            ///< Number of whole frames stored in this buffer.
   const enum section_mode_t 
@@ -562,9 +1158,9 @@ public:
   virtual void encode(uint32_t datum) const;
   virtual void encode(uint16_t datum) const;
   virtual void encode(uint8_t datum) const;
-  void encode_scalar(const uint32_t *data);
-  void encode_scalar(const uint16_t *data);
-  void encode_scalar(const uint8_t *data);
+  virtual void encode_scalar(const uint32_t *data);
+  virtual void encode_scalar(const uint16_t *data);
+  virtual void encode_scalar(const uint8_t *data);
   virtual void encode_vector(const uint32_t *data, int ndata);
   virtual void encode_vector(const uint16_t *data, int ndata);
   virtual void encode_vector(const uint8_t *data, int ndata);
@@ -572,17 +1168,27 @@ public:
   virtual int compute_params(const uint16_t *data, const int ndata);
   virtual int compute_params(const uint8_t *data, const int ndata);
   virtual int write_params() const;
+  virtual int get_params(uint32_t *params) const;
   virtual bool expect_zero_compression() const;
   bool is_signed() const;
   bool uses_deltas() const {return use_deltas;}
   virtual encoder *replacement_encoder();
   virtual encoder *constant_encoder(int d0);
   enum data_t get_data_type() const {return data_type;} ///< Read data_type.
+  /// Prefer to keep the previous parameters, if they serve as well.
+  /// Called at the start of each file, so it also forgets them.
+  void set_reuse_params(bool r) {reuse_params=r; have_params=false;}
   /// Clear delta history.
-  void reset_previous();
+  virtual void reset_previous();
+  void set_lookahead(size_t stride, const void *end);
+  /// Number of overflow values encoded since the last call.
+  size_t take_overflows() {size_t n=overflows; overflows=0; return n;}
 
 protected:
   const bool use_deltas; ///< Whether to encode successive difference values.
+  bool reuse_params;     ///< Prefer the previous parameters, if as good.
+  bool have_params;      ///< Parameters have been computed at least once.
+  mutable size_t overflows; ///< Overflow values encoded (see take_overflows).
   obitstream *out_bs;    ///< The bitstream for writing encoded data.
   enum data_t data_type; ///< The type to be encoded.
   unsigned int data_size_bytes;   ///< Raw data word size in bytes
@@ -590,6 +1196,8 @@ protected:
   uint32_t prev_datum;        ///< Previous value for deltas (uint32_t).
   uint16_t prev_sdatum; ///< Previous value for deltas (uint16_t).
   uint8_t prev_cdatum; ///< Previous value for deltas (uint8_t).
+  size_t frame_stride;  ///< Bytes from one frame's data to the next (0=unknown).
+  const unsigned char *data_end; ///< End of the whole frames in the section.
 
   template <typename T>
   void compute_mean(double& mean,
@@ -612,9 +1220,17 @@ public:
 
   virtual int read_params();
   virtual void dump_info(ostream &fout=cout) const;
+  virtual int get_nbits() const;
+  virtual void reset_previous();
+  virtual enum code_t get_code() const;
+  bool matches(enum code_t code, enum data_t dt, bool deltas) const;
 
   bool set_input(ibitstream *in_bs);
   bool set_data_type(enum data_t dt_in);
+  bool uses_deltas() const {return use_deltas;} ///< Whether deltas are used.
+  enum data_t get_data_type() const {return data_type;} ///< Read data_type.
+  /// Number of overflow values decoded since the last call.
+  size_t take_overflows() {size_t n=overflows; overflows=0; return n;}
 
   void decode_scalar(uint32_t *data);
   void decode_scalar(uint16_t *data);
@@ -631,6 +1247,7 @@ protected:
 protected:
   const bool use_deltas; ///< Whether to encode successive difference values.
   ibitstream *in_bs;     ///< The bitstream for reading encoded data.
+  size_t overflows;      ///< Overflow values decoded (see take_overflows).
   enum data_t data_type; ///< The type to be encoded.
   int data_size_bytes;   ///< Raw data word size in bytes
   int data_size_bits;    ///< Raw data word size in bits
@@ -661,11 +1278,15 @@ public:
   virtual int compute_params(const uint16_t *data, const int ndata);
   virtual int compute_params(const uint8_t *data, const int ndata);
   virtual int write_params() const;
+  virtual int get_params(uint32_t *params) const;
   virtual bool expect_zero_compression() const;
 
 protected:
   virtual int overflow_waste(const int histogram[33], unsigned int n);
   int best_code_length(const int histogram[33], int ndata);
+  template <typename T>
+  void keep_previous_offset(const T *data, int ndata,
+                            uint32_t prev_offset, unsigned int prev_nbits);
 
 protected:
   unsigned int nbits;     ///< Number of bits per encoded symbol
@@ -686,6 +1307,8 @@ public:
 
   virtual int read_params();
   virtual void dump_info(ostream &fout=cout) const;
+  virtual enum code_t get_code() const;
+  virtual int get_nbits() const;
 
 protected:
   virtual uint32_t decode_u32();
@@ -714,16 +1337,35 @@ public:
   virtual ~encoder_runlength();
 
   virtual void encode(uint32_t datum) const;
+  virtual void encode(uint16_t datum) const;
+  virtual void encode(uint8_t datum) const;
+  virtual void encode_scalar(const uint32_t *data);
+  virtual void encode_scalar(const uint16_t *data);
+  virtual void encode_scalar(const uint8_t *data);
   virtual void encode_vector(const uint32_t *data, int ndata);
+  virtual void encode_vector(const uint16_t *data, int ndata);
+  virtual void encode_vector(const uint8_t *data, int ndata);
   virtual int compute_params(const uint32_t *data, const int ndata);
   virtual int compute_params(const uint16_t *data, const int ndata);
+  virtual int compute_params(const uint8_t *data, const int ndata);
   virtual int write_params() const;
+  virtual int get_params(uint32_t *params) const;
   virtual bool expect_zero_compression() const;
   virtual encoder *replacement_encoder();
+  virtual void reset_previous();
 
 protected:
   int ndata_checked;    ///< Number of data tested in compute_params
   int nchanges_data;    ///< Number of data changes found in compute_params().
+  size_t run_bits;      ///< Bits to code the data tested in compute_params.
+  uint32_t run_skip;    ///< Data in later frames already counted in a run.
+
+  template <typename T>
+  void encode_runs(const T *data, int ndata, T &prev);
+  template <typename T>
+  uint32_t run_continuation(const T *data, int ndata, T value) const;
+  template <typename T>
+  void count_changes(const T *data, const int ndata);
 
 private:
   const static enum code_t ALGORITHM_CODE = 
@@ -739,9 +1381,13 @@ public:
 
   virtual int read_params();
   virtual void dump_info(ostream &fout=cout) const;
+  virtual enum code_t get_code() const;
+  virtual void reset_previous();
 
 protected:
   virtual uint32_t decode_u32();
+  virtual uint16_t decode_u16();
+  virtual uint8_t decode_u8();
 
   uint32_t repeated_value;  ///< Value to be used in future.
   uint32_t uses_remaining;  ///< Undecoded consecutive uses of value.
@@ -763,11 +1409,13 @@ class encoder_constant : public encoder {
 public:
   encoder_constant(int value, enum data_t dt, bool deltas, obitstream *ob=NULL);
   virtual ~encoder_constant();
+  void set_value(int value);
 
   virtual void encode(uint32_t datum) const;
   virtual void encode(uint16_t datum) const;
   virtual void encode(uint8_t datum) const;
   virtual int write_params() const;
+  virtual int get_params(uint32_t *params) const;
 
 protected:
   uint32_t fixed_data;    ///< The fixed value for this channel.
@@ -787,6 +1435,8 @@ public:
 
   virtual int read_params();
   virtual void dump_info(ostream &fout=cout) const;
+  virtual enum code_t get_code() const;
+  virtual int get_nbits() const;
 
 protected:
   virtual uint32_t decode_u32();
@@ -812,4 +1462,11 @@ encoder * encoder_generator(enum code_t code, enum data_t data_type,
 decoder * decoder_generator(enum code_t code, enum data_t data_type, 
                             bool deltas);
 
+
+//---------------------------------------------------------------------------
+// CRC-32 (IEEE 802.3) of raw data.
+//---------------------------------------------------------------------------
+
+uint32_t slim_crc32(uint32_t crc, const void *buf, size_t length);
+
 #endif  // #ifndef SLIM_H
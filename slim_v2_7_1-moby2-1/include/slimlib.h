@@ -30,6 +30,9 @@ extern "C" {
 #endif
 
 typedef struct slimlib_file_t  SLIMFILE;
+typedef struct slim_reader_t   SLIMSHARED;
+typedef struct slim_batch_t    SLIMBATCH;
+typedef struct slimlib_ctx_t   SLIMCTX;
 
 extern SLIMFILE *slimopen(const char *filename,
 			  const char *modes);
@@ -46,10 +49,43 @@ extern void slimrewind(SLIMFILE *sf);
 
 extern int slimseek(SLIMFILE *sf, long offset, int whence);
 
+extern int slimreadahead(SLIMFILE *sf, int nsections);
+
 extern long slimrawsize(const char *filename);
 
 extern long slimdrawsize(int fd);
 
+extern long slimframes(SLIMFILE *sf);
+
+extern long slimframesize(SLIMFILE *sf);
+
+extern size_t slimreadframes(SLIMFILE *sf, long first_frame, size_t nframes,
+                             void *buf);
+
+extern size_t slimreadchan(SLIMFILE *sf, int chan, long first, size_t n,
+                           void *buf);
+
+extern SLIMSHARED *slimshare(const char *filename);
+
+extern SLIMFILE *slimcursor(SLIMSHARED *sh);
+
+extern int slimunshare(SLIMSHARED *sh);
+
+extern SLIMBATCH *slimbatchopen(int nfiles, const char * const *filenames);
+
+extern SLIMFILE *slimbatchnext(SLIMBATCH *batch, int *ifile);
+
+extern int slimbatchclose(SLIMBATCH *batch);
+
+extern SLIMCTX *slimctxnew(void);
+
+extern SLIMFILE *slimopen_ctx(SLIMCTX *ctx, const char *filename,
+                              const char *modes);
+
+extern SLIMFILE *slimdopen_ctx(SLIMCTX *ctx, int fd, const char *modes);
+
+extern int slimctxfree(SLIMCTX *ctx);
+
 #ifdef __cplusplus /* If this is a C++ compiler, end C linkage */
 }
 #endif
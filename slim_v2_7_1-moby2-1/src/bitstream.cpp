@@ -27,6 +27,9 @@
 #include <cstring>
 #include <cerrno>
 #include <iostream>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include "bitstream.h"
 #include "slim.h"
 
@@ -36,6 +39,27 @@
 #endif
 
 
+
+/// Adds the time from construction to destruction to a total, if given
+/// one.  Lets a function with several returns time itself.
+class io_timer {
+public:
+  /// \param total  The total to add to, or NULL for no timing.
+  io_timer(double *total) : sum(total) {
+    if (sum)
+      start = slim_clock();
+  }
+  ~io_timer() {
+    if (sum)
+      *sum += slim_clock() - start;
+  }
+
+private:
+  double *sum;           ///< The total, or NULL.
+  double start;          ///< Time at construction.
+};
+
+
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 /// \class bitstream
 /// Bit stream base class.
@@ -45,9 +69,13 @@
 /// Dummy default constructor.
 bitstream::bitstream() {
   buffer_base = NULL;
+  refills = 0;
+  io_seconds = 0.0;
+  timed = false;
 }
 
 
+
 /*
 /// Start bitstream using a FILE ptr to an open file.
 bitstream::bitstream(FILE *file, int buffersize) 
@@ -60,7 +88,12 @@ bitstream::bitstream(FILE *file, int buffersize)
 
 
 /// Start bitstream by filename
-bitstream::bitstream(const char *filename, int buffersize) {;}
+bitstream::bitstream(const char *filename, int buffersize) {
+  buffer_base = NULL;
+  refills = 0;
+  io_seconds = 0.0;
+  timed = false;
+}
 
 
 /*
@@ -100,6 +133,20 @@ bitstream::~bitstream()
 
 /// Close the IO file.
 void ibitstream::close()
+{
+  close_input();
+#ifdef HAVE_LIBZSTD
+  if (zstd_ctx)
+    ZSTD_freeDCtx(zstd_ctx);
+  zstd_ctx = NULL;
+#endif
+}
+
+
+
+/// Close the IO file, but keep the buffers and any zstd context for the
+/// next file (see reopen()).
+void ibitstream::close_input()
 {
 #ifdef HAVE_LIBZZIP
   if (zfp)
@@ -110,12 +157,18 @@ void ibitstream::close()
   if (lz4_ctx)
     LZ4F_freeDecompressionContext(lz4_ctx);
   lz4_ctx = NULL;
+  using_lz4 = false;
+#endif
+#ifdef HAVE_LIBZSTD
+  using_zstd = false;
 #endif
   if (fp) {
     rewind(fp);
     fclose(fp);
   }
   fp = NULL;
+  pread_fd = -1;  // The descriptor is shared, so it is not ours to close.
+  from_memory = false;
 }
 
 
@@ -130,9 +183,9 @@ bool obitstream::is_open() const
 bool ibitstream::is_open() const 
 {
 #ifdef HAVE_LIBZZIP
-  return (zfp != NULL) || (fp != NULL);
+  return (zfp != NULL) || (fp != NULL) || (pread_fd >= 0) || from_memory;
 #else
-  return (fp != NULL);
+  return (fp != NULL) || (pread_fd >= 0) || from_memory;
 #endif
 }
 
@@ -159,7 +212,7 @@ void bitstream::setupstream()
 
 
 /// Return the number of bytes used so far in this stream.
-int bitstream::get_bytes_used() {
+size_t bitstream::get_bytes_used() {
   return sizeof(Byte_t)*(buf_used + buffptr.Bptr - buffer_base) +
     (bitptr / 8);
 }
@@ -172,16 +225,147 @@ int bitstream::get_bitptr() {
 }
 
 
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+/// \class zstd_seek_table
+/// Frame table of a zstd file in the seekable format, which lets a reader
+/// start decompressing at the frame holding any given raw offset.  The
+/// table is read once and never changed, so cursors may share it.
+// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+/// Read the seek table from the end of a file (using pread(2) only).
+/// Throws if the file has no seek table.
+/// \param fd  The open file.
+zstd_seek_table::zstd_seek_table(int fd)
+{
+  const size_t FOOTER_SIZE = 9;  // n_frames, descriptor, magic
+  const size_t HEADER_SIZE = 8;  // skippable magic, frame size
+  Byte_t footer[FOOTER_SIZE];
+  uint32_t word;
+
+  struct stat status;
+  if (fstat(fd, &status) || status.st_size < off_t(HEADER_SIZE+FOOTER_SIZE) ||
+      pread(fd, footer, FOOTER_SIZE, status.st_size-FOOTER_SIZE) !=
+      ssize_t(FOOTER_SIZE))
+    throw "zstd file has no seek table.";
+  memcpy(&word, footer+5, 4);
+  if (word != SEEKABLE_MAGIC)
+    throw "zstd file has no seek table.";
+  memcpy(&word, footer, 4);
+  n_frames = word;
+  const size_t entry_size = (footer[4] & 0x80) ? 12 : 8;
+  const size_t table_size = n_frames * entry_size;
+  const off_t table_start = status.st_size - FOOTER_SIZE - table_size;
+  if (n_frames < 0 || table_start < off_t(HEADER_SIZE))
+    throw "zstd seek table is corrupt.";
+
+  Byte_t *table = new Byte_t[table_size + HEADER_SIZE];
+  if (pread(fd, table, table_size + HEADER_SIZE, table_start - HEADER_SIZE) !=
+      ssize_t(table_size + HEADER_SIZE)) {
+    delete [] table;
+    throw "zstd seek table cannot be read.";
+  }
+  memcpy(&word, table, 4);
+  uint32_t frame_size;
+  memcpy(&frame_size, table+4, 4);
+  if (word != SKIPPABLE_MAGIC || frame_size != table_size + FOOTER_SIZE) {
+    delete [] table;
+    throw "zstd seek table is corrupt.";
+  }
+
+  c_offset = new off_t[n_frames+1];
+  d_offset = new size_t[n_frames+1];
+  c_offset[0] = 0;
+  d_offset[0] = 0;
+  for (int i=0; i<n_frames; i++) {
+    uint32_t csize, dsize;
+    memcpy(&csize, table + HEADER_SIZE + i*entry_size, 4);
+    memcpy(&dsize, table + HEADER_SIZE + i*entry_size + 4, 4);
+    c_offset[i+1] = c_offset[i] + csize;
+    d_offset[i+1] = d_offset[i] + dsize;
+  }
+  delete [] table;
+  if (c_offset[n_frames] != table_start - off_t(HEADER_SIZE)) {
+    delete [] c_offset;
+    delete [] d_offset;
+    throw "zstd seek table is corrupt.";
+  }
+}
+
+
+
+/// Destructor.
+zstd_seek_table::~zstd_seek_table()
+{
+  delete [] c_offset;
+  delete [] d_offset;
+}
+
+
+
+/// Find which frame holds a given raw byte.
+/// \param offset  Offset (bytes) into the decompressed stream.
+/// \return Frame number, or -1 if the offset is beyond the data.
+int zstd_seek_table::find_frame(size_t offset) const
+{
+  if (n_frames == 0 || offset >= d_offset[n_frames])
+    return -1;
+
+  int lo=0, hi=n_frames-1;
+  while (lo < hi) {
+    int mid = (lo+hi+1)/2;
+    if (d_offset[mid] <= offset)
+      lo = mid;
+    else
+      hi = mid-1;
+  }
+  return lo;
+}
+
+
+
+
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 /// \class obitstream
 /// Output bit stream.
 /// Allows you to write data one bit at a time with buffered writing.
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 
+/// Find where a stream's output starts in its file, if the file can be
+/// patched in place: a regular file, not opened for appending.
+/// \param fp  The output file.
+/// \return The file offset, or -1 if the file cannot be patched.
+static off_t patchable_offset(FILE *fp)
+{
+  struct stat st;
+  if (fp == NULL || fstat(fileno(fp), &st) || !S_ISREG(st.st_mode))
+    return -1;
+  int fl = fcntl(fileno(fp), F_GETFL);
+  if (fl < 0 || (fl & O_APPEND))
+    return -1;
+  return ftello(fp);
+}
+
+
+
 /// Start obitstream using a FILE ptr to an open file.
 obitstream::obitstream(FILE *file, int buffersize)
 {
   fp = file;
+  file_start = patchable_offset(fp);
+  holding = false;
+  held = NULL;
+  held_size = held_alloc = 0;
+#ifdef HAVE_LIBLZ4
+  using_lz4 = lz4_threaded = false;
+  lz4_ctx = NULL;
+  lz4_buffer = spare_buffer = lz4_pending = NULL;
+#endif
+#ifdef HAVE_LIBZSTD
+  using_zstd = false;
+  zstd_ctx = NULL;
+  zstd_buffer = NULL;
+  zstd_frames = NULL;
+#endif
   bufsize = buffersize;
   setupstream();
 }
@@ -193,16 +377,55 @@ obitstream::obitstream(const char *filename, int buffersize)
   if (fp == NULL) {
     throw bad_output_file(filename, "writing");
   }
+  file_start = patchable_offset(fp);
+  holding = false;
+  held = NULL;
+  held_size = held_alloc = 0;
+#ifdef HAVE_LIBLZ4
+  using_lz4 = lz4_threaded = false;
+  lz4_ctx = NULL;
+  lz4_buffer = spare_buffer = lz4_pending = NULL;
+#endif
+#ifdef HAVE_LIBZSTD
+  using_zstd = false;
+  zstd_ctx = NULL;
+  zstd_buffer = NULL;
+  zstd_frames = NULL;
+#endif
   bufsize = buffersize;
   setupstream();
 }
 
 
 
+/// Re-target a closed stream at another file, as if newly constructed by
+/// obitstream(const char *), but keeping its buffer.  Any LZ4 or zstd
+/// layer must be requested again with use_lz4() or use_zstd().
+/// \param filename  The file to write.
+void obitstream::reopen(const char *filename)
+{
+  if (is_open())
+    throw "Cannot re-target an obitstream that is still open.";
+  fp = fopen(filename, "wb");
+  if (fp == NULL) {
+    throw bad_output_file(filename, "writing");
+  }
+  file_start = patchable_offset(fp);
+  holding = false;
+  held_size = 0;
+  buf_used = 0;
+  buffptr.Bptr = buffer_base;
+  bitptr = 0;
+  reset_counters();
+}
+
+
+
 // Destructor flushed output buffer and calls base destructor.
 obitstream::~obitstream()
 {
   close();
+  delete [] held;
 }
 
 
@@ -210,9 +433,18 @@ obitstream::~obitstream()
 /// Close the output stream by flushing and closing the FILE *.
 void obitstream::close()
 {
+  release();
   windup();
   const bool FLUSH_TRAILING_BITS = true;
   flush(FLUSH_TRAILING_BITS);
+#ifdef HAVE_LIBLZ4
+  if (using_lz4)
+    lz4_end();
+#endif
+#ifdef HAVE_LIBZSTD
+  if (using_zstd)
+    zstd_end();
+#endif
   if (fp)
     fclose(fp);
   fp = NULL;
@@ -351,11 +583,71 @@ void obitstream::print() const
 void obitstream::flush(bool flush_trailing_bits)
 {
   int thiswrite;
+  io_timer timer(timed ? &io_seconds : NULL);
+  refills++;
   while (bitptr > 0 && flush_trailing_bits) {
     buffptr.Bptr ++;
     bitptr -= 8*sizeof(Byte_t);
   }
 
+  if (holding) {
+    thiswrite = buffptr.Bptr-buffer_base;
+    if (held_size + thiswrite > held_alloc) {
+      size_t n = held_alloc ? 2*held_alloc : 4*bufsize;
+      while (n < held_size + thiswrite)
+        n *= 2;
+      Byte_t *new_held = new Byte_t[n];
+      if (held_size)
+        memcpy(new_held, held, held_size);
+      delete [] held;
+      held = new_held;
+      held_alloc = n;
+    }
+    memcpy(held + held_size, buffer_base, thiswrite);
+    memset(buffer_base, 0, thiswrite);
+    held_size += thiswrite;
+    buf_used += thiswrite;
+    if (flush_trailing_bits)
+      bitptr = 0;
+    buffptr.Bptr = buffer_base;
+    return;
+  }
+
+#ifdef HAVE_LIBZSTD
+  if (using_zstd) {
+    thiswrite = buffptr.Bptr-buffer_base;
+    zstd_write(buffer_base, thiswrite);
+    if (thiswrite)
+      memset(buffer_base, 0, thiswrite);
+    buf_used += thiswrite;
+    if (flush_trailing_bits)
+      bitptr = 0;
+    buffptr.Bptr = buffer_base;
+    return;
+  }
+#endif
+#ifdef HAVE_LIBLZ4
+  if (using_lz4) {
+    thiswrite = buffptr.Bptr-buffer_base;
+    if (lz4_threaded) {
+      // The helper thread clears the buffer after compressing it.
+      if (thiswrite)
+        lz4_handoff(thiswrite);
+    } else {
+      size_t c = lz4_write(buffer_base, thiswrite);
+      if (c)
+        lz4_raise(c);
+      if (thiswrite)
+        memset(buffer_base, 0, thiswrite);
+    }
+    buf_used += thiswrite;
+    if (flush_trailing_bits)
+      bitptr = 0;
+    buffptr.Bptr = buffer_base;
+    return;
+  }
+#endif
+
   thiswrite = fwrite(buffer_base, sizeof(Byte_t), 
 		     (buffptr.Bptr-buffer_base), fp);
   buf_used += thiswrite;
@@ -369,6 +661,453 @@ void obitstream::flush(bool flush_trailing_bits)
 
 
 
+/// Return the number of bits written so far in this stream.
+size_t obitstream::get_bits_used() const {
+  return 8*(buf_used + (buffptr.Bptr - buffer_base)) + bitptr;
+}
+
+
+
+/// Can data already written to the file be patched in place?
+/// \return Whether patch() works on any part of the stream.
+bool obitstream::can_patch() const {
+#ifdef HAVE_LIBLZ4
+  if (using_lz4)
+    return false;
+#endif
+#ifdef HAVE_LIBZSTD
+  if (using_zstd)
+    return false;
+#endif
+  return fp != NULL && file_start >= 0;
+}
+
+
+
+/// Keep all further output in memory (instead of writing it) until
+/// release(), so that patch() can change it.  Use this when can_patch()
+/// is false, as with pipes or an outer compression layer.
+void obitstream::hold() {
+  holding = true;
+}
+
+
+
+/// Write out any output kept in memory by hold(), and stop holding.
+void obitstream::release() {
+  if (!holding)
+    return;
+  holding = false;
+  if (held_size == 0)
+    return;
+
+  // Set aside the partly filled buffer (including any partial word).
+  size_t tail = buffptr.Bptr - buffer_base;
+  size_t tail_alloc = tail + (bitptr ? sizeof(Word_t) : 0);
+  int tail_bitptr = bitptr;
+  Byte_t *save = new Byte_t[tail_alloc+1];
+  memcpy(save, buffer_base, tail_alloc);
+  memset(buffer_base, 0, tail_alloc);
+
+  // Send the held data through the usual path, one buffer at a time.
+  const bool IGNORE_TRAILING_BITS = false;
+  buf_used -= held_size;
+  for (size_t done=0; done < held_size; ) {
+    size_t n = held_size - done;
+    if (n > bufsize)
+      n = bufsize;
+    memcpy(buffer_base, held + done, n);
+    buffptr.Bptr = buffer_base + n;
+    bitptr = 0;
+    flush(IGNORE_TRAILING_BITS);
+    done += n;
+  }
+  held_size = 0;
+
+  memcpy(buffer_base, save, tail_alloc);
+  buffptr.Bptr = buffer_base + tail;
+  bitptr = tail_bitptr;
+  delete [] save;
+}
+
+
+
+/// Overwrite bytes already written to the stream.  The bytes may still
+/// be in the buffer, held in memory by hold(), or in the file (only if
+/// can_patch() is true).
+/// \param offset  Byte offset of the first byte to change.
+/// \param value   The new value, written little-endian.
+/// \param nbytes  Number of bytes to change (at most 8).
+void obitstream::patch(size_t offset, uint64_t value, int nbytes) {
+  Byte_t bytes[8];
+  assert (nbytes <= 8);
+  int n_file = 0;  // How many leading bytes are already in the file.
+  for (int i=0; i<nbytes; i++) {
+    size_t pos = offset + i;
+    bytes[i] = Byte_t(value >> (8*i));
+    if (pos >= buf_used)
+      buffer_base[pos - buf_used] = bytes[i];
+    else if (pos + held_size >= buf_used)
+      held[pos + held_size - buf_used] = bytes[i];
+    else
+      n_file = i+1;
+  }
+
+  if (n_file) {
+    if (!can_patch())
+      throw "obitstream::patch() cannot change data already written.";
+    if (fflush(fp) || 
+        pwrite(fileno(fp), bytes, n_file, file_start + offset) != n_file)
+      throw bad_output_file("(slim output)", "patching");
+  }
+}
+
+
+
+/// Compress all further output as one LZ4 frame.
+/// Must be called before anything is written.  The slim data are
+/// unchanged, so the result is the same as running lz4(1) on a slim file,
+/// and ibitstream reads it back transparently.
+/// \param background_thread  Compress on a helper thread, which works on
+///                           one full buffer while the encoder fills another.
+void obitstream::use_lz4(bool background_thread)
+{
+#ifdef HAVE_LIBLZ4
+  if (using_lz4)
+    return;
+  if (buf_used > 0 || buffptr.Bptr != buffer_base || bitptr > 0)
+    throw "LZ4 output must be selected before any data are written.";
+#ifdef HAVE_LIBZSTD
+  if (using_zstd)
+    throw "Cannot use both LZ4 and zstd output.";
+#endif
+
+  size_t c = LZ4F_createCompressionContext(&lz4_ctx, LZ4F_VERSION);
+  if (LZ4F_isError(c))
+    throw "Cannot create an LZ4 compression context.";
+
+  LZ4F_preferences_t prefs;
+  memset(&prefs, 0, sizeof(prefs));
+  prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+
+  // Big enough for the frame header, for any one full buffer, or for the
+  // frame end (NULL preferences give the worst case).
+  lz4_bufsize = LZ4F_compressBound(bufsize, NULL) + LZ4F_HEADER_SIZE_MAX;
+  lz4_buffer = new Byte_t [lz4_bufsize];
+
+  c = LZ4F_compressBegin(lz4_ctx, lz4_buffer, lz4_bufsize, &prefs);
+  if (LZ4F_isError(c))
+    throw "Cannot start an LZ4 frame.";
+  if (fwrite(lz4_buffer, sizeof(Byte_t), c, fp) != c)
+    throw bad_output_file("(slim output)", "writing");
+  using_lz4 = true;
+
+  if (background_thread) {
+    spare_buffer = new Byte_t [bufsize];
+    memset(spare_buffer, 0, bufsize);
+    lz4_pending = NULL;
+    lz4_pending_size = 0;
+    lz4_finish = false;
+    lz4_error = 0;
+    lz4_errno = 0;
+    pthread_mutex_init(&lz4_mutex, NULL);
+    pthread_cond_init(&lz4_cond, NULL);
+    if (pthread_create(&lz4_thread, NULL, lz4_worker, this)) {
+      // Run without the helper rather than fail.
+      pthread_mutex_destroy(&lz4_mutex);
+      pthread_cond_destroy(&lz4_cond);
+      delete [] spare_buffer;
+      spare_buffer = NULL;
+    } else
+      lz4_threaded = true;
+  }
+#else
+  throw "This slim was built without LZ4 support (configure --with-lz4).";
+#endif
+}
+
+
+
+/// Compress all further output with zstd, in the seekable format: a
+/// series of independent frames of frame_size raw bytes each, then a
+/// table of frame sizes.  Plain zstd(1) can expand the result, and
+/// slim_reader_t can still seek to any section in it.
+/// Must be called before anything is written.
+/// \param level       zstd compression level.
+/// \param nworkers    Number of zstd compression threads (0 = none).
+/// \param frame_size  Raw bytes per frame.  Larger frames compress better,
+///                    but a seek must decompress up to one whole frame.
+void obitstream::use_zstd(int level, int nworkers, size_t frame_size)
+{
+#ifdef HAVE_LIBZSTD
+  if (using_zstd)
+    return;
+  if (buf_used > 0 || buffptr.Bptr != buffer_base || bitptr > 0)
+    throw "zstd output must be selected before any data are written.";
+#ifdef HAVE_LIBLZ4
+  if (using_lz4)
+    throw "Cannot use both LZ4 and zstd output.";
+#endif
+  if (frame_size == 0 || frame_size > 0x40000000)
+    throw "zstd frame size must be between 1 byte and 1 GB.";
+
+  zstd_ctx = ZSTD_createCCtx();
+  if (zstd_ctx == NULL)
+    throw "Cannot create a zstd compression context.";
+  size_t c = ZSTD_CCtx_setParameter(zstd_ctx, ZSTD_c_compressionLevel, level);
+  if (ZSTD_isError(c))
+    throw "Cannot set the zstd compression level.";
+  ZSTD_CCtx_setParameter(zstd_ctx, ZSTD_c_checksumFlag, 1);
+  // A zstd library built without threads refuses workers: then go on
+  // compressing on this thread.
+  if (nworkers > 0)
+    ZSTD_CCtx_setParameter(zstd_ctx, ZSTD_c_nbWorkers, nworkers);
+
+  zstd_bufsize = ZSTD_CStreamOutSize();
+  zstd_buffer = new Byte_t [zstd_bufsize];
+  zstd_frame_size = frame_size;
+  zstd_frame_in = zstd_frame_out = 0;
+  zstd_nframes = 0;
+  zstd_nalloc = 64;
+  zstd_frames = new uint32_t [2*zstd_nalloc];
+  using_zstd = true;
+#else
+  throw "This slim was built without zstd support (configure --with-zstd).";
+#endif
+}
+
+
+
+#ifdef HAVE_LIBZSTD
+/// Compress bytes, ending a frame (and recording it in the seek table)
+/// each time the frame reaches zstd_frame_size raw bytes.
+/// \param data    The (slim) bytes to compress.
+/// \param nbytes  How many bytes.
+void obitstream::zstd_write(const Byte_t *data, size_t nbytes)
+{
+  while (nbytes > 0) {
+    size_t n = zstd_frame_size - zstd_frame_in;
+    if (n > nbytes)
+      n = nbytes;
+    zstd_compress(data, n, ZSTD_e_continue);
+    zstd_frame_in += n;
+    data += n;
+    nbytes -= n;
+    if (zstd_frame_in == zstd_frame_size)
+      zstd_compress(NULL, 0, ZSTD_e_end);
+  }
+}
+
+
+
+/// Run the zstd compressor and write all the output it gives back.
+/// \param data    Bytes to compress (may be NULL if nbytes is 0).
+/// \param nbytes  How many bytes.
+/// \param op      ZSTD_e_continue, or ZSTD_e_end to end the frame.
+void obitstream::zstd_compress(const Byte_t *data, size_t nbytes,
+                               ZSTD_EndDirective op)
+{
+  ZSTD_inBuffer in = {data, nbytes, 0};
+  while (1) {
+    ZSTD_outBuffer out = {zstd_buffer, zstd_bufsize, 0};
+    size_t remaining = ZSTD_compressStream2(zstd_ctx, &out, &in, op);
+    if (ZSTD_isError(remaining))
+      throw "zstd compression failed.";
+    if (out.pos && fwrite(zstd_buffer, sizeof(Byte_t), out.pos, fp) != out.pos)
+      throw bad_output_file("(slim output)", "writing");
+    zstd_frame_out += out.pos;
+    if (op == ZSTD_e_end ? remaining == 0 : in.pos == in.size)
+      break;
+  }
+  if (op != ZSTD_e_end)
+    return;
+
+  // Record the finished frame.
+  if (zstd_nframes >= zstd_nalloc) {
+    uint32_t *f = new uint32_t [4*zstd_nalloc];
+    memcpy(f, zstd_frames, 2*zstd_nalloc*sizeof(uint32_t));
+    delete [] zstd_frames;
+    zstd_frames = f;
+    zstd_nalloc *= 2;
+  }
+  zstd_frames[2*zstd_nframes] = zstd_frame_out;
+  zstd_frames[2*zstd_nframes+1] = zstd_frame_in;
+  zstd_nframes++;
+  zstd_frame_in = zstd_frame_out = 0;
+}
+
+
+
+/// End the last frame, write the seek table, and free the compressor.
+/// The seek table is a skippable frame, so any zstd decoder ignores it.
+void obitstream::zstd_end()
+{
+  if (zstd_frame_in > 0 || zstd_nframes == 0)
+    zstd_compress(NULL, 0, ZSTD_e_end);
+
+  uint32_t header[2];
+  header[0] = zstd_seek_table::SKIPPABLE_MAGIC;
+  header[1] = 8*zstd_nframes + 9;
+  Byte_t footer[9];
+  uint32_t word = zstd_nframes;
+  memcpy(footer, &word, 4);
+  footer[4] = 0;                 // Descriptor: no per-frame checksums.
+  word = zstd_seek_table::SEEKABLE_MAGIC;
+  memcpy(footer+5, &word, 4);
+  const bool written =
+    fwrite(header, sizeof(uint32_t), 2, fp) == 2 &&
+    fwrite(zstd_frames, sizeof(uint32_t), 2*zstd_nframes, fp) ==
+      size_t(2*zstd_nframes) &&
+    fwrite(footer, sizeof(Byte_t), 9, fp) == 9;
+
+  ZSTD_freeCCtx(zstd_ctx);
+  zstd_ctx = NULL;
+  delete [] zstd_buffer;
+  zstd_buffer = NULL;
+  delete [] zstd_frames;
+  zstd_frames = NULL;
+  using_zstd = false;
+  if (!written)
+    throw bad_output_file("(slim output)", "writing");
+}
+#endif
+
+
+
+#ifdef HAVE_LIBLZ4
+/// Compress bytes into the current LZ4 frame and write any output.
+/// \param data    The (slim) bytes to compress.
+/// \param nbytes  How many bytes.
+/// \return 0, an LZ4F error code, or LZ4_WRITE_FAILED (with errno set).
+size_t obitstream::lz4_write(const Byte_t *data, size_t nbytes)
+{
+  if (nbytes == 0)
+    return 0;
+  size_t c = LZ4F_compressUpdate(lz4_ctx, lz4_buffer, lz4_bufsize,
+                                 data, nbytes, NULL);
+  if (LZ4F_isError(c))
+    return c;
+  if (c && fwrite(lz4_buffer, sizeof(Byte_t), c, fp) != c)
+    return LZ4_WRITE_FAILED;
+  return 0;
+}
+
+
+
+/// Throw the exception for an error returned by lz4_write().
+/// \param err  The error (not 0).
+void obitstream::lz4_raise(size_t err)
+{
+  if (err == LZ4_WRITE_FAILED)
+    throw bad_output_file("(slim output)", "writing");
+  throw "LZ4 compression failed.";
+}
+
+
+
+/// Pass the full buffer to the helper thread, and swap in the spare one.
+/// Waits if the helper thread is still compressing the previous buffer.
+/// \param nbytes  Bytes used in the buffer.
+void obitstream::lz4_handoff(size_t nbytes)
+{
+  pthread_mutex_lock(&lz4_mutex);
+  while (lz4_pending)
+    pthread_cond_wait(&lz4_cond, &lz4_mutex);
+  size_t err = lz4_error;
+  if (!err) {
+    lz4_pending = buffer_base;
+    lz4_pending_size = nbytes;
+    pthread_cond_broadcast(&lz4_cond);
+  }
+  pthread_mutex_unlock(&lz4_mutex);
+  if (err) {
+    errno = lz4_errno;
+    lz4_raise(err);
+  }
+
+  Byte_t *b = buffer_base;
+  buffer_base = spare_buffer;
+  spare_buffer = b;
+  beyondbuffer = buffer_base + bufsize;
+}
+
+
+
+/// Stop any helper thread, end the LZ4 frame, and free the compressor.
+void obitstream::lz4_end()
+{
+  size_t err = 0;
+  if (lz4_threaded) {
+    pthread_mutex_lock(&lz4_mutex);
+    lz4_finish = true;
+    pthread_cond_broadcast(&lz4_cond);
+    pthread_mutex_unlock(&lz4_mutex);
+    pthread_join(lz4_thread, NULL);
+    pthread_mutex_destroy(&lz4_mutex);
+    pthread_cond_destroy(&lz4_cond);
+    delete [] spare_buffer;
+    spare_buffer = NULL;
+    lz4_threaded = false;
+    err = lz4_error;
+    errno = lz4_errno;
+  }
+
+  if (!err) {
+    size_t c = LZ4F_compressEnd(lz4_ctx, lz4_buffer, lz4_bufsize, NULL);
+    if (LZ4F_isError(c))
+      err = c;
+    else if (fwrite(lz4_buffer, sizeof(Byte_t), c, fp) != c)
+      err = LZ4_WRITE_FAILED;
+  }
+  const int saved_errno = errno;
+  LZ4F_freeCompressionContext(lz4_ctx);
+  lz4_ctx = NULL;
+  delete [] lz4_buffer;
+  lz4_buffer = NULL;
+  using_lz4 = false;
+  if (err) {
+    errno = saved_errno;
+    lz4_raise(err);
+  }
+}
+
+
+
+/// Body of the helper thread: compress each buffer handed over by
+/// lz4_handoff(), then clear it for re-use, until told to finish.
+/// \param arg  The obitstream that owns the thread.
+void *obitstream::lz4_worker(void *arg)
+{
+  obitstream *ob = static_cast<obitstream *>(arg);
+
+  pthread_mutex_lock(&ob->lz4_mutex);
+  while (1) {
+    while (!ob->lz4_pending && !ob->lz4_finish)
+      pthread_cond_wait(&ob->lz4_cond, &ob->lz4_mutex);
+    if (!ob->lz4_pending)
+      break;
+    Byte_t *data = ob->lz4_pending;
+    size_t nbytes = ob->lz4_pending_size;
+    pthread_mutex_unlock(&ob->lz4_mutex);
+
+    size_t c = ob->lz4_write(data, nbytes);
+    memset(data, 0, nbytes);
+
+    pthread_mutex_lock(&ob->lz4_mutex);
+    if (c && !ob->lz4_error) {
+      ob->lz4_error = c;
+      ob->lz4_errno = errno;
+    }
+    ob->lz4_pending = NULL;
+    pthread_cond_broadcast(&ob->lz4_cond);
+  }
+  pthread_mutex_unlock(&ob->lz4_mutex);
+  return NULL;
+}
+#endif
+
+
+
 
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 /// \class ibitstream
@@ -380,25 +1119,32 @@ void obitstream::flush(bool flush_trailing_bits)
 ibitstream::ibitstream(FILE *file, int buffersize)
 {
   fp = file;
+  pread_fd = -1;
+  pread_pos = 0;
+  from_memory = false;
+  mem_remaining = 0;
 #ifdef HAVE_LIBZZIP
   zfp = NULL;
 #endif
 #ifdef HAVE_LIBLZ4
-  uint32_t magic_bytes = 0;
   using_lz4 = false;
   lz4_ctx = NULL;
-  if (fread(&magic_bytes, sizeof(Byte_t), 4, fp) >= 4) {
-    if (magic_bytes == 0x184d2204) {
-      size_t c = LZ4F_createDecompressionContext(&lz4_ctx, LZ4F_VERSION);
-      if (LZ4F_isError(c))
-        throw bad_output_file("unknown",
-          ("LZ4 error: " + string(LZ4F_getErrorName(c))).c_str());
-      using_lz4 = true;
-    }
-  }
+#endif
+#ifdef HAVE_LIBZSTD
+  using_zstd = false;
+  zstd_ctx = NULL;
+  zstd_buffer = NULL;
+#endif
+  zstd_table = NULL;
+#if defined(HAVE_LIBLZ4) || defined(HAVE_LIBZSTD)
+  uint32_t magic_bytes = 0;
+  if (fread(&magic_bytes, sizeof(Byte_t), 4, fp) >= 4)
+    detect_compression(magic_bytes);
   fseek(fp, 0, SEEK_SET);
 #endif
   bufsize = buffersize;
+  partial_word = 0;
+  partial_word_bitptr = -1;
   setupstream();
 }
 
@@ -409,7 +1155,23 @@ ibitstream::ibitstream(ZZIP_FILE *file, int buffersize)
 {
   fp = NULL;
   zfp = file;
+  pread_fd = -1;
+  pread_pos = 0;
+  from_memory = false;
+  mem_remaining = 0;
+#ifdef HAVE_LIBLZ4
+  using_lz4 = false;
+  lz4_ctx = NULL;
+#endif
+#ifdef HAVE_LIBZSTD
+  using_zstd = false;
+  zstd_ctx = NULL;
+  zstd_buffer = NULL;
+#endif
+  zstd_table = NULL;
   bufsize = buffersize;
+  partial_word = 0;
+  partial_word_bitptr = -1;
   setupstream();
 }
 #endif
@@ -418,6 +1180,10 @@ ibitstream::ibitstream(ZZIP_FILE *file, int buffersize)
 /// Start inputbitstream by filename.
 ibitstream::ibitstream(const char *filename, int buffersize) 
 {
+  pread_fd = -1;
+  pread_pos = 0;
+  from_memory = false;
+  mem_remaining = 0;
 #ifdef HAVE_LIBZZIP
   fp = NULL;
   zfp = zzip_fopen(filename, "rb");
@@ -429,22 +1195,23 @@ ibitstream::ibitstream(const char *filename, int buffersize)
     throw bad_output_file(filename, "reading");
   }
 #ifdef HAVE_LIBLZ4
-  uint32_t magic_bytes = 0;
   using_lz4 = false;
   lz4_ctx = NULL;
+#endif
+#ifdef HAVE_LIBZSTD
+  using_zstd = false;
+  zstd_ctx = NULL;
+  zstd_buffer = NULL;
+#endif
+  zstd_table = NULL;
+#if defined(HAVE_LIBLZ4) || defined(HAVE_LIBZSTD)
+  uint32_t magic_bytes = 0;
 #ifdef HAVE_LIBZZIP
-  if (zzip_fread(&magic_bytes, sizeof(Byte_t), 4, zfp) >= 4) {
+  if (zzip_fread(&magic_bytes, sizeof(Byte_t), 4, zfp) >= 4)
 #else
-  if (fread(&magic_bytes, sizeof(Byte_t), 4, fp) >= 4) {
-#endif
-    if (magic_bytes == 0x184d2204) {
-      size_t c = LZ4F_createDecompressionContext(&lz4_ctx, LZ4F_VERSION);
-      if (LZ4F_isError(c))
-        throw bad_output_file("unknown",
-          ("LZ4 error: " + string(LZ4F_getErrorName(c))).c_str());
-      using_lz4 = true;
-    }
-  }
+  if (fread(&magic_bytes, sizeof(Byte_t), 4, fp) >= 4)
+#endif
+    detect_compression(magic_bytes);
 #ifdef HAVE_LIBZZIP
   zzip_seek(zfp, 0, SEEK_SET);
 #else
@@ -467,6 +1234,23 @@ ibitstream::ibitstream(int fd, int buffersize)
 
     throw bad_output_file(fdname, "reading");
   }
+  pread_fd = -1;
+  pread_pos = 0;
+  from_memory = false;
+  mem_remaining = 0;
+#ifdef HAVE_LIBZZIP
+  zfp = NULL;
+#endif
+#ifdef HAVE_LIBLZ4
+  using_lz4 = false;
+  lz4_ctx = NULL;
+#endif
+#ifdef HAVE_LIBZSTD
+  using_zstd = false;
+  zstd_ctx = NULL;
+  zstd_buffer = NULL;
+#endif
+  zstd_table = NULL;
   bufsize = buffersize;
   partial_word = 0;
   partial_word_bitptr = -1;
@@ -475,6 +1259,173 @@ ibitstream::ibitstream(int fd, int buffersize)
 
 
 
+/// Start inputbitstream reading a shared file descriptor at an offset.
+/// All reads use pread(2), so the descriptor's own file position is never
+/// used or changed.  Any number of such streams may therefore read one
+/// descriptor concurrently from separate threads.  The descriptor is not
+/// closed by this object.  (LZ4-compressed input is not supported.)
+/// A zstd-compressed file can be read only if it is in the seekable
+/// format; then offsets count bytes of the decompressed stream.
+/// \param fd         The open, seekable file descriptor.
+/// \param offset     Byte offset in the file where reading starts.
+/// \param buffersize Size of the I/O buffer (bytes).
+/// \param table      The file's zstd seek table, or NULL if not zstd.
+ibitstream::ibitstream(int fd, off_t offset, int buffersize,
+                       const zstd_seek_table *table)
+{
+  fp = NULL;
+  pread_fd = fd;
+  pread_pos = offset;
+  from_memory = false;
+  mem_remaining = 0;
+#ifdef HAVE_LIBZZIP
+  zfp = NULL;
+#endif
+#ifdef HAVE_LIBLZ4
+  using_lz4 = false;
+  lz4_ctx = NULL;
+#endif
+#ifdef HAVE_LIBZSTD
+  using_zstd = false;
+  zstd_ctx = NULL;
+  zstd_buffer = NULL;
+#endif
+  zstd_table = table;
+  bufsize = buffersize;
+  partial_word = 0;
+  partial_word_bitptr = -1;
+  bitstream::setupstream();
+#ifdef HAVE_LIBLZ4
+  lz4_buffer = NULL;
+#endif
+  if (table) {
+#ifdef HAVE_LIBZSTD
+    start_zstd();
+#else
+    throw "This slim was built without zstd support (configure --with-zstd).";
+#endif
+  }
+  seek(offset);
+}
+
+
+
+/// Start inputbitstream on a complete slim file already in memory.
+/// The stream takes ownership of the buffer, which must have been
+/// allocated by new Byte_t[] with room for the data rounded up to a whole
+/// number of Word_t words (any padding must be zero).
+/// \param data    The buffer (adopted: it is deleted with the stream).
+/// \param length  Number of valid data bytes in the buffer.
+ibitstream::ibitstream(Byte_t *data, size_t length)
+{
+  fp = NULL;
+  pread_fd = -1;
+  pread_pos = 0;
+  from_memory = true;
+  mem_remaining = length;
+#ifdef HAVE_LIBZZIP
+  zfp = NULL;
+#endif
+#ifdef HAVE_LIBLZ4
+  using_lz4 = false;
+  lz4_ctx = NULL;
+  lz4_buffer = NULL;
+#endif
+#ifdef HAVE_LIBZSTD
+  using_zstd = false;
+  zstd_ctx = NULL;
+  zstd_buffer = NULL;
+#endif
+  zstd_table = NULL;
+  bufsize = length;
+  if (bufsize % sizeof(Word_t))
+    bufsize += sizeof(Word_t) - bufsize % sizeof(Word_t);
+  buffer_base = data;
+  buf_used = 0;
+  buffptr.Bptr = buffer_base;
+  beyondbuffer = buffer_base + bufsize;
+  bitptr = 0;
+  partial_word = 0;
+  partial_word_bitptr = -1;
+  reset_counters();
+  fill();
+}
+
+
+
+/// Re-target the stream at another file by name, as if newly constructed
+/// by ibitstream(const char *), but keeping its buffers and any zstd
+/// context.  Any file now open is closed.  Streams that read memory or a
+/// shared descriptor cannot be re-targeted.
+/// \param filename  The file to read.
+void ibitstream::reopen(const char *filename)
+{
+  if (from_memory || pread_fd >= 0)
+    throw "Cannot re-target an ibitstream on memory or a shared descriptor.";
+  close_input();
+#ifdef HAVE_LIBZZIP
+  zfp = zzip_fopen(filename, "rb");
+  if (zfp == NULL)
+#else
+  fp = fopen(filename, "rb");
+  if (fp == NULL)
+#endif
+    throw bad_output_file(filename, "reading");
+
+#if defined(HAVE_LIBLZ4) || defined(HAVE_LIBZSTD)
+  uint32_t magic_bytes = 0;
+#ifdef HAVE_LIBZZIP
+  if (zzip_fread(&magic_bytes, sizeof(Byte_t), 4, zfp) >= 4)
+#else
+  if (fread(&magic_bytes, sizeof(Byte_t), 4, fp) >= 4)
+#endif
+    detect_compression(magic_bytes);
+#ifdef HAVE_LIBZZIP
+  zzip_seek(zfp, 0, SEEK_SET);
+#else
+  fseek(fp, 0, SEEK_SET);
+#endif
+#endif
+  restart();
+}
+
+
+
+/// Re-target the stream at another file descriptor, as if newly
+/// constructed by ibitstream(int), but keeping its buffers.  Any file now
+/// open is closed.
+/// \param fd  The descriptor (the stream takes it over, as fdopen(3) does).
+void ibitstream::reopen(int fd)
+{
+  if (from_memory || pread_fd >= 0)
+    throw "Cannot re-target an ibitstream on memory or a shared descriptor.";
+  close_input();
+  fp = fdopen(fd, "rb");
+  if (fp == NULL) {
+    char *fdname = new char[14];
+    snprintf(fdname, 14, "fd#%i", fd);
+    throw bad_output_file(fdname, "reading");
+  }
+  restart();
+}
+
+
+
+/// Start reading from the beginning of a newly opened input.
+void ibitstream::restart()
+{
+  buf_used = 0;
+  buffptr.Bptr = buffer_base;
+  beyondbuffer = buffer_base + bufsize;
+  bitptr = 0;
+  partial_word = 0;
+  partial_word_bitptr = -1;
+  reset_counters();
+  fill();
+}
+
+
+
 /// Destructor only uses base class destructor.
 ibitstream::~ibitstream()
 {
@@ -486,6 +1437,10 @@ ibitstream::~ibitstream()
     delete [] lz4_buffer;
   lz4_buffer = NULL;
 #endif
+#ifdef HAVE_LIBZSTD
+  delete [] zstd_buffer;
+  zstd_buffer = NULL;
+#endif
 #ifdef DEBUG_READBITS
   print_debug();
 }
@@ -506,7 +1461,8 @@ void ibitstream::print_debug() {
 
 
 /// Return the number of bytes used so far in this stream.
-int ibitstream::get_bytes_used() {
+/// For a stream reading by pread(2), this is the absolute file offset.
+size_t ibitstream::get_bytes_used() {
   return      sizeof(Byte_t)*(buf_used + buffptr.Bptr - beyondbuffer) +
     (bitptr / 8);
 }
@@ -583,6 +1539,78 @@ Word_t ibitstream::readbits(int n_bits)
 
 
 
+/// Skip over data without reading them as bits.  Whole buffers are
+/// passed over by seeking, if the stream allows it, else they are read.
+/// \param n_bits Number of bits to skip.
+void ibitstream::skipbits(size_t n_bits)
+{
+  n_bits += bitptr;   // Count from the start of the current word.
+  size_t nwords = n_bits / Bits_per_word;
+  int rem = n_bits % Bits_per_word;
+
+  // Stay at the end of a word rather than step past it (see next_word()).
+  if (nwords > 0 && rem == 0) {
+    nwords--;
+    rem = Bits_per_word;
+  }
+
+  int base = 0;   // bitptr of a word's first bit: nonzero in a partial word.
+  while (nwords > 0) {
+    size_t words_after = (beyondbuffer - buffptr.Bptr)/sizeof(Word_t) - 1;
+    if (nwords <= words_after) {
+      buffptr.Dptr += nwords;
+      break;
+    }
+    // Step to the first word of the next buffer.
+    nwords -= words_after + 1;
+    size_t nbytes = nwords * sizeof(Word_t);
+    if (nbytes >= bufsize && skip_input(nbytes))
+      nwords = 0;
+    else
+      fill();
+    base = bitptr;
+  }
+  bitptr = base + rem;
+  if (bitptr > Bits_per_word)
+    throw "Out of data in ibitstream";
+}
+
+
+
+/// Advance the input by a number of bytes beyond the current buffer
+/// without reading them, then fill the buffer.
+/// \param nbytes Number of bytes to pass over.
+/// \return Whether the stream could seek (else nothing is done).
+bool ibitstream::skip_input(size_t nbytes)
+{
+  if (partial_word_bitptr >= 0)
+    return false;   // Already at the end of the data.
+#ifdef HAVE_LIBZSTD
+  if (using_zstd && (pread_fd < 0 || zstd_table == NULL))
+    return false;   // Compressed offsets are not raw offsets.
+#endif
+
+  if (pread_fd >= 0) {
+    seek(buf_used + nbytes);
+    return true;
+  }
+#ifdef HAVE_LIBLZ4
+  if (using_lz4)
+    return false;
+#endif
+#ifdef HAVE_LIBZZIP
+  if (zfp)
+    return false;
+#endif
+  if (from_memory || fp == NULL || fseeko(fp, nbytes, SEEK_CUR) != 0)
+    return false;
+  buf_used += nbytes;
+  fill();
+  return true;
+}
+
+
+
 /// Read a null-terminated string of 8-bit characters from the bit stream
 /// \param s     Pointer to the string (must be available memory).
 /// \param count Maximum size of the string.
@@ -661,47 +1689,36 @@ void ibitstream::print() const
 int ibitstream::fill()
 {
   int thisread;
-#ifdef HAVE_LIBZZIP
-  if (zfp) {
-#ifdef HAVE_LIBLZ4
-    if (using_lz4)
-      thisread = zzip_fread(lz4_buffer, sizeof(Byte_t), bufsize, zfp);
-    else
-#endif
-    thisread = zzip_fread(buffer_base, sizeof(Byte_t), bufsize, zfp);
-  } else if (fp) {
+  io_timer timer(timed ? &io_seconds : NULL);
+  refills++;
+#ifdef HAVE_LIBZSTD
+  if (using_zstd) {
+    thisread = fill_zstd();
+  } else
 #endif
+  if (pread_fd >= 0) {
+    thisread = fill_pread();
+  } else if (from_memory) {
+    // The whole stream is in the buffer already.
+    thisread = mem_remaining;
+    mem_remaining = 0;
 #ifdef HAVE_LIBLZ4
-  if (using_lz4)
-    thisread = fread(lz4_buffer, sizeof(Byte_t), bufsize, fp);
-  else
+  } else if (using_lz4) {
+    thisread = fill_lz4();
 #endif
-    thisread = fread(buffer_base, sizeof(Byte_t), bufsize, fp);
-#ifdef HAVE_LIBZZIP
   } else {
-    throw bad_output_file("unknown", "reading");
-  }
-#endif
-#ifdef HAVE_LIBLZ4
-  if (using_lz4) {
-    if (thisread > 0) {
-      size_t to_read = thisread;
-      size_t this_read = bufsize;
-      size_t c = LZ4F_decompress(lz4_ctx, buffer_base, &this_read, lz4_buffer,
-        &to_read, NULL);
-      if (LZ4F_isError(c))
-        throw bad_output_file("unknown",
-          ("LZ4 error: " + string(LZ4F_getErrorName(c))).c_str());
 #ifdef HAVE_LIBZZIP
-      if (zfp)
-        zzip_seek(zfp, (int) to_read - thisread, SEEK_CUR);
-      else
+    if (zfp) {
+      thisread = zzip_fread(buffer_base, sizeof(Byte_t), bufsize, zfp);
+    } else if (fp) {
 #endif
-      fseek(fp, (int) to_read - thisread, SEEK_CUR);
-      thisread = (int) this_read;
+      thisread = fread(buffer_base, sizeof(Byte_t), bufsize, fp);
+#ifdef HAVE_LIBZZIP
+    } else {
+      throw bad_output_file("unknown", "reading");
     }
-  }
 #endif
+  }
 
   // Handle partial words at end by saving them for a future, final call.
   if (thisread % sizeof(Word_t) != 0) {
@@ -718,7 +1735,8 @@ int ibitstream::fill()
   // If no data read, see whether we saved any partial words last time.
   if (thisread == 0) {
     if (partial_word_bitptr >= 0) {
-      buf_used += sizeof(Word_t);
+      // Count only the real bytes, so get_bytes_used() stays exact.
+      buf_used += sizeof(Word_t) - partial_word_bitptr/8;
       memcpy(buffer_base, &partial_word, sizeof(Word_t));
       buffptr.Bptr = buffer_base;
       beyondbuffer = buffer_base + sizeof(Word_t);
@@ -740,3 +1758,196 @@ int ibitstream::fill()
 #endif
   return thisread;
 }
+
+
+
+#ifdef HAVE_LIBLZ4
+/// Fill the read buffer by decompressing an LZ4-compressed file.
+/// A block of LZ4 input seldom decompresses to exactly one buffer, so keep
+/// going until the buffer is full: fill() treats a short buffer (or one
+/// with a partial word) as the end of the stream.
+/// \return Number of bytes put into the buffer.
+int ibitstream::fill_lz4()
+{
+  size_t produced = 0;
+  while (produced < bufsize) {
+    int nread;
+#ifdef HAVE_LIBZZIP
+    if (zfp)
+      nread = zzip_fread(lz4_buffer, sizeof(Byte_t), bufsize, zfp);
+    else
+#endif
+    nread = fread(lz4_buffer, sizeof(Byte_t), bufsize, fp);
+    if (nread <= 0)
+      break;
+
+    size_t to_read = nread;
+    size_t this_read = bufsize - produced;
+    size_t c = LZ4F_decompress(lz4_ctx, buffer_base + produced, &this_read,
+                               lz4_buffer, &to_read, NULL);
+    if (LZ4F_isError(c))
+      throw bad_output_file("unknown",
+        ("LZ4 error: " + string(LZ4F_getErrorName(c))).c_str());
+
+    // Return any unused input to the stream.
+#ifdef HAVE_LIBZZIP
+    if (zfp)
+      zzip_seek(zfp, (int) to_read - nread, SEEK_CUR);
+    else
+#endif
+    fseek(fp, (int) to_read - nread, SEEK_CUR);
+    produced += this_read;
+    if (c == 0)
+      break;      // End of the LZ4 frame.
+  }
+  return (int) produced;
+}
+#endif
+
+
+
+/// Prepare to decompress if the stream starts with the magic number of
+/// a compression format we can read.
+/// \param magic_bytes  The first 4 bytes of the stream (little-endian).
+void ibitstream::detect_compression(uint32_t magic_bytes)
+{
+#ifdef HAVE_LIBLZ4
+  if (magic_bytes == 0x184d2204) {
+    size_t c = LZ4F_createDecompressionContext(&lz4_ctx, LZ4F_VERSION);
+    if (LZ4F_isError(c))
+      throw bad_output_file("unknown",
+        ("LZ4 error: " + string(LZ4F_getErrorName(c))).c_str());
+    using_lz4 = true;
+  }
+#endif
+#ifdef HAVE_LIBZSTD
+  if (magic_bytes == zstd_seek_table::ZSTD_MAGIC)
+    start_zstd();
+#endif
+}
+
+
+
+#ifdef HAVE_LIBZSTD
+/// Create the zstd decompressor and its input buffer.
+void ibitstream::start_zstd()
+{
+  if (zstd_ctx)
+    ZSTD_DCtx_reset(zstd_ctx, ZSTD_reset_session_only);
+  else
+    zstd_ctx = ZSTD_createDCtx();
+  if (zstd_ctx == NULL)
+    throw "Cannot create a zstd decompression context.";
+  if (zstd_buffer == NULL)
+    zstd_buffer = new Byte_t [ZSTD_DStreamInSize()];
+  zstd_in_size = zstd_in_pos = 0;
+  zstd_skip = 0;
+  using_zstd = true;
+}
+
+
+
+/// Fill the read buffer by decompressing a zstd-compressed file, from
+/// whichever source the stream reads (FILE, ZZIP_FILE, or pread(2)).
+/// After a seek(), the decompressed bytes before the target are dropped.
+/// \return Number of bytes put into the buffer.
+int ibitstream::fill_zstd()
+{
+  size_t produced = 0;
+  while (produced < bufsize) {
+    if (zstd_in_pos >= zstd_in_size) {
+      const size_t insize = ZSTD_DStreamInSize();
+      ssize_t nread;
+      if (pread_fd >= 0) {
+        do {
+          nread = pread(pread_fd, zstd_buffer, insize, pread_pos);
+        } while (nread < 0 && errno == EINTR);
+        if (nread < 0)
+          throw "Failed to pread in ibitstream";
+        pread_pos += nread;
+      } else {
+#ifdef HAVE_LIBZZIP
+        if (zfp)
+          nread = zzip_fread(zstd_buffer, sizeof(Byte_t), insize, zfp);
+        else
+#endif
+        nread = fread(zstd_buffer, sizeof(Byte_t), insize, fp);
+      }
+      if (nread <= 0)
+        break;
+      zstd_in_size = nread;
+      zstd_in_pos = 0;
+    }
+
+    ZSTD_inBuffer in = {zstd_buffer, zstd_in_size, zstd_in_pos};
+    ZSTD_outBuffer out = {buffer_base + produced, bufsize - produced, 0};
+    size_t c = ZSTD_decompressStream(zstd_ctx, &out, &in);
+    if (ZSTD_isError(c))
+      throw bad_output_file("unknown",
+        ("zstd error: " + string(ZSTD_getErrorName(c))).c_str());
+    zstd_in_pos = in.pos;
+
+    if (zstd_skip > 0) {
+      size_t drop = zstd_skip < out.pos ? zstd_skip : out.pos;
+      memmove(buffer_base + produced, buffer_base + produced + drop,
+              out.pos - drop);
+      out.pos -= drop;
+      zstd_skip -= drop;
+    }
+    produced += out.pos;
+  }
+  return (int) produced;
+}
+#endif
+
+
+
+/// Fill the read buffer from the shared descriptor (see ibitstream(int,
+/// off_t,int)), retrying short reads until the buffer is full or at EOF.
+/// \return  Bytes read from disk.
+int ibitstream::fill_pread()
+{
+  size_t nread = 0;
+  while (nread < bufsize) {
+    ssize_t n = pread(pread_fd, buffer_base+nread, bufsize-nread, pread_pos);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      throw "Failed to pread in ibitstream";
+    if (n == 0)
+      break;
+    nread += n;
+    pread_pos += n;
+  }
+  return int(nread);
+}
+
+
+
+/// Move a stream reading by pread(2) to a new byte offset and refill it.
+/// Streams opened any other way cannot seek.
+/// \param offset  Byte offset in the file where reading resumes.
+void ibitstream::seek(off_t offset)
+{
+  if (pread_fd < 0)
+    throw "ibitstream::seek() requires a stream that reads by pread.";
+
+  pread_pos = offset;
+#ifdef HAVE_LIBZSTD
+  if (using_zstd) {
+    // Restart decompression at the frame holding the offset.
+    int frame = zstd_table->find_frame(offset);
+    if (frame < 0)
+      frame = zstd_table->n_frames;  // At or beyond the end: no data.
+    pread_pos = zstd_table->c_offset[frame];
+    zstd_skip = offset - zstd_table->d_offset[frame];
+    zstd_in_size = zstd_in_pos = 0;
+    ZSTD_DCtx_reset(zstd_ctx, ZSTD_reset_session_only);
+  }
+#endif
+  buf_used = offset;
+  partial_word = 0;
+  partial_word_bitptr = -1;
+  reset_counters();
+  fill();
+}
@@ -25,6 +25,7 @@
 
 #include <stdint.h>
 #include <cstdio>
+#include <sys/types.h>
 
 #ifdef HAVE_LIBZZIP
 #include <zzip/zzip.h>
@@ -32,6 +33,11 @@
 
 #ifdef HAVE_LIBLZ4
 #include <lz4frame.h>
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
 #endif
 
 #include "bit_constants.h"
@@ -49,9 +55,16 @@ public:
   virtual bool is_open() const = 0;
   virtual void setupstream();
   virtual void windup()=0;
-  virtual int get_bytes_used(); 
+  virtual size_t get_bytes_used(); 
   int get_bitptr(); 
   virtual void print() const = 0;  ///< Print properties of stream (pure virt)
+  /// Time the I/O of each buffer (see get_io_seconds()).
+  void set_timing(bool t=true) {timed=t;}
+  /// Number of times the buffer was filled (or flushed).
+  size_t get_refills() const {return refills;}
+  /// Time spent filling (or flushing) the buffer, if set_timing() was used.
+  double get_io_seconds() const {return io_seconds;}
+  void reset_counters() {refills=0; io_seconds=0.0;} ///< Zero the counters.
 
 protected:
   static const int Bits_per_word = 8*sizeof(Word_t); ///< Bits per buffer word.
@@ -65,6 +78,9 @@ protected:
     Word_t *Dptr;         ///< Pointer to the current word (as Word_t *). 
   } buffptr;              ///< Pointer to the current word.
   int bitptr;             ///< Pointer to the current bits.
+  size_t refills;         ///< Number of buffer fills (or flushes).
+  double io_seconds;      ///< Time spent in buffer fills (or flushes).
+  bool timed;             ///< Whether to time buffer fills (or flushes).
   /// Make *Dptr always point to same place as Bptr.
   /// But where Bptr is a (Byte_t *), *Dptr is a (Word_t *)
 
@@ -75,12 +91,66 @@ public:
 
 
 
+/// The frame table of a zstd file in the seekable format (the format of
+/// zstd's contrib/seekable_format): independent frames, followed by a
+/// skippable frame listing each frame's compressed and raw sizes.
+class zstd_seek_table {
+public:
+  zstd_seek_table(int fd);
+  ~zstd_seek_table();
+  int find_frame(size_t offset) const;
+
+  int n_frames;           ///< Number of data frames.
+  off_t *c_offset;        ///< File offset of each frame (n_frames+1 entries).
+  size_t *d_offset;       ///< Raw offset of each frame (n_frames+1 entries).
+
+  static const uint32_t ZSTD_MAGIC = 0xfd2fb528;    ///< Starts zstd frames.
+  static const uint32_t SKIPPABLE_MAGIC = 0x184d2a5e; ///< Seek table frame.
+  static const uint32_t SEEKABLE_MAGIC = 0x8f92eab1;  ///< Ends seek table.
+};
+
+
+
 class obitstream : public bitstream {
 private:
   // No private attributes.
 
 protected:
   FILE *fp;               ///< The I/O stream.
+  off_t file_start;       ///< File offset of the stream start, or -1 if the
+                          ///< file cannot be patched in place.
+  bool holding;           ///< Keep full buffers in memory (see hold()).
+  Byte_t *held;           ///< Output held back by hold()
+  size_t held_size;       ///< Bytes used in held
+  size_t held_alloc;      ///< Allocated size of held (bytes)
+#ifdef HAVE_LIBLZ4
+  LZ4F_compressionContext_t lz4_ctx;  ///< LZ4 compression context
+  Byte_t *lz4_buffer;     ///< Point to LZ4 compressed output buffer
+  size_t lz4_bufsize;     ///< Size of lz4_buffer (bytes)
+  bool using_lz4;         ///< Is the output LZ4 compressed?
+  bool lz4_threaded;      ///< Does a helper thread run the LZ4 compressor?
+  Byte_t *spare_buffer;   ///< Second I/O buffer, filled during compression
+  Byte_t *lz4_pending;    ///< Buffer handed to the helper thread, or NULL
+  size_t lz4_pending_size;///< Bytes used in lz4_pending
+  bool lz4_finish;        ///< Tell the helper thread to exit
+  size_t lz4_error;       ///< First lz4_write() error seen by the helper thread
+  int lz4_errno;          ///< errno for lz4_error (if LZ4_WRITE_FAILED)
+  pthread_t lz4_thread;   ///< The helper thread
+  pthread_mutex_t lz4_mutex; ///< Guards the lz4_pending hand-off
+  pthread_cond_t lz4_cond;   ///< Signals a change in lz4_pending
+#endif
+#ifdef HAVE_LIBZSTD
+  ZSTD_CCtx *zstd_ctx;    ///< zstd compression context
+  Byte_t *zstd_buffer;    ///< Point to zstd compressed output buffer
+  size_t zstd_bufsize;    ///< Size of zstd_buffer (bytes)
+  bool using_zstd;        ///< Is the output zstd compressed?
+  size_t zstd_frame_size; ///< Raw bytes per seekable zstd frame
+  size_t zstd_frame_in;   ///< Raw bytes in the current frame so far
+  size_t zstd_frame_out;  ///< Compressed bytes of the current frame so far
+  uint32_t *zstd_frames;  ///< Seek table (compressed, raw size per frame)
+  int zstd_nframes;       ///< Frames in the seek table
+  int zstd_nalloc;        ///< Allocated size of zstd_frames (in frames)
+#endif
 
 public:
   obitstream(FILE *file, int buffersize=DEFAULT_IOBUFFER_SIZE);
@@ -88,6 +158,7 @@ public:
 	     int buffersize=DEFAULT_IOBUFFER_SIZE);
   ~obitstream();
 
+  void reopen(const char *filename);
   void writebits(uint32_t data, int nbits);
   void writestring(const char *str, bool write_trailing_null=false);
   template <typename T> void writeword(const T data);
@@ -97,6 +168,32 @@ public:
   virtual bool is_open() const;
   void windup();
   void flush(bool flush_trailing_bits);
+  size_t get_bits_used() const;
+  bool can_patch() const;
+  void hold();
+  void release();
+  void patch(size_t offset, uint64_t value, int nbytes);
+  void use_lz4(bool background_thread=false);
+  void use_zstd(int level=DEFAULT_ZSTD_LEVEL, int nworkers=0,
+                size_t frame_size=DEFAULT_ZSTD_FRAME_SIZE);
+
+  enum {DEFAULT_ZSTD_LEVEL=3};                   ///< Default zstd level.
+  enum {DEFAULT_ZSTD_FRAME_SIZE=8*1024*1024};    ///< Default frame size.
+
+private:
+#ifdef HAVE_LIBZSTD
+  void zstd_write(const Byte_t *data, size_t nbytes);
+  void zstd_compress(const Byte_t *data, size_t nbytes, ZSTD_EndDirective op);
+  void zstd_end();
+#endif
+#ifdef HAVE_LIBLZ4
+  enum {LZ4_WRITE_FAILED=1}; ///< lz4_write() could not write the output.
+  size_t lz4_write(const Byte_t *data, size_t nbytes);
+  void lz4_raise(size_t err);
+  void lz4_handoff(size_t nbytes);
+  void lz4_end();
+  static void *lz4_worker(void *arg);
+#endif
 };
 
 
@@ -115,11 +212,24 @@ protected:
   ZZIP_FILE *zfp;               ///< The I/O stream.
 #endif
   FILE *fp;
+  int pread_fd;           ///< Shared descriptor read by pread(2), or -1.
+  off_t pread_pos;        ///< File offset of the next pread(2).
+  size_t mem_remaining;   ///< Bytes of an in-memory stream not yet filled.
+  bool from_memory;       ///< Stream reads an adopted memory buffer.
 #ifdef HAVE_LIBLZ4
   LZ4F_decompressionContext_t lz4_ctx;  ///< LZ4 decompression context
   Byte_t *lz4_buffer;     ///< Point to LZ4 decompression buffer
   bool using_lz4;         ///< Is the file LZ4 compressed?
 #endif
+#ifdef HAVE_LIBZSTD
+  ZSTD_DCtx *zstd_ctx;    ///< zstd decompression context
+  Byte_t *zstd_buffer;    ///< Point to zstd compressed input buffer
+  size_t zstd_in_size;    ///< Bytes of compressed input in zstd_buffer
+  size_t zstd_in_pos;     ///< Bytes of zstd_buffer already decompressed
+  size_t zstd_skip;       ///< Raw bytes still to discard after a seek
+  bool using_zstd;        ///< Is the file zstd compressed?
+#endif
+  const zstd_seek_table *zstd_table; ///< Frame table for seeking, or NULL.
 
 public:
   ibitstream(FILE *file, int buffersize=DEFAULT_IOBUFFER_SIZE);
@@ -129,23 +239,42 @@ public:
   ibitstream(const char *filename, 
 	     int buffersize=DEFAULT_IOBUFFER_SIZE);
   ibitstream(int fd, int buffersize=DEFAULT_IOBUFFER_SIZE);
+  ibitstream(int fd, off_t offset, int buffersize,
+             const zstd_seek_table *table=NULL);
+  ibitstream(Byte_t *data, size_t length);
   ~ibitstream();
 
+  void reopen(const char *filename);
+  void reopen(int fd);
   virtual void close();
+  void close_input();
   virtual bool is_open() const;
   void setupstream();
   void windup();
   virtual void print() const;
-  virtual int get_bytes_used(); 
+  virtual size_t get_bytes_used(); 
   Word_t readbits(int nbits);
   int32_t readbits_int(int nbits);
   Word_t read_unary(); 
   int readstring(char *s, int count=-1);
+  void skipbits(size_t nbits);
+  void seek(off_t offset);
   //int get_bits_used() { return bitptr + Bits_per_word*buf_used;}
 
 private:
+  void restart();
   void next_word();
   int fill();
+  int fill_pread();
+  bool skip_input(size_t nbytes);
+#ifdef HAVE_LIBLZ4
+  int fill_lz4();
+#endif
+#ifdef HAVE_LIBZSTD
+  int fill_zstd();
+  void start_zstd();
+#endif
+  void detect_compression(uint32_t magic_bytes);
 
   Word_t partial_word;
   int partial_word_bitptr;
@@ -21,7 +21,6 @@
 
 
 #include "slim.h"
-#include "crc.h"   // for CRC32 table 
 #include <cstring> // for memcpy
 
 
@@ -40,6 +39,8 @@ raw_section::raw_section(enum section_mode_t mode_in) :
 mode(mode_in) {
   private_buf_size = buf_size = 0;
   private_buf = buf = NULL;
+  max_size = (mode == SECTION_COMPRESS_MODE) ? 
+    size_t(MAX_SECTION_LENGTH) : size_t(MAX_SECTION_LENGTH_LIMIT);
 
   n_chan_alloc = 10;
   n_chan_used = 0;
@@ -162,8 +163,8 @@ size_t raw_section::resize(size_t size) {
   }
 
   // Increasing the size.
-  if (size > MAX_SECTION_LENGTH)
-    throw "Cannot resize buffer beyond MAX_SECTION_LENGTH";
+  if (size > max_size)
+    throw "Cannot resize buffer beyond its maximum size";
 
   // Make a new buffer and copy the old to it (up to the old size).
   Buffer_t *new_buf = new Buffer_t[size + MAX_GHOST_BYTES];
@@ -179,6 +180,16 @@ size_t raw_section::resize(size_t size) {
 
 
 
+/// Set the largest size that resize() allows.
+/// \param size  The limit (bytes), at most MAX_SECTION_LENGTH_LIMIT.
+void raw_section::set_max_size(size_t size) {
+  if (size > MAX_SECTION_LENGTH_LIMIT)
+    throw "Cannot allow raw sections beyond MAX_SECTION_LENGTH_LIMIT";
+  max_size = size;
+}
+
+
+
 /// Switch to using a buffer from user space.
 /// This only makes sense if the section is for compression, so assert
 /// that mode.  Also, a section to be written to disk can safely
@@ -230,14 +241,7 @@ unsigned long raw_section::crc(size_t length) const {
   if (length <= 0)
     length = buf_size;
 
-  const unsigned char *s = buf;
-  register unsigned long c = 0xffffffffL;
-
-  if (length) do {
-    c = slim_crc_32_table[((int)c ^ (*s++)) & 0xff] ^ (c >> 8);
-  } while (--length);
-
-  return c ^ 0xffffffffL;       /* (instead of ~c for 64-bit machines) */
+  return slim_crc32(0, buf, length);
 }
   
 
@@ -51,21 +51,7 @@ int main(int argc, char *argv[])
   if (argc <= 0) {
     ctrl->usage();
   } else {
-    while (argc--) {
-      try {
-        ctrl->handle_one_file(*argv++);
-
-      } catch (const bad_file &bf) {
-        // Handle errors specific to this one file with a message to stderr.
-        bf.mesg();
-        n_bad_files++;
-
-      } catch (char const *error) {
-        // In general error case, abort.
-        cerr << "Caught error: " << error << "\n";
-        exit(1);
-      }
-    }
+    n_bad_files = ctrl->handle_files(argc, argv);
   }
 
   delete ctrl;
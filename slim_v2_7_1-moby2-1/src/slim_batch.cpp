@@ -0,0 +1,503 @@
+/// \file slim_batch.cpp
+/// Implements the class slim_batch_t, which reads many (typically small)
+/// slim files into memory concurrently and hands each one to a decoder as
+/// soon as its data have arrived.
+
+//  Copyright (C) 2008, 2009 Joseph Fowler
+//
+//  This file is part of slim, a compression package for science data.
+//
+//  Slim is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Slim is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with slim.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "slim.h"
+#include "bitstream.h"
+
+/// LZ4 frames start with these 4 bytes (little-endian).
+static const uint32_t LZ4_MAGIC = 0x184d2204;
+
+/// Largest single read request (io_uring lengths are 32-bit).
+static const size_t MAX_READ_REQUEST = 1<<30;
+
+
+/// The read state of one file in a batch.
+struct slim_batch_slot_t {
+  const char *name;      ///< Path of the file.
+  int fd;                ///< Descriptor while the file is open, else -1.
+  unsigned char *data;   ///< The file contents (padded to whole words).
+  size_t length;         ///< Size of the file (bytes).
+  size_t done;           ///< Bytes read so far.
+  int error;             ///< errno of a failed open/stat/read, or 0.
+#ifdef HAVE_LIBURING
+  struct statx stx;      ///< File status, from an io_uring statx.
+  int ops_pending;       ///< io_uring open+statx requests not yet done.
+#endif
+};
+
+
+/// The reader threads' shared state.
+struct slim_batch_pool_t {
+  pthread_mutex_t lock;  ///< Guards the batch's queue counters.
+  pthread_cond_t file_ready;  ///< Signalled when a file joins ready[].
+  pthread_cond_t room;   ///< Signalled when next() frees a slot in depth.
+  pthread_t *threads;    ///< The reader threads.
+  int nthreads;          ///< Number of reader threads.
+  bool stopping;         ///< Set by the destructor to end the threads.
+};
+
+
+#ifdef HAVE_LIBURING
+/// Operations we ask io_uring to do for a file.
+enum slim_batch_op_t {
+  BATCH_OP_OPEN,         ///< openat(2)
+  BATCH_OP_STATX,        ///< statx(2)
+  BATCH_OP_READ,         ///< read(2)
+};
+
+/// The io_uring state.
+struct slim_batch_ring_t {
+  struct io_uring ring;  ///< The submission and completion queues.
+};
+
+/// Tag each io_uring request with file number and operation.
+static inline void *ring_tag(int ifile, slim_batch_op_t op) {
+  return (void *)(intptr_t)(4*ifile + op);
+}
+#endif
+
+
+/// Allocate a zeroed buffer big enough for an ibitstream to adopt.
+/// \param length  Size of the file (bytes).
+/// \return The buffer, rounded up to a whole number of words.
+static unsigned char *new_slim_buffer(size_t length) {
+  size_t n = length + sizeof(Word_t) - length % sizeof(Word_t);
+  unsigned char *data = new unsigned char[n];
+  memset(data + n - sizeof(Word_t), 0, sizeof(Word_t));
+  return data;
+}
+
+
+
+// ----------------------------------------------------------------------
+/// \class slim_batch_t
+/// A batch of slim files to be read into memory ahead of decoding.
+/// For many small files, the cost of expanding them one at a time is
+/// dominated by the serial open/read latency of each file.  This class
+/// keeps up to depth files in flight at once, using io_uring when the
+/// library was built with it (and the kernel allows it), or else a small
+/// pool of threads doing open and pread.  Each call to next() returns an
+/// expander for whichever file finished reading first, decoding straight
+/// from memory.  Files are returned in completion order, not list order.
+// ----------------------------------------------------------------------
+
+//----------------------------------------------------------------------
+/// Constructor.  Reading starts at once.
+/// \param n        Number of files.
+/// \param names    Paths of the files.  Must outlive this object.
+/// \param depth_in Maximum number of files to hold (read or being read)
+///                 that next() has not yet returned.  Bounds memory use.
+/// \param nthreads Number of reader threads, if io_uring is not in use.
+//----------------------------------------------------------------------
+slim_batch_t::slim_batch_t(int n, const char * const *names,
+                           int depth_in, int nthreads) {
+  nfiles = n;
+  depth = depth_in > 0 ? depth_in : 1;
+  next_to_issue = 0;
+  outstanding = 0;
+  ready_head = ready_tail = 0;
+  ring = NULL;
+  pool = NULL;
+
+  slots = new slim_batch_slot_t[nfiles];
+  ready = new int[nfiles];
+  for (int i=0; i<nfiles; i++) {
+    slots[i].name = names[i];
+    slots[i].fd = -1;
+    slots[i].data = NULL;
+    slots[i].length = slots[i].done = 0;
+    slots[i].error = 0;
+  }
+
+  if (!start_ring())
+    start_pool(nthreads);
+}
+
+
+
+//----------------------------------------------------------------------
+/// Destructor.  Stops any reads and frees all files not yet returned.
+//----------------------------------------------------------------------
+slim_batch_t::~slim_batch_t() {
+  if (pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->room);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i=0; i<pool->nthreads; i++)
+      pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->file_ready);
+    pthread_cond_destroy(&pool->room);
+    delete [] pool->threads;
+    delete pool;
+  }
+
+#ifdef HAVE_LIBURING
+  if (ring) {
+    // Wait out requests still in flight: they may write into our buffers.
+    next_to_issue = nfiles;
+    while (outstanding > ready_tail - ready_head)
+      wait_ring();
+    io_uring_queue_exit(&ring->ring);
+    delete ring;
+  }
+#endif
+
+  for (int i=0; i<nfiles; i++) {
+    if (slots[i].fd >= 0)
+      close(slots[i].fd);
+    delete [] slots[i].data;
+  }
+  delete [] slots;
+  delete [] ready;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Return the next file whose data are in memory, waiting if needed.
+/// \param ifile  If not NULL, receives the file's index in the batch.
+/// \return An expander reading the file from memory, which the caller
+///  must delete; or NULL when all files have been returned.
+/// Throws bad_file if this file could not be read or is not a slim file.
+/// Calling next() again moves on to the following file.
+//----------------------------------------------------------------------
+slim_expander_t *slim_batch_t::next(int *ifile) {
+  int i = pool ? wait_pool() : wait_ring();
+  if (ifile)
+    *ifile = i;
+  if (i < 0)
+    return NULL;
+
+  slim_batch_slot_t *slot = &slots[i];
+  if (slot->error) {
+    errno = slot->error;
+    throw bad_output_file(slot->name, "reading");
+  }
+
+  // The expander takes ownership of the buffer.
+  unsigned char *data = slot->data;
+  slot->data = NULL;
+
+  // LZ4- or zstd-wrapped files must be decompressed on the way in, so
+  // those are re-opened by name.
+  uint32_t magic = 0;
+  if (slot->length >= 4)
+    memcpy(&magic, data, 4);
+  try {
+    if (magic == LZ4_MAGIC || magic == zstd_seek_table::ZSTD_MAGIC) {
+      delete [] data;
+      return new slim_expander_t(slot->name);
+    }
+    return new slim_expander_t(slot->name, data, slot->length);
+  } catch (const char *e) {
+    throw bad_file(slot->name, ": not a slim file.");
+  }
+}
+
+
+
+//----------------------------------------------------------------------
+/// Read one file completely: open, size, read, close (blocking).
+/// Used by the reader threads.  Errors are stored in the slot.
+/// \param slot  The file to read.
+//----------------------------------------------------------------------
+void slim_batch_t::load_file(slim_batch_slot_t *slot) {
+  int fd = open(slot->name, O_RDONLY);
+  if (fd < 0) {
+    slot->error = errno;
+    return;
+  }
+
+  struct stat status;
+  if (fstat(fd, &status)) {
+    slot->error = errno;
+    close(fd);
+    return;
+  }
+  slot->length = status.st_size;
+  slot->data = new_slim_buffer(slot->length);
+
+  while (slot->done < slot->length) {
+    ssize_t n = pread(fd, slot->data + slot->done,
+                      slot->length - slot->done, slot->done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      slot->error = errno;
+      break;
+    }
+    if (n == 0) {
+      slot->length = slot->done;  // File shrank while we read it.
+      break;
+    }
+    slot->done += n;
+  }
+  close(fd);
+}
+
+
+
+//----------------------------------------------------------------------
+/// Start the reader threads.
+/// \param nthreads  Number of threads.
+//----------------------------------------------------------------------
+void slim_batch_t::start_pool(int nthreads) {
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > nfiles)
+    nthreads = nfiles;
+
+  pool = new slim_batch_pool_t;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->file_ready, NULL);
+  pthread_cond_init(&pool->room, NULL);
+  pool->stopping = false;
+  pool->nthreads = 0;
+  pool->threads = new pthread_t[nthreads > 0 ? nthreads : 1];
+  for (int i=0; i<nthreads; i++)
+    if (pthread_create(&pool->threads[pool->nthreads], NULL,
+                       pool_worker, this) == 0)
+      pool->nthreads++;
+
+  // With no threads at all, next() would wait forever.
+  if (pool->nthreads == 0 && nfiles > 0)
+    throw "slim_batch_t could not start any reader threads.";
+}
+
+
+
+//----------------------------------------------------------------------
+/// Body of each reader thread: read files in list order, but never hold
+/// more than depth files that next() has not yet returned.
+/// \param batch  The slim_batch_t (as void *, for pthread_create).
+/// \return NULL.
+//----------------------------------------------------------------------
+void *slim_batch_t::pool_worker(void *batch) {
+  slim_batch_t *b = static_cast<slim_batch_t *>(batch);
+  slim_batch_pool_t *pool = b->pool;
+
+  pthread_mutex_lock(&pool->lock);
+  while (1) {
+    while (!pool->stopping && b->next_to_issue < b->nfiles &&
+           b->outstanding >= b->depth)
+      pthread_cond_wait(&pool->room, &pool->lock);
+    if (pool->stopping || b->next_to_issue >= b->nfiles)
+      break;
+    int i = b->next_to_issue++;
+    b->outstanding++;
+    pthread_mutex_unlock(&pool->lock);
+
+    b->load_file(&b->slots[i]);
+
+    pthread_mutex_lock(&pool->lock);
+    b->ready[b->ready_tail++] = i;
+    pthread_cond_signal(&pool->file_ready);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Wait for the reader threads to finish the next file.
+/// \return Index of the file, or -1 if all have been returned.
+//----------------------------------------------------------------------
+int slim_batch_t::wait_pool() {
+  pthread_mutex_lock(&pool->lock);
+  while (ready_head == ready_tail && ready_head < nfiles)
+    pthread_cond_wait(&pool->file_ready, &pool->lock);
+
+  int i = -1;
+  if (ready_head < nfiles) {
+    i = ready[ready_head++];
+    outstanding--;
+    pthread_cond_signal(&pool->room);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return i;
+}
+
+
+
+#ifndef HAVE_LIBURING
+
+/// Without io_uring support, always use the reader threads.
+bool slim_batch_t::start_ring() {
+  return false;
+}
+
+/// Without io_uring support, this is never called.
+int slim_batch_t::wait_ring() {
+  throw "slim_batch_t: io_uring support was not built.";
+}
+
+#else
+
+//----------------------------------------------------------------------
+/// Set up io_uring, if the kernel allows it.
+/// \return Whether io_uring is ready for use.
+//----------------------------------------------------------------------
+bool slim_batch_t::start_ring() {
+  ring = new slim_batch_ring_t;
+  // Each file in flight can have at most two requests queued at once.
+  if (io_uring_queue_init(2*depth, &ring->ring, 0) < 0) {
+    delete ring;
+    ring = NULL;
+    return false;
+  }
+  return true;
+}
+
+
+
+/// Get a submission queue entry, submitting queued ones to make room.
+static struct io_uring_sqe *get_sqe(struct io_uring *ring) {
+  struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+  if (sqe == NULL) {
+    io_uring_submit(ring);
+    sqe = io_uring_get_sqe(ring);
+  }
+  return sqe;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Keep up to depth files in flight on the ring, and process completions
+/// until some file has been read completely.
+/// \return Index of the file, or -1 if all have been returned.
+//----------------------------------------------------------------------
+int slim_batch_t::wait_ring() {
+  struct io_uring *r = &ring->ring;
+
+  while (ready_head == ready_tail) {
+    if (ready_head >= nfiles)
+      return -1;
+
+    // Open and stat more files, up to the depth limit.
+    while (next_to_issue < nfiles && outstanding < depth) {
+      int i = next_to_issue++;
+      slim_batch_slot_t *slot = &slots[i];
+      outstanding++;
+      slot->ops_pending = 2;
+
+      struct io_uring_sqe *sqe = get_sqe(r);
+      io_uring_prep_openat(sqe, AT_FDCWD, slot->name, O_RDONLY, 0);
+      io_uring_sqe_set_data(sqe, ring_tag(i, BATCH_OP_OPEN));
+
+      sqe = get_sqe(r);
+      io_uring_prep_statx(sqe, AT_FDCWD, slot->name, 0, STATX_SIZE,
+                          &slot->stx);
+      io_uring_sqe_set_data(sqe, ring_tag(i, BATCH_OP_STATX));
+    }
+    io_uring_submit(r);
+
+    struct io_uring_cqe *cqe;
+    int ret = io_uring_wait_cqe(r, &cqe);
+    if (ret == -EINTR)
+      continue;
+    if (ret < 0)
+      throw "slim_batch_t: io_uring_wait_cqe failed.";
+
+    intptr_t tag = (intptr_t)io_uring_cqe_get_data(cqe);
+    int res = cqe->res;
+    io_uring_cqe_seen(r, cqe);
+    int i = tag/4;
+    slim_batch_slot_t *slot = &slots[i];
+    bool finished = false;
+
+    switch (tag%4) {
+    case BATCH_OP_OPEN:
+      if (res < 0)
+        slot->error = -res;
+      else
+        slot->fd = res;
+      break;
+
+    case BATCH_OP_STATX:
+      if (res < 0)
+        slot->error = -res;
+      else
+        slot->length = slot->stx.stx_size;
+      break;
+
+    case BATCH_OP_READ:
+      if (res < 0) {
+        slot->error = -res;
+        finished = true;
+      } else if (res == 0) {
+        slot->length = slot->done;  // File shrank while we read it.
+        finished = true;
+      } else {
+        slot->done += res;
+        finished = (slot->done >= slot->length);
+      }
+      break;
+    }
+
+    // Once open and statx are both done, start reading.
+    if (tag%4 != BATCH_OP_READ && --slot->ops_pending == 0) {
+      if (slot->error)
+        finished = true;
+      else {
+        slot->data = new_slim_buffer(slot->length);
+        finished = (slot->length == 0);
+      }
+    }
+
+    if (finished) {
+      if (slot->fd >= 0)
+        close(slot->fd);
+      slot->fd = -1;
+      ready[ready_tail++] = i;
+    } else if (slot->data && slot->ops_pending == 0) {
+      size_t request = slot->length - slot->done;
+      if (request > MAX_READ_REQUEST)
+        request = MAX_READ_REQUEST;
+      struct io_uring_sqe *sqe = get_sqe(r);
+      io_uring_prep_read(sqe, slot->fd, slot->data + slot->done,
+                         request, slot->done);
+      io_uring_sqe_set_data(sqe, ring_tag(i, BATCH_OP_READ));
+    }
+  }
+
+  outstanding--;
+  return ready[ready_head++];
+}
+
+#endif  // #ifndef HAVE_LIBURING
@@ -28,6 +28,72 @@
 #include "slim.h"
 #include "bitstream.h"
 
+// Bit rotation and the search for constant low bits work on 16 bytes at a
+// time with SSE2 where we have it (all x86-64).
+#if defined(__SSE2__) && defined(__GNUC__)
+#define SLIM_CHANNEL_SSE2
+#include <emmintrin.h>
+#endif
+
+
+
+/// Rotate each word of an array right by r bits.
+/// \param out   The result (may be the same array as data).
+/// \param data  The array.
+/// \param n     Number of words.
+/// \param r     Bits to rotate by (0 < r < 32).
+static void rotate_right(uint32_t *out, const uint32_t *data, int n, int r) {
+  int i=0;
+#ifdef SLIM_CHANNEL_SSE2
+  const __m128i right = _mm_cvtsi32_si128(r);
+  const __m128i left = _mm_cvtsi32_si128(32-r);
+  for (; i+4 <= n; i+=4) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data+i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out+i), _mm_or_si128(_mm_srl_epi32(v, right),
+                                     _mm_sll_epi32(v, left)));
+  }
+#endif
+  for (; i<n; i++)
+    out[i] = (data[i]>>r) | (data[i]<<(32-r));
+}
+
+/// \overload
+static void rotate_right(uint16_t *out, const uint16_t *data, int n, int r) {
+  int i=0;
+#ifdef SLIM_CHANNEL_SSE2
+  const __m128i right = _mm_cvtsi32_si128(r);
+  const __m128i left = _mm_cvtsi32_si128(16-r);
+  for (; i+8 <= n; i+=8) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data+i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out+i), _mm_or_si128(_mm_srl_epi16(v, right),
+                                     _mm_sll_epi16(v, left)));
+  }
+#endif
+  for (; i<n; i++)
+    out[i] = uint16_t((data[i]>>r) | (data[i]<<(16-r)));
+}
+
+/// \overload
+static void rotate_right(uint8_t *out, const uint8_t *data, int n, int r) {
+  int i=0;
+#ifdef SLIM_CHANNEL_SSE2
+  // SSE2 has no byte shifts: shift 16-bit lanes, and mask off the bits
+  // that crossed from the neighboring byte.
+  const __m128i right = _mm_cvtsi32_si128(r);
+  const __m128i left = _mm_cvtsi32_si128(8-r);
+  const __m128i low_mask = _mm_set1_epi8(char(0xff >> r));
+  const __m128i high_mask = _mm_set1_epi8(char(0xff << (8-r)));
+  for (; i+16 <= n; i+=16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data+i));
+    __m128i lo = _mm_and_si128(_mm_srl_epi16(v, right), low_mask);
+    __m128i hi = _mm_and_si128(_mm_sll_epi16(v, left), high_mask);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out+i), _mm_or_si128(lo, hi));
+  }
+#endif
+  for (; i<n; i++)
+    out[i] = uint8_t((data[i]>>r) | (data[i]<<(8-r)));
+}
+
 // ----------------------------------------------------------------------
 /// \class slim_channel_array
 /// Container for all slim_channel objects in a file
@@ -98,6 +164,26 @@ void slim_channel_array::push(slim_channel *c, size_t frame_offset) {
 
 
 
+/// Delete all channels past the first n, shortening the list.
+/// \param n  The number of channels to keep.
+void slim_channel_array::truncate(int n) {
+  if (n <= 0) {
+    clear();
+    return;
+  }
+  for (int i=n; i<num_chan; i++) {
+    delete chan_array[i];
+    chan_array[i] = NULL;
+    offsets_in_frame[i] = 0;
+  }
+  if (n < num_chan) {
+    num_chan = n;
+    chan_array[n-1]->next_chan = chan_array[0];
+  }
+}
+
+
+
 /// Implement a version of realloc for the arrays we keep.
 /// Copies all existing data to the minimum of the new size and num_chan.
 /// \param n The desired size of the arrays. 
@@ -207,6 +293,11 @@ slim_channel_encode::slim_channel_encode(int reps, int size,
   ndata_sampled = 0;
   enc = NULL;
   usual_encoder = NULL;
+  spare_encoder = NULL;
+  spare_is_constant = false;
+  n_last_params = 0;
+  scratch = NULL;
+  scratch_size = 0;
 }
 
 
@@ -217,6 +308,8 @@ slim_channel_encode::slim_channel_encode(int reps, int size,
 slim_channel_encode::~slim_channel_encode() {
   delete enc;
   delete usual_encoder;
+  delete spare_encoder;
+  delete [] scratch;
 }
 
 
@@ -232,6 +325,72 @@ void slim_channel_encode::reset_previous() {
 
 
 
+//----------------------------------------------------------------------
+/// Tell the encoder where this channel's data lie in later frames of
+/// the section.  A rotating channel encodes from a rotated copy of each
+/// frame, so its encoder may not look ahead.
+/// \param stride  Bytes from one frame to the next.
+/// \param end     End of the last whole frame in the section.
+//----------------------------------------------------------------------
+void slim_channel_encode::set_lookahead(size_t stride, const void *end) {
+  if (enc)
+    enc->set_lookahead(bit_rotation ? 0 : stride, end);
+}
+
+
+
+//----------------------------------------------------------------------
+/// Have the encoder prefer its previous parameters when they serve as
+/// well as new ones, so that sections can share them (XFLAG_SAME).
+/// \param r  Whether to prefer the previous parameters.
+//----------------------------------------------------------------------
+void slim_channel_encode::set_reuse_params(bool r) {
+  if (enc)
+    enc->set_reuse_params(r);
+  if (usual_encoder)
+    usual_encoder->set_reuse_params(r);  // A temporary encoder is in use.
+}
+
+
+
+//----------------------------------------------------------------------
+/// Count the overflow values encoded since the last call.
+/// \return The number of overflows.
+//----------------------------------------------------------------------
+size_t slim_channel_encode::take_overflows() {
+  size_t n = 0;
+  if (enc)
+    n += enc->take_overflows();
+  if (usual_encoder)
+    n += usual_encoder->take_overflows();
+  return n;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Are this section's parameters identical to the previous section's?
+/// Call once per section, before write_params().
+/// \param reps  Repetitions per frame, as the expander will see them.
+/// \return Whether the parameters are unchanged.
+//----------------------------------------------------------------------
+bool slim_channel_encode::params_unchanged(unsigned int reps) {
+  uint32_t params[3+MAX_CODEC_PARAMS];
+  params[0] = reps;
+  params[1] = encode_deltas ? 1 : 0;
+  params[2] = bit_rotation;
+  int n = 3 + enc->get_params(params+3);
+  assert (n <= 3+MAX_CODEC_PARAMS);
+
+  bool same = (n == n_last_params &&
+               memcmp(params, last_params, n*sizeof(uint32_t)) == 0);
+  memcpy(last_params, params, n*sizeof(uint32_t));
+  n_last_params = n;
+  return same;
+}
+
+
+
 //----------------------------------------------------------------------
 /// Find how many low-order bits are constant through the data sample.
 /// \param data  The data sample array.
@@ -243,7 +402,29 @@ int slim_channel_encode::constant_low_bits(const T *data,
 					   int ndata) const {
   T bor = 0u;
   T band = ~T(0u);
-  for (int i=0; i<ndata; i++) {
+  int i=0;
+
+#ifdef SLIM_CHANNEL_SSE2
+  // Reduce 16 bytes at a time, then fold the lanes of the result.
+  const int lanes = 16/sizeof(T);
+  if (ndata >= lanes) {
+    __m128i vor = _mm_setzero_si128();
+    __m128i vand = _mm_set1_epi8(-1);
+    for (; i+lanes <= ndata; i+=lanes) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data+i));
+      vor = _mm_or_si128(vor, v);
+      vand = _mm_and_si128(vand, v);
+    }
+    T lane_or[16/sizeof(T)], lane_and[16/sizeof(T)];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lane_or), vor);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lane_and), vand);
+    for (int j=0; j<lanes; j++) {
+      bor |= lane_or[j];
+      band &= lane_and[j];
+    }
+  }
+#endif
+  for (; i<ndata; i++) {
     bor |= data[i];
     band &= data[i];
   }
@@ -252,10 +433,14 @@ int slim_channel_encode::constant_low_bits(const T *data,
   if (varying_bits == T(0) )
     return 0;
 
+#ifdef __GNUC__
+  return __builtin_ctz(varying_bits);
+#else
   for (int i=8*sizeof(T)-1; i>= 0; i--)
     if ((varying_bits & lowestNset[i]) == 0)
       return i;
   return 0;
+#endif
 }
 
 /// Instantiation for an array of uint32_t
@@ -317,8 +502,7 @@ int slim_channel_encode::compute_params(T *data, int ndata) {
 	for (int i=0; i<ndata; i++)
 	  data[i] = rotate(int32_t(data[i]));
       } else
-	for (int i=0; i<ndata; i++)
-	  data[i] = rotate(data[i]);
+	rotate_right(data, data, ndata, bit_rotation);
     }
   } else
     bit_rotation = bit_unrotation = 0;
@@ -351,49 +535,70 @@ int slim_channel_encode::write_params() const {
 
 
 //----------------------------------------------------------------------
-/// Encode one frame of data from a buffer to a file.
+/// Copy words to the scratch buffer, bit-rotated, so that the caller's
+/// data are never changed.
+/// \param buf    The raw data.
+/// \param nwords Number of words to copy.
+/// \return The scratch buffer holding the rotated words.
+//----------------------------------------------------------------------
+const void *slim_channel_encode::rotated_copy(const void *buf,
+                                              unsigned int nwords) {
+  size_t size = nwords*raw_size;
+  if (size > scratch_size) {
+    delete [] scratch;
+    scratch = new uint32_t[(size+3)/4];
+    scratch_size = size;
+  }
+
+  switch (raw_size) {
+  case 4:
+    rotate_right(scratch, reinterpret_cast<const uint32_t *>(buf),
+                 nwords, bit_rotation);
+    break;
+  case 2:
+    rotate_right(reinterpret_cast<uint16_t *>(scratch),
+                 reinterpret_cast<const uint16_t *>(buf), nwords, bit_rotation);
+    break;
+  case 1:
+    rotate_right(reinterpret_cast<uint8_t *>(scratch),
+                 reinterpret_cast<const uint8_t *>(buf), nwords, bit_rotation);
+    break;
+  }
+  return scratch;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Encode one frame of data from a buffer to a file.  The buffer is
+/// not changed.
 /// \param buf  The (allocated) buffer containing the raw data.
 /// \return Number of raw words actually encoded.
 //----------------------------------------------------------------------
-size_t slim_channel_encode::encode_frame(void *buf) {
-
-  uint32_t *dptr;
-  uint16_t *sptr;
-  uint8_t *cptr;
+size_t slim_channel_encode::encode_frame(const void *buf) {
 
   /// For chans with only one rep per frame, faster to handle specially.
   if (repetitions == 1) {
     return encode_frame_singlevalue(buf);
   }
 
-  unsigned int i;
   unsigned int nwords = repetitions;
+  if (bit_rotation)
+    buf = rotated_copy(buf, nwords);
 
   switch (raw_size) {
   case 4:
-    dptr = reinterpret_cast<uint32_t *>(buf);
-    if (bit_rotation)
-      for (i=0; i<nwords; i++)
-	dptr[i] = rotate(dptr[i]);
-    enc->encode_vector(dptr, nwords);
+    enc->encode_vector(reinterpret_cast<const uint32_t *>(buf), nwords);
     return nwords*4;
     break;
 
   case 2:
-    sptr = reinterpret_cast<uint16_t *>(buf);
-    if (bit_rotation)
-      for (i=0; i<nwords; i++)
-	sptr[i] = rotate(sptr[i]);
-    enc->encode_vector(sptr, nwords);
+    enc->encode_vector(reinterpret_cast<const uint16_t *>(buf), nwords);
     return nwords*2;
     break;
 
   case 1:
-    cptr = reinterpret_cast<uint8_t *>(buf);
-    if (bit_rotation)
-      for (i=0; i<nwords; i++)
-	cptr[i] = rotate(cptr[i]);
-    enc->encode_vector(cptr, nwords);
+    enc->encode_vector(reinterpret_cast<const uint8_t *>(buf), nwords);
     return nwords;
     break;
 
@@ -409,55 +614,42 @@ size_t slim_channel_encode::encode_frame(void *buf) {
 
 
 //----------------------------------------------------------------------
-/// Encode one frame of data from a buffer to a file.
+/// Encode one frame of data from a buffer to a file.  The buffer is
+/// not changed.
 /// \param buf  The (allocated) buffer containing the raw data.
 /// \param size The maximum number of bytes to read from the buffer 
 ///             (may use less).
 /// \return Number of raw words actually encoded.
 //----------------------------------------------------------------------
-size_t slim_channel_encode::encode_partial_frame(void *buf, size_t size) {
-
-  uint32_t *dptr;
-  uint16_t *sptr;
-  uint8_t *cptr;
+size_t slim_channel_encode::encode_partial_frame(const void *buf,
+                                                 size_t size) {
 
   /// For chans with only one rep per frame, faster to handle specially.
   if (repetitions == 1 || size == raw_size) {
     return encode_frame_singlevalue(buf);
   }
 
-  unsigned int i;
   unsigned int nwords;
   if (size > frame_size)
     nwords = repetitions;
   else
     nwords = size/raw_size;
+  if (bit_rotation)
+    buf = rotated_copy(buf, nwords);
 
   switch (raw_size) {
   case 4:
-    dptr = reinterpret_cast<uint32_t *>(buf);
-    if (bit_rotation)
-      for (i=0; i<nwords; i++)
-	dptr[i] = rotate(dptr[i]);
-    enc->encode_vector(dptr, nwords);
+    enc->encode_vector(reinterpret_cast<const uint32_t *>(buf), nwords);
     return nwords*4;
     break;
 
   case 2:
-    sptr = reinterpret_cast<uint16_t *>(buf);
-    if (bit_rotation)
-      for (i=0; i<nwords; i++)
-	sptr[i] = rotate(sptr[i]);
-    enc->encode_vector(sptr, nwords);
+    enc->encode_vector(reinterpret_cast<const uint16_t *>(buf), nwords);
     return nwords*2;
     break;
 
   case 1:
-    cptr = reinterpret_cast<uint8_t *>(buf);
-    if (bit_rotation)
-      for (i=0; i<nwords; i++)
-	cptr[i] = rotate(cptr[i]);
-    enc->encode_vector(cptr, nwords);
+    enc->encode_vector(reinterpret_cast<const uint8_t *>(buf), nwords);
     return nwords;
     break;
 
@@ -473,40 +665,46 @@ size_t slim_channel_encode::encode_partial_frame(void *buf, size_t size) {
 
 
 //----------------------------------------------------------------------
-/// Encode one data value from a buffer to a file.
+/// Encode one data value from a buffer to a file.  The buffer is not
+/// changed.
 /// Will be called when repetitions==1 to remove useless loops.
 /// It's important that this be defined as an inline function.
 /// \param buf  The (allocated) buffer containing the raw data.
 /// \return Number of raw words actually encoded.
 //----------------------------------------------------------------------
-inline size_t slim_channel_encode::encode_frame_singlevalue(void *buf) {
+inline size_t slim_channel_encode::encode_frame_singlevalue(const void *buf) {
 
-  uint32_t *dptr;
-  uint16_t *sptr;
-  uint8_t *cptr;
+  // Rotated values are encoded from a local copy.  Unrotated ones are
+  // encoded where they lie, where an encoder may look ahead from them.
+  uint32_t d;
+  uint16_t s;
+  uint8_t c;
 
   switch (raw_size) {
   case 4:
-    dptr = reinterpret_cast<uint32_t *>(buf);
-    if (bit_rotation)
-      dptr[0] = rotate(dptr[0]);
-    enc->encode_scalar(dptr);
+    if (bit_rotation) {
+      d = rotate(*reinterpret_cast<const uint32_t *>(buf));
+      enc->encode_scalar(&d);
+    } else
+      enc->encode_scalar(reinterpret_cast<const uint32_t *>(buf));
     return 4;
     break;
 
   case 2:
-    sptr = reinterpret_cast<uint16_t *>(buf);
-    if (bit_rotation)
-      sptr[0] = rotate(sptr[0]);
-    enc->encode_scalar(sptr);
+    if (bit_rotation) {
+      s = rotate(*reinterpret_cast<const uint16_t *>(buf));
+      enc->encode_scalar(&s);
+    } else
+      enc->encode_scalar(reinterpret_cast<const uint16_t *>(buf));
     return 2;
     break;
 
   case 1:
-    cptr = reinterpret_cast<uint8_t *>(buf);
-    if (bit_rotation)
-      cptr[0] = rotate(cptr[0]);
-    enc->encode_scalar(cptr);
+    if (bit_rotation) {
+      c = rotate(*reinterpret_cast<const uint8_t *>(buf));
+      enc->encode_scalar(&c);
+    } else
+      enc->encode_scalar(reinterpret_cast<const uint8_t *>(buf));
     return 1;
     break;
 
@@ -577,7 +775,13 @@ encoder *slim_channel_encode::replace_encoder() {
 
   usual_encoder = enc;
   usual_deltas = encode_deltas;
-  enc =  usual_encoder->replacement_encoder();
+  if (spare_encoder && !spare_is_constant &&
+      spare_encoder->get_data_type() == usual_encoder->get_data_type()) {
+    enc = spare_encoder;
+    spare_encoder = NULL;
+    enc->reset_previous();
+  } else
+    enc =  usual_encoder->replacement_encoder();
   enc->set_output(ob);
   encode_deltas = enc->uses_deltas();
   return enc;
@@ -598,7 +802,13 @@ encoder *slim_channel_encode::replace_constant(int d0) {
   bit_rotation = bit_unrotation = 0;
   usual_encoder = enc;
   usual_deltas = encode_deltas;
-  enc = usual_encoder->constant_encoder(d0);
+  if (spare_encoder && spare_is_constant &&
+      spare_encoder->get_data_type() == usual_encoder->get_data_type()) {
+    enc = spare_encoder;
+    spare_encoder = NULL;
+    static_cast<encoder_constant *>(enc)->set_value(d0);
+  } else
+    enc = usual_encoder->constant_encoder(d0);
   enc->set_output(ob);
   encode_deltas = enc->uses_deltas();
   return enc;
@@ -608,14 +818,19 @@ encoder *slim_channel_encode::replace_constant(int d0) {
 
 //----------------------------------------------------------------------
 /// Return to using the usual encoder.
-/// Undoes the work of replace_encoder().
+/// Undoes the work of replace_encoder().  The temporary encoder is kept
+/// as a spare, since a channel that needed one usually needs it again.
 /// \return  Pointer to the usual encoder.
 //----------------------------------------------------------------------
 encoder * slim_channel_encode::restore_encoder() {
   if (usual_encoder == NULL) 
     return NULL;
 
-  delete (enc);
+  uint32_t params[MAX_CODEC_PARAMS];
+  enc->get_params(params);
+  delete spare_encoder;
+  spare_encoder = enc;
+  spare_is_constant = (params[0] == SLIM_ENCODER_CONSTANT);
   enc = usual_encoder;
   encode_deltas = usual_deltas;
   usual_encoder = NULL;
@@ -639,6 +854,8 @@ slim_channel_decode::slim_channel_decode(int reps, int size, bool deltas) :
   slim_channel(reps, size, deltas)
 {
   dec = NULL;
+  spare_dec = NULL;
+  ib = NULL;
 }
 
 //----------------------------------------------------------------------
@@ -646,6 +863,71 @@ slim_channel_decode::slim_channel_decode(int reps, int size, bool deltas) :
 //----------------------------------------------------------------------
 slim_channel_decode::~slim_channel_decode() {
   delete dec;
+  delete spare_dec;
+}
+
+//----------------------------------------------------------------------
+/// Give the channel a new shape, so that it can serve another section
+/// instead of being replaced.
+/// \param reps  The number of repetitions of data per frame.
+/// \param size  The size (bytes) of a single data word.
+/// \param deltas Whether this channel will decode data or its deltas.
+//----------------------------------------------------------------------
+void slim_channel_decode::configure(unsigned int reps, int size,
+                                    bool deltas) {
+  repetitions = reps;
+  raw_size = size;
+  frame_size = size*reps;
+  encode_deltas = deltas;
+  bit_rotation = bit_unrotation = 0;
+}
+
+//----------------------------------------------------------------------
+/// Make sure the channel has a decoder for this algorithm, type, and
+/// use of deltas, ready for a new section.  The current decoder is kept
+/// if it serves; otherwise it becomes the spare, and the old spare is
+/// used if it serves.  Only when neither does is a new decoder made.
+/// Channels that switch between two codecs (such as a usual codec and
+/// the constant one) thus stop allocating after the first switch.
+/// \param code      ID # of the decoding method.
+/// \param data_type ID # for the data type.
+/// \param deltas    Whether to decode successive difference data.
+//----------------------------------------------------------------------
+void slim_channel_decode::use_decoder(enum code_t code, enum data_t data_type,
+                                      bool deltas) {
+  if (dec == NULL || !dec->matches(code, data_type, deltas)) {
+    decoder *old = dec;
+    if (spare_dec && spare_dec->matches(code, data_type, deltas)) {
+      dec = spare_dec;
+    } else {
+      delete spare_dec;
+      spare_dec = NULL;
+      dec = decoder_generator(code, data_type, deltas);
+    }
+    spare_dec = old;
+  }
+  dec->reset_previous();
+  if (ib)
+    dec->set_input(ib);
+}
+
+
+
+//----------------------------------------------------------------------
+/// Count the overflow values decoded since the last call.
+/// \return The number of overflows.
+//----------------------------------------------------------------------
+size_t slim_channel_decode::take_overflows() {
+  return dec ? dec->take_overflows() : 0;
+}
+
+//----------------------------------------------------------------------
+/// Clear the "history" value, to decode a new section with the same
+/// parameters.
+//----------------------------------------------------------------------
+void slim_channel_decode::reset_previous() {
+  if (dec)
+    dec->reset_previous();
 }
 
 //----------------------------------------------------------------------
@@ -745,30 +1027,24 @@ size_t slim_channel_decode::decode_frame(void *buf, size_t size) {
     dptr = reinterpret_cast<uint32_t *>(buf);
     
     dec->decode_vector(dptr, nwords);
-    if (bit_rotation) {
-      for (unsigned int i=0; i<nwords; i++)
-	dptr[i] = rotate(dptr[i]);
-    }
+    if (bit_rotation)
+      rotate_right(dptr, dptr, nwords, bit_unrotation);
     return nwords*raw_size;
     break;
 
   case 2:
     sptr = reinterpret_cast<uint16_t *>(buf);
     dec->decode_vector(sptr, nwords);
-    if (bit_rotation) {
-      for (unsigned int i=0; i<nwords; i++)
-	sptr[i] = rotate(sptr[i]);
-    }
+    if (bit_rotation)
+      rotate_right(sptr, sptr, nwords, bit_unrotation);
     return nwords*raw_size;
     break;
 
   case 1:
     cptr = reinterpret_cast<uint8_t *>(buf);
     dec->decode_vector(cptr, nwords);
-    if (bit_rotation) {
-      for (unsigned int i=0; i<nwords; i++)
-	cptr[i] = rotate(cptr[i]);
-    }
+    if (bit_rotation)
+      rotate_right(cptr, cptr, nwords, bit_unrotation);
     return nwords*raw_size;
     break;
 
@@ -838,3 +1114,15 @@ void slim_channel_decode::dump_info(ostream &fout) const {
 
 
 
+//----------------------------------------------------------------------
+/// Bits per encoded symbol used by this channel's decoder.
+/// \return Number of bits, or 0 if there is no decoder.
+//----------------------------------------------------------------------
+int slim_channel_decode::get_nbits() const {
+  if (!dec)
+    return 0;
+  return dec->get_nbits();
+}
+
+
+
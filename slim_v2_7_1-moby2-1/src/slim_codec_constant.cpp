@@ -55,6 +55,17 @@ encoder_constant::encoder_constant(int value, enum data_t dt, bool deltas,
 encoder_constant::~encoder_constant() {;}
 
 
+
+//----------------------------------------------------------------------
+/// Change the constant value, so the encoder can serve another section.
+/// \param value  The new value.
+void encoder_constant::set_value(int value) {
+  fixed_data = value;
+  fixed_sdata = value;
+  fixed_cdata = value;
+}
+
+
 //----------------------------------------------------------------------
 /// Encode by writing precisely nothing.
 void encoder_constant::encode(uint32_t datum) const {
@@ -99,6 +110,19 @@ int encoder_constant::write_params() const {
 
 
 
+//----------------------------------------------------------------------
+/// Get the values that write_params() would write.
+/// \param params  Array (at least MAX_CODEC_PARAMS long) to fill.
+/// \return Number of values filled in.
+int encoder_constant::get_params(uint32_t *params) const {
+  params[0] = ALGORITHM_CODE;
+  params[1] = data_type;
+  params[2] = fixed_data;
+  return 3;
+}
+
+
+
 //----------------------------------------------------------------------
 //----------------------------------------------------------------------
 
@@ -202,3 +226,21 @@ void decoder_constant::dump_info(ostream &fout) const {
     break;
   }
 }
+
+
+
+//----------------------------------------------------------------------
+/// Bits per encoded symbol: none, as the value is in the parameters.
+/// \return Number of bits (0).
+int decoder_constant::get_nbits() const {
+  return 0;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Which algorithm does this decoder implement?
+/// \return The algorithm code.
+enum code_t decoder_constant::get_code() const {
+  return ALGORITHM_CODE;
+}
@@ -41,10 +41,15 @@ encoder::encoder(enum data_t dt, bool deltas, obitstream *ob) :
   use_deltas(deltas)
 {
   set_data_type(dt);
+  reuse_params = false;
+  have_params = false;
+  overflows = 0;
   out_bs = ob;
   prev_datum = 0u;
   prev_sdatum = 0u;
   prev_cdatum = 0u;
+  frame_stride = 0;
+  data_end = NULL;
 }
 
 
@@ -255,6 +260,18 @@ void encoder::reset_previous()
   prev_cdatum = 0u;
 }
 
+
+
+/// Say where this channel's data in later frames of the section can be
+/// found, for encoders that can use them (such as runlength).
+/// \param stride  Bytes from one frame's data to the next (0=don't look).
+/// \param end     End of the last whole frame in the section.
+void encoder::set_lookahead(size_t stride, const void *end)
+{
+  frame_stride = stride;
+  data_end = reinterpret_cast<const unsigned char *>(end);
+}
+
 /// Compute parameters of the encoder based on a sample of data.
 /// This is virtual--subclasses will override this with their own method.
 /// \param data   Array of data words.
@@ -307,6 +324,19 @@ int encoder::write_params() const {
 
 
 
+/// Get the values that write_params() would write, for comparing the
+/// parameters of successive sections.
+/// This is virtual--subclasses will override this with their own method.
+/// \param params  Array (at least MAX_CODEC_PARAMS long) to fill.
+/// \return Number of values filled in.
+int encoder::get_params(uint32_t *params) const {
+  params[0] = ALGORITHM_CODE;
+  params[1] = data_type;
+  return 2;
+}
+
+
+
 /// Do we expect this channel to have no effect?
 bool encoder::expect_zero_compression() const {
   return false;
@@ -395,6 +425,7 @@ decoder::decoder(enum data_t dt, bool deltas, ibitstream *ib) :
   use_deltas(deltas) {
   set_data_type(dt);
   in_bs = ib;
+  overflows = 0;
   prev_datum = 0u;
   prev_sdatum = 0u;
   prev_cdatum = 0u;
@@ -596,8 +627,49 @@ int decoder::read_params()
 
 
 
+/// Reset the prev_ data members to 0 so that a new section can be
+/// decoded with the same parameters.
+void decoder::reset_previous()
+{
+  prev_datum = 0u;
+  prev_sdatum = 0u;
+  prev_cdatum = 0u;
+}
+
+
+
 /// Write decoder parameters to a stream.
 /// \param fout  The writeable output stream.
 void decoder::dump_info(ostream &fout) const {
   fout << "  Default (dummy) decoder";
 }
+
+
+
+/// Bits per encoded symbol: the full word, for the default decoder.
+/// \return Number of bits.
+int decoder::get_nbits() const {
+  return data_size_bits;
+}
+
+
+
+/// Which algorithm does this decoder implement?
+/// This is virtual--subclasses will override this with their own method.
+/// \return The algorithm code.
+enum code_t decoder::get_code() const {
+  return SLIM_ENCODER_DEFAULT;
+}
+
+
+
+/// Could this decoder serve a channel with the given algorithm, type,
+/// and use of deltas?  (If so, the channel can keep it.)
+/// \param code    The algorithm code.
+/// \param dt      The data type.
+/// \param deltas  Whether the channel uses deltas.
+bool decoder::matches(enum code_t code, enum data_t dt, bool deltas) const {
+  if (code == SLIM_ENCODER_CODE_A)
+    code = SLIM_ENCODER_REDUCED_BINARY;
+  return code == get_code() && dt == data_type && deltas == use_deltas;
+}
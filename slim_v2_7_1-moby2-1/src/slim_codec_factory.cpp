@@ -67,6 +67,10 @@ encoder *encoder_generator(enum code_t code, enum data_t data_type, bool deltas)
     switch (data_type) {
     case SLIM_TYPE_I32:
     case SLIM_TYPE_U32:
+    case SLIM_TYPE_I16:
+    case SLIM_TYPE_U16:
+    case SLIM_TYPE_I8:
+    case SLIM_TYPE_U8:
       s = new encoder_runlength(data_type, deltas);
       break;
 
@@ -140,6 +144,10 @@ decoder *decoder_generator(code_t code, data_t data_type, bool deltas) {
     switch (data_type) {
     case SLIM_TYPE_I32:
     case SLIM_TYPE_U32:
+    case SLIM_TYPE_I16:
+    case SLIM_TYPE_U16:
+    case SLIM_TYPE_I8:
+    case SLIM_TYPE_U8:
       s = new decoder_runlength(data_type, deltas);
       break;
     default:
@@ -46,10 +46,12 @@
 encoder_reduced_binary::encoder_reduced_binary(enum data_t dt, bool deltas, 
 					       obitstream *ob) 
   : encoder(dt, deltas, ob) {
+  // Until compute_params() is called (it is not, on tiny sections), code
+  // values at full width, with the all-ones code still kept for overflows.
   nbits = 8u * slim_type_size[dt];
-  max = UINT_MAX;
   offset = 0u;
-  Overflow = UINT_MAX;
+  Overflow = lowestNset[nbits];
+  max = Overflow-1;
 }
 
 
@@ -83,6 +85,7 @@ inline void encoder_reduced_binary::encode(uint32_t  datum) const {
   cout << ", -> OFLOW  " << u << endl;
 #endif
 
+  overflows++;
   out_bs->writebits(Overflow, nbits);
   out_bs->writebits(datum, data_size_bits);
 }
@@ -99,6 +102,7 @@ inline void encoder_reduced_binary::encode(uint16_t  datum) const {
     return;
   }
 
+  overflows++;
   out_bs->writebits(Overflow, nbits);
   out_bs->writebits(datum, data_size_bits);
 }
@@ -115,6 +119,7 @@ inline void encoder_reduced_binary::encode(uint8_t  datum) const {
     return;
   }
 
+  overflows++;
   out_bs->writebits(Overflow, nbits);
   out_bs->writebits(datum, data_size_bits);
 }
@@ -163,6 +168,50 @@ int encoder_reduced_binary::best_code_length(const int histogram[33],
  
 
 
+//----------------------------------------------------------------------
+/// When asked to reuse parameters, keep the previous section's offset if
+/// it is close to the new one (within 1/16 of the coded range) and codes
+/// the sample nearly as well (within 1/256 of its length).  The section
+/// header can then mark the parameters as unchanged.  The sample is not
+/// the whole section, hence the first test.
+/// \param data        Array of data to be analyzed.
+/// \param ndata       Length of data array.
+/// \param prev_offset The offset used in the previous section.
+/// \param prev_nbits  The bits per symbol in the previous section.
+template <typename T>
+void encoder_reduced_binary::keep_previous_offset(const T *data, int ndata,
+                                                  uint32_t prev_offset,
+                                                  unsigned int prev_nbits) {
+  bool had_params = have_params;
+  have_params = true;
+  if (!reuse_params || !had_params || nbits != prev_nbits ||
+      T(offset) == T(prev_offset))
+    return;
+
+  const T top = T(lowestNset[nbits] - 1);
+  const T new_off = T(offset), old_off = T(prev_offset);
+  const T shift = T(new_off - old_off) < T(old_off - new_off) ?
+    T(new_off - old_off) : T(old_off - new_off);
+  if (shift > (top >> 4))
+    return;
+
+  int new_overflows = 0, old_overflows = 0;
+  for (int i=0; i<ndata; i++) {
+    if (T(data[i] - new_off) > top)
+      new_overflows++;
+    if (T(data[i] - old_off) > top)
+      old_overflows++;
+  }
+  // Signed and 64-bit: the old offset may overflow less, and the bit
+  // counts of a large section need not fit in an int.
+  const int64_t new_length = int64_t(new_overflows)*data_size_bits +
+    int64_t(nbits)*ndata;
+  if (int64_t(old_overflows-new_overflows)*data_size_bits <= new_length/256)
+    offset = prev_offset;
+}
+
+
+
 //----------------------------------------------------------------------
 /// Log-base2 of the argument.
 inline double log2(double x) {
@@ -180,6 +229,8 @@ inline double log2(double x) {
 /// \return Error code, or 0=no error.
 int encoder_reduced_binary::compute_params(const uint32_t *data, 
 					   const int ndata) {
+  const uint32_t prev_offset = offset;
+  const unsigned int prev_nbits = nbits;
   assert (data_type == SLIM_TYPE_I32 ||
 	  data_type == SLIM_TYPE_U32);
 
@@ -217,6 +268,7 @@ int encoder_reduced_binary::compute_params(const uint32_t *data,
   // But we _want_ unsigned data and offset at the bottom of range.
   if (nbits > 1)
     offset -= 1 << (nbits-1u);
+  keep_previous_offset(data, ndata, prev_offset, prev_nbits);
 
   // set Overflow to the largest nbits-bit number
   Overflow = lowestNset[nbits];
@@ -242,6 +294,8 @@ int encoder_reduced_binary::compute_params(const uint32_t *data,
 /// \return Error code, or 0=no error.
 int encoder_reduced_binary::compute_params(const uint16_t *data, 
 					   const int ndata) {
+  const uint32_t prev_offset = offset;
+  const unsigned int prev_nbits = nbits;
   assert (data_type == SLIM_TYPE_I16 ||
 	  data_type == SLIM_TYPE_U16);
 
@@ -275,6 +329,7 @@ int encoder_reduced_binary::compute_params(const uint16_t *data,
   // But we _want_ unsigned data and offset at the bottom of range.
   if (nbits > 1)
     offset -= 1 << (nbits-1u);
+  keep_previous_offset(data, ndata, prev_offset, prev_nbits);
 
   // set Overflow to the largest nbits-bit number
   Overflow = lowestNset[nbits];
@@ -292,6 +347,8 @@ int encoder_reduced_binary::compute_params(const uint16_t *data,
 /// \return Error code, or 0=no error.
 int encoder_reduced_binary::compute_params(const uint8_t *data, 
                                            const int ndata) {
+  const uint32_t prev_offset = offset;
+  const unsigned int prev_nbits = nbits;
   assert (data_type == SLIM_TYPE_I8 ||
           data_type == SLIM_TYPE_U8);
 
@@ -325,6 +382,7 @@ int encoder_reduced_binary::compute_params(const uint8_t *data,
   // But we _want_ unsigned data and offset at the bottom of range.
   if (nbits > 1)
     offset -= 1 << (nbits-1u);
+  keep_previous_offset(data, ndata, prev_offset, prev_nbits);
 
   // set Overflow to the largest nbits-bit number
   Overflow = lowestNset[nbits];
@@ -351,6 +409,20 @@ int encoder_reduced_binary::write_params() const {
 
 
 
+//----------------------------------------------------------------------
+/// Get the values that write_params() would write.
+/// \param params  Array (at least MAX_CODEC_PARAMS long) to fill.
+/// \return Number of values filled in.
+int encoder_reduced_binary::get_params(uint32_t *params) const {
+  params[0] = ALGORITHM_CODE;
+  params[1] = data_type;
+  params[2] = offset & lowestNset[data_size_bits];
+  params[3] = nbits;
+  return 4;
+}
+
+
+
 ///----------------------------------------------------------------------
 // Do we expect this channel to have no effect?
 bool encoder_reduced_binary::expect_zero_compression() const {
@@ -430,8 +502,10 @@ uint32_t decoder_reduced_binary::decode_u32()
   uint32_t datum;
   try {
     datum = in_bs->readbits(nbits);
-    if (datum == Overflow) 
+    if (datum == Overflow) {
+      overflows++;
       return in_bs->readbits(data_size_bits);
+    }
     else
       return datum+offset;
   } catch (const char * s) { // This catches end of input.
@@ -450,6 +524,7 @@ uint16_t decoder_reduced_binary::decode_u16()
   try {
     datum = in_bs->readbits(nbits);
     if (datum == Overflow) {
+      overflows++;
       return in_bs->readbits(data_size_bits);
     } else
       return datum+offset;
@@ -469,6 +544,7 @@ uint8_t decoder_reduced_binary::decode_u8()
   try {
     datum = in_bs->readbits(nbits);
     if (datum == Overflow) {
+      overflows++;
       return in_bs->readbits(data_size_bits);
     } else
       return datum+offset;
@@ -502,3 +578,21 @@ void decoder_reduced_binary::dump_info(ostream &fout) const {
     break;
   }
 }
+
+
+
+//----------------------------------------------------------------------
+/// Bits per encoded symbol, as read by read_params().
+/// \return Number of bits.
+int decoder_reduced_binary::get_nbits() const {
+  return nbits;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Which algorithm does this decoder implement?
+/// \return The algorithm code.
+enum code_t decoder_reduced_binary::get_code() const {
+  return ALGORITHM_CODE;
+}
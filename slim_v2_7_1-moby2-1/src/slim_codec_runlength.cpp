@@ -30,6 +30,89 @@
 
 //#define DEBUG_ENCODING
 
+// Runs are found 16 bytes at a time with SSE2 where we have it (all x86-64):
+// compare against the broadcast value and scan the byte mask.
+#if defined(__SSE2__) && defined(__GNUC__)
+#define SLIM_RUNLENGTH_SSE2
+#include <emmintrin.h>
+
+/// Broadcast a value to all lanes of a vector.
+static inline __m128i splat(uint8_t v)  {return _mm_set1_epi8(char(v));}
+static inline __m128i splat(uint16_t v) {return _mm_set1_epi16(short(v));}
+static inline __m128i splat(uint32_t v) {return _mm_set1_epi32(int(v));}
+
+/// Lane-wise equality (the last argument only selects the lane width).
+static inline __m128i lanes_equal(__m128i a, __m128i b, uint8_t)
+{return _mm_cmpeq_epi8(a, b);}
+static inline __m128i lanes_equal(__m128i a, __m128i b, uint16_t)
+{return _mm_cmpeq_epi16(a, b);}
+static inline __m128i lanes_equal(__m128i a, __m128i b, uint32_t)
+{return _mm_cmpeq_epi32(a, b);}
+
+/// Lane-wise difference a-b (the last argument selects the lane width).
+static inline __m128i lanes_minus(__m128i a, __m128i b, uint8_t)
+{return _mm_sub_epi8(a, b);}
+static inline __m128i lanes_minus(__m128i a, __m128i b, uint16_t)
+{return _mm_sub_epi16(a, b);}
+static inline __m128i lanes_minus(__m128i a, __m128i b, uint32_t)
+{return _mm_sub_epi32(a, b);}
+#endif
+
+
+
+/// Find the end of a run of one value.
+/// \param data   The data.
+/// \param i      Index at which to start looking.
+/// \param ndata  Length of the data.
+/// \param value  The repeated value.
+/// \return Index of the first datum at or after i that differs from
+///         value, or ndata if none does.
+template <typename T>
+static inline int run_end(const T *data, int i, int ndata, T value) {
+#ifdef SLIM_RUNLENGTH_SSE2
+  const int lanes = 16/sizeof(T);
+  const __m128i v = splat(value);
+  for (; i+lanes <= ndata; i+=lanes) {
+    __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data+i));
+    unsigned int differ = 0xffff ^ _mm_movemask_epi8(lanes_equal(d, v, T()));
+    if (differ)
+      return i + __builtin_ctz(differ)/sizeof(T);
+  }
+#endif
+  while (i < ndata && data[i] == value)
+    i++;
+  return i;
+}
+
+
+
+/// Find the end of a run of one delta (successive difference).
+/// \param data   The data.
+/// \param i      Index at which to start looking (at least 1).
+/// \param ndata  Length of the data.
+/// \param delta  The repeated delta.
+/// \return Index of the first datum at or after i whose delta from the
+///         one before is not delta, or ndata if there is none.
+template <typename T>
+static inline int delta_run_end(const T *data, int i, int ndata, T delta) {
+#ifdef SLIM_RUNLENGTH_SSE2
+  const int lanes = 16/sizeof(T);
+  const __m128i v = splat(delta);
+  for (; i+lanes <= ndata; i+=lanes) {
+    __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data+i));
+    __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data+i-1));
+    __m128i eq = lanes_equal(lanes_minus(d, p, T()), v, T());
+    unsigned int differ = 0xffff ^ _mm_movemask_epi8(eq);
+    if (differ)
+      return i + __builtin_ctz(differ)/sizeof(T);
+  }
+#endif
+  while (i < ndata && T(data[i]-data[i-1]) == delta)
+    i++;
+  return i;
+}
+
+
 
 //----------------------------------------------------------------------
 /// \class encoder_runlength
@@ -39,12 +122,26 @@
 
 //----------------------------------------------------------------------
 /// Construct (optionally by output bitstream).
+/// Data are coded at their own width, always as unsigned.
 /// \param dt  The data type code.
 /// \param deltas Whether to encode successive differences.
 /// \param ob  The output bitstream.
 encoder_runlength::encoder_runlength(enum data_t dt, bool deltas, obitstream *ob) 
   : encoder(dt, deltas, ob) {
-  set_data_type(SLIM_TYPE_U32);
+  switch (slim_type_size[dt]) {
+  case 1:
+    set_data_type(SLIM_TYPE_U8);
+    break;
+  case 2:
+    set_data_type(SLIM_TYPE_U16);
+    break;
+  default:
+    set_data_type(SLIM_TYPE_U32);
+    break;
+  }
+  ndata_checked = nchanges_data = 0;
+  run_bits = 0;
+  run_skip = 0;
 }
 
 
@@ -55,6 +152,15 @@ encoder_runlength::~encoder_runlength() {;}
 
 
 
+//----------------------------------------------------------------------
+/// Clear the delta history and any run carried over, for a new section.
+void encoder_runlength::reset_previous() {
+  encoder::reset_previous();
+  run_skip = 0;
+}
+
+
+
 //----------------------------------------------------------------------
 /// Encode one datum to the output stream.
 /// \param datum  The word to be encoded.
@@ -69,86 +175,168 @@ void encoder_runlength::encode(uint32_t datum) const {
 
 
 
+//----------------------------------------------------------------------
+/// Encode one datum to the output stream.
+/// \param datum  The word to be encoded.
+void encoder_runlength::encode(uint16_t datum) const {
+  encode(uint32_t(datum));
+}
+
+
+
+//----------------------------------------------------------------------
+/// Encode one datum to the output stream.
+/// \param datum  The word to be encoded.
+void encoder_runlength::encode(uint8_t datum) const {
+  encode(uint32_t(datum));
+}
+
+
+
+//----------------------------------------------------------------------
+/// Encode one datum, as part of a run that may continue into later frames.
+/// (Used for channels with one datum per frame.)
+/// \param data  Pointer to the word to be encoded.
+void encoder_runlength::encode_scalar(const uint32_t *data) {
+  encode_runs(data, 1, prev_datum);
+}
+
+/// \overload
+void encoder_runlength::encode_scalar(const uint16_t *data) {
+  encode_runs(data, 1, prev_sdatum);
+}
+
+/// \overload
+void encoder_runlength::encode_scalar(const uint8_t *data) {
+  encode_runs(data, 1, prev_cdatum);
+}
+
+
+
 //----------------------------------------------------------------------
 /// Encode an array of data to the output stream.
 /// \param data    Array of words to be encoded.
 /// \param ndata   Number of words to be encoded.
-void encoder_runlength::encode_vector(const uint32_t *data, 
-				      int ndata) {
-  uint32_t repeated_value;  ///< Value seen before and not yet recorded.
+void encoder_runlength::encode_vector(const uint32_t *data, int ndata) {
+  encode_runs(data, ndata, prev_datum);
+}
+
+/// \overload
+void encoder_runlength::encode_vector(const uint16_t *data, int ndata) {
+  encode_runs(data, ndata, prev_sdatum);
+}
+
+/// \overload
+void encoder_runlength::encode_vector(const uint8_t *data, int ndata) {
+  encode_runs(data, ndata, prev_cdatum);
+}
+
+
+
+//----------------------------------------------------------------------
+/// Encode an array of data to the output stream as (value, count) pairs.
+/// A run that reaches the end of the array is followed into the same
+/// channel's data in later frames of the section (see set_lookahead), and
+/// its full length is written now.  The data it covers in later frames
+/// are then skipped when their turn comes.  The decoder keeps a run going
+/// from frame to frame already, so it needs no change.
+/// \param data    Array of words to be encoded.
+/// \param ndata   Number of words to be encoded.
+/// \param prev    The delta history for this data type.
+template <typename T>
+void encoder_runlength::encode_runs(const T *data, int ndata, T &prev) {
+  T repeated_value;         ///< Value seen before and not yet recorded.
   uint32_t value_counter;   ///< Count of consecutive appearances of value.
+  int i=0;
+
+  // Skip data already written as part of a run from an earlier frame.
+  if (run_skip > 0) {
+    i = (run_skip < uint32_t(ndata)) ? run_skip : ndata;
+    run_skip -= i;
+    if (use_deltas)
+      prev = data[i-1];
+  }
 
-  if (use_deltas) {
-    repeated_value = data[0]-prev_datum;
-    prev_datum = repeated_value;
-    value_counter = 1;
-    for (int i=1; i<ndata; i++) {
-      if (data[i]-prev_datum == repeated_value)
-	value_counter ++;
-      else {
-#ifdef DEBUG_ENCODING
-	cout << "encoder_runlength DELTA: encoding " << value_counter
-             << " repeats of " << repeated_value << endl;
-#endif
-	
-	mexp_golomb_write(out_bs, repeated_value);
-	mexp_golomb_write(out_bs, value_counter);
-	repeated_value = data[i]-prev_datum;
-	value_counter = 1;
-      }
-      prev_datum = data[i];
+  while (i < ndata) {
+    int run_start = i;
+    if (use_deltas) {
+      repeated_value = T(data[i]-prev);
+      i = delta_run_end(data, i+1, ndata, repeated_value);
+      prev = data[i-1];
+    } else {
+      repeated_value = data[i];
+      i = run_end(data, i+1, ndata, repeated_value);
+    }
+    value_counter = i - run_start;
+    if (i == ndata) {
+      run_skip = run_continuation(data, ndata, repeated_value);
+      value_counter += run_skip;
     }
-  } else {
-    repeated_value = data[0];
-    value_counter = 1;
-    for (int i=1; i<ndata; i++) {
-      if (data[i] == repeated_value)
-	value_counter ++;
-      else {
 
 #ifdef DEBUG_ENCODING
-	cout << "encoder_runlength: encoding " << value_counter
-             << " repeats of " << repeated_value << endl;
+    cout << "encoder_runlength: encoding " << value_counter
+         << " repeats of " << uint32_t(repeated_value) << endl;
 #endif
-
-	mexp_golomb_write(out_bs, repeated_value);
-	mexp_golomb_write(out_bs, value_counter);
-	repeated_value = data[i];
-	value_counter = 1;
-      }
-    }
+    mexp_golomb_write(out_bs, repeated_value);
+    mexp_golomb_write(out_bs, value_counter);
   }
+}
 
-  // There's always an unwritten value when we reach end of loop.
-#ifdef DEBUG_ENCODING
-	cout << "encoder_runlength: encoding " << value_counter
-             << " repeats of " << repeated_value << endl;
-#endif
-  mexp_golomb_write(out_bs, repeated_value);
-  mexp_golomb_write(out_bs, value_counter);
+
+
+//----------------------------------------------------------------------
+/// Count how far a run continues into this channel's data in later
+/// frames.  Only whole frames of the current section are examined.
+/// \param data   The array just encoded (the current frame's data).
+/// \param ndata  Number of words per frame in this channel.
+/// \param value  The value (or delta) repeated at the end of data.
+/// \return Number of data in later frames that continue the run.
+template <typename T>
+uint32_t encoder_runlength::run_continuation(const T *data, int ndata,
+                                             T value) const {
+  if (frame_stride == 0 || data_end == NULL)
+    return 0;
+
+  uint32_t count = 0;
+  T prev = data[ndata-1];
+  const unsigned char *frame = reinterpret_cast<const unsigned char *>(data);
+  for (frame += frame_stride; frame + ndata*sizeof(T) <= data_end;
+       frame += frame_stride) {
+    const T *d = reinterpret_cast<const T *>(frame);
+    int j;
+    if (use_deltas) {
+      if (T(d[0]-prev) != value)
+	return count;
+      j = delta_run_end(d, 1, ndata, value);
+      prev = d[ndata-1];
+    } else
+      j = run_end(d, 0, ndata, value);
+    count += j;
+    if (j < ndata)
+      return count;
+  }
+  return count;
 }
 
 
 
 //----------------------------------------------------------------------
-/// Compute the parameters needed for the encoding algorithm.
-/// This algorithm has no parameters: it can be a good or a bad idea,
-/// but this routine has nothing to do.
-/// \param data  Array of data to be analyzed (can be a statistical sample).
+/// Count the changes of value in data, and the bits to code its runs,
+/// for compute_params().
+/// \param data  Array of data to be analyzed.
 /// \param ndata Length of data array.
-/// \return Error code, or 0=no error.
-int encoder_runlength::compute_params(const uint32_t *data, 
-				      const int ndata) {
-  uint32_t prevdata = data[0];
-  nchanges_data = 1;
-  for (int i=1; i<ndata; i++) {
-    if (data[i] != prevdata) {
-      nchanges_data ++; 
-      prevdata = data[i];
-    }
+template <typename T>
+void encoder_runlength::count_changes(const T *data, const int ndata) {
+  nchanges_data = 0;
+  run_bits = 0;
+  int i = 0;
+  while (i < ndata) {
+    int end = run_end(data, i+1, ndata, data[i]);
+    nchanges_data ++;
+    run_bits += mexp_golomb_bits(data[i]) + mexp_golomb_bits(end-i);
+    i = end;
   }
   ndata_checked = ndata;
-  return 0;
 }
 
 
@@ -156,21 +344,27 @@ int encoder_runlength::compute_params(const uint32_t *data,
 //----------------------------------------------------------------------
 /// Compute the parameters needed for the encoding algorithm.
 /// This algorithm has no parameters: it can be a good or a bad idea,
-/// but this routine has nothing to do.
+/// but this routine has nothing to do but count changes of value.
 /// \param data  Array of data to be analyzed (can be a statistical sample).
 /// \param ndata Length of data array.
 /// \return Error code, or 0=no error.
+int encoder_runlength::compute_params(const uint32_t *data, 
+				      const int ndata) {
+  count_changes(data, ndata);
+  return 0;
+}
+
+/// \overload
 int encoder_runlength::compute_params(const uint16_t *data, 
 				      const int ndata) {
-  uint16_t prevdata = data[0];
-  nchanges_data = 1;
-  for (int i=1; i<ndata; i++) {
-    if (data[i] != prevdata) {
-      nchanges_data ++; 
-      prevdata = data[i];
-    }
-  }
-  ndata_checked = ndata;
+  count_changes(data, ndata);
+  return 0;
+}
+
+/// \overload
+int encoder_runlength::compute_params(const uint8_t *data, 
+				      const int ndata) {
+  count_changes(data, ndata);
   return 0;
 }
 
@@ -190,18 +384,41 @@ int encoder_runlength::write_params() const {
 
 
 
+//----------------------------------------------------------------------
+/// Get the values that write_params() would write.
+/// \param params  Array (at least MAX_CODEC_PARAMS long) to fill.
+/// \return Number of values filled in.
+int encoder_runlength::get_params(uint32_t *params) const {
+  params[0] = ALGORITHM_CODE;
+  params[1] = data_type;
+  return 2;
+}
+
+
+
 //----------------------------------------------------------------------
 /// Do we expect this channel to have no effect?
 /// \return true if compression is a bad idea; false if it's good.
 bool encoder_runlength::expect_zero_compression() const {
   if (nchanges_data*3 > ndata_checked)
     return true;
+  // Narrow data must also take fewer bits as runs than as they are.
+  if (slim_type_size[data_type] < 4 &&
+      run_bits >= size_t(ndata_checked) * 8 * slim_type_size[data_type])
+    return true;
   return false;
 }
 
 
 
+//----------------------------------------------------------------------
+/// A replacement encoder for sections where runs don't pay.
+/// Narrow data get the default encoder, as they did before runlength
+/// coding supported them, so they never take more space than that.
+/// \return  Encoder of the desired replacement type.
 encoder *encoder_runlength::replacement_encoder() {
+  if (slim_type_size[data_type] < 4)
+    return encoder::replacement_encoder();
   return new encoder_reduced_binary(data_type, use_deltas);
 }
 
@@ -220,7 +437,6 @@ encoder *encoder_runlength::replacement_encoder() {
 /// \param ib  The input bitstream.
 decoder_runlength::decoder_runlength(enum data_t dt, bool deltas, ibitstream *ib) :
   decoder(dt, deltas, ib) {
-  set_data_type(SLIM_TYPE_U32);
 
   repeated_value = 0;
   uses_remaining = 0u;
@@ -246,6 +462,16 @@ int decoder_runlength::read_params() {
 
 
 
+//----------------------------------------------------------------------
+/// Clear the delta history and any unfinished run, for a new section.
+void decoder_runlength::reset_previous() {
+  decoder::reset_previous();
+  repeated_value = 0;
+  uses_remaining = 0u;
+}
+
+
+
 //----------------------------------------------------------------------
 /// Decode one word from the input stream.
 /// \return  The decoded word.
@@ -265,9 +491,36 @@ uint32_t decoder_runlength::decode_u32()
 
 
 
+//----------------------------------------------------------------------
+/// Decode one 16-bit word from the input stream.
+/// \return  The decoded word.
+uint16_t decoder_runlength::decode_u16() {
+  return uint16_t(decode_u32());
+}
+
+
+
+//----------------------------------------------------------------------
+/// Decode one 8-bit word from the input stream.
+/// \return  The decoded word.
+uint8_t decoder_runlength::decode_u8() {
+  return uint8_t(decode_u32());
+}
+
+
+
 //----------------------------------------------------------------------
 /// Write decoder parameters to a stream.
 /// \param fout  The writeable output stream.
 void decoder_runlength::dump_info(ostream &fout) const {
   fout << "     Runlength decoder\n";
 }
+
+
+
+//----------------------------------------------------------------------
+/// Which algorithm does this decoder implement?
+/// \return The algorithm code.
+enum code_t decoder_runlength::get_code() const {
+  return ALGORITHM_CODE;
+}
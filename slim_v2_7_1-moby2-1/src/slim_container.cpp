@@ -0,0 +1,337 @@
+/// \file slim_container.cpp
+/// Implements container_adapter, the front end for raw files that wrap
+/// their frames in headers, and the container formats slim knows.
+
+//  Copyright (C) 2008, 2009 Joseph Fowler
+//
+//  This file is part of slim, a compression package for science data.
+//
+//  Slim is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Slim is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with slim.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <climits>
+#include "slim.h"
+#include "bit_constants.h"
+
+// ---------------------------------------------------------------------------
+/// \class container_adapter
+/// A front end for one file format that wraps binary frames in a header
+/// (or several regions of differing layout).  parse() divides a raw file
+/// into regions, each with its own frame layout, and
+/// slim_compressor_t::compress_from_file() then slims each region with
+/// its own channels.  Any slim file can be expanded as usual, so a
+/// format needs no code for expansion.
+///
+/// The formats built in are made by create():
+///   - "ljh": LJH microcalorimeter pulse files.  The text header ends at
+///     "#End of Header"; each record is a 16-bit word, a 32-bit time
+///     stamp and "Total Samples" 16-bit samples.
+///   - "dirfile": one field file of a dirfile, whose type is read from
+///     the "format" file in the same directory.
+///   - "header:SIZE" or "header:MARKER": a header of SIZE bytes, or of
+///     text lines through the first to start with MARKER, then frames of
+///     the layout given by set_payload().
+// ---------------------------------------------------------------------------
+///
+
+
+/// Constructor: no regions yet.
+container_adapter::container_adapter() :
+  code(SLIM_ENCODER_REDUCED_BINARY), deltas(false), rotate(false),
+  regions(NULL), nregions(0), nalloc(0) {
+}
+
+
+
+/// Destructor.
+container_adapter::~container_adapter() {
+  delete [] regions;
+}
+
+
+
+/// Set how to code channels whose layout the format defines.
+/// \param code_in    Code method.
+/// \param deltas_in  Encode deltas?
+/// \param rotate_in  Let channels rotate up low bits?
+void container_adapter::set_channel_defaults(enum code_t code_in,
+                                             bool deltas_in, bool rotate_in) {
+  code = code_in;
+  deltas = deltas_in;
+  rotate = rotate_in;
+}
+
+
+
+/// Set the frame layout for formats whose frames the user describes.
+/// \param layout  The layout.
+void container_adapter::set_payload(const frame_schema &layout) {
+  payload = layout;
+}
+
+
+
+/// Forget all regions.
+void container_adapter::clear() {
+  nregions = 0;
+}
+
+
+
+/// Append a region to the file.
+/// \param nbytes  Size of the region (0 = the rest of the file).
+/// \param layout  Its frame layout.
+void container_adapter::add_region(size_t nbytes, const frame_schema &layout) {
+  if (nregions >= nalloc) {
+    nalloc = nalloc ? 2*nalloc : 4;
+    container_region *bigger = new container_region[nalloc];
+    for (int i=0; i<nregions; i++)
+      bigger[i] = regions[i];
+    delete [] regions;
+    regions = bigger;
+  }
+  regions[nregions].size = nbytes;
+  regions[nregions].layout = layout;
+  nregions++;
+}
+
+
+
+/// Append a header to the file: bytes slimmed as one channel of uint8.
+/// \param nbytes  Size of the header.
+void container_adapter::add_header(size_t nbytes) {
+  if (nbytes == 0)
+    return;
+  frame_schema layout;
+  schema_group g = group(1, 1, SLIM_TYPE_U8);
+  g.deltas = g.rotate = false;
+  layout.push(g);
+  add_region(nbytes, layout);
+}
+
+
+
+/// A group of channels coded as set_channel_defaults() says.
+/// \param nchan      Number of channels.
+/// \param repeats    Repeats per channel in a frame.
+/// \param data_type  Data type.
+/// \return The group.
+schema_group container_adapter::group(int nchan, int repeats,
+                                      enum data_t data_type) const {
+  schema_group g;
+  g.nchan = nchan;
+  g.repeats = repeats;
+  g.data_type = data_type;
+  g.code = code;
+  g.deltas = deltas;
+  g.rotate = rotate;
+  return g;
+}
+
+
+
+/// Measure a text header: the lines through the first that starts with
+/// a marker.  Throws bad_file if there is no such line before the end of
+/// the file, a non-text character, or an over-long line (any of which
+/// means the header ended without its marker).
+/// \param path    The file.
+/// \param marker  Text that starts the last line of the header.
+/// \param what    Name of the format, for messages.
+/// \param lines   (out) The lines of the header, if not NULL.
+/// \return Size of the header (bytes).
+static size_t text_header_size(const char *path, const string &marker,
+                               const char *what, string *lines=NULL) {
+  const size_t LINESIZE = 512;
+  ifstream fp(path);
+  if (!fp)
+    throw bad_file(path, ": cannot be read.");
+
+  string no_marker = string(": is not ") + what + ". No " + marker +
+    " marker";
+  size_t size = 0;
+  string line;
+  while (getline(fp, line)) {
+    if (line.size() >= LINESIZE)
+      throw bad_file(path, (no_marker + " before a long line").c_str());
+    for (size_t i=0; i<line.size(); i++)
+      if (line[i] < '\t' || line[i] >= 0x7f)
+        throw bad_file(path, (no_marker + " before non-text data").c_str());
+    size += line.size() + 1;
+    if (lines)
+      *lines += line + "\n";
+    if (line.compare(0, marker.size(), marker) == 0)
+      return size;
+  }
+  throw bad_file(path, no_marker.c_str());
+}
+
+
+
+// ---------------------------------------------------------------------------
+// LJH files
+// ---------------------------------------------------------------------------
+
+/// LJH microcalorimeter pulse files: a text header, then records.
+class ljh_container : public container_adapter {
+public:
+  const char *name() const {return "ljh";}
+  void parse(const char *path);
+};
+
+
+
+/// Find the header size and record length of an LJH file.
+/// \param path  The file.
+void ljh_container::parse(const char *path) {
+  clear();
+  string header;
+  size_t size = text_header_size(path, "#End of Header", "an LJH file",
+                                 &header);
+
+  int nsamples = 0;
+  istringstream lines(header);
+  string line;
+  while (getline(lines, line))
+    if (line.find("Total Samples:") == 0) {
+      size_t pos = line.find_first_of("0123456789");
+      if (pos != string::npos)
+        istringstream(line.substr(pos)) >> nsamples;
+    }
+  if (nsamples <= 0 ||
+      nsamples != int(nsamples & lowestNset[BITS_SLIM_REPETITIONS]))
+    throw bad_file(path, ": is not an LJH file. No usable Total Samples");
+
+  // Each record: a 16-bit word, a 32-bit time stamp, then the samples.
+  frame_schema record;
+  record.push(group(1, 1, SLIM_TYPE_U16));
+  record.push(group(1, 1, SLIM_TYPE_U32));
+  record.push(group(1, nsamples, SLIM_TYPE_U16));
+  add_header(size);
+  add_region(0, record);
+}
+
+
+
+// ---------------------------------------------------------------------------
+// Dirfile fields
+// ---------------------------------------------------------------------------
+
+/// One field file of a dirfile: a single channel, typed by the format file.
+class dirfile_container : public container_adapter {
+public:
+  const char *name() const {return "dirfile";}
+  void parse(const char *path);
+};
+
+
+
+/// Find the type of a dirfile field from the format file beside it.
+/// \param path  The field file.
+void dirfile_container::parse(const char *path) {
+  clear();
+  string dir(path), field(path);
+  size_t slash = dir.rfind('/');
+  if (slash == string::npos)
+    dir = ".";
+  else {
+    field = dir.substr(slash+1);
+    dir.erase(slash);
+  }
+
+  dirfile_format format;
+  try {
+    format.read(dir.c_str());
+  } catch (const bad_file &) {
+    throw bad_file(path, ": is not in a dirfile (no format file).");
+  }
+  const dirfile_field *f = format.find(field);
+  if (f == NULL)
+    throw bad_file(path, ": is not a RAW field of its dirfile.");
+  if (f->type == SLIM_TYPE_UNDETERMINED)
+    throw bad_file(path, (": dirfile type " + f->type_name +
+                          " cannot be slimmed.").c_str());
+  frame_schema layout;
+  layout.push(group(1, 1, f->type));
+  add_region(0, layout);
+}
+
+
+
+// ---------------------------------------------------------------------------
+// Generic header and frames
+// ---------------------------------------------------------------------------
+
+/// A header of fixed size or ending at a marker line, then frames of the
+/// layout given by set_payload().
+class header_container : public container_adapter {
+public:
+  header_container(const string &arg);
+  const char *name() const {return "header";}
+  void parse(const char *path);
+
+private:
+  string marker;         ///< Text starting the header's last line.
+  size_t size;           ///< Header size, if there is no marker.
+};
+
+
+
+/// Constructor.
+/// \param arg  The header size (bytes) or marker.
+header_container::header_container(const string &arg) : size(0) {
+  istringstream size_str(arg);
+  if (!(size_str >> size) || !size_str.eof())
+    marker = arg;
+}
+
+
+
+/// Find the header of a file.
+/// \param path  The file.
+void header_container::parse(const char *path) {
+  clear();
+  if (payload.empty())
+    throw "The header container needs a frame layout.";
+  add_header(marker.empty() ? size :
+             text_header_size(path, marker, "a headed file"));
+  add_region(0, payload);
+}
+
+
+
+/// Make an adapter for a container format.
+/// \param spec  The format: "ljh", "dirfile", "header:SIZE" or
+///              "header:MARKER".
+/// \return A new adapter (the caller deletes it).  Throws a message if
+///         the format is unknown.
+container_adapter *container_adapter::create(const char *spec) {
+  string name(spec), arg;
+  size_t colon = name.find(':');
+  if (colon != string::npos) {
+    arg = name.substr(colon+1);
+    name.erase(colon);
+  }
+
+  if (name == "ljh" && colon == string::npos)
+    return new ljh_container;
+  if (name == "dirfile" && colon == string::npos)
+    return new dirfile_container;
+  if (name == "header" && !arg.empty())
+    return new header_container(arg);
+  throw "Unknown container (use ljh, dirfile, header:SIZE or header:MARKER).";
+}
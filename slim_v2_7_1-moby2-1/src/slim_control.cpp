@@ -29,20 +29,49 @@
 #include <unistd.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "slim.h"
+#include "bitstream.h"
 #define RAW_SUFFIX ".raw"   ///< Suffix for all raw files when preserving original.
 
 
+/// Parse a byte count, with an optional suffix k, M or G (powers of 1024).
+/// \param str  The text to parse.
+/// \return The number of bytes (0 if unparseable).
+static size_t parse_size(const char *str) {
+  char *end;
+  unsigned long long n = strtoull(str, &end, 10);
+  if (end == str)
+    return 0;
+  switch (*end) {
+  case 'k': case 'K': n <<= 10; end++; break;
+  case 'm': case 'M': n <<= 20; end++; break;
+  case 'g': case 'G': n <<= 30; end++; break;
+  }
+  if (*end != '\0')
+    return 0;
+  return size_t(n);
+}
+
+
+
 /// Single-character options
-const char short_opt[] = "m:c:r:F:dnpXxSC0bPokquivsyfg987654321V?B:";
+const char short_opt[] = "m:c:r:D:eaK:GF:M:A::dnpXxSCLWR0bPokqtuivsyfgzZY::T:j:J:987654321V?B:";
 
 /// The long options slim recognizes.
 const static struct option long_opt[] = {
   {"method",            required_argument, NULL, 'm'},
   {"num-chan",          required_argument, NULL, 'c'},
   {"repeats",           required_argument, NULL, 'r'},
+  {"frame-schema",      required_argument, NULL, 'D'},
+  {"detect",            no_argument,       NULL, 'e'},
+  {"auto-layout",       no_argument,       NULL, 'a'},
+  {"container",         required_argument, NULL, 'K'},
+  {"dirfile",           no_argument,       NULL, 'G'},
   {"frames",            required_argument, NULL, 'F'},
+  {"section-size",      required_argument, NULL, 'M'},
+  {"adaptive",          optional_argument, NULL, 'A'},
   {"deltas",            no_argument,       NULL, 'd'},
   {"filename",          no_argument,       NULL, 'n'},
   {"preserve",          no_argument,       NULL, 'p'},
@@ -50,12 +79,18 @@ const static struct option long_opt[] = {
   {"expand",            no_argument,       NULL, 'x'},
   {"rawsize",           no_argument,       NULL, 'S'},
   {"compute-crc32",     no_argument,       NULL, 'C'},
+  {"section-sizes",     no_argument,       NULL, 'L'},
+  {"wide-sizes",        no_argument,       NULL, 'W'},
+  {"reuse-params",      no_argument,       NULL, 'R'},
   {"ignore-crc32",      no_argument,       NULL, '0'},
   {"permit-bitrotation",no_argument,       NULL, 'b'},
   {"practice",          no_argument,       NULL, 'P'},
   {"stdout",            no_argument,       NULL, 'o'},
   {"force",             no_argument,       NULL, 'k'},
+  {"jobs",              required_argument, NULL, 'j'},
+  {"job-memory",        required_argument, NULL, 'J'},
   {"quiet",             no_argument,       NULL, 'q'},
+  {"stats",             no_argument,       NULL, 't'},
   {"unsigned",          no_argument,       NULL, 'u'},
   {"int",               no_argument,       NULL, 'i'},
   {"ushort",            no_argument,       NULL, 'v'},
@@ -63,6 +98,10 @@ const static struct option long_opt[] = {
   {"char",              no_argument,       NULL, 'y'},
   {"float",             no_argument,       NULL, 'f'},
   {"double",            no_argument,       NULL, 'g'},
+  {"lz4",               no_argument,       NULL, 'z'},
+  {"lz4-thread",        no_argument,       NULL, 'Z'},
+  {"zstd",              optional_argument, NULL, 'Y'},
+  {"zstd-threads",      required_argument, NULL, 'T'},
   {"best",              no_argument,       NULL, '9'},
   {"18-pct",            no_argument,       NULL, '9'},
   {"16-pct",            no_argument,       NULL, '8'},
@@ -144,10 +183,40 @@ void slim_control::process_args(int argc, char * const argv[])
       onechan = (nchan == 1);
       break;
 
+    case 'D':
+      schema_path = optarg;
+      break;
+
+    case 'e':
+      detect_only = true;
+      break;
+
+    case 'a':
+      auto_layout = true;
+      break;
+
+    case 'K':
+      container_spec = optarg;
+      break;
+
+    case 'G':
+      dirfile_mode = true;
+      break;
+
     case 'F':
       nframes = atoi(optarg);
       break;
 
+    case 'M':
+      section_size = parse_size(optarg);
+      if (section_size < sizeof(Word_t) ||
+          section_size > MAX_SECTION_LENGTH_LIMIT) {
+        cerr << "slim: --section-size must be between " << sizeof(Word_t)
+             << " and " << MAX_SECTION_LENGTH_LIMIT << " bytes.\n";
+        exit(1);
+      }
+      break;
+
     case 'o':
       slimcat();
       break;
@@ -193,6 +262,26 @@ void slim_control::process_args(int argc, char * const argv[])
       crc = true;
       break;
 
+    case 'A':
+      adaptive = optarg ? atof(optarg) : 1.0;
+      if (adaptive <= 0.0) {
+        cerr << "slim: --adaptive ratio must be positive.\n";
+        exit(1);
+      }
+      break;
+
+    case 'L':
+      slim_sizes = true;
+      break;
+
+    case 'W':
+      wide_sizes = true;
+      break;
+
+    case 'R':
+      reuse_params = true;
+      break;
+
     case '0':
       ignore_crc = true;
       break;
@@ -205,10 +294,30 @@ void slim_control::process_args(int argc, char * const argv[])
       force_clobber = true;
       break;
 
+    case 'j':
+      njobs = atoi(optarg);
+      if (njobs < 1) {
+        cerr << "slim: --jobs must be at least 1.\n";
+        exit(1);
+      }
+      break;
+
+    case 'J':
+      job_memory = parse_size(optarg);
+      if (job_memory == 0) {
+        cerr << "slim: --job-memory must be a positive size.\n";
+        exit(1);
+      }
+      break;
+
     case 'q':
       quiet = true;
       break;
 
+    case 't':
+      print_stats = true;
+      break;
+
     case 'u':
       data_type = SLIM_TYPE_U32;
       break;
@@ -242,6 +351,25 @@ void slim_control::process_args(int argc, char * const argv[])
       data_type = SLIM_TYPE_DOUBLE;
       break;
 
+    case 'z':
+      lz4_output = true;
+      break;
+
+    case 'Z':
+      lz4_output = true;
+      lz4_thread = true;
+      break;
+
+    case 'Y':
+      zstd_level = optarg ? atoi(optarg) : 0;
+      if (zstd_level <= 0)
+        zstd_level = obitstream::DEFAULT_ZSTD_LEVEL;
+      break;
+
+    case 'T':
+      zstd_workers = atoi(optarg);
+      break;
+
     case '9': case '8': case '7':
     case '6': case '5': case '4':
     case '3': case '2': case '1':
@@ -276,6 +404,60 @@ void slim_control::process_args(int argc, char * const argv[])
     mode = SLIM_ENCODE;
     preserve_input = true;
   }
+
+  // Read the frame schema only now, so that -m, -d and -b can give its
+  // defaults wherever they appear.  It replaces -c, -r and the type.
+  if (schema_path) {
+    try {
+      schema.read(schema_path, code_method, deltas, permit_bitrotation);
+    } catch (const char *msg) {
+      cerr << "slim: " << schema_path << ":" << schema.line() << ": "
+           << msg << "\n";
+      exit(1);
+    } catch (const bad_file &bf) {
+      bf.mesg(cerr);
+      exit(1);
+    }
+    nchan = schema.num_channels();
+    onechan = (nchan == 1);
+  }
+
+  if (container_spec) {
+    try {
+      delete container_adapter::create(container_spec);
+    } catch (const char *msg) {
+      cerr << "slim: --container=" << container_spec << ": " << msg << "\n";
+      exit(1);
+    }
+    if (auto_layout) {
+      cerr << "slim: --auto-layout cannot be used with --container.\n";
+      exit(1);
+    }
+  }
+
+  if (dirfile_mode && (container_spec || schema_path || use_stdout ||
+                       detect_only || mode == SLIM_DECODE)) {
+    cerr << "slim: --dirfile cannot be used with --container, "
+      "--frame-schema, --stdout, --detect or --expand.\n";
+    exit(1);
+  }
+
+#ifndef HAVE_LIBLZ4
+  if (lz4_output) {
+    cerr << "slim: LZ4 output requires slim built with --with-lz4.\n";
+    exit(1);
+  }
+#endif
+#ifndef HAVE_LIBZSTD
+  if (zstd_level) {
+    cerr << "slim: zstd output requires slim built with --with-zstd.\n";
+    exit(1);
+  }
+#endif
+  if (lz4_output && zstd_level) {
+    cerr << "slim: choose at most one of --lz4 and --zstd.\n";
+    exit(1);
+  }
 }
 
 
@@ -333,6 +515,8 @@ void slim_control::set_defaults()
   nchan = 1;
   nframes = 0;
   repeats = 0;
+  section_size = MAX_SECTION_LENGTH;
+  adaptive = 0.0;
   debug_buf_size = 0;
   sample_pct = 10;
   mode = SLIM_MODE_UNKNOWN;
@@ -350,10 +534,27 @@ void slim_control::set_defaults()
   onechan = true;
   noreps = false;
   crc = false;
+  slim_sizes = false;
+  wide_sizes = false;
+  reuse_params = false;
   ignore_crc = false;
   reserved0 = false;
   practice = false;
   quiet = false;
+  print_stats = false;
+  lz4_output = false;
+  lz4_thread = false;
+  zstd_level = 0;
+  zstd_workers = 0;
+  njobs = 1;
+  job_memory = 0;
+  schema_path = NULL;
+  detect_only = false;
+  auto_layout = false;
+  container_spec = NULL;
+  dirfile_mode = false;
+  report = &cout;
+  errors = &cerr;
 }
 
 
@@ -371,6 +572,7 @@ char slim_control::flags() const
   if (onechan) r |= FLAG_ONECHAN;
   if (noreps) r |= FLAG_NOREPS;
   if (crc) r |= FLAG_CRC;
+  if (slim_sizes) r |= FLAG_SLEN;
   return r;
 }
 
@@ -388,6 +590,7 @@ char slim_control::flags(char in)
   onechan =       in & FLAG_ONECHAN;
   noreps =        in & FLAG_NOREPS;
   crc =           in & FLAG_CRC;
+  slim_sizes =    in & FLAG_SLEN;
 
   return in;
 }
@@ -423,12 +626,27 @@ void slim_control::handle_one_file(const char *fname)
   int ret = stat(fname, &st);
   if (ret)
     throw bad_file(fname, ": does not exist.");
+
+  // A dirfile is a directory: slim its fields, each to its own file.
+  if (dirfile_mode) {
+    if (!S_ISDIR(st.st_mode))
+      throw bad_file(fname, ": is not a dirfile directory.");
+    if (compress_dirfile(fname) > 0)
+      throw bad_file(fname, ": some fields could not be slimmed.");
+    return;
+  }
   if (S_ISDIR(st.st_mode)) {
     throw bad_file(fname, " is a directory -- ignored.");
   }
   if (!S_ISREG(st.st_mode)) {
     throw bad_file(fname, ": not a regular file.");
   }
+
+  // Finding the layout reads the file but changes nothing.
+  if (detect_only) {
+    detect_one_file(fname);
+    return;
+  }
   if (st.st_nlink > 1 && !force_clobber && !preserve_input) {
     throw bad_file(fname, ": has more than one hard link (use -k to force).");
   }
@@ -459,31 +677,247 @@ void slim_control::handle_one_file(const char *fname)
 
 
 
-/// Compress one file using slim_compressor_t::compress_from_file()
-/// \param rawname  The name of the file to be encoded.
-void slim_control::compress_one_file(const char *rawname) {
+/// Progress of one file in slim_control::handle_files().
+enum job_status_t {
+  JOB_PENDING,              ///< Not finished (or not started).
+  JOB_DONE,                 ///< Finished successfully.
+  JOB_BAD_FILE,             ///< Failed with an error about this file.
+  JOB_FATAL,                ///< Failed with an error that stops everything.
+  JOB_SKIPPED,              ///< Never started, because of a fatal error.
+};
 
-  // Verify that file exists
-  struct stat st;
-  int ret = stat(rawname, &st);
-  if (ret)
-    throw bad_file(rawname, ": does not exist.");
-  const size_t raw_file_size = st.st_size;
 
-  // Create the output slim-file name, create compressor object.
-  ostringstream outstr;
-  outstr << rawname << '.' << SLIM_SUFFIX;
-  string outname_string = outstr.str();
-  const char *outname = outname_string.c_str();
 
-  if (!force_clobber) {
-    ret = stat(outname, &st);
-    if (ret == 0)
-      throw bad_file(outname, ": slim file exists (use -k to force).");
+/// The state shared by the threads of slim_control::handle_files().
+struct slim_jobs_t {
+  const slim_control *ctrl; ///< Settings for all files.
+  int nfiles;               ///< Number of files.
+  char * const *fnames;     ///< Names of the files.
+  int next;                 ///< Next file to start.
+  size_t budget;            ///< Memory budget for all jobs (bytes).
+  size_t in_use;            ///< Memory estimate of the running jobs (bytes).
+  bool stop;                ///< A fatal error happened: start no more files.
+  int *status;              ///< Each file's job_status_t.
+  string *out;              ///< Each file's statistics, when done.
+  string *err;              ///< Each file's warnings and errors, when done.
+  const char **fatal;       ///< Each file's fatal error, or NULL.
+  pthread_mutex_t lock;     ///< Guards all of the above.
+  pthread_cond_t changed;   ///< Signals a finished job.
+};
+
+
+
+/// Body of each worker thread of slim_control::handle_files(): handle
+/// files in turn, each with its own copy of the settings, while the
+/// memory budget allows, and save their messages.
+/// \param arg  The slim_jobs_t.
+static void *run_jobs(void *arg) {
+  slim_jobs_t *jobs = static_cast<slim_jobs_t *>(arg);
+
+  pthread_mutex_lock(&jobs->lock);
+  while (!jobs->stop && jobs->next < jobs->nfiles) {
+    const int i = jobs->next++;
+    pthread_mutex_unlock(&jobs->lock);
+    const size_t need = jobs->ctrl->memory_estimate(jobs->fnames[i]);
+    pthread_mutex_lock(&jobs->lock);
+
+    // Any one job may run alone, however large.
+    while (!jobs->stop && jobs->in_use > 0 &&
+           jobs->in_use + need > jobs->budget)
+      pthread_cond_wait(&jobs->changed, &jobs->lock);
+    if (jobs->stop) {
+      jobs->status[i] = JOB_SKIPPED;
+      pthread_cond_broadcast(&jobs->changed);
+      break;
+    }
+    jobs->in_use += need;
+    pthread_mutex_unlock(&jobs->lock);
+
+    ostringstream out, err;
+    int status = JOB_DONE;
+    const char *fatal = NULL;
+    slim_control *job = jobs->ctrl->clone();
+    job->set_report(&out, &err);
+    try {
+      job->handle_one_file(jobs->fnames[i]);
+    } catch (const bad_file &bf) {
+      bf.mesg(err);
+      status = JOB_BAD_FILE;
+    } catch (char const *error) {
+      fatal = error;
+      status = JOB_FATAL;
+    }
+    delete job;
+
+    pthread_mutex_lock(&jobs->lock);
+    jobs->in_use -= need;
+    jobs->out[i] = out.str();
+    jobs->err[i] = err.str();
+    jobs->fatal[i] = fatal;
+    jobs->status[i] = status;
+    if (status == JOB_FATAL)
+      jobs->stop = true;
+    pthread_cond_broadcast(&jobs->changed);
   }
+  pthread_mutex_unlock(&jobs->lock);
+  return NULL;
+}
+
+
+
+/// Handle many files, by encoding or decoding each.  With --jobs N, up to
+/// N files are handled at once, so long as their memory estimates fit the
+/// --job-memory budget.  Either way, each file's statistics and errors are
+/// printed in the order of the files.
+/// An error about one file is reported and the others are handled anyway.
+/// Any other error (a const char *) is reported, and slim exits once
+/// the files already started are done.
+/// \param nfiles  Number of files.
+/// \param fnames  Names of the files.
+/// \return Number of files that failed.
+int slim_control::handle_files(int nfiles, char * const fnames[])
+{
+  int n_bad_files = 0;
+
+  // One at a time.  Output to stdout can't be shared between files, and
+  // each dirfile shares its fields among the jobs.
+  if (njobs <= 1 || nfiles <= 1 || use_stdout || dirfile_mode) {
+    for (int i=0; i<nfiles; i++) {
+      try {
+        handle_one_file(fnames[i]);
+
+      } catch (const bad_file &bf) {
+        // Handle errors specific to this one file with a message to stderr.
+        bf.mesg();
+        n_bad_files++;
+
+      } catch (char const *error) {
+        // In general error case, abort.
+        cerr << "Caught error: " << error << "\n";
+        exit(1);
+      }
+    }
+    return n_bad_files;
+  }
+
+  slim_jobs_t jobs;
+  jobs.ctrl = this;
+  jobs.nfiles = nfiles;
+  jobs.fnames = fnames;
+  jobs.next = 0;
+  jobs.budget = job_memory;
+  if (jobs.budget == 0) {
+    // By default, half the physical memory.
+    long pages = sysconf(_SC_PHYS_PAGES), pagesize = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && pagesize > 0)
+      jobs.budget = size_t(pages) * size_t(pagesize) / 2;
+    else
+      jobs.budget = size_t(1) << 30;
+  }
+  jobs.in_use = 0;
+  jobs.stop = false;
+  jobs.status = new int[nfiles];
+  jobs.out = new string[nfiles];
+  jobs.err = new string[nfiles];
+  jobs.fatal = new const char *[nfiles];
+  for (int i=0; i<nfiles; i++)
+    jobs.status[i] = JOB_PENDING;
+  pthread_mutex_init(&jobs.lock, NULL);
+  pthread_cond_init(&jobs.changed, NULL);
+
+  const int nwanted = njobs < nfiles ? njobs : nfiles;
+  pthread_t *threads = new pthread_t[nwanted];
+  int nthreads = 0;
+  while (nthreads < nwanted &&
+         pthread_create(&threads[nthreads], NULL, run_jobs, &jobs) == 0)
+    nthreads++;
+  if (nthreads == 0) {
+    cerr << "slim: cannot start threads for --jobs.\n";
+    exit(1);
+  }
+
+  // Report each file in order, as soon as it and all before it are done.
+  const char *fatal = NULL;
+  pthread_mutex_lock(&jobs.lock);
+  for (int i=0; i<nfiles; i++) {
+    while (jobs.status[i] == JOB_PENDING && !(jobs.stop && i >= jobs.next))
+      pthread_cond_wait(&jobs.changed, &jobs.lock);
+    if (jobs.status[i] == JOB_PENDING)
+      break;      // Never started, nor will any later file be.
+    if (jobs.status[i] == JOB_SKIPPED)
+      continue;
+    pthread_mutex_unlock(&jobs.lock);
+
+    cout << jobs.out[i] << flush;
+    cerr << jobs.err[i];
+    if (jobs.status[i] == JOB_BAD_FILE)
+      n_bad_files++;
+    if (jobs.status[i] == JOB_FATAL && fatal == NULL) {
+      fatal = jobs.fatal[i];
+      cerr << "Caught error: " << fatal << "\n";
+    }
+    pthread_mutex_lock(&jobs.lock);
+  }
+  pthread_mutex_unlock(&jobs.lock);
+
+  for (int t=0; t<nthreads; t++)
+    pthread_join(threads[t], NULL);
+  delete [] threads;
+  pthread_cond_destroy(&jobs.changed);
+  pthread_mutex_destroy(&jobs.lock);
+  delete [] jobs.status;
+  delete [] jobs.out;
+  delete [] jobs.err;
+  delete [] jobs.fatal;
+
+  if (fatal)
+    exit(1);
+  return n_bad_files;
+}
+
+
+
+/// Make a copy of these settings, for handling one file on its own
+/// thread.  Derived classes with settings of their own must override.
+/// \return The copy (the caller must delete it).
+slim_control *slim_control::clone() const
+{
+  return new slim_control(*this);
+}
+
+
+
+/// Estimate the memory needed to handle one file: its I/O buffers and
+/// the largest raw section it can hold (at most the --section-size).  The
+/// raw size of a slim file is not known until it is read, so assume that
+/// it expands at most 64-fold.
+/// \param fname  The name of the file to be encoded or decoded.
+/// \return The estimate (bytes), or 0 if the file doesn't exist.
+size_t slim_control::memory_estimate(const char *fname) const
+{
+  enum slim_mode_t thismode = mode;
+  if (thismode == SLIM_MODE_UNKNOWN)
+    thismode = detect_file_mode(fname);
+
+  struct stat st;
+  if (stat(fname, &st))
+    return 0;
+  size_t raw = st.st_size;
+  if (thismode == SLIM_DECODE)
+    raw = (raw > section_size/64) ? section_size : 64*raw;
+  if (raw > section_size)
+    raw = section_size;
+  return raw + 2*obitstream::DEFAULT_IOBUFFER_SIZE;
+}
+
 
-  slim_compressor_t *compressor =
-    new slim_compressor_t(outname, flags(), deltas, sample_pct);
+
+/// Create the channels for a raw file from the -c, -r, -F and type
+/// options, when there is no frame schema.
+/// \param compressor     The compressor to get the channels.
+/// \param raw_file_size  Size of the raw file (bytes).
+void slim_control::build_channels(slim_compressor_t *compressor,
+                                  size_t raw_file_size) {
 
   // If no cmd-line indications, just let there be 1 frame,
   // and all data go in multiple repeats within that section and frame.
@@ -493,7 +927,8 @@ void slim_control::compress_one_file(const char *rawname) {
     nframes_thisfile = 1;
   } else if (nframes <= 0) {
     if (repeats == 1)
-      nframes_thisfile =  divide_round_up(raw_file_size, sizeof(int)*nchan);
+      nframes_thisfile =  divide_round_up(raw_file_size,
+                                          sizeof(int)*size_t(nchan));
     else
       nframes_thisfile = 1;
   } else if (repeats <= 0) {
@@ -501,14 +936,21 @@ void slim_control::compress_one_file(const char *rawname) {
   }
 
   // Treat 1-channel sections as a single frame, for efficient compress time.
-  // Then break up that frame only if it exceeds the MAX_SECTION_LENGTH
+  // Then break up that frame only if it exceeds the section size limit
+  // (or, for adaptive sections, into blocks that sections are built from).
   if (nchan == 1) {
+    size_t words = raw_file_size / sizeof(int);
+    if (repeats > 0 || nframes > 0)
+      words = size_t(repeats_thisfile) * nframes_thisfile;
+    const size_t sect_words = (adaptive > 0.0 && section_size >
+                               size_t(ADAPTIVE_BLOCK_LENGTH) ?
+                               size_t(ADAPTIVE_BLOCK_LENGTH) : section_size)
+      / sizeof(int);
+    nframes_thisfile = divide_round_up(words, sect_words);
     if (nframes_thisfile > 1)
-      repeats_thisfile *= nframes_thisfile;
-    nframes_thisfile = divide_round_up(repeats_thisfile,
-                                       MAX_SECTION_LENGTH / sizeof(int));
-    if (nframes_thisfile > 1)
-      repeats_thisfile = MAX_SECTION_LENGTH / sizeof(int);
+      repeats_thisfile = sect_words;
+    else
+      repeats_thisfile = words;
   }
   noreps = (repeats_thisfile == 1);
 
@@ -518,9 +960,110 @@ void slim_control::compress_one_file(const char *rawname) {
 		    deltas, permit_bitrotation);
 
   compressor->set_section_frames(nframes_thisfile);
+}
+
+
+
+/// Compress one file using slim_compressor_t::compress_from_file()
+/// \param rawname  The name of the file to be encoded.
+void slim_control::compress_one_file(const char *rawname) {
+
+  // Verify that file exists
+  struct stat st;
+  int ret = stat(rawname, &st);
+  if (ret)
+    throw bad_file(rawname, ": does not exist.");
+  const size_t raw_file_size = st.st_size;
+
+  // Create the output slim-file name, create compressor object.
+  ostringstream outstr;
+  outstr << rawname << '.' << SLIM_SUFFIX;
+  if (lz4_output)
+    outstr << ".lz4";
+  else if (zstd_level)
+    outstr << ".zst";
+  string outname_string = outstr.str();
+  const char *outname = outname_string.c_str();
+
+  if (!force_clobber) {
+    ret = stat(outname, &st);
+    if (ret == 0)
+      throw bad_file(outname, ": slim file exists (use -k to force).");
+  }
+
+  // Find the frame layout, if asked.  Files too short to judge keep the
+  // layout given on the command line.
+  frame_schema detected;
+  const frame_schema *layout = &schema;
+  if (auto_layout) {
+    frame_detector detector;
+    if (njobs > 1)
+      detector.set_threads(1);  // The jobs already share the CPUs.
+    try {
+      detector.detect(rawname, detected, permit_bitrotation);
+    } catch (const bad_file &) {
+      detected = frame_schema();
+    }
+    if (!detected.empty())
+      layout = &detected;
+    onechan = (layout->empty() ? nchan : layout->num_channels()) == 1;
+  }
+
+  // A container format divides the file into regions, each with its own
+  // channels.  Frames that the format leaves to the user are described
+  // by --frame-schema or by -c, -r and the type.
+  container_adapter *container = NULL;
+  if (container_spec) {
+    frame_schema payload(schema);
+    if (payload.empty()) {
+      schema_group g = {nchan, repeats > 0 ? repeats : 1, data_type,
+                        code_method, deltas, permit_bitrotation};
+      payload.push(g);
+    }
+    container = container_adapter::create(container_spec);
+    container->set_channel_defaults(code_method, deltas, permit_bitrotation);
+    container->set_payload(payload);
+    try {
+      container->parse(rawname);
+    } catch (...) {
+      delete container;
+      throw;
+    }
+    onechan = true;
+    for (int r=0; r<container->size(); r++)
+      onechan = onechan && (*container)[r].layout.num_channels() == 1;
+    noreps = false;
+  }
+
+  slim_compressor_t *compressor =
+    new slim_compressor_t(outname, flags(), deltas, sample_pct);
+  if (lz4_output)
+    compressor->use_lz4(lz4_thread);
+  else if (zstd_level)
+    compressor->use_zstd(zstd_level, zstd_workers);
+  compressor->set_max_section_size(section_size);
+  compressor->set_wide_sizes(wide_sizes);
+  compressor->set_adaptive(adaptive);
+  compressor->set_reuse_params(reuse_params);
+
+  // A frame schema gives the channels; sections hold as many whole
+  // frames as fit, unless -F asks for fewer.
+  if (container == NULL) {
+    if (!layout->empty()) {
+      compressor->set_layout(*layout);
+      if (nframes > 0 && layout->num_channels() > 1)
+        compressor->set_section_frames(nframes);
+    } else
+      build_channels(compressor, raw_file_size);
+  }
+
   compressor->set_quiet(quiet);
-  compressor->compress_from_file(rawname);
+  compressor->set_report(report);
+  compressor->set_stats(print_stats);
+  compressor->compress_from_file(rawname, container);
+  compressor->write_stats(*report);
   delete compressor;
+  delete container;
 
   // Clean up unwanted files
   struct stat st_raw, st_out;
@@ -529,7 +1072,7 @@ void slim_control::compress_one_file(const char *rawname) {
   if (ret1 || ret2) return;
   if (!force_clobber && (st_raw.st_size <= st_out.st_size)) {
     if (!quiet)
-      cerr << "slim: " << rawname <<
+      *errors << "slim: " << rawname <<
         " expanded when slimmed (use -k to force).\n";
     unlink(outname);
   } else if (practice) {
@@ -541,6 +1084,87 @@ void slim_control::compress_one_file(const char *rawname) {
 
 
 
+/// Slim all RAW fields of a dirfile with slim_dirfile_t, --jobs of them
+/// at once, and write the manifest "slim.manifest" in the dirfile.
+/// Errors about single fields are printed, not thrown.
+/// \param dir  The dirfile directory.
+/// \return Number of fields that failed.
+int slim_control::compress_dirfile(const char *dir) {
+  slim_dirfile_t dirfile(dir);
+
+  // Each field is one channel.
+  onechan = true;
+  noreps = false;
+  dirfile.set_threads(njobs);
+  dirfile.set_flags(flags(), sample_pct);
+  dirfile.set_channel_defaults(code_method, deltas, permit_bitrotation);
+  dirfile.set_auto_code(auto_layout);
+  dirfile.set_max_section_size(section_size);
+  dirfile.set_adaptive(adaptive);
+  dirfile.set_reuse_params(reuse_params);
+  dirfile.set_wide_sizes(wide_sizes);
+  if (lz4_output)
+    dirfile.use_lz4(lz4_thread);
+  else if (zstd_level)
+    dirfile.use_zstd(zstd_level, zstd_workers);
+  dirfile.set_force(force_clobber);
+  dirfile.set_preserve(preserve_input);
+  dirfile.set_practice(practice);
+
+  const int nfailed = dirfile.compress();
+  const string manifest = dirfile.write_manifest();
+
+  const dirfile_format &fields = dirfile.get_fields();
+  size_t raw_total = 0, slim_total = 0;
+  int nslimmed = 0;
+  for (int i=0; i<fields.size(); i++) {
+    const dirfile_field &f = fields[i];
+    if (f.status == DIRFILE_FAILED)
+      *errors << "slim: " << dir << "/" << f.name << ": " << f.message << "\n";
+    if (f.status == DIRFILE_SLIMMED || f.status == DIRFILE_EARLIER)
+      nslimmed++;
+    raw_total += f.raw_bytes;
+    slim_total += f.slim_bytes;
+  }
+  if (!quiet) {
+    ios_base::fmtflags old = report->flags();
+    streamsize oldprec = report->precision(3);
+    report->setf(ios_base::fixed, ios_base::floatfield);
+    *report << dir << ": " << nslimmed << " of " << fields.size()
+            << " fields slimmed, " << raw_total << " -> " << slim_total
+            << " bytes ("
+            << (slim_total ? double(raw_total) / slim_total : 1.0)
+            << ":1); manifest in " << manifest << "\n";
+    report->flags(old);
+    report->precision(oldprec);
+  }
+  return nfailed;
+}
+
+
+
+/// Find the frame layout of one raw file, and print it as a frame schema
+/// (see --frame-schema) with the compression ratio of the sample.
+/// \param rawname  The name of the raw file.
+void slim_control::detect_one_file(const char *rawname) {
+  frame_detector detector;
+  frame_schema layout;
+  double ratio = detector.detect(rawname, layout, permit_bitrotation);
+
+  ios_base::fmtflags old = report->flags();
+  streamsize oldprec = report->precision(3);
+  report->setf(ios_base::fixed, ios_base::floatfield);
+  *report << "# " << rawname << ": " << detector.get_frame_size()
+          << "-byte frames, " << layout.num_channels() << " channels, "
+          << ratio << ":1 on the first " << detector.get_sample_size()
+          << " bytes\n";
+  report->flags(old);
+  report->precision(oldprec);
+  layout.write(*report);
+}
+
+
+
 /// Expand one compressed file using slim_expander_t::expand_to_file().
 /// \param compname  The name of the file to be decoded.
 void slim_control::expand_one_file(const char *compname) {
@@ -556,10 +1180,11 @@ void slim_control::expand_one_file(const char *compname) {
   // But if we have --preserve, then append a ".raw" suffix instead.
   const char *last_suffix = strrchr(compname,'.');
   size_t baselen;
-#ifdef HAVE_LIBLZ4
+#if defined(HAVE_LIBLZ4) || defined(HAVE_LIBZSTD)
   if (last_suffix &&
-    (!strcmp(last_suffix, ".lz4") || !strcmp(last_suffix, ".LZ4"))) {
-    // Strip off extra LZ4 suffix if found
+    (!strcmp(last_suffix, ".lz4") || !strcmp(last_suffix, ".LZ4") ||
+     !strcmp(last_suffix, ".zst") || !strcmp(last_suffix, ".ZST"))) {
+    // Strip off extra LZ4 or zstd suffix if found
     char *period = (char*) last_suffix;
     ((char *) last_suffix)[0] = '\0';
     last_suffix = strrchr(compname, '.');
@@ -599,11 +1224,18 @@ void slim_control::expand_one_file(const char *compname) {
   if (ignore_crc)
     expander->set_ignore_crc();
   expander->set_quiet(quiet);
+  expander->set_report(report);
+  expander->set_errors(errors);
+  expander->set_stats(print_stats);
 
-  if (use_stdout)
+  // With raw data on stdout, statistics go to the error stream.
+  if (use_stdout) {
     expander->expand_to_stdout();
-  else
+    expander->write_stats(*errors);
+  } else {
     expander->expand_to_file(rawname);
+    expander->write_stats(*report);
+  }
 
   delete expander;
   delete [] rawname;
@@ -647,7 +1279,10 @@ void slim_control::debug_compress_from_memory(const char *rawname) {
   // If no cmd-line indications, just let there be 1 frame, 1 section,
   // and all data go in multiple repeats within that section and frame.
   int repeats_thisfile = repeats;
-  if (repeats <= 0 && nframes <= 0) {
+  if (!schema.empty()) {
+    if (nframes <= 0)
+      nframes = INT_MAX;
+  } else if (repeats <= 0 && nframes <= 0) {
     repeats_thisfile = raw_file_size/sizeof(int);
     nframes = 1;
   } else if (nframes <= 0) {
@@ -660,9 +1295,12 @@ void slim_control::debug_compress_from_memory(const char *rawname) {
   }
 
   // Build the channel list
-  for (int i=0; i<nchan; i++)
-    compressor->add_channel(repeats_thisfile, code_method, data_type,
-		    deltas, permit_bitrotation);
+  if (!schema.empty())
+    schema.add_channels(compressor);
+  else
+    for (int i=0; i<nchan; i++)
+      compressor->add_channel(repeats_thisfile, code_method, data_type,
+                              deltas, permit_bitrotation);
 
   compressor->set_section_frames(nframes);
 
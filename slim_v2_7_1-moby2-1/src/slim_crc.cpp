@@ -0,0 +1,228 @@
+/// \file slim_crc.cpp
+/// Implements fast computation of the CRC-32 (IEEE 802.3), giving the
+/// same values as the byte-at-a-time table of crc.h.
+
+//  Copyright (C) 2008, 2009 Joseph Fowler
+//
+//  This file is part of slim, a compression package for science data.
+//
+//  Slim is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Slim is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with slim.  If not, see <http://www.gnu.org/licenses/>.
+
+// Three methods are available, chosen once at run time:
+//
+// 1. The folding method of Gopal et al., "Fast CRC Computation for
+//    Generic Polynomials Using PCLMULQDQ Instruction" (Intel, 2009), on
+//    x86-64 processors with carry-less multiply.  Used for all whole
+//    16-byte blocks of any buffer of at least 64 bytes.
+// 2. "Slicing-by-16": 16 lookup tables, consuming 16 bytes per step.
+// 3. The classic table of crc.h, one byte per step, for the odd bytes.
+
+#include <cstring>
+#include <pthread.h>
+#include "slim.h"
+#include "crc.h"   // for CRC32 table
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define SLIM_CRC_PCLMUL
+#include <immintrin.h>
+#endif
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define SLIM_CRC_BYTEWISE_ONLY  // Slicing tables assume little-endian words.
+#endif
+
+
+static uint32_t crc_slice_table[16][256]; ///< Tables for slicing-by-16.
+static bool use_pclmul = false;           ///< CPU has carry-less multiply?
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+
+
+/// Build the slicing tables and check the CPU.  Runs once.
+static void crc_setup() {
+  for (int i=0; i<256; i++)
+    crc_slice_table[0][i] = uint32_t(slim_crc_32_table[i]);
+  for (int k=1; k<16; k++)
+    for (int i=0; i<256; i++) {
+      uint32_t c = crc_slice_table[k-1][i];
+      crc_slice_table[k][i] = (c >> 8) ^ crc_slice_table[0][c & 0xff];
+    }
+
+#ifdef SLIM_CRC_PCLMUL
+  __builtin_cpu_init();
+  use_pclmul = __builtin_cpu_supports("pclmul") &&
+    __builtin_cpu_supports("sse4.1");
+#endif
+}
+
+
+
+/// Advance the CRC register one byte at a time.
+/// \param c      The CRC register (pre-inverted).
+/// \param s      The data.
+/// \param length Number of bytes.
+/// \return The new CRC register.
+static inline uint32_t crc_bytewise(uint32_t c, const unsigned char *s,
+                                    size_t length) {
+  while (length--)
+    c = crc_slice_table[0][(c ^ *s++) & 0xff] ^ (c >> 8);
+  return c;
+}
+
+
+
+#ifndef SLIM_CRC_BYTEWISE_ONLY
+/// Advance the CRC register 16 bytes at a time (slicing-by-16).
+/// \param c      The CRC register (pre-inverted).
+/// \param s      The data.
+/// \param length Number of bytes (a multiple of 16).
+/// \return The new CRC register.
+static uint32_t crc_slicing16(uint32_t c, const unsigned char *s,
+                              size_t length) {
+  const uint32_t (*t)[256] = crc_slice_table;
+  for (; length >= 16; length -= 16, s += 16) {
+    uint32_t w[4];
+    memcpy(w, s, 16);
+    w[0] ^= c;
+    c = t[15][w[0] & 0xff] ^ t[14][(w[0]>>8) & 0xff] ^
+      t[13][(w[0]>>16) & 0xff] ^ t[12][w[0]>>24] ^
+      t[11][w[1] & 0xff] ^ t[10][(w[1]>>8) & 0xff] ^
+      t[9][(w[1]>>16) & 0xff] ^ t[8][w[1]>>24] ^
+      t[7][w[2] & 0xff] ^ t[6][(w[2]>>8) & 0xff] ^
+      t[5][(w[2]>>16) & 0xff] ^ t[4][w[2]>>24] ^
+      t[3][w[3] & 0xff] ^ t[2][(w[3]>>8) & 0xff] ^
+      t[1][(w[3]>>16) & 0xff] ^ t[0][w[3]>>24];
+  }
+  return c;
+}
+#endif
+
+
+
+#ifdef SLIM_CRC_PCLMUL
+/// Advance the CRC register by folding with carry-less multiplication.
+/// The constants are the bit-reflected ones for the CRC-32 polynomial
+/// from the Intel paper; the last step is a Barrett reduction.
+/// \param c      The CRC register (pre-inverted).
+/// \param s      The data.
+/// \param length Number of bytes (at least 64, a multiple of 16).
+/// \return The new CRC register.
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc_pclmul(uint32_t c, const unsigned char *s,
+                           size_t length) {
+  const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+  const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+  const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+  const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+  const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+  __m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+  // Fold four 128-bit lanes in parallel, 64 bytes per step.
+  x1 = _mm_loadu_si128((const __m128i *)(s + 0x00));
+  x2 = _mm_loadu_si128((const __m128i *)(s + 0x10));
+  x3 = _mm_loadu_si128((const __m128i *)(s + 0x20));
+  x4 = _mm_loadu_si128((const __m128i *)(s + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(int(c)));
+  s += 64;
+  length -= 64;
+
+  for (; length >= 64; length -= 64, s += 64) {
+    x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                       _mm_loadu_si128((const __m128i *)(s + 0x00)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+                       _mm_loadu_si128((const __m128i *)(s + 0x10)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+                       _mm_loadu_si128((const __m128i *)(s + 0x20)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+                       _mm_loadu_si128((const __m128i *)(s + 0x30)));
+  }
+
+  // Fold the four lanes into one.
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  // Fold any remaining 16-byte blocks.
+  for (; length >= 16; length -= 16, s += 16) {
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                       _mm_loadu_si128((const __m128i *)s));
+  }
+
+  // Reduce 128 bits to 64, then Barrett-reduce to 32.
+  x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, mask32);
+  x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  x2 = _mm_and_si128(x1, mask32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+  x2 = _mm_and_si128(x2, mask32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return uint32_t(_mm_extract_epi32(x1, 1));
+}
+#endif
+
+
+
+/// Compute or continue a CRC-32 (IEEE 802.3).  The CRC of a buffer can be
+/// built up from pieces: slim_crc32(slim_crc32(0, a, na), b, nb) is the
+/// CRC of a followed by b.
+/// \param crc    CRC of the data so far (0 for none).
+/// \param buf    The next data.
+/// \param length Number of bytes in buf.
+/// \return The CRC of all data so far.
+uint32_t slim_crc32(uint32_t crc, const void *buf, size_t length) {
+  pthread_once(&crc_once, crc_setup);
+
+  const unsigned char *s = static_cast<const unsigned char *>(buf);
+  uint32_t c = crc ^ 0xffffffffU;
+
+#ifdef SLIM_CRC_PCLMUL
+  if (use_pclmul && length >= 64) {
+    size_t n = length & ~size_t(15);
+    c = crc_pclmul(c, s, n);
+    s += n;
+    length -= n;
+  }
+#endif
+#ifndef SLIM_CRC_BYTEWISE_ONLY
+  if (length >= 16) {
+    size_t n = length & ~size_t(15);
+    c = crc_slicing16(c, s, n);
+    s += n;
+    length -= n;
+  }
+#endif
+  c = crc_bytewise(c, s, length);
+  return c ^ 0xffffffffU;
+}
@@ -0,0 +1,688 @@
+/// \file slim_detect.cpp
+/// Implements frame_detector, which finds the frame layout of a raw file
+/// of unknown structure.
+
+//  Copyright (C) 2008, 2009 Joseph Fowler
+//
+//  This file is part of slim, a compression package for science data.
+//
+//  Slim is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Slim is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with slim.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <iostream>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <pthread.h>
+#include <unistd.h>
+#include "slim.h"
+
+// Comparing the sample with itself at each lag works on 16 bytes at a
+// time with SSE2 where we have it (all x86-64).
+#if defined(__SSE2__) && defined(__GNUC__)
+#define SLIM_DETECT_SSE2
+#include <emmintrin.h>
+#endif
+
+static const size_t DETECT_SAMPLE_SIZE = 4 << 20; ///< Most bytes of file to read.
+static const size_t DETECT_MIN_SAMPLE = 256;     ///< Fewest bytes to work with.
+static const size_t DETECT_LAG_BYTES = 256 << 10; ///< Bytes compared per lag.
+static const size_t DETECT_MODEL_BYTES = 512 << 10; ///< Bytes modelled per layout.
+static const size_t DETECT_MIN_FRAMES = 16;  ///< Fewest frames to judge a layout.
+static const size_t DETECT_MAX_FRAME = 8192; ///< Default largest frame (bytes).
+static const int DETECT_SHORTLIST = 12;      ///< Lags kept after screening.
+static const int DETECT_LAGS_PER_TASK = 64;  ///< Lags screened per thread task.
+static const double PARAM_BITS = 80.0; ///< Rough size of one channel's params.
+
+
+
+//----------------------------------------------------------------------
+// Running tasks on several threads
+//----------------------------------------------------------------------
+
+/// Tasks shared out among the threads of run_parallel().
+struct detect_work_t {
+  void (*task)(void *ctx, int i); ///< Do task number i.
+  void *ctx;             ///< Context for every task.
+  int ntasks;            ///< Number of tasks.
+  int next;              ///< Next task to start.
+  pthread_mutex_t lock;  ///< Guards next.
+};
+
+
+
+/// Body of each thread of run_parallel(): take tasks until none are left.
+/// \param arg  The detect_work_t.
+static void *detect_worker(void *arg) {
+  detect_work_t *work = static_cast<detect_work_t *>(arg);
+  for (;;) {
+    pthread_mutex_lock(&work->lock);
+    const int i = work->next++;
+    pthread_mutex_unlock(&work->lock);
+    if (i >= work->ntasks)
+      break;
+    work->task(work->ctx, i);
+  }
+  return NULL;
+}
+
+
+
+/// Run tasks 0 to ntasks-1 on up to nthreads threads (this one included).
+/// \param task      The function that does one task.
+/// \param ctx       Context for every task.
+/// \param ntasks    Number of tasks.
+/// \param nthreads  Most threads to use.
+static void run_parallel(void (*task)(void *, int), void *ctx,
+                         int ntasks, int nthreads) {
+  detect_work_t work;
+  work.task = task;
+  work.ctx = ctx;
+  work.ntasks = ntasks;
+  work.next = 0;
+  pthread_mutex_init(&work.lock, NULL);
+
+  if (nthreads > ntasks)
+    nthreads = ntasks;
+  pthread_t *threads = new pthread_t[nthreads > 1 ? nthreads-1 : 1];
+  int started = 0;
+  for (int t=1; t<nthreads; t++)
+    if (pthread_create(&threads[started], NULL, detect_worker, &work) == 0)
+      started++;
+  detect_worker(&work);
+  for (int t=0; t<started; t++)
+    pthread_join(threads[t], NULL);
+  delete [] threads;
+  pthread_mutex_destroy(&work.lock);
+}
+
+
+
+//----------------------------------------------------------------------
+// Screening frame sizes
+//----------------------------------------------------------------------
+
+/// Total distance between bytes and the bytes lag earlier, where the
+/// distance of two bytes is their difference modulo 256, taken as small
+/// (0 to 128) either way.  Frame sizes (and their multiples) give small
+/// totals, because each byte is then compared with the same byte of the
+/// previous frame.
+/// \param p    The first byte to compare (p-lag must be valid).
+/// \param n    Number of bytes to compare.
+/// \param lag  The lag.
+/// \return The total distance.
+static uint64_t lag_distance(const unsigned char *p, size_t n, size_t lag) {
+  uint64_t total = 0;
+  size_t i = 0;
+#ifdef SLIM_DETECT_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  __m128i sum = zero;
+  for (; i+16 <= n; i+=16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p+i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p+i-lag));
+    __m128i d = _mm_sub_epi8(a, b);
+    d = _mm_min_epu8(d, _mm_sub_epi8(zero, d));
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(d, zero));
+  }
+  uint64_t lanes[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), sum);
+  total = lanes[0] + lanes[1];
+#endif
+  for (; i<n; i++) {
+    uint8_t d = p[i] - p[i-lag];
+    uint8_t nd = -d;
+    total += (d < nd) ? d : nd;
+  }
+  return total;
+}
+
+
+
+/// The lag screening shared by the threads.
+struct lag_screen_t {
+  const unsigned char *p; ///< First byte compared.
+  size_t n;               ///< Bytes compared.
+  size_t maxlag;          ///< Largest lag.
+  uint64_t *distance;     ///< Result for each lag (index 0 unused).
+};
+
+
+
+/// Screen one block of lags.
+/// \param ctx  The lag_screen_t.
+/// \param i    Block number.
+static void screen_lags(void *ctx, int i) {
+  lag_screen_t *s = static_cast<lag_screen_t *>(ctx);
+  size_t first = 1 + size_t(i) * DETECT_LAGS_PER_TASK;
+  for (size_t lag=first; lag<first+DETECT_LAGS_PER_TASK && lag<=s->maxlag;
+       lag++)
+    s->distance[lag] = lag_distance(s->p, s->n, lag);
+}
+
+
+
+//----------------------------------------------------------------------
+// Modelling the cost of a layout
+//----------------------------------------------------------------------
+
+/// The best way found to code one column (one word position in a frame).
+struct column_model_t {
+  double bits;           ///< Estimated bits per frame.
+  enum data_t type;      ///< Data type.
+  enum code_t code;      ///< Code method.
+  bool deltas;           ///< Code successive differences?
+};
+
+
+
+/// Bits needed for a signed value in the reduced binary code's terms:
+/// the length of its zig-zag form.
+/// \param s  The value.
+/// \return The number of bits.
+static inline int signed_bits(int64_t s) {
+  uint64_t zz = (uint64_t(s) << 1) ^ uint64_t(s >> 63);
+  return zz ? 64 - __builtin_clzll(zz) : 0;
+}
+
+
+
+/// Bits per datum of the reduced binary code.  The encoder picks the
+/// code length k from a histogram of data sizes about the mean (see
+/// encoder_reduced_binary::best_code_length), but it keeps the all-ones
+/// code for overflows, so data at the top edge of the window overflow too.
+/// \param hist   Histogram of signed_bits() of the centered data.
+/// \param edge   Count, for each k, of the centered data at the top edge
+///               of a k-bit window (-1 for k=1, else 2^(k-1)-1).
+/// \param n      Number of data.
+/// \param wbits  Word size (bits).
+/// \return The bits per datum.
+static double reduced_binary_bits(const uint64_t hist[], const uint64_t edge[],
+                                  uint64_t n, int wbits) {
+  uint64_t over = 0, best_length = ~uint64_t(0);
+  int nbits = wbits;
+  for (int k=wbits; k>0; k--) {
+    if (k < wbits)
+      over += hist[k+1];
+    uint64_t length = over*wbits + uint64_t(k)*n;
+    if (length < best_length) {
+      best_length = length;
+      nbits = k;
+    }
+  }
+  over = 0;
+  for (int l=nbits+1; l<=wbits; l++)
+    over += hist[l];
+  return nbits + double(over + edge[nbits]) * wbits / n;
+}
+
+
+
+/// Count a centered datum in the size histogram and the window edges.
+/// \param d     The datum less the mean.
+/// \param hist  Histogram of signed_bits().
+/// \param edge  Counts of data at the top edge of each window size.
+static inline void tally(int64_t d, uint64_t hist[], uint64_t edge[]) {
+  hist[signed_bits(d)]++;
+  if (d == -1)
+    edge[1]++;
+  else if (d > 0 && ((d+1) & d) == 0)
+    edge[signed_bits(d)]++;
+}
+
+
+
+/// Estimate the cheapest code for one column of a candidate layout:
+/// constant, reduced binary on values or deltas, runlength, or raw.
+/// \param p       The column's word in the first frame.
+/// \param nf      Number of frames.
+/// \param stride  Frame size (bytes).
+/// \return The column's model.
+template <typename U, typename S>
+static column_model_t model_column(const unsigned char *p, size_t nf,
+                                   size_t stride) {
+  U x0, prev, x;
+  memcpy(&x0, p, sizeof(U));
+  prev = x0;
+  uint64_t changes = 0;
+  int64_t offset = 0, dsum = 0;
+  S smin = S(x0), smax = S(x0);
+  U umin = x0, umax = x0;
+  for (size_t f=1; f<nf; f++) {
+    memcpy(&x, p + f*stride, sizeof(U));
+    offset += S(U(x - x0));
+    dsum += S(U(x - prev));
+    changes += (x != prev);
+    if (S(x) < smin) smin = S(x);
+    if (S(x) > smax) smax = S(x);
+    if (x < umin) umin = x;
+    if (x > umax) umax = x;
+    prev = x;
+  }
+
+  // The reduced binary code centers values (or deltas) on their typical
+  // size, so measure each from its mean.
+  const U mean = U(x0 + U(llrint(double(offset) / nf)));
+  const U mean_delta = U(llrint(double(dsum) / (nf - 1)));
+  uint64_t vhist[8*sizeof(U)+1], dhist[8*sizeof(U)+1];
+  uint64_t vedge[8*sizeof(U)+1], dedge[8*sizeof(U)+1];
+  for (size_t b=0; b<=8*sizeof(U); b++)
+    vhist[b] = dhist[b] = vedge[b] = dedge[b] = 0;
+  prev = x0;
+  for (size_t f=0; f<nf; f++) {
+    memcpy(&x, p + f*stride, sizeof(U));
+    tally(S(U(x - mean)), vhist, vedge);
+    if (f > 0)
+      tally(S(U(x - prev - mean_delta)), dhist, dedge);
+    prev = x;
+  }
+
+  // Signed if the data (or their deltas) span less range that way.
+  const bool is_signed = uint64_t(int64_t(smax) - int64_t(smin)) <
+    uint64_t(umax - umin);
+  const int width = sizeof(U);
+  column_model_t m;
+  if (width == 4)
+    m.type = is_signed ? SLIM_TYPE_I32 : SLIM_TYPE_U32;
+  else if (width == 2)
+    m.type = is_signed ? SLIM_TYPE_I16 : SLIM_TYPE_U16;
+  else
+    m.type = is_signed ? SLIM_TYPE_I8 : SLIM_TYPE_U8;
+  m.code = SLIM_ENCODER_REDUCED_BINARY;
+  m.deltas = false;
+
+  // Constant columns get the constant code automatically.
+  if (changes == 0) {
+    m.bits = 0.0;
+    return m;
+  }
+
+  // A run costs a value and a length.
+  const int wbits = 8*width;
+  m.bits = reduced_binary_bits(vhist, vedge, nf, wbits);
+  double dbits = reduced_binary_bits(dhist, dedge, nf-1, wbits);
+  if (dbits < m.bits) {
+    m.bits = dbits;
+    m.deltas = true;
+  }
+  double runs = changes * (8.0*width + 8.0) / double(nf - 1);
+  if (runs < m.bits) {
+    m.bits = runs;
+    m.code = SLIM_ENCODER_RUNLENGTH;
+    m.deltas = false;
+  }
+  if (8.0*width < m.bits) {
+    m.bits = 8.0*width;
+    m.code = SLIM_ENCODER_DEFAULT;
+    m.deltas = false;
+  }
+  return m;
+}
+
+
+
+/// Find the cheapest split of a frame into 1-, 2- and 4-byte columns by
+/// dynamic programming over byte offsets, and make a schema of it.
+/// \param sample  The sample data.
+/// \param size    Bytes of sample to model.
+/// \param frame   The frame size (bytes).
+/// \param rotate  Let the channels rotate up low bits?
+/// \param schema  (out) The layout.
+/// \return Estimated compression ratio (0 if too few frames to judge).
+static double model_layout(const unsigned char *sample, size_t size,
+                           size_t frame, bool rotate, frame_schema &schema) {
+  schema = frame_schema();
+  const size_t nf = size / frame;
+  if (nf < DETECT_MIN_FRAMES)
+    return 0.0;
+
+  // Each channel's params, amortized over the frames of a section.
+  size_t sect_frames = MAX_SECTION_LENGTH / frame;
+  if (sect_frames > nf)
+    sect_frames = nf;
+  const double overhead = PARAM_BITS / sect_frames;
+
+  double *best = new double[frame+1];
+  column_model_t *chosen = new column_model_t[frame+1];
+  int *width = new int[frame+1];
+  best[0] = 0.0;
+  for (size_t o=1; o<=frame; o++)
+    best[o] = -1.0;
+  for (size_t o=0; o<frame; o++) {
+    for (int w=1; w<=4 && o+w<=frame; w*=2) {
+      const unsigned char *p = sample + o;
+      column_model_t m;
+      if (w == 4)
+        m = model_column<uint32_t,int32_t>(p, nf, frame);
+      else if (w == 2)
+        m = model_column<uint16_t,int16_t>(p, nf, frame);
+      else
+        m = model_column<uint8_t,int8_t>(p, nf, frame);
+      double cost = best[o] + m.bits + overhead;
+      if (best[o+w] < 0.0 || cost < best[o+w]) {
+        best[o+w] = cost;
+        chosen[o+w] = m;
+        width[o+w] = w;
+      }
+    }
+  }
+
+  // Walk back from the end of the frame, then group like neighbors.
+  int ncol = 0;
+  for (size_t o=frame; o>0; o-=width[o])
+    ncol++;
+  column_model_t *cols = new column_model_t[ncol];
+  int c = ncol;
+  for (size_t o=frame; o>0; o-=width[o])
+    cols[--c] = chosen[o];
+  for (c=0; c<ncol; ) {
+    schema_group g;
+    g.nchan = 1;
+    g.repeats = 1;
+    g.data_type = cols[c].type;
+    g.code = cols[c].code;
+    g.deltas = cols[c].deltas;
+    g.rotate = rotate;
+    for (c++; c<ncol && cols[c].type == g.data_type &&
+           cols[c].code == g.code && cols[c].deltas == g.deltas; c++)
+      g.nchan++;
+    schema.push(g);
+  }
+
+  double bits = best[frame];
+  delete [] cols;
+  delete [] width;
+  delete [] chosen;
+  delete [] best;
+  if (bits < 1e-3)
+    bits = 1e-3;
+  return 8.0 * frame / bits;
+}
+
+
+
+/// Compress the sample with a layout, discarding the output.
+/// \param sample  The sample data.
+/// \param size    Bytes of sample.
+/// \param frame   The frame size (bytes).
+/// \param schema  The layout.
+/// \return Compression ratio (0 on failure).
+static double compress_sample(const unsigned char *sample, size_t size,
+                              size_t frame, const frame_schema &schema) {
+  const size_t nf = size / frame;
+  const size_t whole = nf * frame;
+  size_t slim_bytes = 0;
+  slim_compressor_t *compressor = NULL;
+  try {
+    compressor = new slim_compressor_t("/dev/null", 0, false, 10);
+    compressor->set_quiet(true);
+    compressor->set_stats(true);
+    schema.add_channels(compressor);
+    compressor->set_section_frames(nf);
+    for (size_t done=0; done<whole; )
+      done += compressor->write_onesection(sample + done, whole - done);
+    slim_bytes = compressor->get_stats()->slim_bytes;
+  } catch (const char *) {
+    slim_bytes = 0;
+  } catch (const bad_file &) {
+    slim_bytes = 0;
+  }
+  delete compressor;
+  return slim_bytes ? double(whole) / slim_bytes : 0.0;
+}
+
+
+
+/// The candidate layouts shared by the threads.
+struct layout_search_t {
+  const unsigned char *sample; ///< The sample data.
+  size_t model_size;     ///< Bytes to model, and to compress on trial.
+  bool rotate;           ///< Let the channels rotate up low bits?
+  size_t *frame;         ///< Frame size of each candidate.
+  frame_schema *layout;  ///< Layout of each candidate.
+  double *estimate;      ///< Modelled ratio of each candidate.
+  double *ratio;         ///< Compressed ratio of each candidate.
+  int *finalist;         ///< Candidates to compress.
+};
+
+
+
+/// Model one candidate's layout.
+/// \param ctx  The layout_search_t.
+/// \param i    Candidate number.
+static void model_candidate(void *ctx, int i) {
+  layout_search_t *s = static_cast<layout_search_t *>(ctx);
+  s->estimate[i] = model_layout(s->sample, s->model_size, s->frame[i],
+                                s->rotate, s->layout[i]);
+}
+
+
+
+/// Compress the modelled part of the sample with one finalist's layout.
+/// \param ctx  The layout_search_t.
+/// \param i    Finalist number.
+static void compress_finalist(void *ctx, int i) {
+  layout_search_t *s = static_cast<layout_search_t *>(ctx);
+  const int k = s->finalist[i];
+  s->ratio[k] = compress_sample(s->sample, s->model_size, s->frame[k],
+                                s->layout[k]);
+}
+
+
+
+// ---------------------------------------------------------------------------
+/// \class frame_detector
+/// Finds the frame layout of a raw file by searching on a sample from its
+/// start (up to 4 MB), in three steps, each spread over several threads:
+///
+/// 1. Screen every frame size up to the limit by comparing the sample
+///    with itself at that lag, and keep the best few and all of their
+///    divisors (a multiple of the frame size looks as good as the frame).
+/// 2. For each of these frame sizes, split the frame into 1-, 2- and
+///    4-byte columns to minimize the modelled cost, choosing each
+///    column's signedness, code method and deltas.
+/// 3. Compress the start of the sample with each of these layouts, and
+///    keep the one that really compresses best (favoring the smaller
+///    frame on a tie).
+// ---------------------------------------------------------------------------
+///
+
+
+/// Constructor.  Searches with one thread per processor by default.
+frame_detector::frame_detector() :
+  sample(NULL), sample_size(0), max_frame(DETECT_MAX_FRAME), frame_size(0)
+{
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  nthreads = (ncpu > 0) ? int(ncpu) : 1;
+}
+
+
+
+/// Destructor.
+frame_detector::~frame_detector() {
+  delete [] sample;
+}
+
+
+
+/// Set the number of threads to search with.
+/// \param n  Number of threads (at least 1).
+void frame_detector::set_threads(int n) {
+  nthreads = (n > 0) ? n : 1;
+}
+
+
+
+/// Set the largest frame size to consider.
+/// \param bytes  The size (bytes).
+void frame_detector::set_max_frame_size(size_t bytes) {
+  max_frame = (bytes > 0) ? bytes : 1;
+}
+
+
+
+/// Find the frame layout of a file.
+/// \param path    The raw file.
+/// \param schema  (out) The layout found.
+/// \param rotate  Let the channels rotate up low bits?
+/// \return The compression ratio of the sample with that layout.
+double frame_detector::detect(const char *path, frame_schema &schema,
+                              bool rotate) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL)
+    throw bad_file(path, ": cannot be read.");
+  if (sample == NULL)
+    sample = new unsigned char[DETECT_SAMPLE_SIZE];
+  sample_size = fread(sample, 1, DETECT_SAMPLE_SIZE, fp);
+  fclose(fp);
+  if (sample_size < DETECT_MIN_SAMPLE)
+    throw bad_file(path, ": too short to find a frame layout.");
+
+  // Step 1: screen all lags.
+  size_t maxlag = sample_size / DETECT_MIN_FRAMES;
+  if (maxlag > max_frame)
+    maxlag = max_frame;
+  lag_screen_t screen;
+  screen.p = sample + maxlag;
+  screen.n = sample_size - maxlag;
+  if (screen.n > DETECT_LAG_BYTES)
+    screen.n = DETECT_LAG_BYTES;
+  screen.maxlag = maxlag;
+  screen.distance = new uint64_t[maxlag+1];
+  run_parallel(screen_lags, &screen,
+               int(divide_round_up(maxlag, size_t(DETECT_LAGS_PER_TASK))),
+               nthreads);
+
+  // Keep the closest lags, every divisor of them, and the single-channel
+  // layouts.  A multiple of the frame size can look as close as the frame
+  // size itself, or closer, so any divisor of a close lag may be the frame.
+  bool *candidate = new bool[maxlag+1];
+  for (size_t lag=0; lag<=maxlag; lag++)
+    candidate[lag] = false;
+  const size_t simple[3] = {1, 2, 4};
+  for (int i=0; i<3; i++)
+    if (simple[i] <= maxlag)
+      candidate[simple[i]] = true;
+  bool *taken = new bool[maxlag+1];
+  for (size_t lag=0; lag<=maxlag; lag++)
+    taken[lag] = false;
+  for (int k=0; k<DETECT_SHORTLIST; k++) {
+    size_t lag = 0;
+    for (size_t l=1; l<=maxlag; l++)
+      if (!taken[l] && (lag == 0 || screen.distance[l] < screen.distance[lag]))
+        lag = l;
+    if (lag == 0)
+      break;
+    taken[lag] = true;
+    for (size_t d=1; d<=lag; d++)
+      if (lag % d == 0)
+        candidate[d] = true;
+  }
+  size_t *frame = new size_t[maxlag+1];
+  int ncand = 0;
+  for (size_t lag=1; lag<=maxlag; lag++)
+    if (candidate[lag])
+      frame[ncand++] = lag;
+  delete [] taken;
+  delete [] candidate;
+  delete [] screen.distance;
+
+  // Step 2: model a layout for each frame size.
+  layout_search_t search;
+  search.sample = sample;
+  search.model_size = sample_size < DETECT_MODEL_BYTES ?
+    sample_size : DETECT_MODEL_BYTES;
+  search.rotate = rotate;
+  search.frame = frame;
+  search.layout = new frame_schema[ncand];
+  search.estimate = new double[ncand];
+  search.ratio = new double[ncand];
+  int *finalist = new int[ncand];
+  search.finalist = finalist;
+  run_parallel(model_candidate, &search, ncand, nthreads);
+
+  // Step 3: compress part of the sample with every layout that could be
+  // modelled.  The model misjudges some layouts, so it only rules out
+  // frame sizes with too few frames in the sample.
+  int nfinal = 0;
+  for (int i=0; i<ncand; i++) {
+    search.ratio[i] = 0.0;
+    if (search.estimate[i] > 0.0)
+      finalist[nfinal++] = i;
+  }
+  run_parallel(compress_finalist, &search, nfinal, nthreads);
+
+  // Favor the smaller frame unless the larger is clearly better.
+  int best = -1;
+  for (int j=0; j<nfinal; j++) {
+    const int k = finalist[j];
+    if (search.ratio[k] <= 0.0)
+      continue;
+    if (best < 0)
+      best = k;
+    else {
+      const bool smaller = frame[k] < frame[best];
+      const double margin = smaller ? 0.995 : 1.005;
+      if (search.ratio[k] > margin * search.ratio[best])
+        best = k;
+    }
+  }
+
+  // Report how the whole sample compresses with the winner.
+  double ratio = 0.0;
+  if (best >= 0) {
+    schema = search.layout[best];
+    frame_size = frame[best];
+    ratio = compress_sample(sample, sample_size, frame_size, schema);
+  }
+  delete [] search.ratio;
+  delete [] search.estimate;
+  delete [] search.layout;
+  delete [] finalist;
+  delete [] frame;
+  if (best < 0)
+    throw bad_file(path, ": no frame layout could be found.");
+  return ratio;
+}
+
+
+
+/// Choose the code method and deltas for a file of one channel of known
+/// type (such as one field of a dirfile), from a sample of it.
+/// \param path  The raw file.
+/// \param g     (in/out) The channel: its data_type is used, and its
+///              code and deltas are set if the file is long enough.
+/// \return Whether the file was long enough to judge.
+bool frame_detector::choose_code(const char *path, schema_group &g) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL)
+    throw bad_file(path, ": cannot be read.");
+  if (sample == NULL)
+    sample = new unsigned char[DETECT_SAMPLE_SIZE];
+  sample_size = fread(sample, 1, DETECT_MODEL_BYTES, fp);
+  fclose(fp);
+
+  const size_t width = slim_type_size[g.data_type];
+  const size_t nf = sample_size / width;
+  if (nf < DETECT_MIN_FRAMES)
+    return false;
+  column_model_t m;
+  if (width == 4)
+    m = model_column<uint32_t,int32_t>(sample, nf, width);
+  else if (width == 2)
+    m = model_column<uint16_t,int16_t>(sample, nf, width);
+  else
+    m = model_column<uint8_t,int8_t>(sample, nf, width);
+  g.code = m.code;
+  g.deltas = m.deltas;
+  return true;
+}
@@ -0,0 +1,534 @@
+/// \file slim_dirfile.cpp
+/// Implements dirfile_format, the list of RAW fields of a dirfile, and
+/// slim_dirfile_t, which slims all of its fields at once.
+
+//  Copyright (C) 2008, 2009 Joseph Fowler
+//
+//  This file is part of slim, a compression package for science data.
+//
+//  Slim is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Slim is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with slim.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "slim.h"
+
+static const int DIRFILE_MAX_INCLUDE_DEPTH = 16; ///< Deepest /INCLUDE nesting.
+
+/// Data types of dirfile RAW fields, old (one letter) and new style.
+/// Floats are slimmed as if int32, as with -f.  The 64-bit and complex
+/// types cannot be slimmed.
+static const struct {
+  const char *name;      ///< Type as written in the format file.
+  enum data_t type;      ///< The slim data type.
+  bool is_float;         ///< Floating-point data?
+} dirfile_types[] = {
+  {"c", SLIM_TYPE_U8, false},   {"UINT8", SLIM_TYPE_U8, false},
+  {"INT8", SLIM_TYPE_I8, false},
+  {"u", SLIM_TYPE_U16, false},  {"UINT16", SLIM_TYPE_U16, false},
+  {"s", SLIM_TYPE_I16, false},  {"INT16", SLIM_TYPE_I16, false},
+  {"U", SLIM_TYPE_U32, false},  {"UINT32", SLIM_TYPE_U32, false},
+  {"S", SLIM_TYPE_I32, false},  {"i", SLIM_TYPE_I32, false},
+  {"INT32", SLIM_TYPE_I32, false},
+  {"f", SLIM_TYPE_I32, true},   {"FLOAT32", SLIM_TYPE_I32, true},
+  {"FLOAT", SLIM_TYPE_I32, true},
+  {NULL, SLIM_TYPE_UNDETERMINED, false}
+};
+
+/// Names of the dirfile_status_t values, for the manifest.
+static const char *const status_names[] = {
+  "pending", "slimmed", "earlier", "skipped", "failed"
+};
+
+
+
+// ---------------------------------------------------------------------------
+/// \class dirfile_format
+/// The RAW fields of a dirfile, as listed in its "format" file and any
+/// fragments that it includes.  A dirfile is a directory holding one
+/// flat binary file per field; each RAW line of the format file reads
+///
+///     name  RAW  type  samples_per_frame
+///
+/// Other field kinds (LINCOM, BIT...) are computed from the RAW fields
+/// and have no files, so they are ignored, as are directives other than
+/// /INCLUDE.  Text after a '#' is a comment.
+// ---------------------------------------------------------------------------
+///
+
+
+/// Constructor: no fields.
+dirfile_format::dirfile_format() :
+  fields(NULL), nfields(0), nalloc(0) {
+}
+
+
+
+/// Destructor.
+dirfile_format::~dirfile_format() {
+  delete [] fields;
+}
+
+
+
+/// Read the format file of a dirfile, replacing any fields already held.
+/// Throws bad_file if the format file (or a fragment) cannot be read.
+/// \param dir  The dirfile directory.
+void dirfile_format::read(const char *dir) {
+  nfields = 0;
+  read_file(dir, "format", 0);
+}
+
+
+
+/// Read one format file fragment.
+/// \param dir    The directory holding the fragment.
+/// \param name   The fragment's file name (relative to dir).
+/// \param depth  Number of /INCLUDEs that led here.
+void dirfile_format::read_file(const string &dir, const string &name,
+                               int depth) {
+  const string path = dir + "/" + name;
+  ifstream in(path.c_str());
+  if (!in) {
+    if (depth == 0)
+      throw bad_file(dir.c_str(), ": is not a dirfile (no format file).");
+    throw bad_file(path.c_str(), ": cannot read dirfile format fragment.");
+  }
+
+  // Fields of a fragment in a subdirectory have their files there, too.
+  string subdir;
+  size_t slash = name.rfind('/');
+  if (slash != string::npos)
+    subdir = name.substr(0, slash+1);
+
+  string text;
+  while (getline(in, text)) {
+    size_t hash = text.find('#');
+    if (hash != string::npos)
+      text.erase(hash);
+    istringstream line(text);
+    string word;
+    if (!(line >> word))
+      continue;
+
+    if (word == "/INCLUDE" || word == "INCLUDE") {
+      string fragment;
+      if (!(line >> fragment))
+        continue;
+      if (depth >= DIRFILE_MAX_INCLUDE_DEPTH)
+        throw bad_file(path.c_str(), ": dirfile /INCLUDEs nest too deeply.");
+      // Fragments (and so their fields) must lie within the dirfile.
+      if (fragment[0] == '/' || fragment.find("..") != string::npos)
+        throw bad_file(path.c_str(), (": dirfile fragment " + fragment +
+                                      " is outside the dirfile.").c_str());
+      read_file(dir, subdir + fragment, depth+1);
+      continue;
+    }
+
+    string kind;
+    dirfile_field f;
+    if (word[0] == '/' || !(line >> kind >> f.type_name) || kind != "RAW")
+      continue;
+    // Names become file paths, which must lie within the dirfile and
+    // differ (the fields may be slimmed at once).
+    if (word.find('/') != string::npos || word.find("..") != string::npos)
+      throw bad_file(path.c_str(), (": dirfile field name " + word +
+                                    " is not a plain file name.").c_str());
+    f.name = subdir + word;
+    if (find(f.name))
+      throw bad_file(path.c_str(), (": dirfile field " + f.name +
+                                    " is listed twice.").c_str());
+    if (!(line >> f.spf) || f.spf <= 0)
+      f.spf = 1;
+    f.type = SLIM_TYPE_UNDETERMINED;
+    f.is_float = false;
+    for (int i=0; dirfile_types[i].name; i++)
+      if (f.type_name == dirfile_types[i].name) {
+        f.type = dirfile_types[i].type;
+        f.is_float = dirfile_types[i].is_float;
+        break;
+      }
+    f.code = SLIM_ENCODER_REDUCED_BINARY;
+    f.deltas = false;
+    f.raw_bytes = f.slim_bytes = 0;
+    f.status = DIRFILE_PENDING;
+    push(f);
+  }
+}
+
+
+
+/// Append a field.
+/// \param f  The field.
+void dirfile_format::push(const dirfile_field &f) {
+  if (nfields >= nalloc) {
+    nalloc = nalloc ? 2*nalloc : 16;
+    dirfile_field *bigger = new dirfile_field[nalloc];
+    for (int i=0; i<nfields; i++)
+      bigger[i] = fields[i];
+    delete [] fields;
+    fields = bigger;
+  }
+  fields[nfields++] = f;
+}
+
+
+
+/// Find a field by name.
+/// \param name  The field's name (its file, relative to the dirfile).
+/// \return The field, or NULL if there is no RAW field of that name.
+const dirfile_field *dirfile_format::find(const string &name) const {
+  for (int i=0; i<nfields; i++)
+    if (fields[i].name == name)
+      return &fields[i];
+  return NULL;
+}
+
+
+
+// ---------------------------------------------------------------------------
+/// \class slim_dirfile_t
+/// Slims every RAW field of a dirfile, each to its own slim file beside
+/// the raw one (name.slm, the name that GetData's slim encoding reads).
+/// Each field is a single channel of the type that the format file gives.
+/// The fields are shared out among a pool of threads; each thread keeps
+/// one compressor, and its section buffers, from field to field.
+///
+/// compress() records what became of each field, and write_manifest()
+/// lists them with their raw and slim sizes.
+// ---------------------------------------------------------------------------
+///
+
+
+/// Constructor.  Reads the dirfile's format file (throws bad_file if it
+/// cannot be read).
+/// \param dir_in  The dirfile directory.
+slim_dirfile_t::slim_dirfile_t(const char *dir_in) :
+  dir(dir_in), nthreads(1), flags(FLAG_ONECHAN), sample_pct(50),
+  code(SLIM_ENCODER_REDUCED_BINARY), deltas(false), rotate(false),
+  auto_code(false), section_size(MAX_SECTION_LENGTH), adaptive(0.0),
+  reuse_params(false), wide_sizes(false), lz4_output(false),
+  lz4_thread(false), zstd_level(0), zstd_workers(0), force(false),
+  preserve(false), practice(false), next(0) {
+  format.read(dir_in);
+  pthread_mutex_init(&lock, NULL);
+}
+
+
+
+/// Destructor.
+slim_dirfile_t::~slim_dirfile_t() {
+  pthread_mutex_destroy(&lock);
+}
+
+
+
+/// Set the number of fields to slim at once.
+/// \param n  Number of threads (at least 1).
+void slim_dirfile_t::set_threads(int n) {
+  nthreads = (n > 0) ? n : 1;
+}
+
+
+
+/// Set the header flags and sampling of each slim file.
+/// \param flags_in       File header flags (see slim_control::flags()).
+/// \param sample_pct_in  Percent of data sampled to choose parameters.
+void slim_dirfile_t::set_flags(char flags_in, int sample_pct_in) {
+  flags = flags_in;
+  sample_pct = sample_pct_in;
+}
+
+
+
+/// Set how to code the fields, unless chosen per field.
+/// \param code_in    Code method.
+/// \param deltas_in  Encode deltas?  (Never for floating-point fields.)
+/// \param rotate_in  Let channels rotate up low bits?
+void slim_dirfile_t::set_channel_defaults(enum code_t code_in,
+                                          bool deltas_in, bool rotate_in) {
+  code = code_in;
+  deltas = deltas_in;
+  rotate = rotate_in;
+}
+
+
+
+/// Wrap each slim file in an LZ4 frame (as name.slm.lz4).
+/// \param background_thread  Run LZ4 on a helper thread?
+void slim_dirfile_t::use_lz4(bool background_thread) {
+  lz4_output = true;
+  lz4_thread = background_thread;
+  zstd_level = 0;
+}
+
+
+
+/// Wrap each slim file in a zstd frame (as name.slm.zst).
+/// \param level     zstd compression level.
+/// \param nworkers  zstd compression threads (0 = none).
+void slim_dirfile_t::use_zstd(int level, int nworkers) {
+  zstd_level = level;
+  zstd_workers = nworkers;
+  lz4_output = false;
+}
+
+
+
+/// Slim all fields of the dirfile.
+/// \return Number of fields that failed.
+int slim_dirfile_t::compress() {
+  next = 0;
+  for (int i=0; i<format.size(); i++)
+    format[i].status = DIRFILE_PENDING;
+
+  const int nwanted = nthreads < format.size() ? nthreads : format.size();
+  pthread_t *threads = new pthread_t[nwanted > 1 ? nwanted : 1];
+  int nstarted = 0;
+  while (nwanted > 1 && nstarted < nwanted &&
+         pthread_create(&threads[nstarted], NULL, worker, this) == 0)
+    nstarted++;
+  if (nstarted == 0)
+    worker(this);
+  for (int t=0; t<nstarted; t++)
+    pthread_join(threads[t], NULL);
+  delete [] threads;
+
+  int nfailed = 0;
+  for (int i=0; i<format.size(); i++)
+    if (format[i].status == DIRFILE_FAILED)
+      nfailed++;
+  return nfailed;
+}
+
+
+
+/// Body of each worker thread of compress(): slim fields in turn with
+/// one compressor, until none are left.
+/// \param arg  The slim_dirfile_t.
+void *slim_dirfile_t::worker(void *arg) {
+  slim_dirfile_t *d = static_cast<slim_dirfile_t *>(arg);
+  slim_compressor_t *compressor = NULL;
+  frame_detector detector;
+  detector.set_threads(1);   // The workers already share the CPUs.
+
+  for (;;) {
+    pthread_mutex_lock(&d->lock);
+    const int i = d->next++;
+    pthread_mutex_unlock(&d->lock);
+    if (i >= d->format.size())
+      break;
+    d->compress_field(d->format[i], compressor, detector);
+  }
+  delete compressor;
+  return NULL;
+}
+
+
+
+/// Find the raw and slim sizes of a field that an earlier run slimmed,
+/// from its slim file.
+/// \param slim  The field's slim file.
+/// \param f     (out) The field.
+/// \return Whether slim is a readable slim file.
+static bool describe_earlier(const string &slim, dirfile_field &f) {
+  struct stat st;
+  if (stat(slim.c_str(), &st) || !S_ISREG(st.st_mode))
+    return false;
+
+  slim_expander_t *expander = NULL;
+  size_t raw_bytes = 0;
+  bool readable = false;
+  try {
+    expander = new slim_expander_t(slim.c_str());
+    if (expander->is_open()) {
+      if (expander->has_rawsize())
+        raw_bytes = expander->get_rawsize();
+      else {
+        slim_section_info_t info;
+        size_t size;
+        while ((size = expander->scan_section(&info)) > 0)
+          raw_bytes += size;
+      }
+      readable = true;
+    }
+  } catch (const bad_file &bf) {
+    readable = false;
+  } catch (const char *error) {
+    readable = false;
+  }
+  delete expander;
+  if (readable) {
+    f.raw_bytes = raw_bytes;
+    f.slim_bytes = st.st_size;
+  }
+  return readable;
+}
+
+
+
+/// Slim one field, and record what became of it.  Errors about the
+/// field are recorded, not thrown.
+/// \param f           The field.
+/// \param compressor  (in/out) The thread's compressor, or NULL to make
+///                    one.  Deleted and set to NULL after an error.
+/// \param detector    The thread's detector, to choose codes with.
+void slim_dirfile_t::compress_field(dirfile_field &f,
+                                    slim_compressor_t *&compressor,
+                                    frame_detector &detector) {
+  const string raw = dir + "/" + f.name;
+  f.code = code;
+  f.deltas = deltas && !f.is_float;
+  f.raw_bytes = f.slim_bytes = 0;
+  f.message.clear();
+
+  struct stat st;
+  if (stat(raw.c_str(), &st) || !S_ISREG(st.st_mode)) {
+    // Perhaps slimmed already, by an earlier run (with any outer layer).
+    const string slim = raw + "." + SLIM_SUFFIX;
+    const string earlier[] = {slim, slim + ".lz4", slim + ".zst"};
+    for (int i=0; i<3; i++)
+      if (describe_earlier(earlier[i], f)) {
+        f.status = DIRFILE_EARLIER;
+        return;
+      }
+    f.status = DIRFILE_SKIPPED;
+    f.message = "no raw file";
+    return;
+  }
+  f.raw_bytes = f.slim_bytes = st.st_size;
+  if (f.type == SLIM_TYPE_UNDETERMINED) {
+    f.status = DIRFILE_SKIPPED;
+    f.message = "type " + f.type_name + " cannot be slimmed";
+    return;
+  }
+
+  string out = raw + "." + SLIM_SUFFIX;
+  if (lz4_output)
+    out += ".lz4";
+  else if (zstd_level)
+    out += ".zst";
+  if (!force && stat(out.c_str(), &st) == 0) {
+    f.status = DIRFILE_FAILED;
+    f.message = "slim file exists (use -k to force)";
+    return;
+  }
+
+  schema_group g = {1, 1, f.type, f.code, f.deltas, rotate};
+  frame_schema layout;
+  try {
+    if (auto_code && detector.choose_code(raw.c_str(), g)) {
+      f.code = g.code;
+      f.deltas = g.deltas;
+    }
+    layout.push(g);
+
+    if (compressor == NULL) {
+      compressor = new slim_compressor_t(out.c_str(), flags, f.deltas,
+                                         sample_pct);
+      compressor->set_max_section_size(section_size);
+      compressor->set_wide_sizes(wide_sizes);
+      compressor->set_adaptive(adaptive);
+      compressor->set_reuse_params(reuse_params);
+      compressor->set_quiet(true);
+    } else
+      compressor->open(out.c_str());
+    if (lz4_output)
+      compressor->use_lz4(lz4_thread);
+    else if (zstd_level)
+      compressor->use_zstd(zstd_level, zstd_workers);
+    compressor->set_layout(layout);
+    if (compressor->compress_from_file(raw.c_str()))
+      throw bad_file(raw.c_str(), ": cannot be read.");
+
+  } catch (const bad_file &bf) {
+    ostringstream mesg;
+    bf.mesg(mesg);
+    f.message = mesg.str();
+    f.message.erase(f.message.find_last_not_of("\n") + 1);
+  } catch (const char *error) {
+    f.message = error;
+  }
+  if (!f.message.empty()) {
+    f.status = DIRFILE_FAILED;
+    delete compressor;
+    compressor = NULL;
+    unlink(out.c_str());
+    return;
+  }
+
+  if (stat(out.c_str(), &st) == 0)
+    f.slim_bytes = st.st_size;
+  f.status = DIRFILE_SLIMMED;
+  if (practice)
+    unlink(out.c_str());
+  else if (!preserve)
+    unlink(raw.c_str());
+}
+
+
+
+/// Write the manifest: one line per RAW field with its type, code, raw
+/// and slim sizes, and what became of it, then the totals.  A field left
+/// raw has slim size equal to its raw size.
+/// \param os  Where to write it.
+void slim_dirfile_t::write_manifest(ostream &os) const {
+  ios_base::fmtflags old = os.flags();
+  streamsize oldprec = os.precision(3);
+  os.setf(ios_base::fixed, ios_base::floatfield);
+
+  os << "# slim dirfile manifest: " << dir << "\n"
+     << "# field  type  method  deltas  raw_bytes  slim_bytes  ratio  "
+     << "status  [message]\n";
+  size_t raw_total = 0, slim_total = 0;
+  for (int i=0; i<format.size(); i++) {
+    const dirfile_field &f = format[i];
+    const bool coded = (f.status == DIRFILE_SLIMMED);
+    os << f.name << "  " << f.type_name << "  "
+       << (coded ? frame_schema::code_name(f.code) : "-") << "  "
+       << (coded ? (f.deltas ? "deltas" : "nodeltas") : "-") << "  "
+       << f.raw_bytes << "  " << f.slim_bytes << "  "
+       << (f.slim_bytes ? double(f.raw_bytes) / f.slim_bytes : 1.0) << "  "
+       << status_names[f.status];
+    if (!f.message.empty())
+      os << "  # " << f.message;
+    os << "\n";
+    raw_total += f.raw_bytes;
+    slim_total += f.slim_bytes;
+  }
+  os << "# total  " << raw_total << "  " << slim_total << "  "
+     << (slim_total ? double(raw_total) / slim_total : 1.0) << "\n";
+
+  os.flags(old);
+  os.precision(oldprec);
+}
+
+
+
+/// Write the manifest to the file "slim.manifest" in the dirfile.
+/// Throws bad_output_file if it cannot be written.
+/// \return The manifest's path.
+string slim_dirfile_t::write_manifest() const {
+  const string path = dir + "/slim.manifest";
+  ofstream os(path.c_str());
+  if (!os)
+    throw bad_output_file(path.c_str(), "writing");
+  write_manifest(os);
+  return path;
+}
@@ -36,7 +36,8 @@ void dump_one_file(const char *path) {
   char buf[2] = {};
   fread(buf, sizeof(char), 2, fp);
   fclose(fp);
-  if (strncmp(buf, FILE_MAGIC, 2) != 0) {
+  if (strncmp(buf, FILE_MAGIC, 2) != 0 &&
+      strncmp(buf, FILE_MAGIC_V2, 2) != 0) {
     cerr << "File " <<path << " is not a slim file.  Skipping...\n";
     return;
   }
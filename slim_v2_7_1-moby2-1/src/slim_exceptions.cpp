@@ -42,8 +42,10 @@ bad_file::~bad_file() {
   str = NULL;
 }
 
-void bad_file::mesg() const {
-  cerr << str << endl;
+/// Print the error message.
+/// \param os  Where to print it.
+void bad_file::mesg(ostream &os) const {
+  os << str << endl;
 }
 
 
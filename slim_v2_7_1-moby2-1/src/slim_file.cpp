@@ -30,6 +30,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <utime.h>
+#include <pthread.h>
 
 #include "slim.h"
 #include "bitstream.h"
@@ -41,6 +42,31 @@ enum section_foot_markers_t {
   BITS_SECTION_FOOT = 4,    ///< Number of bits to write for sect. foot markers.
 };
 
+/// Bytes of raw data encoded between updates of an inline CRC.
+static const size_t CRC_CHUNK_SIZE = 65536;
+
+/// State of the thread that decodes sections ahead of the reader (see
+/// slim_expander_t::set_read_ahead()).  The thread decodes into spare
+/// buffers and queues them in file order; the reader takes them from the
+/// queue and gives each back as a spare when it is done with it.
+struct slim_readahead_t {
+  pthread_t thread;      ///< The read-ahead thread.
+  pthread_mutex_t lock;  ///< Guards everything below.
+  pthread_cond_t decoded;///< Signalled when a section joins the queue.
+  pthread_cond_t room;   ///< Signalled when the queue has room (or on stop).
+  int depth;             ///< Most sections decoded but not yet taken.
+  raw_section **queue;   ///< Ring of depth decoded sections.
+  size_t *sizes;         ///< Raw size of each section in queue.
+  int head;              ///< Next entry of queue to take.
+  int count;             ///< Sections in queue.
+  raw_section **spares;  ///< Buffers ready to decode into.
+  int nspares;           ///< Buffers in spares.
+  bool done;             ///< No more sections will be queued.
+  bool stop;             ///< The reader wants the thread to quit.
+  const char *error;     ///< Why decoding stopped early, or NULL.
+  bad_file *file_error;  ///< Copy of a bad_file that stopped it, or NULL.
+};
+
 /// Fail an assertion if this is NOT a TWOS-COMPLEMENT machine.
 /// The program assumes throughout that it's on a twos-complement
 /// machine.  Failing these assertions means that this is NOT.  It
@@ -91,6 +117,7 @@ slim_compressor_t::slim_compressor_t(const char *out_name,
 				     char flags_in, bool deltas,	
 				     int samplepct_in) :
   flags(flags_in), 
+  requested_flags(flags_in),
   sample_pct(samplepct_in),
   encode_deltas(deltas)
 {
@@ -102,8 +129,18 @@ slim_compressor_t::slim_compressor_t(const char *out_name,
   mtime=0;
   sections_written = 0;
   sec_bytes_stored = 0;
+  section_offset = 0;
+  max_section_size = MAX_SECTION_LENGTH;
+  wide_sizes = requested_wide = false;
+  reuse_params = false;
+  mixed_layouts = false;
+  narrow_runlength = false;
+  adaptive_threshold = 0.0;
   total_bytes_compressed = 0;
   num_frames = 1;
+  quiet = false;
+  report = &cout;
+  stats = NULL;
 
   ob = new obitstream(out_name);
 
@@ -116,6 +153,46 @@ slim_compressor_t::slim_compressor_t(const char *out_name,
   section = new raw_section(SECTION_COMPRESS_MODE);
   curptr = section->ptr(0,0);
   max_frames_per_section = INT_MAX;
+  sample_data = NULL;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Start writing another compressed file, as if newly constructed, but
+/// keeping this compressor's buffers and channels (with their settings).
+/// Compressing many similar files through one compressor thus saves most
+/// of the cost of setting up each.  Any file now open is finished first.
+/// Any LZ4 or zstd layer must be requested again for the new file.
+/// \param out_name The output (compressed) data file path.
+//----------------------------------------------------------------------
+void slim_compressor_t::open(const char *out_name) {
+  if (ob->is_open())
+    close_output();
+  ob->reopen(out_name);
+
+  delete [] out_filename;
+  int len = strlen(out_name);
+  out_filename = new char [len+1];
+  strncpy(out_filename, out_name, len);
+  out_filename[len] = '\0';
+
+  flags = requested_flags;      // Undo any flags the last file implied.
+  wide_sizes = requested_wide;
+  raw_size = 0;
+  mtime = 0;
+  sections_written = 0;
+  sec_bytes_stored = 0;
+  section_offset = 0;
+  total_bytes_compressed = 0;
+  curptr = section->ptr(0,0);
+  clear_channel_history();
+
+  if (stats) {
+    stats->clear();
+    for (int i=0; i<num_channels(); i++)
+      reinterpret_cast<slim_channel_encode *>(channels[i])->take_overflows();
+  }
 }
 
 
@@ -132,7 +209,9 @@ slim_compressor_t::~slim_compressor_t() {
   delete section;
   delete ob;
 
+  delete [] sample_data;
   delete [] out_filename;
+  delete stats;
 }
 
 
@@ -143,6 +222,90 @@ slim_compressor_t::~slim_compressor_t() {
 void slim_compressor_t::close_output() {
   write_last_section_foot();
   ob->close();
+  if (stats)
+    update_stats();
+}
+
+
+//----------------------------------------------------------------------
+/// Wrap the compressed output in an LZ4 frame, for a further reduction
+/// of flag-like and housekeeping data.  Call before writing anything.
+/// \param background_thread  Run the LZ4 compressor on a helper thread.
+//----------------------------------------------------------------------
+void slim_compressor_t::use_lz4(bool background_thread) {
+  ob->use_lz4(background_thread);
+}
+
+
+//----------------------------------------------------------------------
+/// Compress the output further with zstd, in the seekable format (so
+/// that slim_reader_t can still seek within it).  For archive copies.
+/// Call before writing anything.
+/// \param level     zstd compression level.
+/// \param nworkers  Number of zstd compression threads (0 = none).
+//----------------------------------------------------------------------
+void slim_compressor_t::use_zstd(int level, int nworkers) {
+  ob->use_zstd(level, nworkers);
+}
+
+
+
+//----------------------------------------------------------------------
+/// Keep (or stop keeping) the time and bytes spent in each stage, the
+/// overflows in each channel, and the output buffer refills.  Timing
+/// costs a clock reading per stage per section, so it is off by default.
+/// Call before compressing a file; the record starts over with open().
+/// \param s  Whether to keep statistics.
+//----------------------------------------------------------------------
+void slim_compressor_t::set_stats(bool s) {
+  if (s && !stats) {
+    stats = new slim_stats_t;
+    for (int i=0; i<num_channels(); i++)  // Forget any earlier overflows.
+      reinterpret_cast<slim_channel_encode *>(channels[i])->take_overflows();
+  } else if (!s) {
+    delete stats;
+    stats = NULL;
+  }
+  ob->set_timing(s);
+}
+
+
+
+//----------------------------------------------------------------------
+/// Get the statistics of the current (or just finished) file.
+/// \return The statistics, or NULL if set_stats() was not called.
+//----------------------------------------------------------------------
+const slim_stats_t *slim_compressor_t::get_stats() {
+  if (stats)
+    update_stats();
+  return stats;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Write the statistics of the current (or just finished) file as one
+/// line of JSON.  Writes nothing if set_stats() was not called.
+/// \param os  The output stream.
+//----------------------------------------------------------------------
+void slim_compressor_t::write_stats(ostream &os) {
+  if (stats) {
+    update_stats();
+    stats->write_json(os, out_filename, true);
+  }
+}
+
+
+
+//----------------------------------------------------------------------
+/// Copy the counters kept by the output bitstream into the statistics.
+//----------------------------------------------------------------------
+void slim_compressor_t::update_stats() {
+  stats->raw_bytes = total_bytes_compressed;
+  stats->slim_bytes = ob->get_bits_used() / 8;
+  stats->seconds[SLIM_STAGE_FLUSH] = ob->get_io_seconds();
+  stats->bytes[SLIM_STAGE_FLUSH] = stats->slim_bytes;
+  stats->refills = ob->get_refills();
 }
 
 
@@ -178,9 +341,11 @@ slim_channel_encode * slim_compressor_t::add_channel(int reps,
 					   bool deltas,
 					   bool rotate) {
   size_t size=slim_type_size[data_type];
+  if (code == SLIM_ENCODER_RUNLENGTH && size < 4)
+    narrow_runlength = true;
 
   slim_channel_encode *c = 
-    new slim_channel_encode(reps, size, encode_deltas, rotate);
+    new slim_channel_encode(reps, size, deltas, rotate);
   encoder *e = encoder_generator(code, data_type, deltas);
   c->set_encoder(e);
   add_channel(c);
@@ -189,6 +354,7 @@ slim_channel_encode * slim_compressor_t::add_channel(int reps,
 
 
 
+
 //----------------------------------------------------------------------
 /// How many channels have been recorded?
 /// \return Number of channels owned by this object.
@@ -235,13 +401,34 @@ void slim_compressor_t::confirm_flags() {
   //   flags |= FLAG_ONECHAN;
 
   if (flags & FLAG_NOREPS)
-    assert (no_reps());
-  if (no_reps())
+    assert (no_reps() && !mixed_layouts);
+  if (no_reps() && !mixed_layouts)
     flags |= FLAG_NOREPS;
 }
 
 
 
+//----------------------------------------------------------------------
+/// Does the file use features that readers before FILE_MAGIC_V2 would
+/// misread?  Such files start with FILE_MAGIC_V2, which those readers
+/// refuse as not slim files.  Call after confirm_flags() and after
+/// wide_sizes is settled.
+/// \return true if the file needs FILE_MAGIC_V2.
+//----------------------------------------------------------------------
+bool slim_compressor_t::needs_new_reader() const {
+  if (flags & FLAG_SLEN)
+    return true;   // Section headers carry an extra size.
+  if (wide_sizes)
+    return true;   // Sizes are 64 bits.
+  if (reuse_params)
+    return true;   // Channels may omit their parameters.
+  if (narrow_runlength)
+    return true;   // Older readers widen runlength data to 32 bits.
+  return false;
+}
+
+
+
 //----------------------------------------------------------------------
 /// Write the file header to the slim (output) file.
 /// \param in_filename  The 
@@ -251,19 +438,46 @@ int slim_compressor_t::write_file_header(const char *in_filename = NULL) {
   const bool with_nullchar = true;
 
   confirm_flags();
-  ob->writestring(FILE_MAGIC);
+
+  // Sizes that don't fit in 32 bits need the 64-bit (wide) header variant.
+  if ((flags & FLAG_SIZE) && raw_size != (raw_size & 0xffffffffUL))
+    wide_sizes = true;
+  int xflags = 0;
+  if (wide_sizes)
+    xflags |= XFLAG_WIDE;
+  if (reuse_params)
+    xflags |= XFLAG_SAME;
+  if (xflags)
+    flags |= FLAG_XTRA;
+
+  // Channels shouldn't change parameters needlessly, if they can be reused.
+  for (int c=0; c<num_channels(); c++)
+    reinterpret_cast<slim_channel_encode *>(channels[c])->
+      set_reuse_params(reuse_params);
+
+  ob->writestring(needs_new_reader() ? FILE_MAGIC_V2 : FILE_MAGIC);
   ob->writebits(mtime, 32);
   ob->writebits(flags, 8);
   if (flags & FLAG_SIZE)
-    ob->writebits(raw_size, 32);
+    ob->writebits(uint32_t(raw_size), 32); // Low 32 bits if wide; see XTRA.
   if (flags & FLAG_NAME) {
     if (in_filename)
       ob->writestring(in_filename, with_nullchar);
     else
       ob->writestring("", with_nullchar);
   }
-  if (flags & FLAG_XTRA)
-    ob->writebits(0, 16); // XTRA not supported yet.
+  // XTRA data: 16-bit length, extended flags, then 64-bit raw size if
+  // both wide and FLAG_SIZE.
+  if (flags & FLAG_XTRA) {
+    if (xflags) {
+      bool wide_raw_size = wide_sizes && (flags & FLAG_SIZE);
+      ob->writebits(wide_raw_size ? 9 : 1, 16);
+      ob->writebits(xflags, 8);
+      if (wide_raw_size)
+        write_size(raw_size, BITS_SLIM_WIDE_SIZE);
+    } else
+      ob->writebits(0, 16);
+  }
   assert(! (flags & FLAG_TOC));  // TOC not supported yet.
   
   return 0;
@@ -277,12 +491,18 @@ int slim_compressor_t::write_file_header(const char *in_filename = NULL) {
 //----------------------------------------------------------------------
 int slim_compressor_t::write_section_header() {
   ob->windup();  // Byte-align the section header.
+  section_offset = ob->get_bytes_used();
 
   // Size in bytes (32 bits)
   if (section == NULL)
     throw "Cannot write_section_header for a NULL section.";
   size_t this_sect_size = section->get_size();
-  ob->writebits(this_sect_size, BITS_SLIM_SECT_SIZE);
+  write_size(this_sect_size, BITS_SLIM_SECT_SIZE);
+
+  // Slim size in bytes (32 bits).  Not known until the section is
+  // encoded, so encode_write_section() patches it in.
+  if (flags & FLAG_SLEN)
+    write_size(0, BITS_SLIM_SECT_SLIM_SIZE);
 
   // Table-of-contents forward pointer.  NOT IMPLEMENTED
   assert(! (flags & FLAG_TOC));  // TOC not supported yet.
@@ -297,9 +517,27 @@ int slim_compressor_t::write_section_header() {
     ob->writebits(nchan, BITS_SLIM_NUM_CHAN);
   }
 
-  // A parameter set for each channel.
+  // A parameter set for each channel.  With XFLAG_SAME, a bit first says
+  // whether it's unchanged from the previous section (and so omitted).
+  // Every PARAMS_KEY_INTERVAL sections, all parameters are written.
   bool no_repeats = (flags & FLAG_NOREPS);
+  bool key_section = ((sections_written-1) % PARAMS_KEY_INTERVAL == 0);
   for (int c=0; c<nchan; c++) {
+    if (reuse_params) {
+      slim_channel_encode *chan =
+        reinterpret_cast<slim_channel_encode *>(channels[c]);
+      unsigned int reps = chan->get_repetitions();
+      if (nchan <= 1) {
+        reps = this_sect_size / chan->get_raw_size();
+        if (reps == 0)
+          reps = 1;
+      } else if (no_repeats)
+        reps = 1;
+      bool same = chan->params_unchanged(reps) && !key_section;
+      ob->writebits(same ? 1 : 0, 1);
+      if (same)
+        continue;
+    }
     if ((nchan>1) && !no_repeats) {
       int reps = channels[c]->get_repetitions();
       assert (reps >= 0);
@@ -317,30 +555,47 @@ int slim_compressor_t::write_section_header() {
 
 
 //----------------------------------------------------------------------
-/// Compute the number of data in the input for a given channel.
-/// It's okay if this is just a lower limit, as we use this only
-/// in saying how many values are available for the sampling phase.
+/// Write a size to the slim file: 64 bits in a wide file, else nbits.
+/// \param size   The size.
+/// \param nbits  Number of bits in an ordinary (not wide) file.
+//----------------------------------------------------------------------
+void slim_compressor_t::write_size(size_t size, int nbits) {
+  if (wide_sizes) {
+    ob->writebits(uint32_t(size), 32);
+    ob->writebits(uint32_t(uint64_t(size) >> 32), 32);
+    return;
+  }
+  if (size != (size & lowestNset[nbits]))
+    throw "Cannot write size in allowed number of bits.";
+  ob->writebits(size, nbits);
+}
+
+
+
+//----------------------------------------------------------------------
+/// Compute the number of data in the input for a given channel,
+/// including any in a partial last frame.  It must not be a mere lower
+/// limit: the data are tested for being strictly constant, and a
+/// channel's data in a partial frame are encoded like any others.
 /// \param chan_num Array index of the channel in question.
 /// \param section_size Number of bytes available.
-/// \return Estimated number of data in the file.
+/// \return Number of data in the section.
 //----------------------------------------------------------------------
 int slim_compressor_t::num_data(int chan_num, int section_size) const {
   if (chan_num < 0 || chan_num >= num_channels())
     return 0;
 
-  int frames_available = section_size / frame_size;
-  if (frames_available > 0)
-    return frames_available * channels[chan_num]->get_repetitions();
+  const int reps = channels[chan_num]->get_repetitions();
+  int ndata = (section_size / frame_size) * reps;
 
-  // No complete frames exist.  For now, we know how to solve only if
-  // all channels have the same size.
-  size_t chan0_size = channels[0]->get_raw_size();
-  if(num_channels()>1) {
-    for (int i=1; i<num_channels(); i++) {
-      assert(chan0_size == channels[i]->get_raw_size());
-    }
+  // A partial frame holds whatever of the channel's words it reaches.
+  const size_t rest = section_size % frame_size;
+  const size_t before = channels.offset(chan_num);
+  if (rest > before) {
+    size_t partial = (rest - before) / channels[chan_num]->get_raw_size();
+    ndata += (partial < size_t(reps)) ? int(partial) : reps;
   }
-  return section_size / (num_channels() * chan0_size);
+  return ndata;
 }
 
 
@@ -354,14 +609,14 @@ int slim_compressor_t::num_data(int chan_num, int section_size) const {
 void slim_compressor_t::set_section_frames(unsigned int nf) {
 
   // Is the requested number of frames too big for a section?
-  if (nf*frame_size > MAX_SECTION_LENGTH ) {
+  if (nf*frame_size > max_section_size ) {
 
     // Is even one frame too big for a section?
-    if (frame_size > MAX_SECTION_LENGTH)
+    if (frame_size > max_section_size)
       throw "Frame is too long to fit in a single section.";
 
     if (frame_size > 0)
-      nf = MAX_SECTION_LENGTH / frame_size;
+      nf = max_section_size / frame_size;
     else
       nf = 1;
   }
@@ -407,13 +662,15 @@ int slim_compressor_t::compute_section_params(size_t length) {
   int chan_num;
   int nchan = num_channels();
 
-  // Allocate arrays for sampled data.
+  // Allocate arrays for sampled data, once for all sections.
   const int Target_group_size = 20;  // Do this many consecutive data points.
   const int Max_number_groups = 1000; // Don't allow more than this many groups.
   const int samplegroups = (sample_pct*Max_number_groups)/100;
   const int Target_data= samplegroups*Target_group_size;
 
-  uint32_t *data = new uint32_t[Target_data+1];
+  if (sample_data == NULL)
+    sample_data = new uint32_t[Target_data+1];
+  uint32_t *data = sample_data;
   uint16_t *sdata = (uint16_t *)data; // They can share a buffer
   uint8_t  *cdata = (uint8_t *)data; // They can share a buffer
   assert (data != NULL);
@@ -499,9 +756,15 @@ int slim_compressor_t::compute_section_params(size_t length) {
       // So use 10%, 20%, ... 90% of the available data.
       int available_groups = 
         (available_data + Target_group_size/2)/Target_group_size;
-      // Treat sample_pct as a percentage of all groups.
+      // Treat sample_pct as a percentage of all groups, but sample at
+      // least one (which must leave room for its final datum).
       ngroups = (available_groups*sample_pct)/100;
       group_size = Target_group_size;
+      if (ngroups < 1) {
+        ngroups = 1;
+        if (group_size > available_data-1)
+          group_size = available_data-1;
+      }
       if (ngroups>1)
         skip_between_groups = 
           (available_data-1 - ngroups*group_size)/(ngroups-1) -1;
@@ -579,7 +842,6 @@ int slim_compressor_t::compute_section_params(size_t length) {
     }
   }
 
-  delete [] data;
   return 0;
 }
 
@@ -690,6 +952,257 @@ write_onesection(const unsigned char *buf, size_t length) {
 
 
 
+//----------------------------------------------------------------------
+/// Set the upper limit on the raw size of sections.  Call before
+/// set_section_frames().  Sections much larger than the default
+/// (MAX_SECTION_LENGTH) suit very wide frames, whose per-section headers
+/// would otherwise be a large part of the file.
+/// \param size  The limit (bytes), at most MAX_SECTION_LENGTH_LIMIT.
+//----------------------------------------------------------------------
+void slim_compressor_t::set_max_section_size(size_t size) {
+  if (size < sizeof(Word_t))
+    throw "Section size limit is too small.";
+  section->set_max_size(size);
+  max_section_size = size;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Choose section boundaries by how the data change, when compressing
+/// from a file.  Sections grow (up to the size limit) while the data
+/// statistics are steady, and a new section begins when the estimated
+/// cost of coding the newest data with the current section's parameters
+/// exceeds threshold times the cost of a new section header.
+/// \param threshold  The cost ratio.  Zero or less restores fixed-size
+///                   sections (the default).
+//----------------------------------------------------------------------
+void slim_compressor_t::set_adaptive(double threshold) {
+  adaptive_threshold = (threshold > 0.0) ? threshold : 0.0;
+}
+
+
+
+/// Range of the data (or deltas) of one channel, used in choosing
+/// adaptive section boundaries.  Because codes work modulo the word size,
+/// track the range under both signed and unsigned readings of the data.
+struct data_range_t {
+  int64_t smin, smax;    ///< Range, reading data as signed.
+  uint64_t umin, umax;   ///< Range, reading data as unsigned.
+  size_t n;              ///< Number of data.
+
+  /// Make an empty range.
+  void clear() {
+    smin = INT64_MAX; smax = INT64_MIN;
+    umin = UINT64_MAX; umax = 0;
+    n = 0;
+  }
+
+  /// Extend this range to include another.
+  /// \param r  The other range.
+  void merge(const data_range_t &r) {
+    if (r.smin < smin) smin = r.smin;
+    if (r.smax > smax) smax = r.smax;
+    if (r.umin < umin) umin = r.umin;
+    if (r.umax > umax) umax = r.umax;
+    n += r.n;
+  }
+
+  /// \return Bits per datum needed to code every value in the range.
+  int bits() const {
+    if (n == 0)
+      return 0;
+    uint64_t sr = uint64_t(smax) - uint64_t(smin);
+    uint64_t ur = umax - umin;
+    uint64_t r = (sr < ur) ? sr : ur;
+    return r ? 64 - __builtin_clzll(r) : 0;
+  }
+};
+
+
+
+/// Find the range of one channel's data (or deltas) over whole frames.
+/// Like compute_section_params(), look only at a sample: groups of
+/// consecutive frames, spaced to give roughly Target_data values.
+/// \param buf        The first frame.
+/// \param nframes    Number of frames.
+/// \param frame_size Size (bytes) of a frame.
+/// \param reps       Repetitions of the channel per frame.
+/// \param deltas     Find the range of successive differences?
+/// \param r          The range (output).
+template <typename U, typename S>
+static void find_range(const unsigned char *buf, size_t nframes,
+                       size_t frame_size, int reps, bool deltas,
+                       data_range_t &r) {
+  const size_t Group_frames = 16;
+  const size_t Target_data = 2048;
+  size_t step = Group_frames * ((nframes * reps) / Target_data);
+  if (step < Group_frames)
+    step = Group_frames;
+
+  r.clear();
+  U prev = 0;
+  bool have_prev = false;
+  for (size_t f=0; f<nframes; f++) {
+    if (f % step == Group_frames) {
+      f += step - Group_frames - 1;
+      have_prev = false;
+      continue;
+    }
+    const U *u = reinterpret_cast<const U *>(buf + f*frame_size);
+    for (int i=0; i<reps; i++) {
+      U d = u[i];
+      if (deltas) {
+        d = U(u[i] - prev);
+        prev = u[i];
+        if (!have_prev) {
+          have_prev = true;
+          continue;
+        }
+      }
+      int64_t sd = S(d);
+      if (sd < r.smin) r.smin = sd;
+      if (sd > r.smax) r.smax = sd;
+      if (d < r.umin) r.umin = d;
+      if (d > r.umax) r.umax = d;
+      r.n++;
+    }
+  }
+}
+
+
+
+//----------------------------------------------------------------------
+/// Estimate the cost of starting a new section: its header, the
+/// parameters of every channel, and the first datum of each channel
+/// (which is coded without a delta history).
+/// \return Estimated size (bits).
+//----------------------------------------------------------------------
+size_t slim_compressor_t::section_overhead_bits() const {
+  const int sizebits = wide_sizes ? BITS_SLIM_WIDE_SIZE : BITS_SLIM_SECT_SIZE;
+  size_t bits = sizebits + BITS_SLIM_NUM_CHAN + BITS_SECTION_FOOT + 8;
+  if (flags & FLAG_SLEN)
+    bits += sizebits;
+  if (flags & FLAG_CRC)
+    bits += 32;
+  for (int c=0; c<num_channels(); c++)
+    bits += BITS_SLIM_REPETITIONS + 1 + BITS_SLIM_NBITS +
+      BITS_SLIM_ALG_CODE + BITS_SLIM_TYPE_CODE + BITS_SLIM_NBITS +
+      16 * channels[c]->get_raw_size();
+  return bits;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Compress an open file with adaptive section boundaries (see
+/// set_adaptive()).  The data are read in blocks of whole frames, about
+/// ADAPTIVE_BLOCK_LENGTH bytes each.  Each channel's range in a new block
+/// is compared with its range in the section so far.  Coding both with
+/// parameters to span the two costs extra bits; when the estimate exceeds
+/// the threshold times section_overhead_bits(), the section ends before
+/// the block.
+/// \param infp    The raw file, open for reading.
+/// \param nbytes  Most bytes to read from it.
+/// \return Number of raw bytes compressed (as reported by
+///         write_onesection()).
+//----------------------------------------------------------------------
+size_t slim_compressor_t::compress_adaptive(FILE *infp, size_t nbytes) {
+  if (frame_size == 0)
+    throw "Cannot compress with no channels.";
+
+  // Sections can't exceed the fixed-section size (see compress_region()).
+  size_t max_frames = max_frames_per_section;
+  if (max_frames * frame_size > max_section_size)
+    max_frames = max_section_size / frame_size;
+  if (max_frames == 0)
+    max_frames = 1;
+  size_t block_frames = ADAPTIVE_BLOCK_LENGTH / frame_size;
+  if (block_frames == 0)
+    block_frames = 1;
+  if (block_frames > max_frames)
+    block_frames = max_frames;
+  const size_t block_size = block_frames * frame_size;
+  const size_t max_size = (max_frames / block_frames) * block_size;
+  num_frames = max_frames;
+
+  const int nchan = num_channels();
+  data_range_t *sect_range = new data_range_t[nchan];
+  data_range_t *block_range = new data_range_t[nchan];
+  unsigned char *buf = new unsigned char[max_size + MAX_GHOST_BYTES];
+  const double cut_cost = adaptive_threshold * section_overhead_bits();
+
+  size_t filled = 0, total = 0, written = 0;
+  for (;;) {
+    if (filled == max_size) {
+      written += write_onesection(buf, filled);
+      filled = 0;
+    }
+    double start = stats ? slim_clock() : 0.0;
+    size_t want = block_size;
+    if (want > nbytes - total)
+      want = nbytes - total;
+    size_t nread = fread(buf + filled, 1, want, infp);
+    if (stats)
+      stats->add(SLIM_STAGE_READ, start, nread);
+    if (nread == 0)
+      break;
+    total += nread;
+
+    // Ranges of each channel in the new block (whole frames only).
+    size_t nf = nread / frame_size;
+    double extra_cost = 0.0;
+    for (int c=0; c<nchan; c++) {
+      const slim_channel *chan = channels[c];
+      const unsigned char *p = buf + filled + channels.offset(c);
+      int reps = chan->get_repetitions();
+      bool deltas = chan->get_deltas();
+      data_range_t &r = block_range[c];
+      switch (chan->get_raw_size()) {
+      case 4: find_range<uint32_t,int32_t>(p, nf, frame_size, reps, deltas, r);
+        break;
+      case 2: find_range<uint16_t,int16_t>(p, nf, frame_size, reps, deltas, r);
+        break;
+      default: find_range<uint8_t,int8_t>(p, nf, frame_size, reps, deltas, r);
+        break;
+      }
+      if (filled == 0)
+        continue;
+      data_range_t both = sect_range[c];
+      both.merge(r);
+      int nbits = both.bits();
+      extra_cost += double(nbits - sect_range[c].bits()) * sect_range[c].n +
+        double(nbits - r.bits()) * r.n;
+    }
+
+    // End the current section before this block, if the block would make
+    // the section cost too much.
+    if (filled > 0 && extra_cost > cut_cost) {
+      written += write_onesection(buf, filled);
+      memmove(buf, buf + filled, nread);
+      filled = 0;
+    }
+    if (filled == 0)
+      for (int c=0; c<nchan; c++)
+        sect_range[c] = block_range[c];
+    else
+      for (int c=0; c<nchan; c++)
+        sect_range[c].merge(block_range[c]);
+    filled += nread;
+    if (nread < block_size)
+      break;
+  }
+  if (filled > 0)
+    written += write_onesection(buf, filled);
+
+  delete [] buf;
+  delete [] block_range;
+  delete [] sect_range;
+  return written;
+}
+
+
+
 //----------------------------------------------------------------------
 /// Compress a single section in memory onto disk.
 /// If request exceeds section size, no more than the full section size
@@ -719,64 +1232,127 @@ size_t slim_compressor_t::encode_write_section(size_t length) {
     section->resize(length);
   }
 
+  // Time each stage, if asked.  Output buffer flushes are charged to the
+  // flush stage, so they are left out of the others (by moving start).
+  double start = 0.0, io_start = 0.0;
+  if (stats) {
+    start = slim_clock();
+    io_start = ob->get_io_seconds();
+  }
+
   // Compute the encoding parameters and write the section header.
+  // If the header might leave the buffer before its slim size is patched
+  // in, and the file can't be patched, keep the section in memory.
   compute_section_params(this_sect_size);
+  if ((flags & FLAG_SLEN) && !ob->can_patch())
+    ob->hold();
   write_section_header();
+  if (stats) {
+    stats->add(SLIM_STAGE_PARAMS, start + ob->get_io_seconds() - io_start,
+               this_sect_size);
+    start = slim_clock();
+  }
 
-  // If we need the CRC, then it must be computed before chan->encode_frame
-  // potentially corrupts the data by applying bit rotations.
-  if (flags & FLAG_CRC)
+  // Encoding leaves the data unchanged, so the CRC is computed as we go,
+  // a chunk of frames at a time while they are still in cache.  When
+  // timing the stages, it is computed in a pass of its own instead.
+  const bool crc_inline = (flags & FLAG_CRC) && !stats;
+  if ((flags & FLAG_CRC) && !crc_inline) {
     section_crc = section->crc(this_sect_size);
+    stats->add(SLIM_STAGE_CRC, start, this_sect_size);
+    start = slim_clock();
+  }
+  if (stats)
+    io_start = ob->get_io_seconds();
 
   // The whole number of frames in this section.
   int frames_this_sect = this_sect_size / frame_size;
 
   // Loop over all whole frames in this section, encoding and writing.
-  unsigned char *buf = section->ptr(0,0);
+  const unsigned char *buf = section->ptr(0,0);
+  const unsigned char *crc_done = buf;  // End of data in the CRC so far.
+  uint32_t crc = 0;
   slim_channel_encode *chan; // Alias for current channel.
   chan = reinterpret_cast<slim_channel_encode *>(channels[0]);
   int num_chan = num_channels();
   size_t bytes_thiscall;
 
+  // Let encoders (runlength) carry a run through later whole frames.
+  for (int i=0; i<num_chan; i++)
+    reinterpret_cast<slim_channel_encode *>(channels[i])->
+      set_lookahead(frame_size, buf + frames_this_sect*frame_size);
+
   for (int frame_num=0; frame_num < frames_this_sect; frame_num++) {
     for (int i=0; i<num_chan; i++) {
       bytes_thiscall = chan->encode_frame(buf);
       buf += bytes_thiscall;
       chan = reinterpret_cast<slim_channel_encode *>(chan->next_chan);
     }
+    if (crc_inline && size_t(buf - crc_done) >= CRC_CHUNK_SIZE) {
+      crc = slim_crc32(crc, crc_done, buf - crc_done);
+      crc_done = buf;
+    }
   }
   size_t bytes_written = buf - section->ptr(0,0);
 
   // If there's a partial frame remaining, this loop writes it, using as
-  // many channels as needed.  Here we handle a partial word, too.
+  // many channels as needed.  Here we handle a partial word, too.  The
+  // partial word is encoded from a zero-padded copy (so the compressed
+  // file doesn't depend on whatever follows the data).
+  for (int i=0; i<num_chan; i++)
+    reinterpret_cast<slim_channel_encode *>(channels[i])->
+      set_lookahead(0, NULL);
   size_t size_request, size_written;
-  size_t ghost_bytes = 0;
   for (int i=0; i<num_chan && bytes_written < this_sect_size; i++) {
-
-    // Handle partial words by always rounding up the requested write
-    // size to the next complete word.  This rounding will only make a
-    // difference when writing the appropriate (final) channel in the file.
-    // Clear the ghost memory area to have a unique compressed file (not
-    // dependent on uninitialized memory).
     size_request = this_sect_size - bytes_written;
-    if (size_request < chan->get_frame_size() &&
-        size_request % chan->get_raw_size()) {
-      ghost_bytes = chan->get_raw_size() - (size_request % chan->get_raw_size());
-      memset(buf + size_request, 0, ghost_bytes);
-      assert (ghost_bytes <= MAX_GHOST_BYTES);
-    }
-    size_written = chan->encode_partial_frame(buf, size_request + ghost_bytes);
+    size_t raw = chan->get_raw_size();
+    if (size_request < chan->get_frame_size() && size_request % raw) {
+      size_t whole = size_request - size_request % raw;
+      uint64_t last_word = 0;
+      assert (raw - size_request % raw <= MAX_GHOST_BYTES);
+      if (whole > 0)
+        chan->encode_partial_frame(buf, whole);
+      memcpy(&last_word, buf + whole, size_request - whole);
+      chan->encode_partial_frame(&last_word, raw);
+      size_written = size_request;
+    } else
+      size_written = chan->encode_partial_frame(buf, size_request);
     buf += size_written;
-    bytes_written += size_written - ghost_bytes;
+    bytes_written += size_written;
     chan = reinterpret_cast<slim_channel_encode *>(chan->next_chan);
-
   }
-  
+  if (crc_inline)
+    section_crc = slim_crc32(crc, crc_done,
+                             section->ptr(0,0) + this_sect_size - crc_done);
+
   // Compute and emit the CRC checksum, if requested.
   if (flags & FLAG_CRC) {
     ob->writeword(section_crc);
   }
 
+  if (stats) {
+    stats->add(SLIM_STAGE_CODE, start + ob->get_io_seconds() - io_start,
+               this_sect_size);
+    stats->sections++;
+    stats->set_channels(num_chan);
+    for (int i=0; i<num_chan; i++)
+      stats->overflows[i] +=
+        reinterpret_cast<slim_channel_encode *>(channels[i])->take_overflows();
+  }
+
+  // The section ends after its End-Section block, at a byte boundary.
+  if (flags & FLAG_SLEN) {
+    size_t end = (ob->get_bits_used() + BITS_SECTION_FOOT + 7) / 8;
+    size_t slim_size = end - section_offset;
+    int nbits = wide_sizes ? BITS_SLIM_WIDE_SIZE : BITS_SLIM_SECT_SLIM_SIZE;
+    if (slim_size != (slim_size & lowestNset[nbits]))
+      throw "Cannot write section slim size in allowed number of bits.";
+    size_t field = section_offset +
+      (wide_sizes ? BITS_SLIM_WIDE_SIZE : BITS_SLIM_SECT_SIZE)/8;
+    ob->patch(field, slim_size, nbits/8);
+    ob->release();
+  }
+
   sec_bytes_stored = 0; // For next time
   total_bytes_compressed += bytes_written;
   return bytes_written;
@@ -798,16 +1374,99 @@ void slim_compressor_t::get_input_file_stats(const char *raw_file_name) {
 
 
 //----------------------------------------------------------------------
-/// Compress an entire file.
+/// Replace the channels with those of a frame layout.  Sections hold as
+/// many whole frames as fit (set_section_frames() can ask for fewer).
+/// A single channel is treated as one long frame per section (or per
+/// block, for adaptive sections), which compresses fastest.
+/// \param layout  The frame layout.
+//----------------------------------------------------------------------
+void slim_compressor_t::set_layout(const frame_schema &layout) {
+  reset_channels();
+  if (layout.num_channels() == 1) {
+    schema_group g = layout[0];
+    size_t block = max_section_size;
+    if (adaptive_threshold > 0.0 && block > size_t(ADAPTIVE_BLOCK_LENGTH))
+      block = ADAPTIVE_BLOCK_LENGTH;
+    size_t reps = block / slim_type_size[g.data_type];
+    if (reps > lowestNset[BITS_SLIM_REPETITIONS])
+      reps = lowestNset[BITS_SLIM_REPETITIONS];
+    add_channel(reps > 0 ? int(reps) : 1, g.code, g.data_type,
+                g.deltas, g.rotate);
+  } else
+    layout.add_channels(this);
+
+  size_t nf = max_section_size / frame_size;
+  set_section_frames(nf > 0 ? nf : 1);
+}
+
+
+
+//----------------------------------------------------------------------
+/// Compress the next part of an open file with the current channels,
+/// in sections of the current size or adaptively (see set_adaptive()).
+/// \param infp    The raw file, open for reading.
+/// \param nbytes  Bytes to compress.
+/// \return Number of raw bytes compressed (less than nbytes only if the
+///         file ends first).
+//----------------------------------------------------------------------
+size_t slim_compressor_t::compress_region(FILE *infp, size_t nbytes) {
+  if (adaptive_threshold > 0.0)
+    return compress_adaptive(infp, nbytes);
+
+  // Break up into equal-sized sections (except for last can be short).
+  size_t frames_per_sect = max_frames_per_section;
+  if (frames_per_sect * frame_size > max_section_size)
+    frames_per_sect = max_section_size / frame_size;
+  if (frames_per_sect == 0)
+    frames_per_sect = 1;
+  num_frames = frames_per_sect;
+  const size_t sect_size = frames_per_sect * frame_size;
+
+  // Loop over all sections in the output
+  size_t offset = 0;
+  while (offset < nbytes) {
+    size_t this_size = sect_size;
+    if (this_size > nbytes - offset)
+      this_size = nbytes - offset;
+    double start = stats ? slim_clock() : 0.0;
+    this_size = section->fill(infp, this_size);
+    if (stats)
+      stats->add(SLIM_STAGE_READ, start, this_size);
+    if (this_size == 0)
+      break;  // The file shrank since we learned its size.
+    encode_write_section(this_size);
+    offset += this_size;
+  }
+  return offset;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Compress an entire file.  A container adapter, if given, must already
+/// have parsed the file; each of its regions is then compressed with
+/// its own channels, replacing any set up before.
 /// \param raw_file_name  Name of the file to be compressed.
+/// \param container      The file's regions, or NULL to use the current
+///                       channels for the whole file.
 /// \return 0 on success, or error code.
 //----------------------------------------------------------------------
-int slim_compressor_t::compress_from_file(const char *raw_file_name) {
-
-  size_t bytes_written = 0;
+int slim_compressor_t::compress_from_file(const char *raw_file_name,
+                                          const container_adapter *container) {
 
   // Find (and save) mtime and size of raw file.
   get_input_file_stats(raw_file_name);
+  mixed_layouts = (container != NULL && container->size() > 1);
+
+  // Later regions get their channels after the file header is written,
+  // which must already know if any use narrow runlength codes.
+  for (int r=0; container != NULL && r<container->size(); r++) {
+    const frame_schema &layout = (*container)[r].layout;
+    for (int g=0; g<layout.size(); g++)
+      if (layout[g].code == SLIM_ENCODER_RUNLENGTH &&
+          slim_type_size[layout[g].data_type] < 4)
+        narrow_runlength = true;
+  }
   
   if (raw_size > 0) {
 
@@ -817,37 +1476,24 @@ int slim_compressor_t::compress_from_file(const char *raw_file_name) {
       return -1;
     setvbuf(infp, NULL, _IOFBF, 8192*16);
 
-    // Break up into equal-sized sections (except for last can be short).
-    num_frames = max_frames_per_section;
-    int breakup_factor = 1;
-    if (num_frames * frame_size > MAX_SECTION_LENGTH) {
-      breakup_factor = divide_round_up(max_frames_per_section, MAX_SECTION_LENGTH);
-      num_frames = divide_round_up(num_frames, breakup_factor);
-    }
-    int num_sect = divide_round_up(raw_size, frame_size*max_frames_per_section);
-    num_sect *= breakup_factor;
-    int frames_this_sect;
-    int frames_written = 0;
-
-    // Loop over all sections in the output
-    for (int i_sect=0; i_sect<num_sect; i_sect++) {
-
-      // Make sure not to miss any frames on the last pass.
-      if (i_sect == num_sect-1) {
-        int frames_entire_file = divide_round_up(raw_size, frame_size);
-        frames_this_sect = frames_entire_file - frames_written;
-      } else if (i_sect%breakup_factor == breakup_factor-1) {
-        frames_this_sect = max_frames_per_section - (breakup_factor-1)*num_frames;
-      } else
-        frames_this_sect = num_frames;
-    
-      size_t this_size = frames_this_sect * frame_size;
-      if (this_size + frames_written * frame_size > raw_size) {
-        this_size = raw_size - (frames_written * frame_size);
+    if (container == NULL)
+      compress_region(infp, raw_size);
+    else {
+      // Each region with its own channels.  The last (or one of size 0)
+      // takes the rest of the file.
+      size_t offset = 0;
+      for (int r=0; r<container->size() && offset < raw_size; r++) {
+        const container_region &region = (*container)[r];
+        size_t nbytes = raw_size - offset;
+        if (region.size > 0 && region.size < nbytes &&
+            r < container->size()-1)
+          nbytes = region.size;
+        set_layout(region.layout);
+        size_t done = compress_region(infp, nbytes);
+        offset += done;
+        if (done < nbytes)
+          break;  // The file shrank since we learned its size.
       }
-      this_size = section->fill(infp, this_size);
-      bytes_written += encode_write_section(this_size);
-      frames_written += frames_this_sect;
     }
 
     fclose(infp);
@@ -870,20 +1516,21 @@ int slim_compressor_t::compress_from_file(const char *raw_file_name) {
     double ratio = double(raw_size) / final_size;
     double bitsperword = 32.0/ratio;
     double saved = 100.*(1.-double(final_size)/raw_size);
-    cout.width(20);
-    cout << raw_file_name << ": ";
-
-    cout.setf(ios_base::fixed, ios_base::floatfield);
-    cout.width(8);
-    cout.precision(3);
-    cout << ratio << ":1, ";
-    cout.width(6);
-    cout.precision(3);
-    cout << bitsperword << " bits/word, ";
-    cout.width(6);
-    cout.precision(2);
-    cout << saved << "% saved.\n";
-    cout.precision(6);
+    ostream &out = *report;
+    out.width(20);
+    out << raw_file_name << ": ";
+
+    out.setf(ios_base::fixed, ios_base::floatfield);
+    out.width(8);
+    out.precision(3);
+    out << ratio << ":1, ";
+    out.width(6);
+    out.precision(3);
+    out << bitsperword << " bits/word, ";
+    out.width(6);
+    out.precision(2);
+    out << saved << "% saved.\n";
+    out.precision(6);
   }
 
   return 0;
@@ -919,29 +1566,7 @@ inline void slim_compressor_t::write_last_section_foot() {
 /// \param in_name   The input (slim) file name.  Will be used read-only.
 //----------------------------------------------------------------------
 slim_expander_t::slim_expander_t(const char *in_name) {
-  verify_twos_complement();
-
-  ib = NULL;
-  section = NULL;
-
-  flags = 0;
-  mtime = 0;
-  raw_size = 0;
-
-  bytes_read = 0;
-  sec_bytes_read = 0;
-  current_section_size = 0;
-
-  size_t len = strlen(in_name);
-  in_filename = new char [len+1];
-  strncpy(in_filename, in_name, len);
-  in_filename[len] = '\0';
-  
-  channels.clear();
-  num_frames = 0;
-  eof_tag_found = false;
-  used_read = used_r_onesection = false;
-  ignore_crc = false;
+  initialize(in_name);
 
   // Find the compressed size
   struct stat status;
@@ -958,50 +1583,278 @@ slim_expander_t::slim_expander_t(const char *in_name) {
 /// \param in_fd     The input (slim) descriptor.  Will be used read-only.
 //----------------------------------------------------------------------
 slim_expander_t::slim_expander_t(int in_fd) {
+  initialize(NULL);
+
+  // Find the compressed size
+  struct stat status;
+  fstat(in_fd, &status);
+  slim_size = status.st_size;
+
+  ib = new ibitstream(in_fd);
+  if (ib->is_open())
+    read_file_header();
+}
+
+
+//----------------------------------------------------------------------
+/// Constructor that reads a descriptor only with pread(2), starting at
+/// an offset.  The descriptor's own file position is neither used nor
+/// changed, so this may peek at a file that another expander is reading
+/// through the same (or a dup'ed) descriptor.  The descriptor is not
+/// closed by this expander.
+/// \param in_fd     The input (slim) descriptor.  Will be used read-only.
+/// \param offset    Where the slim file starts in it (bytes).
+//----------------------------------------------------------------------
+slim_expander_t::slim_expander_t(int in_fd, int64_t offset) {
+  initialize(NULL);
+
+  struct stat status;
+  fstat(in_fd, &status);
+  slim_size = status.st_size - offset;
+
+  ib = new ibitstream(in_fd, off_t(offset), ibitstream::DEFAULT_IOBUFFER_SIZE);
+  if (ib->is_open())
+    read_file_header();
+}
+
+
+//----------------------------------------------------------------------
+/// Constructor for a cursor on a shared slim file.
+/// The cursor reads the descriptor owned by the slim_reader_t only with
+/// pread(2), so many cursors on one reader may decode in parallel, one per
+/// thread.  Each cursor owns its own buffers, channels, and decoders.
+/// Cursors support seek_section() and seek(), using the shared index.
+/// \param shared  The shared reader.  Must outlive this cursor.
+//----------------------------------------------------------------------
+slim_expander_t::slim_expander_t(const slim_reader_t *shared) {
+  initialize(shared->get_filename());
+  reader = shared;
+  slim_size = shared->get_slimsize();
+
+  ib = new ibitstream(shared->get_fd(), 0, slim_reader_t::CURSOR_IOBUFFER_SIZE,
+                      shared->get_seek_table());
+  if (ib->is_open())
+    read_file_header();
+}
+
+
+//----------------------------------------------------------------------
+/// Constructor for a slim file already read completely into memory
+/// (see slim_batch_t).  No file I/O happens after construction.
+/// \param in_name   The file's name (used only in messages).
+/// \param data      The whole slim file.  The expander takes ownership:
+///                  it must come from new unsigned char[] and be padded
+///                  with zeros to a multiple of 8 bytes.
+/// \param length    Size of the slim file (bytes).
+//----------------------------------------------------------------------
+slim_expander_t::slim_expander_t(const char *in_name, unsigned char *data,
+                                 size_t length) {
+  initialize(in_name);
+  slim_size = length;
+
+  ib = new ibitstream(data, length);
+  if (ib->is_open())
+    read_file_header();
+}
+
+
+//----------------------------------------------------------------------
+/// Set all attributes to their initial state (shared by constructors).
+/// \param in_name   The input (slim) file name, or NULL if not known.
+//----------------------------------------------------------------------
+void slim_expander_t::initialize(const char *in_name) {
   verify_twos_complement();
 
   ib = NULL;
   section = NULL;
+  held_section = NULL;
+  read_ahead = 0;
+  ahead = NULL;
+  in_filename = NULL;
+  channels.clear();
+  ignore_crc = false;
+  quiet = false;
+  report = &cout;
+  errors = &cerr;
+  reader = NULL;
+  chan_info = NULL;
+  chan_info_allocated = 0;
+  stats = NULL;
+  reset(in_name);
+}
+
 
+//----------------------------------------------------------------------
+/// Set the attributes that describe one input file to their initial
+/// state.  Buffers, channels, and decoders are kept for the next file.
+/// \param in_name   The input (slim) file name, or NULL if not known.
+//----------------------------------------------------------------------
+void slim_expander_t::reset(const char *in_name) {
   flags = 0;
   mtime = 0;
   raw_size = 0;
+  slim_size = 0;
 
   bytes_read = 0;
   sec_bytes_read = 0;
   current_section_size = 0;
+  current_section_slim_size = 0;
+  held_size = 0;
+  wide_sizes = false;
+  reuse_params = false;
+  section_reuses_params = false;
+  header_section = -1;
 
+  if (in_filename)
+    delete [] in_filename;
   in_filename = NULL;
+  if (in_name) {
+    size_t len = strlen(in_name);
+    in_filename = new char [len+1];
+    memcpy(in_filename, in_name, len+1);
+  }
 
-  channels.clear();
+  curptr = NULL;
   num_frames = 0;
   eof_tag_found = false;
   used_read = used_r_onesection = false;
-  ignore_crc = false;
+  section_offset = 0;
+  if (stats)
+    stats->clear();
+}
+
+
+//----------------------------------------------------------------------
+/// Start expanding another slim file, as if newly constructed from its
+/// name, but keeping this expander's buffers, channels, and decoders.
+/// Expanding many small files through one expander thus saves most of
+/// the cost of setting up each.  Not allowed for cursors or for files
+/// read into memory.
+/// \param in_name   The input (slim) file name.  Will be used read-only.
+//----------------------------------------------------------------------
+void slim_expander_t::open(const char *in_name) {
+  if (reader)
+    throw "slim_expander_t::open() cannot re-target a cursor.";
+  stop_read_ahead();
+  reset(in_name);
+
+  struct stat status;
+  stat(in_name, &status);
+  slim_size = status.st_size;
+
+  ib->reopen(in_name);
+  if (ib->is_open())
+    read_file_header();
+}
+
+
+//----------------------------------------------------------------------
+/// Start expanding another slim file, as open(const char *) does.
+/// \param in_fd     The input (slim) descriptor.  Will be used read-only.
+//----------------------------------------------------------------------
+void slim_expander_t::open(int in_fd) {
+  if (reader)
+    throw "slim_expander_t::open() cannot re-target a cursor.";
+  stop_read_ahead();
+  reset(NULL);
 
-  // Find the compressed size
   struct stat status;
   fstat(in_fd, &status);
   slim_size = status.st_size;
 
-  ib = new ibitstream(in_fd);
+  ib->reopen(in_fd);
   if (ib->is_open())
     read_file_header();
 }
 
 
+//----------------------------------------------------------------------
+/// Close the input file, but keep buffers, channels, and decoders for
+/// the next call to open().
+//----------------------------------------------------------------------
+void slim_expander_t::close() {
+  stop_read_ahead();
+  ib->close_input();
+}
+
+
 //----------------------------------------------------------------------
 /// Destructor
 //----------------------------------------------------------------------
 slim_expander_t::~slim_expander_t() {
+  stop_read_ahead();
   delete ib;
   delete section;
+  delete [] chan_info;
+  delete stats;
   if (in_filename)
     delete [] in_filename;
 }
 
 
 
+//----------------------------------------------------------------------
+/// Keep (or stop keeping) the time and bytes spent in each stage, the
+/// overflows in each channel, and the input buffer refills.  Timing
+/// costs a clock reading per stage per section, so it is off by default.
+/// While statistics are kept, the CRC-32 is computed in a pass of its
+/// own, after the section is decoded, so that it can be timed apart.
+/// \param s  Whether to keep statistics.
+//----------------------------------------------------------------------
+void slim_expander_t::set_stats(bool s) {
+  if (s && ahead)
+    throw "slim_expander_t::set_stats() cannot start while reading ahead.";
+  if (s && !stats) {
+    stats = new slim_stats_t;
+    for (int i=0; i<num_channels(); i++)  // Forget any earlier overflows.
+      reinterpret_cast<slim_channel_decode *>(channels[i])->take_overflows();
+  } else if (!s) {
+    delete stats;
+    stats = NULL;
+  }
+  ib->set_timing(s);
+}
+
+
+
+//----------------------------------------------------------------------
+/// Get the statistics of the file so far.
+/// \return The statistics, or NULL if set_stats() was not called.
+//----------------------------------------------------------------------
+const slim_stats_t *slim_expander_t::get_stats() {
+  if (stats)
+    update_stats();
+  return stats;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Write the statistics of the file so far as one line of JSON.  Writes
+/// nothing if set_stats() was not called.
+/// \param os  The output stream.
+//----------------------------------------------------------------------
+void slim_expander_t::write_stats(ostream &os) {
+  if (stats) {
+    update_stats();
+    stats->write_json(os, in_filename, false);
+  }
+}
+
+
+
+//----------------------------------------------------------------------
+/// Copy the counters kept by the input bitstream into the statistics.
+//----------------------------------------------------------------------
+void slim_expander_t::update_stats() {
+  stats->slim_bytes = ib->get_bytes_used();
+  stats->seconds[SLIM_STAGE_READ] = ib->get_io_seconds();
+  stats->bytes[SLIM_STAGE_READ] = stats->slim_bytes;
+  stats->refills = ib->get_refills();
+}
+
+
+
 //----------------------------------------------------------------------
 /// Take ownership of an existing encoding channel.
 /// \param c A functioning slim_channel_decode object to use.
@@ -1041,6 +1894,31 @@ slim_expander_t::add_channel(int reps, enum code_t code, enum data_t data_type,
 
 
 
+//----------------------------------------------------------------------
+/// Reconfigure a decoding channel kept from the previous section, so
+/// that it need not be deleted and made anew.  Its decoder is kept too,
+/// if it suits (see slim_channel_decode::use_decoder()).
+/// \param i    Index of the channel.
+/// \param reps Number of repetitions.
+/// \param code ID # of the encoding method to use.
+/// \param data_type ID # for the data type.
+/// \param deltas Whether to encode successive difference data.
+/// \param bit_rotation  Number of bits by which raw data are rotated.
+//----------------------------------------------------------------------
+slim_channel_decode *
+slim_expander_t::reuse_channel(int i, int reps, enum code_t code,
+                               enum data_t data_type, bool deltas,
+                               int bit_rotation) {
+  slim_channel_decode *c =
+    reinterpret_cast<slim_channel_decode *>(channels[i]);
+  c->configure(reps, slim_type_size[data_type], deltas);
+  c->use_decoder(code, data_type, deltas);
+  c->read_params(bit_rotation);
+  return c;
+}
+
+
+
 //----------------------------------------------------------------------
 /// How many channels have been recorded?
 /// \return Number of channels owned by this object.
@@ -1069,7 +1947,7 @@ int slim_expander_t::read_file_header() {
   char file_magic[3]="", 
     orig_filename[256]="";
   ib->readstring(file_magic, 2);
-  if (strcmp(file_magic, FILE_MAGIC))
+  if (strcmp(file_magic, FILE_MAGIC) && strcmp(file_magic, FILE_MAGIC_V2))
     throw "file is not a slim file.";
 
   mtime = ib->readbits(32);
@@ -1082,6 +1960,17 @@ int slim_expander_t::read_file_header() {
   if (flags & FLAG_XTRA) {
     unsigned short xtra_len;
     xtra_len = ib->readbits(16);
+    int xflags = 0;
+    if (xtra_len >= 1) {
+      xflags = ib->readbits(8);
+      xtra_len -= 1;
+    }
+    wide_sizes = (xflags & XFLAG_WIDE);
+    reuse_params = (xflags & XFLAG_SAME);
+    if (wide_sizes && (flags & FLAG_SIZE) && xtra_len >= 8) {
+      raw_size = read_size(BITS_SLIM_WIDE_SIZE);
+      xtra_len -= 8;
+    }
     for (int i=0; i<xtra_len; i++)
       ib->readbits(8);
   }
@@ -1098,15 +1987,20 @@ int slim_expander_t::read_file_header() {
 //----------------------------------------------------------------------
 int slim_expander_t::read_section_header() {
   ib->windup(); // Section headers are byte-aligned.
+  section_offset = ib->get_bytes_used();
 
   if (section == NULL)
     section = new raw_section(SECTION_EXPAND_MODE);
   section->reset_channels();
-  channels.clear();
+  header_section++;
 
   // Size of the raw section
-  current_section_size = ib->readbits(BITS_SLIM_SECT_SIZE);
-  sec_bytes_read = 0; // we have read none of it yet
+  current_section_size = read_size(BITS_SLIM_SECT_SIZE);
+
+  // Slim size of the section, if recorded (0 means unknown).
+  current_section_slim_size = 0;
+  if (flags & FLAG_SLEN)
+    current_section_slim_size = read_size(BITS_SLIM_SECT_SLIM_SIZE);
 
 
   // Table of contents fwd ptr in the compressed file to next section.
@@ -1120,6 +2014,18 @@ int slim_expander_t::read_section_header() {
   else
     nchan = ib->readbits(BITS_SLIM_NUM_CHAN);
 
+  if (nchan > chan_info_allocated) {
+    delete [] chan_info;
+    chan_info = new slim_channel_info_t[nchan];
+    chan_info_allocated = nchan;
+  }
+
+  // Channels are kept from the previous section and reconfigured, rather
+  // than made anew for each section.
+  if (nchan < num_channels())
+    channels.truncate(nchan);
+  section_reuses_params = false;
+
   // Read channel descriptions
   for (int c=0; c<nchan; c++) {
     code_t algo_code;
@@ -1127,6 +2033,18 @@ int slim_expander_t::read_section_header() {
     unsigned int repetitions; // Bug if >2^19 and not an unsigned int.
     int data_size;
 
+    // Is the channel unchanged from the previous section?
+    if (reuse_params && ib->readbits(1)) {
+      if (c >= num_channels())
+        throw "Cannot decode: section reuses parameters of a missing channel.";
+      slim_channel_decode *cdec =
+        reinterpret_cast<slim_channel_decode *>(channels[c]);
+      cdec->reset_previous();
+      section->add_channel(cdec->get_repetitions(), cdec->get_raw_size());
+      section_reuses_params = true;
+      continue;
+    }
+
     if (flags & FLAG_NOREPS || nchan <= 1) {
       repetitions = 1;
     } else {
@@ -1148,8 +2066,21 @@ int slim_expander_t::read_section_header() {
         repetitions = 1;
     }
 
-    slim_channel_decode *cdec = 
-      add_channel(repetitions, algo_code, type_code, deltas, bit_rotation);
+    slim_channel_decode *cdec;
+    if (c < num_channels())
+      cdec = reuse_channel(c, repetitions, algo_code, type_code, deltas,
+                           bit_rotation);
+    else
+      cdec = add_channel(repetitions, algo_code, type_code, deltas,
+                         bit_rotation);
+
+    slim_channel_info_t &info = chan_info[c];
+    info.repetitions = cdec->get_repetitions();
+    info.codec = algo_code;
+    info.data_type = type_code;
+    info.deltas = deltas;
+    info.bit_rotation = bit_rotation;
+    info.nbits = cdec->get_nbits();
 
     // Inform the raw section buffer about it.
     section->add_channel(cdec->get_repetitions(), cdec->get_raw_size());
@@ -1168,6 +2099,22 @@ int slim_expander_t::read_section_header() {
 
 
 
+//----------------------------------------------------------------------
+/// Read a size from the slim file: 64 bits in a wide file, else nbits.
+/// \param nbits  Number of bits in an ordinary (not wide) file.
+/// \return The size.
+//----------------------------------------------------------------------
+size_t slim_expander_t::read_size(int nbits) {
+  if (wide_sizes) {
+    uint64_t lo = ib->readbits(32);
+    uint64_t hi = ib->readbits(32);
+    return size_t(lo | (hi << 32));
+  }
+  return ib->readbits(nbits);
+}
+
+
+
 //----------------------------------------------------------------------
 /// Read data from compressed file up to given size.
 /// This call will cover multiple sections, if needed.
@@ -1189,7 +2136,7 @@ size_t slim_expander_t::read(unsigned char *buf, const size_t max) {
   used_read = true;
 
   // First, see if there are previously-read but unused bytes.
-  size_t bytes_unused = current_section_size - sec_bytes_read;
+  size_t bytes_unused = held_size - sec_bytes_read;
   if (bytes_unused > 0) {
     // This time, get all the unused bytes, up to max
     bytes_thiscall = bytes_unused;
@@ -1216,7 +2163,7 @@ size_t slim_expander_t::read(unsigned char *buf, const size_t max) {
   // The previously-read bytes, if there were any, did not complete the request.
 
   while (bytes_decoded < max) {
-    bytes_thiscall = load_decode_section();
+    bytes_thiscall = next_section();
     if (bytes_thiscall == 0)
       break;
 
@@ -1227,13 +2174,13 @@ size_t slim_expander_t::read(unsigned char *buf, const size_t max) {
 
     sec_bytes_read = bytes_thiscall;
     if (buf) {
-      memcpy(buf, section->ptr(0,0), bytes_thiscall);
+      memcpy(buf, held_section->ptr(0,0), bytes_thiscall);
       buf += bytes_thiscall;
     }
     bytes_decoded += bytes_thiscall;
   }
-  if (section)
-    curptr = section->ptr(0,0) + bytes_thiscall;
+  if (held_section)
+    curptr = held_section->ptr(0,0) + bytes_thiscall;
   else
     curptr = NULL;
   return bytes_decoded;
@@ -1254,6 +2201,12 @@ size_t slim_expander_t::load_decode_section() {
     return 0;
   }
 
+  double start = 0.0, io_start = 0.0;
+  if (stats) {
+    start = slim_clock();
+    io_start = ib->get_io_seconds();
+  }
+
   // Recognize EOF by failure to read a section header.
   try {
     read_section_header();
@@ -1262,19 +2215,244 @@ size_t slim_expander_t::load_decode_section() {
     section = NULL;
     return 0;
   }
-  
-  // Now we have a section header read, section is prepared.
-  // It is possible that some bytes were consumed on previous call.
-  // Find out how much to read.
+  if (stats)
+    stats->add(SLIM_STAGE_PARAMS, start + ib->get_io_seconds() - io_start);
+
+  return decode_section_data((flags & FLAG_CRC) && !ignore_crc);
+}
+
+
+
+//----------------------------------------------------------------------
+/// Get the next section to hand out, as held_section: decoded now, or
+/// taken from the read-ahead queue.  Any section held before is given
+/// back.  Exceptions from decoding are raised here, in order.
+/// \return Raw size of the section, or 0 if there are no more.
+//----------------------------------------------------------------------
+size_t slim_expander_t::next_section() {
+  sec_bytes_read = 0;
+  if (ahead == NULL && read_ahead > 0 && !stats && !eof_tag_found)
+    start_read_ahead();
+  if (ahead == NULL) {
+    held_size = load_decode_section();
+    held_section = section;
+    return held_size;
+  }
+
+  pthread_mutex_lock(&ahead->lock);
+  if (held_section)
+    ahead->spares[ahead->nspares++] = held_section;
+  held_section = NULL;
+  held_size = 0;
+  while (ahead->count == 0 && !ahead->done)
+    pthread_cond_wait(&ahead->decoded, &ahead->lock);
+  if (ahead->count > 0) {
+    held_section = ahead->queue[ahead->head];
+    held_size = ahead->sizes[ahead->head];
+    ahead->head = (ahead->head + 1) % ahead->depth;
+    ahead->count--;
+    pthread_cond_signal(&ahead->room);
+  }
+  const char *error = held_section ? NULL : ahead->error;
+  if (held_section == NULL && ahead->file_error) {
+    bad_file bf(*ahead->file_error);
+    pthread_mutex_unlock(&ahead->lock);
+    throw bf;
+  }
+  pthread_mutex_unlock(&ahead->lock);
+  if (error)
+    throw error;
+  return held_size;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Decode sections ahead of read(), read_onesection(), and expansion on
+/// a thread of their own, so that decoding the next sections overlaps
+/// with the caller's use of this one.  At most nsections are kept decoded
+/// but not yet handed out.  The thread starts when the caller first needs
+/// a section, and it stops on seek, open, or close.  Until then, nothing
+/// else may use this expander's bitstream: scan_section() and
+/// peek_section() are refused, and statistics must not be kept (keeping
+/// them turns read-ahead off).  Takes effect when next the thread starts.
+/// \param nsections  Sections to decode ahead (0 to decode as needed).
+//----------------------------------------------------------------------
+void slim_expander_t::set_read_ahead(int nsections) {
+  read_ahead = (nsections > 0) ? nsections : 0;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Start the read-ahead thread at the current section.  Decodes as
+/// needed (without the thread) if it cannot be started.
+//----------------------------------------------------------------------
+void slim_expander_t::start_read_ahead() {
+  slim_readahead_t *ra = new slim_readahead_t;
+  ra->depth = read_ahead;
+  ra->queue = new raw_section *[ra->depth];
+  ra->sizes = new size_t[ra->depth];
+  ra->head = ra->count = 0;
+  // The queue, plus one being decoded, plus one held by the reader.
+  ra->spares = new raw_section *[ra->depth + 2];
+  ra->nspares = 0;
+  ra->done = ra->stop = false;
+  ra->error = NULL;
+  ra->file_error = NULL;
+
+  // Any buffer we have is now a spare (held_section, if any, is the same).
+  if (section)
+    ra->spares[ra->nspares++] = section;
+  section = held_section = NULL;
+  held_size = 0;
+
+  pthread_mutex_init(&ra->lock, NULL);
+  pthread_cond_init(&ra->decoded, NULL);
+  pthread_cond_init(&ra->room, NULL);
+  ahead = ra;
+  if (pthread_create(&ra->thread, NULL, read_ahead_worker, this) != 0) {
+    ahead = NULL;
+    section = ra->nspares ? ra->spares[0] : NULL;
+    pthread_mutex_destroy(&ra->lock);
+    pthread_cond_destroy(&ra->decoded);
+    pthread_cond_destroy(&ra->room);
+    delete [] ra->queue;
+    delete [] ra->sizes;
+    delete [] ra->spares;
+    delete ra;
+  }
+}
+
+
+
+//----------------------------------------------------------------------
+/// Stop the read-ahead thread, if any, and drop the sections it decoded.
+/// Whatever was not yet handed out is lost, so the reader must seek or
+/// reopen before reading on.  One buffer is kept for later sections.
+//----------------------------------------------------------------------
+void slim_expander_t::stop_read_ahead() {
+  if (ahead == NULL)
+    return;
+  slim_readahead_t *ra = ahead;
+  pthread_mutex_lock(&ra->lock);
+  ra->stop = true;
+  pthread_cond_signal(&ra->room);
+  pthread_mutex_unlock(&ra->lock);
+  pthread_join(ra->thread, NULL);
+  ahead = NULL;
+
+  if (held_section)
+    ra->spares[ra->nspares++] = held_section;
+  for (int i=0; i<ra->count; i++)
+    ra->spares[ra->nspares++] = ra->queue[(ra->head + i) % ra->depth];
+  if (section == NULL && ra->nspares > 0)
+    section = ra->spares[--ra->nspares];
+  for (int i=0; i<ra->nspares; i++)
+    delete ra->spares[i];
+  held_section = NULL;
+  held_size = sec_bytes_read = 0;
+  curptr = NULL;
+
+  pthread_mutex_destroy(&ra->lock);
+  pthread_cond_destroy(&ra->decoded);
+  pthread_cond_destroy(&ra->room);
+  delete [] ra->queue;
+  delete [] ra->sizes;
+  delete [] ra->spares;
+  delete ra->file_error;
+  delete ra;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Body of the read-ahead thread: decode sections into spare buffers and
+/// queue them, waiting whenever the queue is full, until the last section
+/// or a decoding error, or until told to stop.  A string or bad_file
+/// error is kept for next_section() to throw on the reader's thread.
+/// \param expander  The slim_expander_t (as void *, for pthread_create).
+/// \return NULL.
+//----------------------------------------------------------------------
+void *slim_expander_t::read_ahead_worker(void *expander) {
+  slim_expander_t *ex = static_cast<slim_expander_t *>(expander);
+  slim_readahead_t *ra = ex->ahead;
+
+  pthread_mutex_lock(&ra->lock);
+  while (!ra->stop && !ra->done) {
+    if (ra->count >= ra->depth) {
+      pthread_cond_wait(&ra->room, &ra->lock);
+      continue;
+    }
+    ex->section = ra->nspares ? ra->spares[--ra->nspares] : NULL;
+    pthread_mutex_unlock(&ra->lock);
+
+    size_t size = 0;
+    const char *error = NULL;
+    bad_file *file_error = NULL;
+    try {
+      size = ex->load_decode_section();
+    } catch (const char *s) {
+      error = s;
+    } catch (const bad_file &bf) {
+      // Its message dies with bf, so keep a copy for the reader to throw.
+      file_error = new bad_file(bf);
+    } catch (...) {
+      error = "slim_expander_t could not decode a section ahead.";
+    }
+
+    pthread_mutex_lock(&ra->lock);
+    if (size > 0 && error == NULL && file_error == NULL) {
+      int tail = (ra->head + ra->count) % ra->depth;
+      ra->queue[tail] = ex->section;
+      ra->sizes[tail] = size;
+      ra->count++;
+    } else {
+      if (ex->section)
+        ra->spares[ra->nspares++] = ex->section;
+      ra->done = true;
+      ra->error = error;
+      ra->file_error = file_error;
+    }
+    ex->section = NULL;
+    pthread_cond_signal(&ra->decoded);
+  }
+  pthread_mutex_unlock(&ra->lock);
+  return NULL;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Decode the data of the section whose header was just read, then read
+/// its CRC (if any) and the End-Section block.
+/// \param check_crc  Whether to verify the CRC-32 of the decoded data.
+/// \return Number of bytes decoded.
+//----------------------------------------------------------------------
+size_t slim_expander_t::decode_section_data(bool check_crc) {
   size_t bytes_thiscall;
   int bytes_remaining=current_section_size;  // signed: can be - if ghost bytes.
   unsigned char *buf = section->ptr(0,0);
   slim_channel_decode *chan = 
     reinterpret_cast<slim_channel_decode *>(channels[0]);
 
+  // Fold each frame into the CRC just after decoding, while it is in cache.
+  // Statistics (input buffer fills aside) are timed per section, and the
+  // CRC is then computed afterwards, in one pass.
+  uint32_t crc = 0;
+  const bool crc_inline = check_crc && !stats;
+  double start = 0.0, io_start = 0.0;
+  if (stats) {
+    start = slim_clock();
+    io_start = ib->get_io_seconds();
+  }
+
   while (bytes_remaining > 0) {
     // Try to fill the entire request on this channel.
     bytes_thiscall = chan->decode_frame(buf, bytes_remaining);
+    if (crc_inline && bytes_remaining > 0)
+      crc = slim_crc32(crc, buf, int(bytes_thiscall) < bytes_remaining ?
+                       bytes_thiscall : bytes_remaining);
 
     // Couldn't fill.  Update and move to next channel in the list.
     buf += bytes_thiscall;
@@ -1284,6 +2462,8 @@ size_t slim_expander_t::load_decode_section() {
       if (bytes_remaining > 0) {
         bytes_thiscall = chan->decode_frame(buf, chan->get_raw_size());
         assert (int(bytes_thiscall) > bytes_remaining);
+        if (crc_inline)
+          crc = slim_crc32(crc, buf, bytes_remaining);
         buf += bytes_remaining;
         bytes_remaining = 0;
       }
@@ -1294,24 +2474,37 @@ size_t slim_expander_t::load_decode_section() {
       (chan->next_chan);
   }
 
+  if (stats)
+    stats->add(SLIM_STAGE_CODE, start + ib->get_io_seconds() - io_start,
+               current_section_size);
+
   // Check CRC, if they are stored in the current file
-  if ((flags & FLAG_CRC) && !ignore_crc) {
-    unsigned long crc = section->crc();
+  if (check_crc) {
+    // Any bytes not decoded (a short section) count as they lie.
+    unsigned char *end = section->ptr(0,0) + current_section_size;
+    if (stats) {
+      start = slim_clock();
+      crc = slim_crc32(0, section->ptr(0,0), current_section_size);
+      stats->add(SLIM_STAGE_CRC, start, current_section_size);
+    } else if (buf < end)
+      crc = slim_crc32(crc, buf, end-buf);
     unsigned long expected_crc = ib->readbits(32);
     if (crc != expected_crc) {
-      cerr << in_filename << ": CRC-32 error.  compute " << crc <<
+      *errors << in_filename << ": CRC-32 error.  compute " << crc <<
         ", file says " << expected_crc << "\n";
 
       size_t actual_size = current_section_size-bytes_remaining;
       if (actual_size != current_section_size) {
-        cerr << in_filename << ": CRC-32 error.  Section size " <<
+        *errors << in_filename << ": CRC-32 error.  Section size " <<
           actual_size << " (expected " << current_section_size << ")\n";
       } else {
-        cerr << in_filename << ": CRC-32 error.  Section size " <<
+        *errors << in_filename << ": CRC-32 error.  Section size " <<
           actual_size << " (as expected)\n";
       }
       throw "CRC error.";
     }
+  } else if (flags & FLAG_CRC) {
+    ib->readbits(32);  // Unchecked, but it still precedes the End-Section.
   }
 
   // We have read every byte in the section, so read the End-Section block.
@@ -1331,11 +2524,20 @@ size_t slim_expander_t::load_decode_section() {
   if (bytes_remaining < 0)
     bytes_thissect += bytes_remaining;
   if (bytes_thissect != current_section_size) {
-    cerr <<  "The uncompressed section was "<<bytes_thissect
+    *errors << "The uncompressed section was "<<bytes_thissect
          <<", not the expected size of "<<current_section_size <<".\n",
     throw "The uncompressed section was not the expected size.";
   }
-    
+
+  if (stats) {
+    const int nchan = num_channels();
+    stats->raw_bytes += bytes_thissect;
+    stats->sections++;
+    stats->set_channels(nchan);
+    for (int i=0; i<nchan; i++)
+      stats->overflows[i] +=
+        reinterpret_cast<slim_channel_decode *>(channels[i])->take_overflows();
+  }
   return bytes_thissect;
 
 }
@@ -1355,9 +2557,9 @@ size_t slim_expander_t::read_onesection(const unsigned char **bufptr) {
     throw "Cannot call slim_expander_t::read_onesection() after ::read.";
   used_r_onesection = true;
 
-  size_t sect_size = load_decode_section();
-  if (section && sect_size > 0)
-    *bufptr = section->ptr(0,0);
+  size_t sect_size = next_section();
+  if (held_section && sect_size > 0)
+    *bufptr = held_section->ptr(0,0);
   else {
     *bufptr = NULL;
     sect_size = 0;
@@ -1367,6 +2569,193 @@ size_t slim_expander_t::read_onesection(const unsigned char **bufptr) {
 
 
 
+//----------------------------------------------------------------------
+/// Describe the next section without decoding its data, if possible.
+/// If the header gives the section's slim size (FLAG_SLEN), or if this
+/// is a cursor on a slim_reader_t whose index shows where the next
+/// section starts, the data are skipped over.  Otherwise they are
+/// decoded (but not checked against the CRC) to find the end.
+/// Note that you can't mix calling scan_section() with read() or 
+/// read_onesection().
+/// \param info  Filled with the section description.
+/// \return Raw size of the section, or 0 if there are no more.
+//----------------------------------------------------------------------
+size_t slim_expander_t::scan_section(slim_section_info_t *info) {
+  if (ahead)
+    throw "slim_expander_t::scan_section() cannot scan while reading ahead.";
+  if (eof_tag_found)
+    return 0;
+  try {
+    read_section_header();
+  } catch (const char *s) {
+    return 0;
+  }
+
+  // Find the start of the next section from the header or the index.
+  size_t next_offset = 0;
+  if (current_section_slim_size) {
+    next_offset = section_offset + current_section_slim_size;
+  } else if (reader) {
+    int isect = reader->find_section(bytes_read);
+    if (isect >= 0 && reader->get_section(isect).slim_offset == section_offset
+        && isect+1 < reader->num_sections())
+      next_offset = reader->get_section(isect+1).slim_offset;
+  }
+
+  info->skipped = (next_offset > 0);
+  if (info->skipped) {
+    skip_section_data(next_offset);
+  } else {
+    decode_section_data(false);
+    try {
+      ib->windup();
+    } catch (const char *s) {
+      ;  // The End-Section block was the last word of the file.
+    }
+  }
+  info->slim_offset = section_offset;
+  info->slim_size = (info->skipped ? next_offset : ib->get_bytes_used()) 
+    - section_offset;
+  info->raw_size = current_section_size;
+  bytes_read += current_section_size;
+  current_section_size = sec_bytes_read = held_size = 0;
+
+  info->num_frames = num_frames;
+  info->num_channels = num_channels();
+  info->channels = chan_info;
+  info->reuses_params = section_reuses_params;
+  return info->raw_size;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Describe the next section from its header alone, reading none of its
+/// data (to learn a file's frame layout, say).  Nothing more can be read
+/// in order afterwards: a cursor must seek, and any other expander can
+/// only be closed or reopened.
+/// \param info  Filled with the section description (slim_size is 0
+///              unless the header gives it).
+/// \return Raw size of the section, or 0 if there are no more.
+//----------------------------------------------------------------------
+size_t slim_expander_t::peek_section(slim_section_info_t *info) {
+  if (ahead)
+    throw "slim_expander_t::peek_section() cannot peek while reading ahead.";
+  if (eof_tag_found)
+    return 0;
+  try {
+    read_section_header();
+  } catch (const char *s) {
+    return 0;
+  }
+
+  info->slim_offset = section_offset;
+  info->slim_size = current_section_slim_size;
+  info->raw_size = current_section_size;
+  info->num_frames = num_frames;
+  info->num_channels = num_channels();
+  info->channels = chan_info;
+  info->skipped = true;
+  info->reuses_params = section_reuses_params;
+
+  // The data were not read, so there is nothing to hand out.
+  eof_tag_found = true;
+  current_section_size = sec_bytes_read = held_size = 0;
+  return info->raw_size;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Skip the data of the section whose header was just read.
+/// \param next_offset  Byte offset of the next section header.
+//----------------------------------------------------------------------
+void slim_expander_t::skip_section_data(size_t next_offset) {
+  ib->windup();
+  size_t here = ib->get_bytes_used();
+  if (next_offset < here)
+    throw "slim_expander_t::skip_section_data() cannot skip backwards.";
+  ib->skipbits(8*(next_offset - here));
+}
+
+
+
+//----------------------------------------------------------------------
+/// Position a cursor at the start of a section, for read() or
+/// read_onesection().  Only cursors from a slim_reader_t can seek.
+/// \param isect  Section number (from 0) to seek.
+/// \return 0 on success, or -1 if there is no such section.
+//----------------------------------------------------------------------
+int slim_expander_t::seek_section(int isect) {
+  if (reader == NULL)
+    throw "slim_expander_t::seek_section() requires a slim_reader_t cursor.";
+  if (isect < 0 || isect >= reader->num_sections())
+    return -1;
+  stop_read_ahead();
+
+  const slim_section_index_t &entry = reader->get_section(isect);
+
+  // Channels may keep parameters from earlier sections.  Unless we just
+  // read the section before, read the headers from the last section that
+  // gives them all.
+  if (reuse_params) {
+    int first = entry.key_section;
+    if (header_section >= first && header_section < isect)
+      first = header_section + 1;
+    header_section = first - 1;
+    for (int i=first; i<isect; i++) {
+      ib->seek(reader->get_section(i).slim_offset);
+      read_section_header();
+    }
+  }
+  ib->seek(entry.slim_offset);
+  eof_tag_found = false;
+  current_section_size = held_size = 0;
+  sec_bytes_read = 0;
+  curptr = NULL;
+  bytes_read = entry.raw_offset;
+  return 0;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Position a cursor at any byte of the raw data, for read().
+/// Only the one section holding that byte is decoded.
+/// Only cursors from a slim_reader_t can seek.
+/// \param raw_offset  Offset (bytes) into the raw data.
+/// \return 0 on success, or -1 if the offset is beyond the data.
+//----------------------------------------------------------------------
+int slim_expander_t::seek(size_t raw_offset) {
+  if (reader == NULL)
+    throw "slim_expander_t::seek() requires a slim_reader_t cursor.";
+
+  // Seeking to the very end leaves nothing more to read.
+  if (raw_offset == reader->get_rawsize()) {
+    stop_read_ahead();
+    eof_tag_found = true;
+    current_section_size = sec_bytes_read = held_size = 0;
+    bytes_read = raw_offset;
+    return 0;
+  }
+
+  int isect = reader->find_section(raw_offset);
+  if (seek_section(isect))
+    return -1;
+
+  size_t skip = raw_offset - reader->get_section(isect).raw_offset;
+  if (skip > 0) {
+    if (next_section() < skip)
+      return -1;
+    sec_bytes_read = skip;
+    curptr = held_section->ptr(0,0) + skip;
+    bytes_read = raw_offset;
+  }
+  return 0;
+}
+
+
+
 //----------------------------------------------------------------------
 /// Expand the entire file to another file.
 /// \param raw_file_name  A file where we put the raw data.
@@ -1377,26 +2766,30 @@ int slim_expander_t::expand_to_file(const char *raw_filename) {
   assert (fp != NULL);
 
   if (!quiet) {
-    cout.width(20);
-    cout << in_filename << ":\t";
+    ostream &out = *report;
+    out.width(20);
+    out << in_filename << ":\t";
     if (raw_size) {
-      cout.width(6);
-      cout.precision(1);
-      ios_base::fmtflags old = cout.setf(ios_base::fixed, ios_base::floatfield);
-      cout << 100.*(1.-double(slim_size)/raw_size);
-      cout.setf(old, ios::floatfield);
+      out.width(6);
+      out.precision(1);
+      ios_base::fmtflags old = out.setf(ios_base::fixed, ios_base::floatfield);
+      out << 100.*(1.-double(slim_size)/raw_size);
+      out.setf(old, ios::floatfield);
 
     } else
-      cout << " ???? ";
-    cout << "% -- replacing with " << raw_filename << "\n";
+      out << " ???? ";
+    out << "% -- replacing with " << raw_filename << "\n";
   }
 
   // Loop over all sections, reading and writing them
   while (1) {
-    size_t bytes_thissect = load_decode_section();
+    size_t bytes_thissect = next_section();
     if (bytes_thissect == 0)
       break;
-    section->flush(fp, bytes_thissect);
+    double start = stats ? slim_clock() : 0.0;
+    held_section->flush(fp, bytes_thissect);
+    if (stats)
+      stats->add(SLIM_STAGE_FLUSH, start, bytes_thissect);
   }
   fclose(fp);
   alter_mtime(raw_filename, mtime);
@@ -1415,10 +2808,13 @@ int slim_expander_t::expand_to_stdout() {
 
   // Loop over all sections, reading and writing them
   while (1) {
-    size_t bytes_thissect = load_decode_section();
+    size_t bytes_thissect = next_section();
     if (bytes_thissect == 0)
       break;
-    section->flush(fp, bytes_thissect);
+    double start = stats ? slim_clock() : 0.0;
+    held_section->flush(fp, bytes_thissect);
+    if (stats)
+      stats->add(SLIM_STAGE_FLUSH, start, bytes_thissect);
   }
   return 0;
 }
@@ -1446,6 +2842,10 @@ int slim_expander_t::dump_sliminfo() {
 
   if (flags&FLAG_XTRA)
     cout << "XTRA header data present\n";
+  if (wide_sizes)
+    cout << "Sizes are stored in 64 bits.\n";
+  if (reuse_params)
+    cout << "Sections can reuse channel parameters.\n";
 
   if (flags&FLAG_TOC)
     cout << "Table of Contents present.  Yugh!\n";
@@ -1465,20 +2865,26 @@ int slim_expander_t::dump_sliminfo() {
     cout << "CRC-32 checksums present.\n";
   else
     cout << "CRC-32 checksums not used.\n";
+
+  if (flags&FLAG_SLEN)
+    cout << "Section headers give slim sizes.\n";
   
   cout << "-----------------------------------------------------------"
 	 "----------------\n";
 
   int isect=0;
-  size_t section_size=0;
+  size_t section_size=0, total_size=0;
+  slim_section_info_t info;
   try {
-    section_size = load_decode_section();
+    section_size = scan_section(&info);
   } catch (const char *s) {
     decode_error = true;
   }
   while (section_size > 0 || decode_error) {
   
     cout << "SECTION "<<isect<<" (size: "<<section_size<<" bytes):\n";
+    if (!decode_error)
+      cout << "Slim size:          " << info.slim_size << " bytes\n";
     cout << "Number of frames:   " << num_frames << "\n";
     cout << "Number of channels: " << num_channels() << "\n";
     slim_channel_decode *chan = NULL; 
@@ -1499,9 +2905,10 @@ int slim_expander_t::dump_sliminfo() {
     cout << endl;
     if (decode_error)
       throw "Decoding error";
+    total_size += section_size;
 
     try {
-      section_size = load_decode_section();
+      section_size = scan_section(&info);
     } catch (const char *s) {
       decode_error = true;
     }
@@ -1509,6 +2916,8 @@ int slim_expander_t::dump_sliminfo() {
     isect++;
   }
 
+  if (!(flags&FLAG_SIZE))
+    cout << "Raw size      "<< total_size << " (sum of sections)\n";
   cout << "-----------------------------------------------------------"
 	 "----------------\n";
   return 0;
@@ -0,0 +1,208 @@
+/// \file slim_reader.cpp
+/// Implements the class slim_reader_t, a shared, thread-safe handle on
+/// one slim file from which many independent cursors can decode.
+
+//  Copyright (C) 2008, 2009 Joseph Fowler
+//
+//  This file is part of slim, a compression package for science data.
+//
+//  Slim is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Slim is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with slim.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "slim.h"
+#include "bitstream.h"
+
+
+// ----------------------------------------------------------------------
+/// \class slim_reader_t
+/// A slim file opened once and shared by many readers.
+/// The reader holds one read-only file descriptor and an index of all
+/// sections (where each starts in the slim file and in the raw data).
+/// It never reads the descriptor except by pread(2), and the index is
+/// not changed after construction, so the object is safe to share among
+/// threads.  Each thread decodes through its own cursor (a
+/// slim_expander_t from new_cursor()), which can seek to any section.
+// ----------------------------------------------------------------------
+
+//----------------------------------------------------------------------
+/// Constructor.  Opens the file and indexes its sections.
+/// \param in_name   The input (slim) file name.  Will be used read-only.
+//----------------------------------------------------------------------
+slim_reader_t::slim_reader_t(const char *in_name) {
+  index = NULL;
+  n_sections = n_allocated = 0;
+  raw_size = 0;
+  seek_table = NULL;
+
+  size_t len = strlen(in_name);
+  in_filename = new char [len+1];
+  memcpy(in_filename, in_name, len+1);
+
+  fd = open(in_name, O_RDONLY);
+  if (fd < 0) {
+    delete [] in_filename;
+    throw bad_output_file(in_name, "reading");
+  }
+
+  // Find the compressed size
+  struct stat status;
+  fstat(fd, &status);
+  slim_size = status.st_size;
+
+  // Cursors read the raw slim bitstream directly, so an LZ4 wrapper
+  // (which must be decompressed serially) cannot be shared.  A zstd
+  // wrapper can, if its seek table lets cursors start at any frame.
+  uint32_t magic_bytes = 0;
+  if (pread(fd, &magic_bytes, 4, 0) == 4 && magic_bytes == 0x184d2204) {
+    close(fd);
+    delete [] in_filename;
+    throw bad_file(in_name, ": LZ4-compressed slim files cannot be shared.");
+  }
+  if (magic_bytes == zstd_seek_table::ZSTD_MAGIC) {
+#ifdef HAVE_LIBZSTD
+    try {
+      seek_table = new zstd_seek_table(fd);
+    } catch (const char *e) {
+      close(fd);
+      delete [] in_filename;
+      throw bad_file(in_name, ": zstd-compressed without a seek table.");
+    }
+#else
+    close(fd);
+    delete [] in_filename;
+    throw bad_file(in_name, ": zstd-compressed, but slim lacks zstd support.");
+#endif
+  }
+
+  try {
+    build_index();
+  } catch (...) {
+    close(fd);
+    delete [] in_filename;
+    delete [] index;
+    delete seek_table;
+    throw;
+  }
+}
+
+
+
+//----------------------------------------------------------------------
+/// Destructor.  All cursors must be deleted first.
+//----------------------------------------------------------------------
+slim_reader_t::~slim_reader_t() {
+  if (fd >= 0)
+    close(fd);
+  delete [] index;
+  delete [] in_filename;
+  delete seek_table;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Make a new cursor on this file, positioned at the first section.
+/// The caller owns the cursor and must delete it before this reader.
+/// \return The new cursor.
+//----------------------------------------------------------------------
+slim_expander_t *slim_reader_t::new_cursor() const {
+  return new slim_expander_t(this);
+}
+
+
+
+//----------------------------------------------------------------------
+/// Find which section holds a given raw byte.
+/// \param raw_offset  Offset (bytes) into the raw data.
+/// \return Section number, or -1 if the offset is beyond the data.
+//----------------------------------------------------------------------
+int slim_reader_t::find_section(size_t raw_offset) const {
+  if (n_sections == 0 || raw_offset >= raw_size)
+    return -1;
+
+  // Binary search for the last section starting at or before raw_offset.
+  int lo=0, hi=n_sections-1;
+  while (lo < hi) {
+    int mid = (lo+hi+1)/2;
+    if (index[mid].raw_offset <= raw_offset)
+      lo = mid;
+    else
+      hi = mid-1;
+  }
+  return lo;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Walk the whole file once, recording where each section starts.
+/// Sections are skipped if their headers give their slim size (FLAG_SLEN);
+/// otherwise they must be decoded to find where the next one starts.
+//----------------------------------------------------------------------
+void slim_reader_t::build_index() {
+  slim_expander_t *cursor = new_cursor();
+  size_t raw_offset = 0;
+  int key_section = 0;
+
+  try {
+    slim_section_info_t info;
+    while (1) {
+      size_t sect_size = cursor->scan_section(&info);
+      if (sect_size == 0)
+        break;
+      if (!info.reuses_params)
+        key_section = n_sections;
+      add_section(info.slim_offset, raw_offset, sect_size, key_section);
+      raw_offset += sect_size;
+    }
+  } catch (...) {
+    delete cursor;
+    throw;
+  }
+  delete cursor;
+  raw_size = raw_offset;
+}
+
+
+
+//----------------------------------------------------------------------
+/// Append one section to the index, growing the array as needed.
+/// \param slim_offset  Byte offset of the section header (slim file).
+/// \param raw_offset   Offset of the section's first raw byte.
+/// \param sect_size    Raw size of the section (bytes).
+/// \param key_section  Latest section that gives all channel parameters.
+//----------------------------------------------------------------------
+void slim_reader_t::add_section(size_t slim_offset, size_t raw_offset,
+                                size_t sect_size, int key_section) {
+  if (n_sections >= n_allocated) {
+    int n = n_allocated ? 2*n_allocated : 16;
+    slim_section_index_t *new_index = new slim_section_index_t[n];
+    for (int i=0; i<n_sections; i++)
+      new_index[i] = index[i];
+    delete [] index;
+    index = new_index;
+    n_allocated = n;
+  }
+  index[n_sections].slim_offset = slim_offset;
+  index[n_sections].raw_offset = raw_offset;
+  index[n_sections].raw_size = sect_size;
+  index[n_sections].key_section = key_section;
+  n_sections++;
+}
@@ -0,0 +1,310 @@
+/// \file slim_schema.cpp
+/// Implements frame_schema, a frame layout of mixed channel types read
+/// from a frame description file.
+
+//  Copyright (C) 2008, 2009 Joseph Fowler
+//
+//  This file is part of slim, a compression package for science data.
+//
+//  Slim is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Slim is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with slim.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <climits>
+#include "slim.h"
+#include "bit_constants.h"
+
+/// A name that may appear in a schema file, and the enum value it means.
+struct schema_name {
+  const char *name;  ///< The name as written in the file.
+  int value;         ///< The data_t or code_t it stands for.
+};
+
+/// Data type names.  Float data are slimmed as if int32, as with -f.
+static const schema_name type_names[] = {
+  {"u32", SLIM_TYPE_U32}, {"uint32", SLIM_TYPE_U32},
+  {"i32", SLIM_TYPE_I32}, {"int32", SLIM_TYPE_I32},
+  {"u16", SLIM_TYPE_U16}, {"uint16", SLIM_TYPE_U16},
+  {"i16", SLIM_TYPE_I16}, {"int16", SLIM_TYPE_I16},
+  {"u8",  SLIM_TYPE_U8},  {"uint8",  SLIM_TYPE_U8},
+  {"i8",  SLIM_TYPE_I8},  {"int8",   SLIM_TYPE_I8},
+  {"float", SLIM_TYPE_I32},
+  {NULL, 0}
+};
+
+/// Code method names.  Only the methods that -m can request are allowed.
+static const schema_name code_names[] = {
+  {"raw",       SLIM_ENCODER_DEFAULT},
+  {"default",   SLIM_ENCODER_DEFAULT},
+  {"rb",        SLIM_ENCODER_REDUCED_BINARY},
+  {"binary",    SLIM_ENCODER_REDUCED_BINARY},
+  {"code_a",    SLIM_ENCODER_CODE_A},
+  {"runlength", SLIM_ENCODER_RUNLENGTH},
+  {"rl",        SLIM_ENCODER_RUNLENGTH},
+  {NULL, 0}
+};
+
+
+
+/// Look up a name in a table.
+/// \param table  The names to search.
+/// \param word   The name (or number) to look up.
+/// \param value  (out) The value found.
+/// \return Whether the name was found.
+static bool lookup(const schema_name *table, const string &word, int &value) {
+  for (; table->name; table++)
+    if (word == table->name) {
+      value = table->value;
+      return true;
+    }
+  return false;
+}
+
+
+
+/// Find the name of a value in a table.
+/// \param table  The names to search.
+/// \param value  The value to name.
+/// \return The first name for the value, or "?" if there is none.
+static const char *name_of(const schema_name *table, int value) {
+  for (; table->name; table++)
+    if (table->value == value)
+      return table->name;
+  return "?";
+}
+
+
+
+// ---------------------------------------------------------------------------
+/// \class frame_schema
+/// The layout of one frame: a list of groups of channels, in the order
+/// they appear in the frame, each group with its own data type, number
+/// of repeats and code method.  A frame description file has one group
+/// per line:
+///
+///     # chans  type  repeats  [method]  [deltas|nodeltas] [rotate|norotate]
+///       1      u32   43       runlength
+///       1056   i32   1        rb        deltas
+///       1      u32   1        raw
+///
+/// Types are u32, i32, u16, i16, u8, i8 (or uint32, int32...) and float.
+/// Methods are raw, rb, code_a or runlength, or their -m numbers; "-" or
+/// nothing means the method given on the command line, and the deltas
+/// and rotation settings likewise default to the command line's.
+/// Text after a '#' is a comment.
+// ---------------------------------------------------------------------------
+///
+
+
+/// Constructor: an empty schema.
+frame_schema::frame_schema() :
+  groups(NULL), ngroups(0), nalloc(0), lineno(0) {
+}
+
+
+
+/// Copy constructor.
+/// \param fs  The schema to copy.
+frame_schema::frame_schema(const frame_schema &fs) :
+  groups(NULL), ngroups(0), nalloc(0), lineno(fs.lineno) {
+  for (int i=0; i<fs.ngroups; i++)
+    push(fs.groups[i]);
+}
+
+
+
+/// Destructor.
+frame_schema::~frame_schema() {
+  delete [] groups;
+}
+
+
+
+/// Assignment.
+/// \param fs  The schema to copy.
+/// \return This schema.
+frame_schema &frame_schema::operator=(const frame_schema &fs) {
+  if (this != &fs) {
+    ngroups = 0;
+    for (int i=0; i<fs.ngroups; i++)
+      push(fs.groups[i]);
+    lineno = fs.lineno;
+  }
+  return *this;
+}
+
+
+
+/// Append a group of channels to the frame.
+/// \param g  The group.
+void frame_schema::push(const schema_group &g) {
+  if (ngroups >= nalloc) {
+    nalloc = nalloc ? 2*nalloc : 16;
+    schema_group *bigger = new schema_group[nalloc];
+    for (int i=0; i<ngroups; i++)
+      bigger[i] = groups[i];
+    delete [] groups;
+    groups = bigger;
+  }
+  groups[ngroups++] = g;
+}
+
+
+
+/// Read a frame description file, replacing any groups already held.
+/// Throws bad_file if the file cannot be read, or a message if a line
+/// cannot be parsed (line() then gives the line number).
+/// \param path    The file to read.
+/// \param code    Code method for groups that do not name one.
+/// \param deltas  Deltas setting for groups that do not give one.
+/// \param rotate  Rotation setting for groups that do not give one.
+void frame_schema::read(const char *path, enum code_t code,
+                        bool deltas, bool rotate) {
+  ifstream in(path);
+  if (!in)
+    throw bad_file(path, ": cannot read frame schema.");
+
+  ngroups = 0;
+  string text;
+  for (lineno=1; getline(in, text); lineno++) {
+    size_t hash = text.find('#');
+    if (hash != string::npos)
+      text.erase(hash);
+    istringstream line(text);
+    string word;
+    if (!(line >> word))
+      continue;
+
+    schema_group g;
+    g.code = code;
+    g.deltas = deltas;
+    g.rotate = rotate;
+
+    istringstream nchan_str(word);
+    if (!(nchan_str >> g.nchan) || !nchan_str.eof() || g.nchan <= 0)
+      throw "Channel count must be a positive integer.";
+
+    int value;
+    if (!(line >> word) || !lookup(type_names, word, value))
+      throw "Unknown or missing data type.";
+    g.data_type = (enum data_t) value;
+
+    if (!(line >> g.repeats) || g.repeats <= 0 ||
+        g.repeats != int(g.repeats & lowestNset[BITS_SLIM_REPETITIONS]))
+      throw "Repeats must be a positive integer that fits in 24 bits.";
+
+    if (line >> word && word != "-") {
+      istringstream code_str(word);
+      if (lookup(code_names, word, value) ||
+          (code_str >> value && code_str.eof() &&
+           (value == SLIM_ENCODER_DEFAULT ||
+            value == SLIM_ENCODER_REDUCED_BINARY ||
+            value == SLIM_ENCODER_CODE_A ||
+            value == SLIM_ENCODER_RUNLENGTH)))
+        g.code = (enum code_t) value;
+      else
+        throw "Unknown code method (use raw, rb, code_a or runlength).";
+    }
+
+    while (line >> word) {
+      if (word == "deltas")
+        g.deltas = true;
+      else if (word == "nodeltas")
+        g.deltas = false;
+      else if (word == "rotate")
+        g.rotate = true;
+      else if (word == "norotate")
+        g.rotate = false;
+      else
+        throw "Unknown option (use deltas, nodeltas, rotate or norotate).";
+    }
+    push(g);
+  }
+
+  if (ngroups == 0)
+    throw "Frame schema describes no channels.";
+  if (num_channels() != int(num_channels() & lowestNset[BITS_SLIM_NUM_CHAN]))
+    throw "Frame schema has too many channels.";
+}
+
+
+
+/// Create all channels of the frame, in order, in a compressor.
+/// \param compressor  The compressor to get the channels.
+void frame_schema::add_channels(slim_compressor_t *compressor) const {
+  for (int i=0; i<ngroups; i++) {
+    const schema_group &g = groups[i];
+    for (int c=0; c<g.nchan; c++)
+      compressor->add_channel(g.repeats, g.code, g.data_type,
+                              g.deltas, g.rotate);
+  }
+}
+
+
+
+/// Write the schema in the form that read() accepts, with every
+/// setting spelled out.
+/// \param os  Where to write it.
+void frame_schema::write(ostream &os) const {
+  os << "# chans  type  repeats  method     options\n";
+  for (int i=0; i<ngroups; i++) {
+    const schema_group &g = groups[i];
+    os << "  ";
+    os.width(6);
+    os << left << g.nchan << " ";
+    os.width(5);
+    os << name_of(type_names, g.data_type) << " ";
+    os.width(8);
+    os << g.repeats << " ";
+    os.width(10);
+    os << name_of(code_names, g.code) << " "
+       << (g.deltas ? "deltas" : "nodeltas")
+       << (g.rotate ? " rotate" : "") << right << "\n";
+  }
+}
+
+
+
+/// Count the channels in all groups.
+/// \return Number of channels per frame.
+int frame_schema::num_channels() const {
+  long n = 0;
+  for (int i=0; i<ngroups; i++)
+    n += groups[i].nchan;
+  return n > INT_MAX ? INT_MAX : int(n);
+}
+
+
+
+/// Size of one frame.
+/// \return Bytes per frame.
+size_t frame_schema::frame_size() const {
+  size_t size = 0;
+  for (int i=0; i<ngroups; i++) {
+    const schema_group &g = groups[i];
+    size += size_t(g.nchan) * g.repeats * slim_type_size[g.data_type];
+  }
+  return size;
+}
+
+
+
+/// Name of a code method, as a schema file would give it.
+/// \param code  The code method.
+/// \return Its name ("?" if none).
+const char *frame_schema::code_name(enum code_t code) {
+  return name_of(code_names, code);
+}
@@ -30,6 +30,19 @@ inline void mexp_golomb_write(obitstream *ob, uint32_t u,
 
 
 
+/// Length of the code that mexp_golomb_write() writes.
+/// \param u     The number to encode.
+/// \param order The order of the code, i.e. the minimum # of value bits.
+/// \return      Number of bits in the code.
+inline unsigned int mexp_golomb_bits(uint32_t u, unsigned int order=1) {
+  unsigned int n = bit_size(u);
+  if (n > order)
+    return 2*n - order;
+  return 1 + order;
+}
+
+
+
 /// Read an unsigned 32-bit value from a bitstream by method mexp_golomb.
 /// \param ib     The bitstream to read.
 /// \param order The order of the code, i.e. the minimum # of value bits.
@@ -0,0 +1,153 @@
+/// \file slim_stats.cpp
+/// Implements slim_stats_t, the optional record of time and bytes spent in
+/// each stage of compressing or expanding one file.
+
+//  Copyright (C) 2008, 2009 Joseph Fowler
+//
+//  This file is part of slim, a compression package for science data.
+//
+//  Slim is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Slim is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with slim.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <iostream>
+#include <iomanip>
+#include <time.h>
+#include "slim.h"
+
+/// Names of the stages, in enum slim_stage_t order, as they appear in JSON.
+static const char *stage_names[SLIM_NUM_STAGES] = {
+  "read", "params", "code", "crc", "flush"};
+
+
+
+/// Read a monotonic clock.
+/// \return Time in seconds from some fixed, arbitrary start.
+double slim_clock() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+
+
+// ----------------------------------------------------------------------
+/// \class slim_stats_t
+/// Time and bytes per stage of compression or expansion, with counts of
+/// sections, bitstream buffer refills, and overflows in each channel.
+// ----------------------------------------------------------------------
+
+/// Constructor
+slim_stats_t::slim_stats_t() {
+  overflows = NULL;
+  num_allocated = 0;
+  clear();
+}
+
+
+
+/// Destructor
+slim_stats_t::~slim_stats_t() {
+  delete [] overflows;
+}
+
+
+
+/// Zero all counters, to start a new file.
+void slim_stats_t::clear() {
+  for (int i=0; i<SLIM_NUM_STAGES; i++) {
+    seconds[i] = 0.0;
+    bytes[i] = 0;
+  }
+  raw_bytes = slim_bytes = 0;
+  sections = 0;
+  refills = 0;
+  num_channels = 0;
+  if (overflows)
+    memset(overflows, 0, num_allocated*sizeof(size_t));
+}
+
+
+
+/// Make room to count overflows in at least n channels.
+/// \param n  Number of channels in the current section.
+void slim_stats_t::set_channels(int n) {
+  if (n > num_allocated) {
+    size_t *bigger = new size_t[n];
+    memset(bigger, 0, n*sizeof(size_t));
+    if (overflows)
+      memcpy(bigger, overflows, num_allocated*sizeof(size_t));
+    delete [] overflows;
+    overflows = bigger;
+    num_allocated = n;
+  }
+  if (n > num_channels)
+    num_channels = n;
+}
+
+
+
+/// Charge the time since start to a stage.
+/// \param stage   The stage.
+/// \param start   Start time of the work, from slim_clock().
+/// \param nbytes  Bytes handled by the work.
+void slim_stats_t::add(enum slim_stage_t stage, double start, size_t nbytes) {
+  seconds[stage] += slim_clock() - start;
+  bytes[stage] += nbytes;
+}
+
+
+
+/// Write the record as a single line of JSON.
+/// \param os           The output stream.
+/// \param filename     The file to name in the record (may be NULL).
+/// \param compressing  Whether this record is of compression (else expansion).
+void slim_stats_t::write_json(ostream &os, const char *filename,
+                              bool compressing) const {
+  ios_base::fmtflags old_flags = os.flags();
+  streamsize old_precision = os.precision();
+  os.setf(ios_base::fixed, ios_base::floatfield);
+  os.precision(6);
+
+  os << "{\"file\": \"";
+  for (const char *c = filename; c && *c; c++) {
+    if (*c == '"' || *c == '\\')
+      os << '\\' << *c;
+    else if ((unsigned char)(*c) < 0x20)
+      os << "\\u00" << hex << setw(2) << setfill('0') << int(*c)
+         << dec << setfill(' ');
+    else
+      os << *c;
+  }
+  os << "\", \"mode\": \"" << (compressing ? "compress" : "expand")
+     << "\", \"raw_bytes\": " << raw_bytes
+     << ", \"slim_bytes\": " << slim_bytes
+     << ", \"sections\": " << sections
+     << ", \"refills\": " << refills;
+
+  double total = 0.0;
+  os << ", \"stages\": {";
+  for (int i=0; i<SLIM_NUM_STAGES; i++) {
+    total += seconds[i];
+    os << (i ? ", \"" : "\"") << stage_names[i] << "\": {\"seconds\": "
+       << seconds[i] << ", \"bytes\": " << bytes[i] << "}";
+  }
+  os << "}, \"seconds\": " << total;
+
+  os << ", \"overflows\": [";
+  for (int i=0; i<num_channels; i++)
+    os << (i ? ", " : "") << overflows[i];
+  os << "]}\n";
+
+  os.flags(old_flags);
+  os.precision(old_precision);
+}
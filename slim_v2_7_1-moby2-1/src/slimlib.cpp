@@ -33,6 +33,18 @@ enum slimlib_mode_t {
 
 
 
+/// Where one channel's samples lie in each frame (see slimreadchan()).
+struct slimlib_chan_t {
+  size_t offset;         ///< Byte offset of its first sample in a frame.
+  size_t word_size;      ///< Bytes per sample.
+  size_t repetitions;    ///< Samples per frame.
+};
+
+/// Most bytes of whole frames that slimreadchan() decodes at a time.
+static const size_t SLIMLIB_CHAN_BUFFER = 1 << 20;
+
+
+
 typedef struct slimlib_file_t SLIMFILE;  ///< The external name is SLIMFILE.
 
 /// All important elements of the SLIMFILE.
@@ -43,15 +55,37 @@ struct slimlib_file_t {
   enum slimlib_mode_t mode;      ///< Mode (SLIMLIB_READ or SLIMLIB_WRITE)
   struct slim_compressor_t *compressor; ///< Compressor, for _WRITE mode.
   struct slim_expander_t   *expander;   ///< Expander, for _READ mode.
+  const struct slim_reader_t *reader;   ///< Shared reader, if a cursor.
+  struct slim_reader_t *own_index; ///< Index made for frame reads, or NULL.
   int writing_is_underway;       ///< If in _WRITE mode, did we start writing?
   int nchan;                     ///< How many channels are known?
   int nframes;                   ///< How many frames expected per section.
   long bytes_used;               ///< How many bytes read/written so far.
 
+  /// The frame layout, learned from the first section header by the
+  /// frame functions (slimframes() and so on).
+  long frame_size;               ///< Bytes per frame (0 = not yet known).
+  struct slimlib_chan_t *chans;  ///< The nchan channels of a frame.
+  unsigned char *chan_buffer;    ///< Whole frames, for slimreadchan().
+
   /// Remember the filename or file descriptor that was opened.  
   /// We'll need this again in case user chooses to rewind.
   int fd;
   char *filename;
+
+  struct slimlib_ctx_t *ctx;     ///< Context to return to on close, or NULL.
+  struct slimlib_file_t *next;   ///< Next idle SLIMFILE in the context.
+};
+
+
+
+typedef struct slimlib_ctx_t SLIMCTX;  ///< The external name is SLIMCTX.
+
+/// A context for opening many slim files in turn (see slimopen_ctx()).
+/// It keeps closed SLIMFILEs, with their expanders and buffers, for reuse.
+struct slimlib_ctx_t {
+  SLIMFILE *idle;                ///< Closed SLIMFILEs, ready for reuse.
+  int nopen;                     ///< How many of its SLIMFILEs are open?
 };
 
 
@@ -73,13 +107,20 @@ SLIMFILE *slimopen(const char *filename,
 
   sf->compressor = NULL;
   sf->expander = NULL;
+  sf->reader = NULL;
+  sf->own_index = NULL;
   sf->writing_is_underway = 0;
   sf->nchan = 0;
   sf->nframes = 0;
   sf->bytes_used = 0;
+  sf->frame_size = 0;
+  sf->chans = NULL;
+  sf->chan_buffer = NULL;
   sf->fd = -1;
   sf->filename = new char[1+strlen(filename)];
   strcpy(sf->filename, filename);
+  sf->ctx = NULL;
+  sf->next = NULL;
 
   try {
     if (strchr(modes, 'r')) {
@@ -118,11 +159,18 @@ SLIMFILE *slimdopen(int fd, const char *modes) {
 
   sf->compressor = NULL;
   sf->expander = NULL;
+  sf->reader = NULL;
+  sf->own_index = NULL;
   sf->writing_is_underway = 0;
   sf->nchan = 0;
   sf->nframes = 0;
   sf->bytes_used = 0;
+  sf->frame_size = 0;
+  sf->chans = NULL;
+  sf->chan_buffer = NULL;
   sf->filename = NULL;
+  sf->ctx = NULL;
+  sf->next = NULL;
 
   try {
     /// This must be a duplicate because slim_expander_t will steal the fd.
@@ -158,15 +206,36 @@ SLIMFILE *slimdopen(int fd, const char *modes) {
 
 
 
-/// Close an open SLIMFILE.
+/// Close an open SLIMFILE.  One from slimopen_ctx() or slimdopen_ctx()
+/// goes back to its context, to be reused for the next file.
 /// \param sf  The open SLIMFILE.
 
 int slimclose(SLIMFILE *sf) {
   try {
+    if (sf->ctx) {
+      sf->ctx->nopen--;
+      if (sf->expander) {
+        sf->expander->close();
+        sf->expander->set_read_ahead(0);
+        delete [] sf->filename;
+        sf->filename = NULL;
+        delete [] sf->chans;
+        sf->chans = NULL;
+        if (sf->fd >= 0)
+          close(sf->fd);
+        sf->fd = -1;
+        sf->next = sf->ctx->idle;
+        sf->ctx->idle = sf;
+        return 0;
+      }
+    }
     if (sf->expander)
       delete sf->expander;
     if (sf->compressor)
       delete sf->compressor;
+    delete sf->own_index;   // Only after its cursor, the expander.
+    delete [] sf->chans;
+    delete [] sf->chan_buffer;
     delete [] sf->filename;
     if (sf->fd >= 0)
       close(sf->fd);
@@ -210,18 +279,77 @@ size_t slimread(void *ptr, size_t size, size_t nmemb, SLIMFILE *sf) {
 
 
 
+/// Find the raw size of an open slim file: from its header if stored
+/// there, else by adding up the sizes in the section headers.
+/// \param expander  The file, not yet read.
+/// \return The raw size, or -1 on error.
+static long expander_rawsize(slim_expander_t *expander)
+{
+  if ( !expander->is_open() )
+    return -1;
+  if ( expander->has_rawsize() )
+    return long(expander->get_rawsize());
+
+  long size = 0;
+  try {
+    slim_section_info_t info;
+    size_t sect_size;
+    while ((sect_size = expander->scan_section(&info)) > 0)
+      size += long(sect_size);
+  } catch (const char *s) {
+    size = -1;
+  }
+  return size;
+}
+
+
+
+/// Return the raw size of the slim file open on a SLIMFILE's descriptor,
+/// reading it from the start with pread(2).  Unlike slimdrawsize() of a
+/// dup'ed descriptor, this leaves the file position (which the dup would
+/// share with the SLIMFILE's expander) where it was.
+/// \param fd  The descriptor (not closed).
+/// \return The raw size, or -1 on error.
+
+static long shared_fd_rawsize(int fd)
+{
+  long size = -1;
+  try {
+    slim_expander_t expander(fd, 0);
+    size = expander_rawsize(&expander);
+  } catch (const bad_file &bf) {
+    size = -1;
+  } catch (const char *e) {
+    size = -1;
+  }
+  return size;
+}
+
+
+
 /// Rewind the current position pointer in the file to the beginning.
-/// Implemented by closing the file and starting again.
+/// Implemented by closing the file and starting again (or, for a cursor
+/// from slimcursor(), by seeking to the first section).  A SLIMFILE from
+/// a context reopens the file with the same expander.
 /// \param sf  The open SLIMFILE.
 
 void slimrewind(SLIMFILE *sf) {
   sf->bytes_used = 0;
-  if (sf->mode == SLIMLIB_READ) {
+  if (sf->mode == SLIMLIB_READ && sf->reader) {
+    sf->expander->seek(0);
+  } else if (sf->mode == SLIMLIB_READ && sf->ctx) {
+    if (sf->filename)
+      sf->expander->open(sf->filename);
+    else
+      sf->expander->open(dup(sf->fd));
+  } else if (sf->mode == SLIMLIB_READ) {
+    const int read_ahead = sf->expander->get_read_ahead();
     delete sf->expander;
     if (sf->filename)
       sf->expander = new slim_expander_t(sf->filename);
     else
       sf->expander = new slim_expander_t(dup(sf->fd));
+    sf->expander->set_read_ahead(read_ahead);
   } else
     throw "slimlib write not written yet";
 }
@@ -229,6 +357,8 @@ void slimrewind(SLIMFILE *sf) {
 
 
 /// Seek to a point in the file (analogue of fseek, which see for meaning of offset and whence).
+/// A cursor from slimcursor() decodes only the section holding the target;
+/// any other SLIMFILE must decode everything up to the target.
 /// \param sf  The open SLIMFILE.
 /// \param offset  Byte requested, relative to beginning, current point, or end.
 /// \param whence  May be SEEK_SET, SEEK_CUR, or SEEK_END.
@@ -239,26 +369,42 @@ int slimseek(SLIMFILE *sf, long offset, int whence) {
   unsigned long uoffset = offset;
   switch (whence) {
   case SEEK_SET:
+    if (offset < 0)
+      return -1;
+    if (sf->reader) {
+      try {
+        if (sf->expander->seek(uoffset))
+          return -1;
+      } catch (char const *s) {
+        return -1;
+      }
+      sf->bytes_used = offset;
+      return 0;
+    }
     slimrewind(sf);
-    if (uoffset ==  sf->expander->read(NULL, uoffset)) 
+    if (uoffset ==  sf->expander->read(NULL, uoffset)) {
+      sf->bytes_used = offset;
       return 0;
-    else
+    } else
       return -1;
     break;
 
   case SEEK_CUR:
-    if (offset >= 0) {
-      if (uoffset ==  sf->expander->read(NULL, uoffset))
+    if (offset >= 0 && sf->reader == NULL) {
+      if (uoffset ==  sf->expander->read(NULL, uoffset)) {
+        sf->bytes_used += offset;
         return 0;
-      else
+      } else
         return -1;
     } else
       return slimseek(sf, offset + sf->bytes_used, SEEK_SET);
     break;
 
   case SEEK_END:  default:
+    if (sf->reader)
+      return slimseek(sf, offset + long(sf->reader->get_rawsize()), SEEK_SET);
     if (sf->filename == NULL)
-      return slimseek(sf, offset + slimdrawsize(dup(sf->fd)), SEEK_SET);
+      return slimseek(sf, offset + shared_fd_rawsize(sf->fd), SEEK_SET);
     return slimseek(sf, offset + slimrawsize(sf->filename), SEEK_SET);
   }
 
@@ -266,8 +412,27 @@ int slimseek(SLIMFILE *sf, long offset, int whence) {
 
 
 
+/// Decode sections ahead of slimread() on a thread of the SLIMFILE's own,
+/// so that decoding the next sections overlaps with the caller's work on
+/// the data already read.  This suits reading a file straight through;
+/// a seek drops the sections decoded ahead (the thread restarts at the
+/// next read).
+/// \param sf         The open SLIMFILE.
+/// \param nsections  Most sections to keep decoded ahead (0 for none).
+/// \return 0 on success, -1 if sf is not open for reading.
+
+int slimreadahead(SLIMFILE *sf, int nsections) {
+  if (sf->mode != SLIMLIB_READ || sf->expander == NULL)
+    return -1;
+  sf->expander->set_read_ahead(nsections);
+  return 0;
+}
+
+
+
 /// Return the raw size of a compressed slim file.
-/// Must open the file and read its header.
+/// Must open the file and read its header (and, if the raw size is not
+/// stored there, its section headers).
 /// \param filename  The file to test by reading its header.
 
 long slimrawsize(const char *filename) 
@@ -275,12 +440,7 @@ long slimrawsize(const char *filename)
   long size;
   slim_expander_t *expander;
   expander = new slim_expander_t(filename);
-
-  if ( expander->is_open() ) {
-    size = long(expander->get_rawsize());
-  } else {
-    size = -1;
-  }
+  size = expander_rawsize(expander);
   delete expander;
   return size;
 }
@@ -290,12 +450,7 @@ long slimdrawsize(int fd)
   long size;
   slim_expander_t *expander;
   expander = new slim_expander_t(fd);
-
-  if ( expander->is_open() ) {
-    size = long(expander->get_rawsize());
-  } else {
-    size = -1;
-  }
+  size = expander_rawsize(expander);
   delete expander;
 
   return size;
@@ -303,4 +458,495 @@ long slimdrawsize(int fd)
 
 
 
+/// Give a SLIMFILE opened by name a section index of its own, by making
+/// it a cursor on a private slim_reader_t at the same position.  Seeks
+/// then decode only the section holding the target.  SLIMFILEs from a
+/// descriptor or a context, and files that cannot be shared (LZ4), are
+/// left as they are, to seek by decoding from the start.
+/// \param sf  The open SLIMFILE.
+
+static void index_sections(SLIMFILE *sf) {
+  if (sf->mode != SLIMLIB_READ || sf->reader || sf->ctx ||
+      sf->filename == NULL)
+    return;
+
+  slim_reader_t *index = NULL;
+  slim_expander_t *cursor = NULL;
+  try {
+    index = new slim_reader_t(sf->filename);
+    cursor = index->new_cursor();
+    cursor->set_read_ahead(sf->expander->get_read_ahead());
+    if (cursor->seek(sf->bytes_used))
+      throw "cannot seek to the current position.";
+  } catch (const bad_file &bf) {
+    delete index;
+    return;
+  } catch (const char *e) {
+    delete cursor;
+    delete index;
+    return;
+  }
+  delete sf->expander;
+  sf->expander = cursor;
+  sf->reader = sf->own_index = index;
+}
+
+
+
+/// Learn the frame layout of a SLIMFILE, if not yet known, from its first
+/// section header.  A frame is the channels of a section, each with its
+/// repetitions; a one-channel file has one sample per frame.
+/// \param sf  The open SLIMFILE.
+/// \return 0 on success, or -1 if the file has no sections.
+
+static int find_layout(SLIMFILE *sf) {
+  if (sf->frame_size > 0)
+    return 0;
+
+  slim_expander_t *peek = NULL;
+  try {
+    if (sf->reader)
+      peek = sf->reader->new_cursor();
+    else if (sf->filename)
+      peek = new slim_expander_t(sf->filename);
+    else
+      peek = new slim_expander_t(sf->fd, 0);
+
+    slim_section_info_t info;
+    if (peek->peek_section(&info) == 0 || info.num_channels <= 0) {
+      delete peek;
+      return -1;
+    }
+    delete [] sf->chans;
+    sf->chans = new slimlib_chan_t[info.num_channels];
+    sf->nchan = info.num_channels;
+    size_t offset = 0;
+    for (int c=0; c<info.num_channels; c++) {
+      slimlib_chan_t &chan = sf->chans[c];
+      chan.offset = offset;
+      chan.word_size = slim_type_size[info.channels[c].data_type];
+      chan.repetitions = (info.num_channels == 1) ? 1 :
+        info.channels[c].repetitions;
+      offset += chan.word_size * chan.repetitions;
+    }
+    sf->frame_size = long(offset);
+  } catch (const bad_file &bf) {
+    sf->frame_size = 0;
+  } catch (const char *e) {
+    sf->frame_size = 0;
+  }
+  delete peek;
+  return (sf->frame_size > 0) ? 0 : -1;
+}
+
+
+
+/// Return the number of whole frames in an open slim file, from the raw
+/// size in the file header (or, failing that, in the section headers)
+/// and the frame layout of the first section.  Nothing is decoded.
+/// \param sf  The open SLIMFILE.
+/// \return The number of frames, or -1 on error.
+
+long slimframes(SLIMFILE *sf) {
+  if (sf->mode != SLIMLIB_READ || find_layout(sf))
+    return -1;
+
+  long raw_size;
+  if (sf->reader)
+    raw_size = long(sf->reader->get_rawsize());
+  else if (sf->expander->has_rawsize())
+    raw_size = long(sf->expander->get_rawsize());
+  else if (sf->filename)
+    raw_size = slimrawsize(sf->filename);
+  else
+    raw_size = shared_fd_rawsize(sf->fd);
+  if (raw_size < 0)
+    return -1;
+  return raw_size / sf->frame_size;
+}
+
+
+
+/// Return the size of one frame of an open slim file (see slimframes()).
+/// \param sf  The open SLIMFILE.
+/// \return Bytes per frame, or -1 on error.
+
+long slimframesize(SLIMFILE *sf) {
+  if (sf->mode != SLIMLIB_READ || find_layout(sf))
+    return -1;
+  return sf->frame_size;
+}
+
+
+
+/// Read whole frames from an open slim file, starting at any frame.
+/// Only the sections holding those frames are decoded, as the file is
+/// indexed on first use (except a SLIMFILE from a descriptor or a
+/// context, which must decode from the start unless the frames follow
+/// on from the last read).  Afterwards the position (see slimtell()) is
+/// just after the frames read.  Frames are as laid out in the first
+/// section, so files whose sections differ in layout (see --container)
+/// cannot be read by frame.
+/// \param sf           The open SLIMFILE.
+/// \param first_frame  Number (from 0) of the first frame to read.
+/// \param nframes      Number of frames to read.
+/// \param buf          Buffer for at least nframes frames.
+/// \return Number of whole frames read (0 on error or past the end).
+
+size_t slimreadframes(SLIMFILE *sf, long first_frame, size_t nframes,
+                      void *buf) {
+  if (sf->mode != SLIMLIB_READ || first_frame < 0 || find_layout(sf))
+    return 0;
+  index_sections(sf);
+
+  const long target = first_frame * sf->frame_size;
+  if (target != sf->bytes_used && slimseek(sf, target, SEEK_SET))
+    return 0;
+  return slimread(buf, sf->frame_size, nframes, sf);
+}
+
+
+
+/// Read consecutive samples of one channel from an open slim file.
+/// Sample k of a channel with r repetitions per frame is repetition
+/// k % r of frame k / r.  The frames are read as by slimreadframes(), a
+/// buffer-full at a time, and the position is left after the last.
+/// \param sf     The open SLIMFILE.
+/// \param chan   Channel number (from 0).
+/// \param first  Number (from 0) of the first sample to read.
+/// \param n      Number of samples to read.
+/// \param buf    Buffer for at least n samples.
+/// \return Number of samples read (0 on error or past the end).
+
+size_t slimreadchan(SLIMFILE *sf, int chan, long first, size_t n,
+                    void *buf) {
+  if (sf->mode != SLIMLIB_READ || first < 0 || find_layout(sf) ||
+      chan < 0 || chan >= sf->nchan)
+    return 0;
+
+  const slimlib_chan_t &c = sf->chans[chan];
+  const size_t frame_size = sf->frame_size;
+  size_t buf_frames = SLIMLIB_CHAN_BUFFER / frame_size;
+  if (buf_frames == 0)
+    buf_frames = 1;
+  if (sf->chan_buffer == NULL)
+    sf->chan_buffer = new unsigned char[SLIMLIB_CHAN_BUFFER > frame_size ?
+                                        SLIMLIB_CHAN_BUFFER : frame_size];
+
+  unsigned char *out = static_cast<unsigned char *>(buf);
+  long frame = first / long(c.repetitions);
+  size_t rep = size_t(first % long(c.repetitions));
+  size_t done = 0;
+  while (done < n) {
+    size_t want = divide_round_up(rep + (n - done), c.repetitions);
+    if (want > buf_frames)
+      want = buf_frames;
+    size_t got = slimreadframes(sf, frame, want, sf->chan_buffer);
+
+    // Copy this channel's samples out of each frame.
+    for (size_t f=0; f<got && done<n; f++, rep=0) {
+      const unsigned char *in = sf->chan_buffer + f*frame_size + c.offset;
+      size_t nrep = c.repetitions - rep;
+      if (nrep > n - done)
+        nrep = n - done;
+      memcpy(out + done*c.word_size, in + rep*c.word_size,
+             nrep*c.word_size);
+      done += nrep;
+    }
+    frame += got;
+    if (got < want)
+      break;
+  }
+  return done;
+}
+
+
+
+/// Open a slim file for sharing among many readers (e.g., threads).
+/// The file is indexed once, and each reader then takes its own cursor
+/// from slimcursor().  Cursors on one SLIMSHARED may be used concurrently
+/// from different threads (each cursor by only one thread at a time).
+/// \param filename  The file to open.
+/// \return The shared handle, or NULL if opening fails.
+
+SLIMSHARED *slimshare(const char *filename) {
+  try {
+    return new slim_reader_t(filename);
+  } catch (const bad_file &bf) {
+    bf.mesg();
+  } catch (const char *e) {
+    fprintf(stderr, "slimshare failed: %s\n", e);
+  }
+  return NULL;
+}
+
+
+
+/// Open a cursor on a shared slim file.  The cursor is an ordinary
+/// read-mode SLIMFILE (use slimread, slimseek, slimclose, etc.), except
+/// that seeking needs to decode only the one section holding the target.
+/// \param sh  The shared handle from slimshare().
+/// \return The open SLIMFILE, or NULL if opening fails.
+
+SLIMFILE *slimcursor(SLIMSHARED *sh) {
+  SLIMFILE *sf = new SLIMFILE();
+
+  sf->mode = SLIMLIB_READ;
+  sf->compressor = NULL;
+  sf->expander = NULL;
+  sf->reader = sh;
+  sf->own_index = NULL;
+  sf->writing_is_underway = 0;
+  sf->nchan = 0;
+  sf->nframes = 0;
+  sf->bytes_used = 0;
+  sf->frame_size = 0;
+  sf->chans = NULL;
+  sf->chan_buffer = NULL;
+  sf->fd = -1;
+  sf->filename = new char[1+strlen(sh->get_filename())];
+  strcpy(sf->filename, sh->get_filename());
+  sf->ctx = NULL;
+  sf->next = NULL;
+
+  try {
+    sf->expander = sh->new_cursor();
+  } catch (const char *e) {
+    slimclose(sf);
+    return NULL;
+  }
+  return sf;
+}
+
+
+
+/// Close a shared slim file.  All its cursors must be closed first.
+/// \param sh  The shared handle from slimshare().
+
+int slimunshare(SLIMSHARED *sh) {
+  delete sh;
+  return 0;
+}
+
+
+
+/// Start reading many slim files into memory at once (see slim_batch_t).
+/// \param nfiles     Number of files.
+/// \param filenames  Paths of the files.  Must stay valid until
+///                   slimbatchclose().
+/// \return The batch, or NULL if it cannot be started.
+
+SLIMBATCH *slimbatchopen(int nfiles, const char * const *filenames) {
+  try {
+    return new slim_batch_t(nfiles, filenames);
+  } catch (const char *e) {
+    fprintf(stderr, "slimbatchopen failed: %s\n", e);
+  }
+  return NULL;
+}
+
+
+
+/// Open the next file of a batch whose data are already in memory.
+/// Files come in the order their reads finish, not the order given.
+/// Files that cannot be read are reported on stderr and skipped.
+/// \param batch  The batch from slimbatchopen().
+/// \param ifile  If not NULL, receives the file's index in the batch
+///               (or -1 when no files remain).
+/// \return The open SLIMFILE, or NULL when no files remain.
+
+SLIMFILE *slimbatchnext(SLIMBATCH *batch, int *ifile) {
+  while (1) {
+    int i = -1;
+    slim_expander_t *expander = NULL;
+    try {
+      expander = batch->next(&i);
+    } catch (const bad_file &bf) {
+      bf.mesg();
+      continue;
+    } catch (const char *e) {
+      fprintf(stderr, "slimbatchnext failed: %s\n", e);
+      i = -1;
+    }
+    if (ifile)
+      *ifile = i;
+    if (expander == NULL)
+      return NULL;
+
+    SLIMFILE *sf = new SLIMFILE();
+    sf->mode = SLIMLIB_READ;
+    sf->compressor = NULL;
+    sf->expander = expander;
+    sf->reader = NULL;
+    sf->writing_is_underway = 0;
+    sf->nchan = 0;
+    sf->nframes = 0;
+    sf->bytes_used = 0;
+    sf->fd = -1;
+    sf->filename = new char[1+strlen(expander->get_filename())];
+    strcpy(sf->filename, expander->get_filename());
+    sf->ctx = NULL;
+    sf->next = NULL;
+    return sf;
+  }
+}
+
+
+
+/// Finish with a batch.  Files not yet opened by slimbatchnext() are
+/// dropped; SLIMFILEs already returned remain open until slimclose().
+/// \param batch  The batch from slimbatchopen().
+
+int slimbatchclose(SLIMBATCH *batch) {
+  delete batch;
+  return 0;
+}
+
+
+
+/// Make a context for opening many slim files in turn, as batch jobs do.
+/// Files opened by slimopen_ctx() or slimdopen_ctx() reuse the expanders
+/// and buffers of files already closed, instead of allocating their own.
+/// A context may have several files open at once, but (like a SLIMFILE)
+/// it must be used by only one thread at a time.
+/// \return The new context.
+
+SLIMCTX *slimctxnew(void) {
+  SLIMCTX *ctx = new SLIMCTX();
+  ctx->idle = NULL;
+  ctx->nopen = 0;
+  return ctx;
+}
+
+
+
+/// Take an idle SLIMFILE from a context, or make a new one.
+/// \param ctx  The context.
+/// \return The SLIMFILE, counted as open, with its expander (if any).
+static SLIMFILE *ctx_take(SLIMCTX *ctx) {
+  SLIMFILE *sf = ctx->idle;
+  if (sf)
+    ctx->idle = sf->next;
+  else {
+    sf = new SLIMFILE();
+    sf->compressor = NULL;
+    sf->expander = NULL;
+    sf->reader = NULL;
+    sf->own_index = NULL;
+    sf->chans = NULL;
+    sf->chan_buffer = NULL;
+    sf->ctx = ctx;
+  }
+  sf->mode = SLIMLIB_READ;
+  sf->writing_is_underway = 0;
+  sf->nchan = 0;
+  sf->nframes = 0;
+  sf->bytes_used = 0;
+  sf->frame_size = 0;
+  sf->fd = -1;
+  sf->filename = NULL;
+  sf->next = NULL;
+  ctx->nopen++;
+  return sf;
+}
+
+
+
+/// Open a slim file for reading, as slimopen() does, but reusing the
+/// expander and buffers of a file closed earlier in the same context.
+/// \param ctx       The context from slimctxnew().
+/// \param filename  The file to open.
+/// \param modes     Modes codes as in fopen.  Only "r" is allowed.
+/// \return The open SLIMFILE, or NULL if opening fails.
+
+SLIMFILE *slimopen_ctx(SLIMCTX *ctx, const char *filename,
+                       const char *modes) {
+  if (strchr(modes, 'r') == NULL)
+    return NULL;   // slimlib write mode has not been written yet.
+
+  SLIMFILE *sf = ctx_take(ctx);
+  sf->filename = new char[1+strlen(filename)];
+  strcpy(sf->filename, filename);
+
+  try {
+    if (sf->expander)
+      sf->expander->open(filename);
+    else
+      sf->expander = new slim_expander_t(filename);
+    if ( ! (sf->expander->is_open()) ) {
+      slimclose(sf);
+      return NULL;
+    }
+  } catch (const bad_file &bf) {
+    slimclose(sf);
+    return NULL;
+  } catch (const char *e) {
+    slimclose(sf);
+    return NULL;
+  }
+  return sf;
+}
+
+
+
+/// Associate a SLIMFILE for reading with an existing file descriptor, as
+/// slimdopen() does, but reusing the expander and buffers of a file
+/// closed earlier in the same context.
+/// \param ctx       The context from slimctxnew().
+/// \param fd        The descriptor of the open file.
+/// \param modes     Modes codes as in fopen.  Only "r" is allowed.
+/// \return The open SLIMFILE, or NULL if opening fails.
+
+SLIMFILE *slimdopen_ctx(SLIMCTX *ctx, int fd, const char *modes) {
+  if (strchr(modes, 'r') == NULL)
+    return NULL;   // slimlib write mode has not been written yet.
+
+  SLIMFILE *sf = ctx_take(ctx);
+  try {
+    /// This must be a duplicate because slim_expander_t will steal the fd.
+    sf->fd = dup(fd);
+    if (sf->fd < 0)
+      throw "unable to duplicate file descriptor.";
+    if (sf->expander)
+      sf->expander->open(fd);
+    else
+      sf->expander = new slim_expander_t(fd);
+    if ( ! (sf->expander->is_open()) ) {
+      slimclose(sf);
+      return NULL;
+    }
+  } catch (const bad_file &bf) {
+    slimclose(sf);
+    return NULL;
+  } catch (const char *e) {
+    fprintf(stderr, "slimopen failed\n");
+    slimclose(sf);
+    return NULL;
+  }
+  return sf;
+}
+
+
+
+/// Free a context and everything it keeps.  Its SLIMFILEs must all be
+/// closed first.
+/// \param ctx  The context from slimctxnew().
+/// \return 0 on success, or EOF if some of its SLIMFILEs are still open.
+
+int slimctxfree(SLIMCTX *ctx) {
+  if (ctx->nopen > 0)
+    return EOF;
+  while (ctx->idle) {
+    SLIMFILE *sf = ctx->idle;
+    ctx->idle = sf->next;
+    delete sf->expander;
+    delete [] sf->chan_buffer;
+    delete sf;
+  }
+  delete ctx;
+  return 0;
+}
+
+
+
 } // ends extern "C"
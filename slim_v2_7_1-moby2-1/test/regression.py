@@ -12,6 +12,9 @@ Currently we check:
 * Proper error messages and non-zero return status when filesystem
   problems arise, such as a file does not exist, read/write permission
   failures.
+* Round trips through the options that only newer readers can expand,
+  and that their files start with the newer magic, so that older
+  readers refuse them.
 
 Joe Fowler, Princeton
 """
@@ -271,5 +274,91 @@ class test_slim(unittest.TestCase):
             os.remove(file)
         os.rmdir(dir)
 
+    def __newFormatRoundTrip(self, data, options, suffix="", tail=""):
+        """Should slim data with options to a file marked with the newer
+        magic "S2", then unslim it to the same bytes.  The raw file is
+        data, then the string tail.  suffix names the outer layer
+        (".lz4" or ".zst"), which is skipped if slim was built without it."""
+        dir = tempfile.mkdtemp()
+        file1 = "%s/data"%dir
+        slimfile = "%s.slm%s"%(file1, suffix)
+        data.tofile(file1)
+        fp = open(file1,"ab")
+        fp.write(tail)
+        fp.close()
+
+        cmd = "slim --force -p %s %s"%(options, file1)
+        stat,out = commands.getstatusoutput( cmd )
+        if stat != 0 and "requires slim built with" in out:
+            os.remove(file1)
+            os.rmdir(dir)
+            self.skipTest(out)
+        self.assertEquals( stat, 0 )
+
+        # The magic is inside the outer layer, if any.
+        unwrap = {"":"cat", ".lz4":"lz4 -dc", ".zst":"zstd -dc"}[suffix]
+        if commands.getstatusoutput("%s < /dev/null"%unwrap)[0] == 0:
+            magic = commands.getoutput("%s %s 2>/dev/null | head -c 2"%(unwrap,
+                                                             slimfile))
+            self.assertEquals( magic, "S2" )
+
+        cmd = "unslim --force -p %s"%slimfile
+        stat,out = commands.getstatusoutput( cmd )
+        self.assertEquals( stat, 0 )
+        cmd = "cmp %s %s.raw"%(file1, file1)
+        stat,out = commands.getstatusoutput( cmd )
+        self.assertEquals( stat, 0 )
+
+        # Clean up
+        files = glob.glob("%s/*"%dir)
+        for f in files:
+            os.remove(f)
+        os.rmdir(dir)
+
+    def __threeChannels(self, N=30000):
+        """Frames of three int32 channels: a slow ramp, noise, a constant."""
+        ramp = 1000 + numpy.arange(N)/7
+        noise = numpy.random.uniform(-300,300,N)
+        const = 5 + 0*ramp
+        return numpy.array(zip(ramp, noise, const), dtype=numpy.int32)
+
+    def test_sectionSizes(self):
+        """Should slim and unslim files with section slim sizes (-L)"""
+        self.__newFormatRoundTrip(self.__threeChannels(), "-L -c3 -r1 -M 64k")
+
+    def test_sectionSizesLz4(self):
+        """Should slim and unslim LZ4-wrapped files with section slim sizes"""
+        self.__newFormatRoundTrip(self.__threeChannels(),
+                                  "-L --lz4 -c3 -r1 -M 64k", suffix=".lz4")
+
+    def test_sectionSizesZstd(self):
+        """Should slim and unslim zstd-wrapped files with section slim sizes"""
+        self.__newFormatRoundTrip(self.__threeChannels(),
+                                  "-L --zstd -c3 -r1 -M 64k", suffix=".zst")
+
+    def test_wideSizes(self):
+        """Should slim and unslim files with 64-bit sizes (-W)"""
+        self.__newFormatRoundTrip(self.__threeChannels(), "-W -c3 -r1 -M 64k")
+
+    def test_reuseParams(self):
+        """Should slim and unslim files whose sections reuse parameters (-R)"""
+        self.__newFormatRoundTrip(self.__threeChannels(),
+                                  "-R -C -c3 -r1 -M 64k")
+
+    def test_reuseParamsAdaptive(self):
+        """Should slim and unslim adaptively sized sections that reuse parameters"""
+        self.__newFormatRoundTrip(self.__threeChannels(100000),
+                                  "-R -A -C -c3 -r1")
+
+    def test_narrowRunlengthUshort(self):
+        """Should slim and unslim uint16 runs natively (-m5 -v), odd last byte"""
+        data = numpy.array(numpy.arange(30000)/50 % 3, dtype=numpy.uint16)
+        self.__newFormatRoundTrip(data, "-m5 -v", tail="\x01")
+
+    def test_narrowRunlengthChar(self):
+        """Should slim and unslim uint8 runs natively (-m5 -y), partial last word"""
+        data = numpy.array(numpy.arange(30001)/40 % 2, dtype=numpy.uint8)
+        self.__newFormatRoundTrip(data, "-m5 -y", tail="\x07\x07")
+
 if __name__ == "__main__": 
     unittest.main()
@@ -0,0 +1,444 @@
+/// \file slim_bench.cpp
+/// Benchmark the slim codecs and bitstream paths on synthetic data.
+/// Generates streams that resemble real instrument data (white noise at
+/// several bit depths, 1/f drifts, glitches, constant and flag channels,
+/// and MCE-like multi-channel frames), then times encoding and decoding
+/// of each with each codec and each output path (plain, lz4, zstd).
+/// Results are written as JSON, one record per stream, codec and path
+/// (the fastest of several trials), so that they can be compared between
+/// versions to catch regressions.
+
+//  Copyright (C) 2008, 2009 Joseph Fowler
+//
+//  This file is part of slim, a compression package for science data.
+//
+//  Slim is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Slim is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with slim.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "slim.h"
+#include "version.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <x86intrin.h>
+#define SLIM_BENCH_RDTSC
+#endif
+
+static const char BENCH_FILENAME[]="/tmp/slim_bench.slm";
+
+/// Wall-clock time and (where the CPU has a time-stamp counter) cycles.
+struct stamp_t {
+  double sec;            ///< Seconds from the monotonic clock.
+  unsigned long long cycles; ///< Time-stamp counter, or 0.
+};
+
+
+/// Read the clock and the cycle counter.
+static stamp_t now() {
+  stamp_t s;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  s.sec = ts.tv_sec + 1e-9*ts.tv_nsec;
+#ifdef SLIM_BENCH_RDTSC
+  s.cycles = __rdtsc();
+#else
+  s.cycles = 0;
+#endif
+  return s;
+}
+
+
+
+//---------------------------------------------------------------------------
+// Synthetic data
+//---------------------------------------------------------------------------
+
+/// A small, fast generator (xorshift64*), so that the data are the same
+/// on every platform and for every run.
+static uint64_t rng_state = 88172645463325252ULL;
+
+static uint64_t rng() {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 2685821657736338717ULL;
+}
+
+/// \return A uniform deviate in [0,1).
+static double uniform() {
+  return (rng() >> 11) * (1.0/9007199254740992.0);
+}
+
+/// \return A unit normal deviate (Box-Muller).
+static double gaussian() {
+  double u = uniform();
+  while (u <= 0.0)
+    u = uniform();
+  return sqrt(-2*log(u)) * cos(2*M_PI*uniform());
+}
+
+
+/// Fill with white noise that uses about nbits bits per sample.
+/// \param data   The buffer to fill.
+/// \param n      Number of samples.
+/// \param nbits  Effective bit depth (the rms is 2^(nbits-3)).
+static void make_white(int32_t *data, size_t n, int nbits) {
+  const double rms = ldexp(1.0, nbits-3);
+  const int32_t offset = 1 << (nbits-1);
+  for (size_t i=0; i<n; i++)
+    data[i] = offset + int32_t(floor(rms*gaussian()));
+}
+
+
+/// Fill with a 1/f drift plus white noise (Voss-McCartney: the sum of
+/// random values, the k-th renewed every 2^k samples).
+/// \param data   The buffer to fill.
+/// \param n      Number of samples.
+/// \param stride Spacing of the samples in data (for interleaved frames).
+static void make_drift(int32_t *data, size_t n, size_t stride=1) {
+  const int NOCTAVES=16;
+  double octave[NOCTAVES];
+  double sum = 0;
+  for (int k=0; k<NOCTAVES; k++)
+    sum += (octave[k] = 400*gaussian());
+  const int32_t base = int32_t(rng() & 0xffff) << 8;
+  for (size_t i=0; i<n; i++) {
+    // Renew the octave given by the lowest set bit of i.
+    if (i > 0) {
+      int k = __builtin_ctzl(i);
+      if (k < NOCTAVES) {
+        sum -= octave[k];
+        sum += (octave[k] = 400*gaussian());
+      }
+    }
+    data[i*stride] = base + int32_t(floor(sum + 30*gaussian()));
+  }
+}
+
+
+/// Fill with 12-bit white noise plus rare large glitches.
+/// \param data   The buffer to fill.
+/// \param n      Number of samples.
+static void make_glitch(int32_t *data, size_t n) {
+  make_white(data, n, 12);
+  for (size_t i=0; i<n; i++)
+    if (uniform() < 0.001)
+      data[i] += int32_t(rng() % (1<<28)) - (1<<27);
+}
+
+
+/// Fill with a flag word that holds each state for a random time.
+/// \param data   The buffer to fill.
+/// \param n      Number of samples.
+static void make_flags(int32_t *data, size_t n) {
+  int32_t state = 0;
+  size_t run = 0;
+  for (size_t i=0; i<n; i++) {
+    if (run-- == 0) {
+      state ^= 1 << (rng() % 12);
+      run = 1 + rng() % 2000;
+    }
+    data[i] = state;
+  }
+}
+
+
+/// Fill with MCE-like frames: a header of mostly constant words with a
+/// frame counter, one drifting channel per detector, and a checksum.
+/// \param data   The buffer to fill.
+/// \param nframes Number of frames.
+/// \param frame  Words per frame.
+static void make_mce(int32_t *data, size_t nframes, int frame) {
+  const int HEADER=43;
+  for (int c=HEADER; c<frame-1; c++)
+    make_drift(data+c, nframes, frame);
+  for (size_t f=0; f<nframes; f++) {
+    int32_t *fr = data + f*frame;
+    for (int c=0; c<HEADER; c++)
+      fr[c] = 0x1000 * c;
+    fr[1] = int32_t(f);         // Frame counter.
+    fr[3] = int32_t(f / 200);   // Slowly changing sync box number.
+    int32_t check = 0;
+    for (int c=0; c<frame-1; c++)
+      check ^= fr[c];
+    fr[frame-1] = check;
+  }
+}
+
+
+
+//---------------------------------------------------------------------------
+// Benchmarks
+//---------------------------------------------------------------------------
+
+/// One synthetic stream.
+struct stream_t {
+  const char *name;      ///< Short name, used in the results.
+  int32_t *data;         ///< The raw data.
+  size_t nwords;         ///< Number of 32-bit words.
+  int nchan;             ///< Channels per frame.
+};
+
+/// One way to encode a stream.
+struct codec_t {
+  const char *name;      ///< Short name, used in the results.
+  enum code_t code;      ///< Encoder.
+  bool deltas;           ///< Encode the differences?
+};
+
+/// The path the compressed bits take to and from the file.
+enum path_t {PATH_PLAIN, PATH_LZ4, PATH_ZSTD};
+static const char *path_names[]={"plain", "lz4", "zstd"};
+
+
+/// Compress a stream to BENCH_FILENAME.
+/// \param s      The stream.
+/// \param c      The codec.
+/// \param path   The output path.
+static void encode(const stream_t &s, const codec_t &c, enum path_t path) {
+  slim_compressor_t *comp =
+    new slim_compressor_t(BENCH_FILENAME, FLAG_CRC | FLAG_SIZE, c.deltas);
+  comp->set_quiet(true);
+  if (path == PATH_LZ4)
+    comp->use_lz4();
+  else if (path == PATH_ZSTD)
+    comp->use_zstd(1);
+  comp->raw_size = s.nwords * sizeof(int32_t);
+
+  // As the slim program does, treat one channel as frames of one full
+  // section each, and multi-channel data as one sample per frame.
+  const size_t max_sect = comp->get_max_section_size();
+  int reps = 1;
+  if (s.nchan == 1)
+    reps = max_sect / sizeof(int32_t);
+  for (int i=0; i<s.nchan; i++)
+    comp->add_channel(reps, c.code, SLIM_TYPE_I32, c.deltas, false);
+
+  // Write whole frames, as many as fit in a section.
+  const size_t frame_bytes = reps * s.nchan * sizeof(int32_t);
+  const size_t sect_bytes = (max_sect / frame_bytes) * frame_bytes;
+  const unsigned char *p = (const unsigned char *)s.data;
+  for (size_t done=0; done < comp->raw_size; ) {
+    size_t n = comp->raw_size - done;
+    if (n > sect_bytes)
+      n = sect_bytes;
+    done += comp->write_onesection(p + done, n);
+  }
+  delete comp;
+}
+
+
+/// Expand BENCH_FILENAME and compare it with the stream.
+/// \param s      The stream.
+/// \return Whether the data were restored exactly.
+static bool decode(const stream_t &s) {
+  slim_expander_t *sx = new slim_expander_t(BENCH_FILENAME);
+  sx->set_quiet(true);
+  const unsigned char *expect = (const unsigned char *)s.data;
+  const size_t raw_bytes = s.nwords * sizeof(int32_t);
+  const unsigned char *sect;
+  size_t done = 0, n;
+  bool ok = true;
+  while ((n = sx->read_onesection(&sect)) > 0) {
+    if (done + n > raw_bytes || memcmp(sect, expect + done, n))
+      ok = false;
+    done += n;
+  }
+  delete sx;
+  return ok && done == raw_bytes;
+}
+
+
+/// Time the encoding and decoding of one stream, keeping the best of
+/// several trials, and print one JSON record.
+/// \param s      The stream.
+/// \param c      The codec.
+/// \param path   The output path.
+/// \param ntrials Number of trials.
+/// \param first  Is this the first record?
+/// \return Whether every trial restored the data exactly.
+static bool bench_one(const stream_t &s, const codec_t &c, enum path_t path,
+                      int ntrials, bool first) {
+  double enc_sec=1e30, dec_sec=1e30;
+  double enc_cyc=1e30, dec_cyc=1e30;
+  bool ok = true;
+  const char *error = NULL;
+
+  for (int t=0; t<ntrials && error == NULL; t++) {
+    try {
+      stamp_t t0 = now();
+      encode(s, c, path);
+      stamp_t t1 = now();
+      ok = decode(s) && ok;
+      stamp_t t2 = now();
+      if (t1.sec-t0.sec < enc_sec) {
+        enc_sec = t1.sec-t0.sec;
+        enc_cyc = double(t1.cycles-t0.cycles);
+      }
+      if (t2.sec-t1.sec < dec_sec) {
+        dec_sec = t2.sec-t1.sec;
+        dec_cyc = double(t2.cycles-t1.cycles);
+      }
+    } catch (const char *mesg) {
+      error = mesg;
+    } catch (const bad_file &bf) {
+      error = "file error";
+    }
+  }
+
+  struct stat st;
+  const double raw_bytes = s.nwords * sizeof(int32_t);
+  const double slim_bytes = (stat(BENCH_FILENAME, &st) ? 0 : st.st_size);
+  unlink(BENCH_FILENAME);
+
+  printf("%s\n  {\"stream\": \"%s\", \"codec\": \"%s\", \"path\": \"%s\", "
+         "\"channels\": %d, \"raw_bytes\": %.0f, ",
+         first ? "" : ",", s.name, c.name, path_names[path], s.nchan,
+         raw_bytes);
+  if (error) {
+    printf("\"ok\": false, \"error\": \"%s\"}", error);
+    return false;
+  }
+  printf("\"slim_bytes\": %.0f, \"ratio\": %.4f,\n"
+         "   \"encode_MBps\": %.2f, \"decode_MBps\": %.2f, ",
+         slim_bytes, slim_bytes > 0 ? raw_bytes/slim_bytes : 0.0,
+         raw_bytes/enc_sec/1e6, raw_bytes/dec_sec/1e6);
+#ifdef SLIM_BENCH_RDTSC
+  printf("\"encode_cycles_per_sample\": %.2f, "
+         "\"decode_cycles_per_sample\": %.2f, ",
+         enc_cyc/s.nwords, dec_cyc/s.nwords);
+#else
+  printf("\"encode_cycles_per_sample\": null, "
+         "\"decode_cycles_per_sample\": null, ");
+#endif
+  printf("\"ok\": %s}", ok ? "true" : "false");
+  fflush(stdout);
+  return ok;
+}
+
+
+
+/// Print usage and exit.
+static void usage() {
+  fprintf(stderr,
+          "usage: slim_bench [-s MB] [-t trials] [-m stream] [-p path]\n"
+          "  -s MB      Raw size of each stream in MB (default 16).\n"
+          "  -t trials  Keep the fastest of this many trials (default 3).\n"
+          "  -m stream  Run only streams whose name begins with this.\n"
+          "  -p path    Run only this output path (plain, lz4, zstd).\n"
+          "Writes results to stdout as JSON.\n");
+  exit(1);
+}
+
+
+
+/// Main program
+/// \param argc Number of cmd-line tokens.
+/// \param argv Command-line tokens.
+/// \return Status value: 0 if every trial restored its data exactly.
+int main(int argc, char *argv[]) {
+  double megabytes = 16;
+  int ntrials = 3;
+  const char *only_stream = NULL, *only_path = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:t:m:p:h")) != -1) {
+    switch (opt) {
+    case 's': megabytes = atof(optarg); break;
+    case 't': ntrials = atoi(optarg); break;
+    case 'm': only_stream = optarg; break;
+    case 'p': only_path = optarg; break;
+    default: usage();
+    }
+  }
+  if (megabytes <= 0 || ntrials <= 0)
+    usage();
+
+  const int MCE_FRAME=43+1024+1;
+  const size_t nwords = size_t(megabytes*1e6/sizeof(int32_t));
+  const size_t mce_frames = 1 + nwords/MCE_FRAME;
+
+  stream_t streams[]={
+    {"white8",  NULL, nwords, 1},
+    {"white12", NULL, nwords, 1},
+    {"white16", NULL, nwords, 1},
+    {"white24", NULL, nwords, 1},
+    {"drift",   NULL, nwords, 1},
+    {"glitch",  NULL, nwords, 1},
+    {"constant",NULL, nwords, 1},
+    {"flags",   NULL, nwords, 1},
+    {"mce",     NULL, mce_frames*MCE_FRAME, MCE_FRAME},
+  };
+  const int NSTREAMS = sizeof(streams)/sizeof(streams[0]);
+
+  const codec_t codecs[]={
+    {"none",              SLIM_ENCODER_DEFAULT,        false},
+    {"reduced_binary",    SLIM_ENCODER_REDUCED_BINARY, false},
+    {"reduced_binary_d",  SLIM_ENCODER_REDUCED_BINARY, true},
+    {"runlength",         SLIM_ENCODER_RUNLENGTH,      false},
+  };
+  const int NCODECS = sizeof(codecs)/sizeof(codecs[0]);
+
+  bool have_path[3] = {true, false, false};
+#ifdef HAVE_LIBLZ4
+  have_path[PATH_LZ4] = true;
+#endif
+#ifdef HAVE_LIBZSTD
+  have_path[PATH_ZSTD] = true;
+#endif
+
+  printf("{\"slim_version\": \"%s\", \"trials\": %d, \"results\": [",
+         SLIM_VERSION, ntrials);
+  bool first = true, all_ok = true;
+  for (int i=0; i<NSTREAMS; i++) {
+    stream_t &s = streams[i];
+    if (only_stream && strncmp(s.name, only_stream, strlen(only_stream)))
+      continue;
+
+    s.data = new int32_t[s.nwords];
+    switch (i) {
+    case 0: make_white(s.data, s.nwords, 8); break;
+    case 1: make_white(s.data, s.nwords, 12); break;
+    case 2: make_white(s.data, s.nwords, 16); break;
+    case 3: make_white(s.data, s.nwords, 24); break;
+    case 4: make_drift(s.data, s.nwords); break;
+    case 5: make_glitch(s.data, s.nwords); break;
+    case 6:
+      for (size_t j=0; j<s.nwords; j++)
+        s.data[j] = 0x5a5a;
+      break;
+    case 7: make_flags(s.data, s.nwords); break;
+    case 8: make_mce(s.data, mce_frames, MCE_FRAME); break;
+    }
+
+    for (int p=PATH_PLAIN; p<=PATH_ZSTD; p++) {
+      if (!have_path[p] || (only_path && strcmp(only_path, path_names[p])))
+        continue;
+      for (int c=0; c<NCODECS; c++) {
+        if (!bench_one(s, codecs[c], path_t(p), ntrials, first))
+          all_ok = false;
+        first = false;
+      }
+    }
+    delete [] s.data;
+  }
+  printf("\n]}\n");
+
+  return all_ok ? 0 : 1;
+}
@@ -0,0 +1,72 @@
+/// \file test_crc32.cpp
+/// Test slim_crc32(): whichever method the CPU allows must agree with a
+/// plain bit-at-a-time CRC-32, for all lengths, alignments, and splits.
+
+//  Copyright (C) 2008, 2009 Joseph Fowler
+//
+//  This file is part of slim, a compression package for science data.
+//
+//  Slim is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Slim is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with slim.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstdlib>
+#include "slim.h"
+
+static const size_t BUF_SIZE = 5000;
+
+
+/// Reference CRC-32, one bit at a time.
+static uint32_t crc_bitwise(const unsigned char *s, size_t length) {
+  uint32_t c = 0xffffffffU;
+  while (length--) {
+    c ^= *s++;
+    for (int k=0; k<8; k++)
+      c = (c >> 1) ^ (0xedb88320U & (0U - (c & 1)));
+  }
+  return c ^ 0xffffffffU;
+}
+
+
+int main(int argc, char *argv[]) {
+  int nfail = 0;
+
+  // The standard check value.
+  if (slim_crc32(0, "123456789", 9) != 0xcbf43926U)
+    nfail++;
+
+  unsigned char *buf = new unsigned char[BUF_SIZE];
+  srandom(2);
+  for (size_t i=0; i<BUF_SIZE; i++)
+    buf[i] = random() & 0xff;
+
+  for (size_t offset=0; offset<16; offset++)
+    for (size_t len=0; len<1100; len++)
+      if (slim_crc32(0, buf+offset, len) != crc_bitwise(buf+offset, len))
+        nfail++;
+
+  // Build up the CRC from two pieces.
+  const size_t len = BUF_SIZE-16;
+  const uint32_t whole = crc_bitwise(buf, len);
+  for (size_t split=0; split<=len; split += 37)
+    if (slim_crc32(slim_crc32(0, buf, split), buf+split, len-split) != whole)
+      nfail++;
+  delete [] buf;
+
+  if (nfail) {
+    printf("test_crc32: FAILED %d checks\n", nfail);
+    return 1;
+  }
+  printf("test_crc32: Passed all CRC-32 tests.\n");
+  return 0;
+}
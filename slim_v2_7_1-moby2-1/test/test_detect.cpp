@@ -0,0 +1,103 @@
+/// \file test_detect.cpp
+/// Test frame_detector on files whose frame size is a multiple of smaller
+/// lags that look nearly as good: 12-byte frames of six 16-bit words
+/// (three slow flags, three noisy values), and 5-byte frames of four
+/// noisy bytes and a zero byte.  The detector must find the frame size,
+/// not one of its divisors.
+
+//  Copyright (C) 2008, 2009 Joseph Fowler
+//
+//  This file is part of slim, a compression package for science data.
+//
+//  Slim is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Slim is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with slim.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstdlib>
+#include "slim.h"
+
+static const char RAW_FILENAME[]="/tmp/test_detect.bin";
+static const int NFRAMES=50000;
+
+
+/// Write the raw file.
+/// \param frame  Frame size (12 or 5 bytes).
+/// \return 0 on success.
+static int make_raw_file(size_t frame) {
+  unsigned char *raw = new unsigned char[NFRAMES*frame];
+  srandom(7);
+  for (int f=0; f<NFRAMES; f++) {
+    unsigned char *p = raw + f*frame;
+    if (frame == 12) {
+      uint16_t *w = reinterpret_cast<uint16_t *>(p);
+      for (int i=0; i<3; i++) {
+        w[i] = (f/500) % 2;
+        w[i+3] = random() & 0x1ff;
+      }
+    } else {
+      for (int i=0; i<4; i++)
+        p[i] = ((random() & 0xf) << 2) | 1;
+      p[4] = 0;
+    }
+  }
+  FILE *fp = fopen(RAW_FILENAME, "wb");
+  size_t nw = fp ? fwrite(raw, frame, NFRAMES, fp) : 0;
+  if (fp)
+    fclose(fp);
+  delete [] raw;
+  return nw == size_t(NFRAMES) ? 0 : 1;
+}
+
+
+
+/// Detect the frame of a raw file.
+/// \param frame  Frame size (bytes) to write and then expect.
+/// \return Number of failures.
+static int check_frame(size_t frame) {
+  if (make_raw_file(frame))
+    return 1;
+  frame_detector detector;
+  frame_schema schema;
+  int nfail = 0;
+  try {
+    detector.detect(RAW_FILENAME, schema);
+    if (detector.get_frame_size() != frame) {
+      printf("test_detect: found %lu-byte frames, not %lu\n",
+             (unsigned long)detector.get_frame_size(), (unsigned long)frame);
+      nfail++;
+    }
+    if (schema.frame_size() != frame)
+      nfail++;
+  } catch (const char *s) {
+    nfail++;
+  } catch (const bad_file &bf) {
+    nfail++;
+  }
+  remove(RAW_FILENAME);
+  return nfail;
+}
+
+
+
+int main(int argc, char *argv[]) {
+  int nfail = 0;
+  nfail += check_frame(12);
+  nfail += check_frame(5);
+
+  if (nfail) {
+    printf("test_detect: FAILED %d checks\n", nfail);
+    return 1;
+  }
+  printf("test_detect: Passed all frame detection tests.\n");
+  return 0;
+}
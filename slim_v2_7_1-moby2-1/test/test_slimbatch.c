@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include "slimlib.h"
+
+/* Read one slim file several times over (plus one missing file) as a
+   batch, and compare every copy with the raw data.  Then read the same
+   files in turn through one SLIMCTX. */
+int main(int argc, char *argv[]) {
+
+  const char SLIM_FILENAME[]="/tmp/fake_test_data.bin.slm";
+  const char RAW_FILENAME[]="/tmp/fake_test_data.bin";
+  const char MISSING_FILENAME[]="/tmp/fake_test_data.missing.slm";
+  enum {NFILES=9, MISSING=4};
+
+  FILE *fp = fopen(RAW_FILENAME, "rb");
+  if (fp == NULL)
+    return 1;
+  fseek(fp, 0, SEEK_END);
+  long raw_size = ftell(fp);
+  rewind(fp);
+  unsigned char *raw = malloc(raw_size);
+  unsigned char *data = malloc(raw_size+1);
+  if (fread(raw, 1, raw_size, fp) != raw_size)
+    return 1;
+  fclose(fp);
+
+  const char *names[NFILES];
+  int i, seen[NFILES];
+  for (i=0; i<NFILES; i++) {
+    names[i] = (i == MISSING) ? MISSING_FILENAME : SLIM_FILENAME;
+    seen[i] = 0;
+  }
+
+  fprintf(stderr, "test_slimbatch: expect one error about %s:\n",
+          MISSING_FILENAME);
+  SLIMBATCH *batch = slimbatchopen(NFILES, names);
+  int nfail = 0, nfiles = 0, ifile;
+  SLIMFILE *sp;
+  while ((sp = slimbatchnext(batch, &ifile)) != NULL) {
+    if (ifile < 0 || ifile >= NFILES || ifile == MISSING || seen[ifile]++)
+      nfail++;
+    if (slimread(data, 1, raw_size+1, sp) != raw_size ||
+        memcmp(data, raw, raw_size))
+      nfail++;
+    slimclose(sp);
+    nfiles++;
+  }
+  slimbatchclose(batch);
+
+  /* The same files, opened in turn by name (and rewound) or by
+     descriptor, with two open at once, through one context. */
+  SLIMCTX *ctx = slimctxnew();
+  int nctx = 0;
+  for (i=0; i<NFILES; i++) {
+    SLIMFILE *other = NULL;
+    if (i % 2) {
+      int fd = open(names[i], O_RDONLY);  /* The SLIMFILE will own fd. */
+      sp = (fd < 0) ? NULL : slimdopen_ctx(ctx, fd, "r");
+    } else
+      sp = slimopen_ctx(ctx, names[i], "r");
+    if (i == MISSING) {
+      if (sp != NULL)
+        nfail++;
+      continue;
+    }
+    if (sp == NULL) {
+      nfail++;
+      continue;
+    }
+    if (i == 2)
+      other = slimopen_ctx(ctx, SLIM_FILENAME, "r");
+    if (i % 2 == 0) {
+      if (slimread(data, 1, raw_size/2, sp) != raw_size/2)
+        nfail++;
+      slimrewind(sp);
+    }
+    if (slimread(data, 1, raw_size+1, sp) != raw_size ||
+        memcmp(data, raw, raw_size))
+      nfail++;
+    if (i == 2 && (other == NULL || slimread(data, 1, raw_size+1, other)
+                   != raw_size || memcmp(data, raw, raw_size)))
+      nfail++;
+    if (other)
+      slimclose(other);
+    slimclose(sp);
+    nctx++;
+  }
+  if (slimctxfree(ctx))
+    nfail++;
+
+  free(raw);
+  free(data);
+
+  if (nfail || nfiles != NFILES-1 || nctx != NFILES-1 || ifile != -1) {
+    printf("test_slimbatch: FAILED (%d errors, %d files)\n", nfail, nfiles);
+    return 1;
+  }
+  printf("test_slimbatch: Passed all batch-read tests.\n");
+  return 0;
+}
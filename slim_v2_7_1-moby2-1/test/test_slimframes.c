@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include "slimlib.h"
+
+enum {NCHAN=3, REPEATS=5, WORD=4, FRAME=NCHAN*REPEATS*WORD};
+
+/* Read frames and channel samples at scattered places from one slim
+   file, comparing with the raw data.  Reads from the end, then the
+   middle, then sequentially, to exercise the seeks.  The file is opened
+   by name (indexed on first use), as a cursor, through a context, or by
+   descriptor (the last two must decode from the start to seek).  Finding
+   the layout of a file opened by descriptor must not move its position. */
+enum {BY_NAME, BY_CURSOR, BY_CONTEXT, BY_DESCRIPTOR, NOPENS};
+
+static int check_file(const char *name, const unsigned char *raw,
+                      long raw_size, long frame, long reps, int how) {
+  int nfail = 0;
+  SLIMSHARED *sh = NULL;
+  SLIMCTX *ctx = NULL;
+  SLIMFILE *sp;
+  if (how == BY_CURSOR) {
+    sh = slimshare(name);
+    sp = sh ? slimcursor(sh) : NULL;
+  } else if (how == BY_CONTEXT) {
+    ctx = slimctxnew();
+    sp = slimopen_ctx(ctx, name, "r");
+  } else if (how == BY_DESCRIPTOR) {
+    const int fd = open(name, O_RDONLY);
+    sp = (fd >= 0) ? slimdopen(fd, "r") : NULL;
+  } else
+    sp = slimopen(name, "r");
+  if (sp == NULL)
+    return 1;
+  if (slimframesize(sp) != frame || slimframes(sp) != raw_size/frame)
+    nfail++;
+
+  const long nframes = raw_size / frame;
+  unsigned char *data = malloc(1000*frame);
+  const long first[] = {nframes-10, nframes/2, 0, 1000, 2000};
+  int i;
+  for (i=0; i<5; i++) {
+    const size_t want = 1000;
+    const size_t expect = (first[i] + (long)want > nframes) ?
+      nframes-first[i] : want;
+    if (slimreadframes(sp, first[i], want, data) != expect ||
+        memcmp(data, raw + first[i]*frame, expect*frame))
+      nfail++;
+    if (slimtell(sp) < (first[i]+(long)expect)*frame)
+      nfail++;
+  }
+  if (slimreadframes(sp, nframes+1, 1, data) != 0)
+    nfail++;
+
+  /* Samples of the last channel, across frame and buffer boundaries. */
+  const long chan = (frame == WORD) ? 0 : NCHAN-1;
+  const long nsamp = 300000 < nframes*reps ? 300000 : nframes*reps;
+  const long start = 7;
+  uint32_t *samples = malloc(nsamp*WORD);
+  if (slimreadchan(sp, chan, start, nsamp-start, samples) != nsamp-start)
+    nfail++;
+  long k;
+  for (k=start; k<nsamp; k++) {
+    const unsigned char *p = raw + (k/reps)*frame + chan*reps*WORD +
+      (k%reps)*WORD;
+    if (memcmp(&samples[k-start], p, WORD)) {
+      nfail++;
+      break;
+    }
+  }
+  if (slimreadchan(sp, NCHAN, 0, 1, samples) != 0)
+    nfail++;
+
+  free(samples);
+  free(data);
+  slimclose(sp);
+  if (sh)
+    slimunshare(sh);
+  if (ctx && slimctxfree(ctx))
+    nfail++;
+  return nfail;
+}
+
+
+
+int main(int argc, char *argv[]) {
+
+  const char RAW_FILENAME[]="/tmp/fake_test_data.bin";
+  const char FRAME_FILENAME[]="/tmp/fake_test_data.frames";
+  const char FRAME_SLIMNAME[]="/tmp/fake_test_data.frames.slm";
+
+  FILE *fp = fopen(RAW_FILENAME, "rb");
+  if (fp == NULL)
+    return 1;
+  fseek(fp, 0, SEEK_END);
+  long raw_size = ftell(fp);
+  rewind(fp);
+  unsigned char *raw = malloc(raw_size);
+  if (fread(raw, 1, raw_size, fp) != raw_size)
+    return 1;
+  fclose(fp);
+
+  /* The same data, slimmed in small sections as 1 channel and as
+     NCHAN channels of REPEATS each. */
+  int nfail = 0;
+  const char *cmd[2] = {
+    "slim -q -k -p -M 64k -c 1 /tmp/fake_test_data.frames",
+    "slim -q -k -p -M 64k -c 3 -r 5 /tmp/fake_test_data.frames"};
+  const long frame[2] = {WORD, FRAME}, reps[2] = {1, REPEATS};
+  int i;
+  for (i=0; i<2; i++) {
+    fp = fopen(FRAME_FILENAME, "wb");
+    if (fp == NULL || fwrite(raw, 1, raw_size, fp) != raw_size)
+      return 1;
+    fclose(fp);
+    if (system(cmd[i]) != 0) {
+      nfail++;
+      continue;
+    }
+    int how;
+    for (how=0; how<NOPENS; how++)
+      nfail += check_file(FRAME_SLIMNAME, raw, raw_size, frame[i], reps[i],
+                          how);
+  }
+  remove(FRAME_FILENAME);
+  remove(FRAME_SLIMNAME);
+  free(raw);
+
+  if (nfail) {
+    printf("test_slimframes: FAILED (%d errors)\n", nfail);
+    return 1;
+  }
+  printf("test_slimframes: Passed all frame-read tests.\n");
+  return 0;
+}
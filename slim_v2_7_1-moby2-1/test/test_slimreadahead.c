@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "slimlib.h"
+
+/* Read one slim file straight through with slimread(), decoding 0, 1, or
+   several sections ahead, in odd-sized pieces that straddle sections.
+   Then seek back and forth and read on, which must drop the sections
+   decoded ahead.  The file is opened by name, as a cursor, or through a
+   context (reused for each pass, to check that closing stops the
+   read-ahead). */
+enum {BY_NAME, BY_CURSOR, BY_CONTEXT, NOPENS};
+enum {CHUNK=10007};
+
+static int check_file(const char *name, const unsigned char *raw,
+                      long raw_size, int nahead, int how,
+                      SLIMCTX *ctx, unsigned char *data) {
+  int nfail = 0;
+  SLIMSHARED *sh = NULL;
+  SLIMFILE *sp;
+  if (how == BY_CURSOR) {
+    sh = slimshare(name);
+    sp = sh ? slimcursor(sh) : NULL;
+  } else if (how == BY_CONTEXT)
+    sp = slimopen_ctx(ctx, name, "r");
+  else
+    sp = slimopen(name, "r");
+  if (sp == NULL || slimreadahead(sp, nahead))
+    return 1;
+
+  long got = 0;
+  size_t n;
+  while ((n = slimread(data + got, 1, CHUNK, sp)) > 0)
+    got += n;
+  if (got != raw_size || memcmp(data, raw, raw_size))
+    nfail++;
+
+  /* Seek backward, forward, then rewind, reading a little each time. */
+  const long where[] = {raw_size/3, raw_size-CHUNK/2, 12345};
+  int i;
+  for (i=0; i<3; i++) {
+    const size_t expect = (where[i]+CHUNK > raw_size) ?
+      raw_size-where[i] : CHUNK;
+    if (slimseek(sp, where[i], SEEK_SET) ||
+        slimread(data, 1, CHUNK, sp) != expect ||
+        memcmp(data, raw+where[i], expect))
+      nfail++;
+  }
+  slimrewind(sp);
+  if (slimread(data, 1, 3*CHUNK, sp) != 3*CHUNK ||
+      memcmp(data, raw, 3*CHUNK))
+    nfail++;
+
+  slimclose(sp);
+  if (sh)
+    slimunshare(sh);
+  return nfail;
+}
+
+
+
+int main(int argc, char *argv[]) {
+
+  const char RAW_FILENAME[]="/tmp/fake_test_data.bin";
+  const char AHEAD_FILENAME[]="/tmp/fake_test_data.ahead";
+  const char AHEAD_SLIMNAME[]="/tmp/fake_test_data.ahead.slm";
+
+  FILE *fp = fopen(RAW_FILENAME, "rb");
+  if (fp == NULL)
+    return 1;
+  fseek(fp, 0, SEEK_END);
+  long raw_size = ftell(fp);
+  rewind(fp);
+  unsigned char *raw = malloc(raw_size);
+  unsigned char *data = malloc(raw_size+CHUNK);
+  if (fread(raw, 1, raw_size, fp) != raw_size)
+    return 1;
+  fclose(fp);
+
+  /* Small sections, so that a read spans several of them. */
+  int nfail = 0;
+  fp = fopen(AHEAD_FILENAME, "wb");
+  if (fp == NULL || fwrite(raw, 1, raw_size, fp) != raw_size)
+    return 1;
+  fclose(fp);
+  if (system("slim -q -p -M 64k /tmp/fake_test_data.ahead") != 0)
+    nfail++;
+
+  SLIMCTX *ctx = slimctxnew();
+  const int nahead[] = {0, 1, 4};
+  int i, how;
+  for (i=0; i<3 && nfail==0; i++)
+    for (how=0; how<NOPENS; how++)
+      nfail += check_file(AHEAD_SLIMNAME, raw, raw_size, nahead[i], how,
+                          ctx, data);
+  if (slimctxfree(ctx))
+    nfail++;
+  remove(AHEAD_FILENAME);
+  remove(AHEAD_SLIMNAME);
+  free(data);
+  free(raw);
+
+  if (nfail) {
+    printf("test_slimreadahead: FAILED (%d errors)\n", nfail);
+    return 1;
+  }
+  printf("test_slimreadahead: Passed all read-ahead tests.\n");
+  return 0;
+}
@@ -0,0 +1,234 @@
+/// \file test_slimshare.cpp
+/// Test the shared slim_reader_t: cursors in several threads decode and
+/// seek concurrently, and must agree with the raw data.  Also check the
+/// section scan that catalogues files without decoding, with and without
+/// section slim sizes in the headers, with 64-bit (wide) sizes, and with
+/// channel parameters reused between sections.  One channel is
+/// bit-rotated, which must not change the caller's buffer.  When slim has
+/// zstd support, repeat the test on a zstd-compressed (seekable) file.
+
+//  Copyright (C) 2008, 2009 Joseph Fowler
+//
+//  This file is part of slim, a compression package for science data.
+//
+//  Slim is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  Slim is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with slim.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <unistd.h>
+#include "slim.h"
+#include "slimlib.h"
+
+static const char SLIM_FILENAME[]="/tmp/test_slimshare.slm";
+static const int NCHAN=3;              ///< Channels per frame.
+static const int NFRAMES=100003;       ///< Frames in the raw data.
+/// Section size: not a whole number of frames, to test partial frames.
+static const size_t SECT_BYTES=2000*NCHAN*sizeof(int32_t) - 4;
+static const int NTHREADS=4;
+
+static int32_t *raw;         ///< The raw data.
+static size_t raw_bytes;     ///< Size of the raw data.
+static slim_reader_t *reader;
+static int failures[NTHREADS];
+
+
+/// Make the raw data.
+static void make_raw_data() {
+  raw_bytes = NCHAN*NFRAMES*sizeof(int32_t);
+  raw = new int32_t[NCHAN*NFRAMES];
+  srandom(1);
+  int32_t level[NCHAN] = {1000, -50000, 7};
+  for (int i=0; i<NFRAMES; i++)
+    for (int c=0; c<NCHAN; c++) {
+      level[c] += (random() % 201) - 100;
+      raw[i*NCHAN+c] = (c == 2) ? level[c]*8 : level[c];
+    }
+}
+
+
+/// Write the raw data to a multi-section slim file.
+/// \param zstd_level  If nonzero, compress further with zstd.
+/// \param flags       File header flags to add (besides CRC and SIZE).
+/// \param xflags      Extended flags (XFLAG_WIDE, XFLAG_SAME) to use.
+static void make_slim_file(int zstd_level, int flags, int xflags) {
+  slim_compressor_t *comp =
+    new slim_compressor_t(SLIM_FILENAME, FLAG_CRC | FLAG_SIZE | flags, true);
+  comp->set_wide_sizes(xflags & XFLAG_WIDE);
+  comp->set_reuse_params(xflags & XFLAG_SAME);
+  if (zstd_level)
+    comp->use_zstd(zstd_level, 2);
+  comp->raw_size = raw_bytes;
+  for (int c=0; c<NCHAN; c++)
+    comp->add_channel(1, SLIM_ENCODER_REDUCED_BINARY, SLIM_TYPE_I32,
+                      true, c == 2);
+  const unsigned char *p = (const unsigned char *)raw;
+  for (size_t done=0; done < raw_bytes; ) {
+    size_t n = raw_bytes - done;
+    if (n > SECT_BYTES)
+      n = SECT_BYTES;
+    done += comp->write_onesection(p + done, n);
+  }
+  delete comp;
+}
+
+
+/// Each thread decodes every NTHREADS-th section, then seeks at random.
+static void *check_sections(void *arg) {
+  long ithread = (long)arg;
+  slim_expander_t *cursor = reader->new_cursor();
+  const unsigned char *sect;
+  const unsigned char *expect = (const unsigned char *)raw;
+
+  for (int i=ithread; i<reader->num_sections(); i += NTHREADS) {
+    const slim_section_index_t &entry = reader->get_section(i);
+    if (cursor->seek_section(i) ||
+        cursor->read_onesection(&sect) != entry.raw_size ||
+        memcmp(sect, expect + entry.raw_offset, entry.raw_size))
+      failures[ithread]++;
+  }
+  delete cursor;
+
+  cursor = reader->new_cursor();
+  unsigned int seed = ithread;
+  unsigned char buf[1000];
+  for (int trial=0; trial<200; trial++) {
+    size_t offset = rand_r(&seed) % (raw_bytes - sizeof(buf));
+    if (cursor->seek(offset) ||
+        cursor->read(buf, sizeof(buf)) != sizeof(buf) ||
+        memcmp(buf, expect + offset, sizeof(buf)))
+      failures[ithread]++;
+  }
+  delete cursor;
+  return NULL;
+}
+
+
+/// Check the C interface: slimshare, slimcursor, and fast slimseek.
+static int check_slimlib() {
+  int nfail = 0;
+  SLIMSHARED *sh = slimshare(SLIM_FILENAME);
+  SLIMFILE *sf = slimcursor(sh);
+  int32_t buf[100];
+  const long words = raw_bytes/sizeof(int32_t);
+
+  if (slimseek(sf, 4*(words/2), SEEK_SET) ||
+      slimread(buf, 4, 100, sf) != 100 ||
+      memcmp(buf, raw + words/2, sizeof(buf)))
+    nfail++;
+  if (slimseek(sf, -400, SEEK_END) || slimtell(sf) != 4*(words-100) ||
+      slimread(buf, 4, 100, sf) != 100 ||
+      memcmp(buf, raw + words-100, sizeof(buf)))
+    nfail++;
+  if (slimread(buf, 4, 1, sf) != 0)
+    nfail++;
+  if (slimseek(sf, -4*words, SEEK_CUR) ||
+      slimread(buf, 4, 100, sf) != 100 ||
+      memcmp(buf, raw, sizeof(buf)))
+    nfail++;
+
+  slimclose(sf);
+  slimunshare(sh);
+  return nfail;
+}
+
+
+/// Check scan_section() against the index, by skipping data (on a cursor)
+/// and by decoding them (on an ordinary expander).
+/// \param sx  The expander, not yet read.
+/// \return Number of failed checks.
+static int check_scan(slim_expander_t *sx) {
+  int nfail = 0, isect = 0;
+  size_t sect_size;
+  slim_section_info_t info;
+
+  while ((sect_size = sx->scan_section(&info)) > 0) {
+    const slim_section_index_t &entry = reader->get_section(isect);
+    size_t next = (isect+1 < reader->num_sections() ?
+                   reader->get_section(isect+1).slim_offset : 0);
+    if (sect_size != entry.raw_size || info.slim_offset != entry.slim_offset ||
+        (next && info.slim_offset + info.slim_size != next) ||
+        info.num_channels != NCHAN ||
+        info.num_frames != 1 + (entry.raw_size-1)/(NCHAN*sizeof(int32_t)) ||
+        info.channels[0].codec != SLIM_ENCODER_REDUCED_BINARY ||
+        info.channels[0].data_type != SLIM_TYPE_I32 ||
+        info.channels[0].nbits <= 0 || info.channels[0].nbits > 32)
+      nfail++;
+    isect++;
+  }
+  if (isect != reader->num_sections())
+    nfail++;
+  delete sx;
+  return nfail;
+}
+
+
+/// Write the slim file, then run all checks on it.
+/// \param zstd_level  If nonzero, compress further with zstd.
+/// \param flags       File header flags to add (besides CRC and SIZE).
+/// \param xflags      Extended flags (XFLAG_WIDE, XFLAG_SAME) to use.
+/// \return Number of failed checks.
+static int check_file(int zstd_level, int flags=0, int xflags=0) {
+  make_slim_file(zstd_level, flags, xflags);
+
+  reader = new slim_reader_t(SLIM_FILENAME);
+  if (reader->get_rawsize() != raw_bytes ||
+      reader->num_sections() != int(1 + (raw_bytes-1)/SECT_BYTES)) {
+    printf("test_slimshare: FAILED to index %s\n", SLIM_FILENAME);
+    delete reader;
+    return 1;
+  }
+
+  pthread_t threads[NTHREADS];
+  for (long i=0; i<NTHREADS; i++) {
+    failures[i] = 0;
+    pthread_create(&threads[i], NULL, check_sections, (void *)i);
+  }
+  int nfail = 0;
+  for (int i=0; i<NTHREADS; i++) {
+    pthread_join(threads[i], NULL);
+    nfail += failures[i];
+  }
+  nfail += check_scan(reader->new_cursor());
+  nfail += check_scan(new slim_expander_t(SLIM_FILENAME));
+  delete reader;
+
+  nfail += check_slimlib();
+  unlink(SLIM_FILENAME);
+  return nfail;
+}
+
+
+int main(int argc, char *argv[]) {
+  make_raw_data();
+  int nfail = check_file(0);
+  nfail += check_file(0, FLAG_SLEN);
+  nfail += check_file(0, FLAG_SLEN, XFLAG_WIDE);
+  nfail += check_file(0, 0, XFLAG_SAME);
+  nfail += check_file(0, FLAG_SLEN, XFLAG_SAME | XFLAG_WIDE);
+#ifdef HAVE_LIBZSTD
+  nfail += check_file(3);
+  nfail += check_file(3, FLAG_SLEN);
+  nfail += check_file(3, FLAG_SLEN, XFLAG_WIDE | XFLAG_SAME);
+#endif
+  delete [] raw;
+
+  if (nfail) {
+    printf("test_slimshare: FAILED %d checks\n", nfail);
+    return 1;
+  }
+  printf("test_slimshare: Passed all shared-reader tests.\n");
+  return 0;
+}